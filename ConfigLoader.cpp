@@ -0,0 +1,291 @@
+// Configuration Loader
+// --------------------
+// parses the config.ini settings that are used by both, the MIDI player and the MIDI converter
+#include <stdlib.h>
+#include <ctype.h>
+#include <string>
+#include <vector>
+#include <map>
+#include <sstream>
+#include <algorithm>
+
+#ifdef _MSC_VER
+#define stricmp	_stricmp
+#else
+#include <strings.h>
+#define stricmp	strcasecmp
+#endif
+
+#include <stdtype.h>
+#include "INIReader.hpp"
+#include "MidiPlay.hpp"
+#include "MidiModules.hpp"
+#include "utils.hpp"
+#include "ConfigLoader.hpp"
+
+
+static const TypeMap_StrU8 gmDrumFallbackMap[] = {
+	{PLROPTS_GDF_NONE, "None"},
+	{PLROPTS_GDF_ALL, "All"},
+	{PLROPTS_GDF_GS, "KeepGS"},
+	{PLROPTS_GDF_NONE, NULL},
+};
+static const TypeMap_StrU8 resetModTypeMap[] = {
+	{MODULE_GM_1, "GM"},
+	{MODULE_GM_2, "GM_L2"},
+	{MODULE_SC55, "GS"},
+	{MODULE_SC88, "SC-88"},
+	{MMO_RESET_XG, "XG"},
+	{MMO_RESET_XG_ALL, "XGAll"},
+	{MMO_RESET_LA_HARD, "LAHard"},
+	{MMO_RESET_LA_SOFT, "LASoft"},
+	{MMO_RESET_CC, "CC"},
+	{MMO_RESET_NONE, NULL},
+};
+static const TypeMap_StrU8 masterVolTypeMap[] = {
+	{MMO_MSTVOL_CC_VOL, "VolumeCC"},
+	{MMO_MSTVOL_CC_EXPR, "ExprCC"},
+	{MODULE_TYPE_GM, "GMSyx"},
+	{MODULE_TYPE_GS, "GSSyx"},
+	{MODULE_TYPE_XG, "XGSyx"},
+	{MODULE_TYPE_LA, "LASyx"},
+	{0xFF, NULL},
+};
+static const TypeMap_StrU8 defInsMapMap[] = {
+	{0x00, "Default"},
+	{MTGS_SC55, "SC-55"},
+	{MTGS_SC88, "SC-88"},
+	{MTGS_SC88PRO, "SC-88Pro"},
+	{MTGS_SC8850, "SC-8850"},
+	{MTXG_MU50, "MUBasic"},
+	{MTXG_MU100, "MU100"},
+	{0xFF, NULL},
+};
+static const TypeMap_StrU8 wireModelMap[] = {
+	{0x00, "None"},
+	{MMO_WIRE_STATS, "Stats"},
+	{MMO_WIRE_STATS | MMO_WIRE_REORDER, "Reorder"},
+	{MMO_WIRE_STATS | MMO_WIRE_REORDER | MMO_WIRE_DROPCC, "Full"},
+	{0x00, NULL},
+};
+
+static const char* INS_SET_PATH = "_MidiInsSets/";
+
+
+static bool is_no_space(char c)
+{
+	return ! ::isspace((unsigned char)c);
+}
+
+void CfgString2Vector(const std::string& valueStr, std::vector<std::string>& valueVector)
+{
+	valueVector.clear();
+	std::stringstream ss(valueStr);
+	std::string item;
+	
+	while(ss.good())
+	{
+		std::getline(ss, item, ',');
+		
+		// ltrim
+		item.erase(item.begin(), std::find_if(item.begin(), item.end(), &is_no_space));
+		// rtrim
+		item.erase(std::find_if(item.rbegin(), item.rend(), &is_no_space).base(), item.end());
+		
+		valueVector.push_back(item);
+	}
+	if (valueVector.size() == 1 && valueVector[0].empty())
+		valueVector.clear();
+	
+	return;
+}
+
+void Vector_Str2UInt32(const std::vector<std::string>& strList, std::vector<UINT32>& intList)
+{
+	std::vector<std::string>::const_iterator slIt;
+	char* endStr;
+	
+	intList.clear();
+	for (slIt = strList.begin(); slIt != strList.end(); ++slIt)
+	{
+		unsigned long val = strtoul(slIt->c_str(), &endStr, 0);
+		intList.push_back((UINT32)val);
+	}
+	
+	return;
+}
+
+UINT16 ParseChnMask(const std::string& maskStr)
+{
+	if (maskStr.empty())
+		return 0xFFFF;	// empty - default to "all channels"
+	std::string prefix = maskStr.substr(0, 2);
+	if (prefix.length() >= 2)
+		prefix[1] = (char)tolower((UINT8)prefix[1]);
+	if (prefix == "0x")
+	{
+		unsigned long val = strtoul(maskStr.c_str(), NULL, 0);
+		return (UINT16)val;
+	}
+	else if (isdigit((unsigned char)maskStr[0]))
+	{
+		// 1-base channel range
+		char* endStr;
+		unsigned long chn1 = strtoul(maskStr.c_str(), &endStr, 0);
+		UINT16 mask = 0x0000;
+		if (*endStr != '-')
+		{
+			// single channel ID
+			mask = 1 << (chn1 - 1);
+		}
+		else
+		{
+			// range: 1-16
+			unsigned long chn2 = strtoul(&endStr[1], NULL, 0);
+			if (chn1 <= chn2)
+			{
+				mask = (1 << (chn2 - chn1 + 1)) - 1;
+				mask <<= (chn1 - 1);
+			}
+			else
+			{
+				// range overflow: 15-3, results in 15,16,1,2,3
+				UINT16 mask1 = ~((1 << (chn1 - 1)) - 1);	// mask for chn1..15
+				UINT16 mask2 = (1 << chn2) - 1;	// mask for 1..chn2
+				mask = mask1 | mask2;
+			}
+		}
+		return mask;
+	}
+	else
+	{
+		return 0x0000;	// invalid
+	}
+}
+
+void ParseChnMaskList(const std::vector<std::string>& maskStrList, std::vector<UINT16>& maskList)
+{
+	std::vector<std::string>::const_iterator cmlIt;
+	
+	maskList.clear();
+	for (cmlIt = maskStrList.begin(); cmlIt != maskStrList.end(); ++cmlIt)
+		maskList.push_back(ParseChnMask(*cmlIt));
+	
+	return;
+}
+
+UINT8 String2Opt_LUT(const TypeMap_StrU8* valMap, const std::string& value, UINT8 defaultVal)
+{
+	const TypeMap_StrU8* vm;
+	for (vm = valMap; vm->name != NULL; vm ++)
+	{
+		if (! stricmp(value.c_str(), vm->name))
+			return vm->value;
+	}
+	return defaultVal;
+}
+
+void LoadPlayerOptions(const INIReader& iniFile, PlayerOpts& plrOpts)
+{
+	plrOpts.numLoops = iniFile.GetInteger("General", "LoopCount", 2);
+	plrOpts.fadeTime = iniFile.GetFloat("General", "FadeTime", 5.0);
+	plrOpts.endPauseTime = iniFile.GetFloat("General", "EndPause", 0.0);
+	plrOpts.loopStartText = iniFile.GetString("General", "Marker_LoopStart", "loopStart");
+	plrOpts.loopEndText = iniFile.GetString("General", "Marker_LoopEnd", "loopEnd");
+	plrOpts.flags = 0x00;
+	if (iniFile.GetBoolean("General", "ResetDevice", true))
+		plrOpts.flags |= PLROPTS_RESET;
+	if (iniFile.GetBoolean("General", "StrictMode", false))
+		plrOpts.flags |= PLROPTS_STRICT;
+	if (iniFile.GetBoolean("General", "EnableCTF", false))
+		plrOpts.flags |= PLROPTS_ENABLE_CTF;
+	plrOpts.nrpnLoops = iniFile.GetBoolean("General", "NRPNLoops", false);
+	plrOpts.noNoteOverlap = iniFile.GetBoolean("General", "NoNoteOverlap", false);
+	plrOpts.gmDrumFallback = String2Opt_LUT(gmDrumFallbackMap, iniFile.GetString("General", "GMDrumFallback", "KeepGS"), PLROPTS_GDF_NONE);
+	plrOpts.fixSysExChksum = iniFile.GetBoolean("General", "FixSysExChecksums", false);
+	plrOpts.compiledTimeline = iniFile.GetBoolean("General", "CompiledTimeline", false);
+	plrOpts.outLookahead = (UINT32)iniFile.GetInteger("General", "OutputLookahead", 0);
+	
+	return;
+}
+
+void LoadInstrumentSetCfg(const INIReader& iniFile, const std::string& cfgBasePath, std::vector<InstrumentSetCfg>& insSetFiles)
+{
+	std::map<std::string, UINT8> INSSET_NAME_MAP;
+	std::map<std::string, UINT8>::const_iterator nmIt;
+	std::string insSetPath;
+	size_t insSetXG;
+	size_t insSetPLG;
+	
+	INSSET_NAME_MAP["GM"] = MODULE_GM_1;
+	INSSET_NAME_MAP["GM_L2"] = MODULE_GM_2;
+	INSSET_NAME_MAP["GS"] = MODULE_TYPE_GS;
+	INSSET_NAME_MAP["YGS"] = MODULE_TG300B;
+	INSSET_NAME_MAP["XG"] = MODULE_TYPE_XG;
+	INSSET_NAME_MAP["XG-PLG"] = MODULE_TYPE_XG | 0x08;
+	INSSET_NAME_MAP["Korg5"] = MODULE_TYPE_K5;
+	INSSET_NAME_MAP["MT-32"] = MODULE_MT32;
+	
+	insSetFiles.clear();
+	insSetXG = (size_t)-1;
+	insSetPLG = (size_t)-1;
+	insSetPath = iniFile.GetString("InstrumentSets", "DataPath", INS_SET_PATH);
+	insSetPath = CombinePaths(cfgBasePath, insSetPath);
+	for (nmIt = INSSET_NAME_MAP.begin(); nmIt != INSSET_NAME_MAP.end(); ++nmIt)
+	{
+		std::string fileName = iniFile.GetString("InstrumentSets", nmIt->first, "");
+		if (! fileName.empty())
+		{
+			InstrumentSetCfg isc;
+			isc.setType = nmIt->second;
+			if (isc.setType == MODULE_TYPE_XG)
+				insSetXG = insSetFiles.size();
+			else if (isc.setType == (MODULE_TYPE_XG | 0x08))
+				insSetPLG = insSetFiles.size();
+			isc.pathNames.push_back(CombinePaths(insSetPath, fileName));
+			insSetFiles.push_back(isc);
+		}
+	}
+	if (insSetXG != (size_t)-1 && insSetPLG != (size_t)-1)
+	{
+		insSetFiles[insSetXG].pathNames.push_back(insSetFiles[insSetPLG].pathNames[0]);
+		insSetFiles.erase(insSetFiles.begin() + insSetPLG);
+	}
+	
+	return;
+}
+
+UINT8 LoadModuleConfig(const INIReader& iniFile, MidiModule& mMod)
+{
+	std::vector<std::string> list;
+	std::string iniStr;
+	
+	if (! MidiModule::GetIDFromNameOrNumber(iniFile.GetString(mMod.name, "ModType", ""), MidiModuleCollection::GetShortModNameLUT(), mMod.modType))
+		return 0xFF;	// invalid module type
+	
+	CfgString2Vector(iniFile.GetString(mMod.name, "PortDelay", ""), list);
+	Vector_Str2UInt32(list, mMod.delayTime);
+	CfgString2Vector(iniFile.GetString(mMod.name, "ChnMask", ""), list);
+	ParseChnMaskList(list, mMod.chnMask);
+	CfgString2Vector(iniFile.GetString(mMod.name, "PlayTypes", ""), list);
+	mMod.SetPlayTypes(list, MidiModuleCollection::GetShortModNameLUT());
+	
+	mMod.options = GetDefaultMidiModOpts();
+	mMod.options.simpleVol = iniFile.GetBoolean(mMod.name, "SimpleVolCtrl", false);
+	mMod.options.aotIns = iniFile.GetBoolean(mMod.name, "AoTInsChange", false);
+	mMod.options.instantSyx = iniFile.GetBoolean(mMod.name, "InstantSyx", false);
+	
+	iniStr = iniFile.GetString(mMod.name, "ResetType", "");
+	mMod.options.resetType = String2Opt_LUT(resetModTypeMap, iniStr, GetMidiModResetType(mMod.modType));
+	iniStr = iniFile.GetString(mMod.name, "MasterVolType", "");
+	mMod.options.masterVol = String2Opt_LUT(masterVolTypeMap, iniStr, GetMidiModMasterVolType(mMod.modType));
+	mMod.options.remapMVolSyx = iniFile.GetBoolean(mMod.name, "RemapMasterVolSyx", false);
+	iniStr = iniFile.GetString(mMod.name, "DefaultInsMap", "");
+	mMod.options.defInsMap = String2Opt_LUT(defInsMapMap, iniStr, GetMidiModDefInsMap(mMod.modType));
+	iniStr = iniFile.GetString(mMod.name, "WireModel", "");
+	mMod.options.wireModel = String2Opt_LUT(wireModelMap, iniStr, 0x00);
+	mMod.options.dropRepeatCtrl = iniFile.GetBoolean(mMod.name, "RemoveRepeatedCtrls", false);
+	mMod.options.ctrlMaxRate = (UINT16)iniFile.GetInteger(mMod.name, "CtrlMaxRate", 0);
+	
+	return 0x00;
+}
@@ -0,0 +1,36 @@
+#ifndef __CONFIGLOADER_HPP__
+#define __CONFIGLOADER_HPP__
+
+#include <stdtype.h>
+#include <string>
+#include <vector>
+
+class INIReader;
+struct PlayerOpts;
+struct MidiModule;
+
+struct InstrumentSetCfg
+{
+	UINT8 setType;
+	std::vector<std::string> pathNames;
+};
+struct TypeMap_StrU8
+{
+	UINT8 value;
+	const char* name;
+};
+
+// parsing of configuration values
+void CfgString2Vector(const std::string& valueStr, std::vector<std::string>& valueVector);
+void Vector_Str2UInt32(const std::vector<std::string>& strList, std::vector<UINT32>& intList);
+UINT16 ParseChnMask(const std::string& maskStr);
+void ParseChnMaskList(const std::vector<std::string>& maskStrList, std::vector<UINT16>& maskList);
+UINT8 String2Opt_LUT(const TypeMap_StrU8* valMap, const std::string& value, UINT8 defaultVal);
+
+// loading of the settings that are shared by the player and the converter
+void LoadPlayerOptions(const INIReader& iniFile, PlayerOpts& plrOpts);
+void LoadInstrumentSetCfg(const INIReader& iniFile, const std::string& cfgBasePath, std::vector<InstrumentSetCfg>& insSetFiles);
+// reads the module type and settings from the section [mMod.name], except for the MIDI ports
+UINT8 LoadModuleConfig(const INIReader& iniFile, MidiModule& mMod);
+
+#endif	// __CONFIGLOADER_HPP__
@@ -26,6 +26,7 @@ struct SCAN_VARS
 	UINT8 curPortID;
 	UINT8 syxReset;	// keeps track of the most recent Reset message type
 	bool insChkOnNote;
+	const BANKSCAN_INSSET* insSet;
 };
 
 // possible bonus: detect GM MIDIs with XG drums (i.e. not Bank MSB, except for MSB=127 on drum channel)
@@ -34,9 +35,9 @@ struct SCAN_VARS
 // Function Prototypes
 static UINT8 GetInsModuleID(const INS_BANK* insBank, UINT8 ins, UINT8 msb, UINT8 lsb);
 static UINT8 GetGSInsModuleMask(const INS_BANK* insBank, UINT8 ins, UINT8 msb);
-static void DoInsCheck_XG(MODULE_CHECK* modChk, UINT8 ins, UINT8 msb, UINT8 lsb);
-static void DoInsCheck_GS(MODULE_CHECK* modChk, UINT8 ins, UINT8 msb, UINT8 lsb);
-static void DoInstrumentCheck(MODULE_CHECK* modChk, UINT8 ins, UINT8 msb, UINT8 lsb);
+static void DoInsCheck_XG(MODULE_CHECK* modChk, const BANKSCAN_INSSET* insSet, UINT8 ins, UINT8 msb, UINT8 lsb);
+static void DoInsCheck_GS(MODULE_CHECK* modChk, const BANKSCAN_INSSET* insSet, UINT8 ins, UINT8 msb, UINT8 lsb);
+static void DoInstrumentCheck(MODULE_CHECK* modChk, const BANKSCAN_INSSET* insSet, UINT8 ins, UINT8 msb, UINT8 lsb);
 static void MayDoInsCheck(MODULE_CHECK* modChk, SCAN_VARS* sv, UINT8 evtChn, bool isNote);
 static void HandleSysEx_MT32(UINT32 syxLen, const UINT8* syxData, MODULE_CHECK* modChk, SCAN_VARS* sv);
 static void HandleSysEx_GS(UINT32 syxLen, const UINT8* syxData, MODULE_CHECK* modChk, SCAN_VARS* sv);
@@ -52,23 +53,26 @@ static const UINT8 PART_ORDER[0x10] =
 #define SYX_RESET_UNDEF	0xFF
 
 
-static const INS_BANK* insBankGM2 = NULL;
-static const INS_BANK* insBankGS = NULL;
-static const INS_BANK* insBankXG = NULL;
-static std::string tmpCharsetStr;
+static BANKSCAN_INSSET defInsSet = {NULL, NULL, NULL};
 
 void SetBankScanInstruments(UINT8 moduleID, const INS_BANK* insBank)
+{
+	SetBankScanInstruments(&defInsSet, moduleID, insBank);
+	return;
+}
+
+void SetBankScanInstruments(BANKSCAN_INSSET* insSet, UINT8 moduleID, const INS_BANK* insBank)
 {
 	switch(moduleID)
 	{
 	case MODULE_GM_2:
-		insBankGM2 = insBank;
+		insSet->insBankGM2 = insBank;
 		break;
 	case MODULE_TYPE_GS:
-		insBankGS = insBank;
+		insSet->insBankGS = insBank;
 		break;
 	case MODULE_TYPE_XG:
-		insBankXG = insBank;
+		insSet->insBankXG = insBank;
 		break;
 	}
 	
@@ -78,33 +82,38 @@ void SetBankScanInstruments(UINT8 moduleID, const INS_BANK* insBank)
 static UINT8 GetInsModuleID(const INS_BANK* insBank, UINT8 ins, UINT8 msb, UINT8 lsb)
 {
 	const INS_PRG_LST* insPrg;
-	const INS_DATA* insData;
-	UINT32 curIns;
+	const UINT32* idxList;
+	UINT32 idxCount;
+	UINT32 curPos;
+	UINT32 firstIdx;
 	
 	if (insBank == NULL)
 		return 0xFF;
 	
+	// return the module of the first matching instrument in the list
 	insPrg = &insBank->prg[ins];
-	for (curIns = 0; curIns < insPrg->count; curIns ++)
+	idxCount = GetInsBankEntries(insPrg, msb, lsb, &idxList);
+	firstIdx = (UINT32)-1;
+	for (curPos = 0; curPos < idxCount; curPos ++)
 	{
-		insData = &insPrg->instruments[curIns];
-		if (msb == 0xFF || insData->bankMSB == msb)
-		{
-			if (lsb == 0xFF || insData->bankLSB == lsb)
-			{
-				return insData->moduleID;
-			}
-		}
+		if (lsb != 0xFF && insPrg->instruments[idxList[curPos]].bankLSB != lsb)
+			continue;
+		if (idxList[curPos] < firstIdx)
+			firstIdx = idxList[curPos];
 	}
+	if (firstIdx == (UINT32)-1)
+		return 0xFF;
 	
-	return 0xFF;
+	return insPrg->instruments[firstIdx].moduleID;
 }
 
 static UINT8 GetGSInsModuleMask(const INS_BANK* insBank, UINT8 ins, UINT8 msb)
 {
 	const INS_PRG_LST* insPrg;
 	const INS_DATA* insData;
-	UINT32 curIns;
+	const UINT32* idxList;
+	UINT32 idxCount;
+	UINT32 curPos;
 	UINT8 insMask;
 	UINT8 maxLsbMask;
 	
@@ -113,11 +122,11 @@ static UINT8 GetGSInsModuleMask(const INS_BANK* insBank, UINT8 ins, UINT8 msb)
 	
 	insPrg = &insBank->prg[ins];
 	insMask = 0x00;
-	for (curIns = 0; curIns < insPrg->count; curIns ++)
+	idxCount = GetInsBankEntries(insPrg, msb, 0xFF, &idxList);
+	for (curPos = 0; curPos < idxCount; curPos ++)
 	{
-		insData = &insPrg->instruments[curIns];
-		if (msb == 0xFF || insData->bankMSB == msb)
-			insMask |= ((1 << insData->bankLSB) - 1);
+		insData = &insPrg->instruments[idxList[curPos]];
+		insMask |= ((1 << insData->bankLSB) - 1);
 	}
 	// copy highest used bit to all "unused" bits
 	// Note: BankLSB is 1-based (LSB 1 requires us to check bit 0)
@@ -128,7 +137,7 @@ static UINT8 GetGSInsModuleMask(const INS_BANK* insBank, UINT8 ins, UINT8 msb)
 	return insMask;
 }
 
-static void DoInsCheck_XG(MODULE_CHECK* modChk, UINT8 ins, UINT8 ccMsb, UINT8 lsb)
+static void DoInsCheck_XG(MODULE_CHECK* modChk, const BANKSCAN_INSSET* insSet, UINT8 ins, UINT8 ccMsb, UINT8 lsb)
 {
 	UINT8 xgIns;
 	UINT8 msb;
@@ -229,14 +238,14 @@ static void DoInsCheck_XG(MODULE_CHECK* modChk, UINT8 ins, UINT8 ccMsb, UINT8 ls
 	{
 		UINT8 insModule;
 		
-		insModule = GetInsModuleID(insBankXG, xgIns, msb, lsb);
+		insModule = GetInsModuleID(insSet->insBankXG, xgIns, msb, lsb);
 		if (insModule < 0x80)
 		{
 			modChk->fmXG |= 1 << (FMBALL_INSSET + insModule);
 		}
 		else
 		{
-			insModule = GetInsModuleID(insBankXG, xgIns, msb, 0x00);	// do the usual XG fallback
+			insModule = GetInsModuleID(insSet->insBankXG, xgIns, msb, 0x00);	// do the usual XG fallback
 			if (insModule < 0x80)
 				modChk->fmXG |= (1 << FMBXG_NEEDS_CTF);
 			else
@@ -247,7 +256,7 @@ static void DoInsCheck_XG(MODULE_CHECK* modChk, UINT8 ins, UINT8 ccMsb, UINT8 ls
 	return;
 }
 
-static void DoInsCheck_GS(MODULE_CHECK* modChk, UINT8 ins, UINT8 ccMsb, UINT8 lsb)
+static void DoInsCheck_GS(MODULE_CHECK* modChk, const BANKSCAN_INSSET* insSet, UINT8 ins, UINT8 ccMsb, UINT8 lsb)
 {
 	INT16 insModule;
 	UINT8 msb;
@@ -290,7 +299,7 @@ static void DoInsCheck_GS(MODULE_CHECK* modChk, UINT8 ins, UINT8 ccMsb, UINT8 ls
 		UINT8 insMask;
 		
 		// search on all instrument maps to guess the right one
-		insModule = GetInsModuleID(insBankGS, ins, msb, 0xFF);
+		insModule = GetInsModuleID(insSet->insBankGS, ins, msb, 0xFF);
 		if (insModule < 0x80)
 		{
 			modChk->fmGS |= 1 << (FMBALL_INSSET + insModule);
@@ -304,7 +313,7 @@ static void DoInsCheck_GS(MODULE_CHECK* modChk, UINT8 ins, UINT8 ccMsb, UINT8 ls
 		}
 		
 		// get mask of modules that CAN use this instrument
-		insMask = GetGSInsModuleMask(insBankGS, ins, msb);
+		insMask = GetGSInsModuleMask(insSet->insBankGS, ins, msb);
 		if (insMask)
 			modChk->gsimNot |= ~insMask;	// take note of the modules that can NOT use it
 	}
@@ -313,7 +322,7 @@ static void DoInsCheck_GS(MODULE_CHECK* modChk, UINT8 ins, UINT8 ccMsb, UINT8 ls
 		// explicit instrument map
 		
 		// test for the defined map
-		insModule = GetInsModuleID(insBankGS, ins, msb, lsb);
+		insModule = GetInsModuleID(insSet->insBankGS, ins, msb, lsb);
 		if (insModule < 0x80)
 		{
 			modChk->fmGS |= 1 << (FMBALL_INSSET + insModule);
@@ -327,7 +336,7 @@ static void DoInsCheck_GS(MODULE_CHECK* modChk, UINT8 ins, UINT8 ccMsb, UINT8 ls
 		}
 		
 		// test for the minimal map (e.g. Bank LSB 0 is present on all maps)
-		insModule = GetInsModuleID(insBankGS, ins, msb, 0xFF);
+		insModule = GetInsModuleID(insSet->insBankGS, ins, msb, 0xFF);
 		if (insModule < 0x80)
 			modChk->gsimAllMap |= 1 << (FMBALL_INSSET + insModule);
 		else
@@ -337,7 +346,7 @@ static void DoInsCheck_GS(MODULE_CHECK* modChk, UINT8 ins, UINT8 ccMsb, UINT8 ls
 	return;
 }
 
-static void DoInstrumentCheck(MODULE_CHECK* modChk, UINT8 ins, UINT8 msb, UINT8 lsb)
+static void DoInstrumentCheck(MODULE_CHECK* modChk, const BANKSCAN_INSSET* insSet, UINT8 ins, UINT8 msb, UINT8 lsb)
 {
 	// MSB 0xFF == unset
 	if ((msb == 0x00 || msb == 0xFF) && (lsb == 0x00 || lsb == 0xFF))
@@ -347,8 +356,8 @@ static void DoInstrumentCheck(MODULE_CHECK* modChk, UINT8 ins, UINT8 msb, UINT8
 	else
 		modChk->fmGM |= (1 << FMBALL_BAD_INS);
 	
-	DoInsCheck_GS(modChk, ins, msb, lsb);
-	DoInsCheck_XG(modChk, ins, msb, lsb);
+	DoInsCheck_GS(modChk, insSet, ins, msb, lsb);
+	DoInsCheck_XG(modChk, insSet, ins, msb, lsb);
 	
 	if (ins & 0x80)
 	{
@@ -388,9 +397,9 @@ static void MayDoInsCheck(MODULE_CHECK* modChk, SCAN_VARS* sv, UINT8 evtChn, boo
 	insData[2] &= ~0x80;	// remove "instrument check" flag
 	
 	if (sv->drumChnMask & (1 << evtChn))
-		DoInstrumentCheck(modChk, 0x80 | insData[2], insData[0], insData[1]);
+		DoInstrumentCheck(modChk, sv->insSet, 0x80 | insData[2], insData[0], insData[1]);
 	else
-		DoInstrumentCheck(modChk, insData[2], insData[0], insData[1]);
+		DoInstrumentCheck(modChk, sv->insSet, insData[2], insData[0], insData[1]);
 	
 	return;
 }
@@ -590,7 +599,7 @@ static int MetaEvtStrCmp(midevt_const_it eventIt, const char* text)
 	return strncmp((const char*)&eventIt->evtData[0], text, textLen);
 }
 
-void MidiBankScan(MidiFile* cMidi, bool ignoreEmptyChns, BANKSCAN_RESULT* result)
+void MidiBankScan(MidiFile* cMidi, bool ignoreEmptyChns, BANKSCAN_RESULT* result, const BANKSCAN_INSSET* insSet)
 {
 	UINT16 curTrk;
 	MidiTrack* mTrk;
@@ -633,6 +642,7 @@ void MidiBankScan(MidiFile* cMidi, bool ignoreEmptyChns, BANKSCAN_RESULT* result
 	sv.portIDs.clear();
 	sv.syxReset = SYX_RESET_UNDEF;
 	sv.insChkOnNote = ignoreEmptyChns;
+	sv.insSet = (insSet != NULL) ? insSet : &defInsSet;
 	
 	for (curTrk = 0; curTrk < cMidi->GetTrackCount(); curTrk ++)
 	{
@@ -811,7 +821,7 @@ void MidiBankScan(MidiFile* cMidi, bool ignoreEmptyChns, BANKSCAN_RESULT* result
 		}	// end for (evtIt)
 	}
 	
-	result->charset = NULL;
+	result->charset.clear();
 #if CHARSET_DETECTION
 	if (! strList.empty())
 	{
@@ -834,10 +844,9 @@ void MidiBankScan(MidiFile* cMidi, bool ignoreEmptyChns, BANKSCAN_RESULT* result
 		int ret = uchardet_handle_data(ucd, allStr.c_str(), allStr.length());
 		uchardet_data_end(ucd);
 		
-		result->charset = uchardet_get_charset(ucd);
-		// store result into a separate buffer, as the pointer goes out-of-scope when the detector is destroyed
-		tmpCharsetStr = (result->charset != NULL) ? result->charset : "";
-		result->charset = tmpCharsetStr.empty() ? NULL : tmpCharsetStr.c_str();
+		// copy the result, as the pointer goes out-of-scope when the detector is destroyed
+		const char* charset = uchardet_get_charset(ucd);
+		result->charset = (charset != NULL) ? charset : "";
 		uchardet_delete(ucd);
 	}
 #endif
@@ -2,6 +2,7 @@
 #define __MIDIBANKSCAP_HPP__
 
 #include <stdtype.h>
+#include <string>
 #include "MidiInsReader.h"
 #include "MidiLib.hpp"
 
@@ -64,11 +65,20 @@ typedef struct
 	
 	MODULE_CHECK details;
 	
-	const char* charset;	// character set of the texts (NULL for detection failure / no detection)
+	std::string charset;	// character set of the texts (empty for detection failure / no detection)
 } BANKSCAN_RESULT;
+typedef struct
+{
+	const INS_BANK* insBankGM2;
+	const INS_BANK* insBankGS;
+	const INS_BANK* insBankXG;
+} BANKSCAN_INSSET;
 
+// set instruments for the global default set
 void SetBankScanInstruments(UINT8 moduleID, const INS_BANK* insBank);
-void MidiBankScan(MidiFile* cMidi, bool ignoreEmptyChns, BANKSCAN_RESULT* result);
+void SetBankScanInstruments(BANKSCAN_INSSET* insSet, UINT8 moduleID, const INS_BANK* insBank);
+// insSet == NULL: use the global default set
+void MidiBankScan(MidiFile* cMidi, bool ignoreEmptyChns, BANKSCAN_RESULT* result, const BANKSCAN_INSSET* insSet = NULL);
 
 
 #endif	// __MIDIBANKSCAP_HPP__
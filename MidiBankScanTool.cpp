@@ -1,16 +1,32 @@
 #include <iostream>
 #include <fstream>
 #include <string>
+#include <stdio.h>
+#include <stdlib.h>
 #include <ctype.h>	// for tolower()
 #include <string.h>	// for stricmp
 #include <vector>
+#include <list>
 #include <map>
+#include <algorithm>
+
+#ifdef _WIN32
+#include <Windows.h>
+#else
+#include <unistd.h>	// for sysconf()
+#include <dirent.h>
+#include <sys/stat.h>
+#endif
 
 #include <stdtype.h>
 #include "MidiLib.hpp"
 
 #include "MidiInsReader.h"
 #include "MidiBankScan.hpp"
+#include "OSThread.h"
+#include "OSMutex.h"
+#include "utils.hpp"
+#include "m3uargparse.hpp"
 
 #ifdef _MSC_VER
 #define stricmp		_stricmp
@@ -24,15 +40,36 @@ struct TempoChg
 	UINT32 tempo;
 	UINT64 tmrTick;
 };
+struct ScanJob
+{
+	std::string fileName;
+	UINT8 result;	// MidiFile::LoadFile() error code
+	bool done;
+	double songLen;	// in seconds
+	BANKSCAN_RESULT scanRes;
+};
+
+#define OUTFMT_TEXT	0x00
+#define OUTFMT_CSV	0x01
+#define OUTFMT_JSON	0x02	// JSON Lines: one object per line
 
+static UINT32 GetCPUCount(void);
+static bool IsDirectory(const std::string& path);
+static bool IsSongFile(const char* fileName);
+static void AddDirectoryFiles(const std::string& dirPath, std::vector<std::string>& fileList);
+static void ScanThread(void* args);
+static void PrintResult_Text(const ScanJob& job);
+static void PrintResult_CSV(const ScanJob& job);
+static void PrintResult_JSON(const ScanJob& job);
 static void PrintFeatureMask(UINT8 fmType, UINT32 fm);
 static void InitModuleNames(void);
-static void CalcSongLength(void);
+static UINT64 CalcSongLength(MidiFile* cMidi);
 
 
 static std::map<std::string, UINT8> shortNameID;	// short name -> ID
 static std::vector<std::string> shortIDName;		// ID -> short name
 
+// instrument banks (read-only while the worker threads are running)
 //static INS_BANK insBankGM1;
 static INS_BANK insBankGM2;
 static INS_BANK insBankGS;
@@ -40,13 +77,18 @@ static INS_BANK insBankXG;
 //static INS_BANK insBankYGS;	// Yamaha GS (TG300B mode)
 //static INS_BANK insBankKorg;
 //static INS_BANK insBankMT32;
+static BANKSCAN_INSSET bscanInsSet;
 static bool ignoreEmptyChns;
+static UINT8 outFormat;
+static bool printFileNames;
+
+// work queue
+static std::vector<ScanJob> jobList;
+static size_t nextJob;
+static size_t nextPrint;	// results are printed in the order of the input files
+static OS_MUTEX* hJobMutex;
 
-static MidiFile* _cMidi;
-static UINT64 _songLength;
-static UINT32 _songTickLen;
-static std::list<TempoChg> _tempoList;
-static UINT64 _tmrFreq = 1000000000;
+static const UINT64 _tmrFreq = 1000000000;
 
 static std::string Bin2Str(UINT32 value, size_t len)
 {
@@ -68,15 +110,18 @@ int main(int argc, char* argv[])
 {
 	int argbase;
 	UINT8 retVal;
-	MidiFile cMidi;
+	UINT32 numThreads;
+	size_t curThr;
 	
 	//std::cout << "MIDI Bank Scan\n";
 	//std::cout << "--------------n";
 	if (argc < 2)
 	{
-		std::cout << "Usage: MidiBankScan.exe [options] input.mid\n";
+		std::cout << "Usage: MidiBankScan.exe [options] files/directories/playlists ...\n";
 		std::cout << "Options:\n";
 		std::cout << "    -e - ignore empty channels\n";
+		std::cout << "    -f n - output format: text (default), csv, json (one line per file)\n";
+		std::cout << "    -j n - number of files to scan in parallel (default: number of CPUs)\n";
 #ifdef _DEBUG
 		getchar();
 #endif
@@ -84,6 +129,8 @@ int main(int argc, char* argv[])
 	}
 	
 	ignoreEmptyChns = false;
+	outFormat = OUTFMT_TEXT;
+	numThreads = 0;
 	argbase = 1;
 	while(argbase < argc && argv[argbase][0] == '-')
 	{
@@ -101,6 +148,25 @@ int main(int argc, char* argv[])
 		{
 			ignoreEmptyChns = true;
 		}
+		else if (optChr == 'f')
+		{
+			argbase ++;
+			if (argbase >= argc)
+				break;
+			if (! stricmp(argv[argbase], "csv"))
+				outFormat = OUTFMT_CSV;
+			else if (! stricmp(argv[argbase], "json"))
+				outFormat = OUTFMT_JSON;
+			else
+				outFormat = OUTFMT_TEXT;
+		}
+		else if (optChr == 'j')
+		{
+			argbase ++;
+			if (argbase >= argc)
+				break;
+			numThreads = (UINT32)strtoul(argv[argbase], NULL, 0);
+		}
 		else
 		{
 			break;
@@ -113,51 +179,282 @@ int main(int argc, char* argv[])
 		return 0;
 	}
 	
+	// collect all songs
+	{
+		std::vector<std::string> fileArgs;
+		std::vector<SongFileList> songList;
+		std::vector<std::string> plList;
+		std::vector<std::string> fileList;
+		size_t curFile;
+		int curArg;
+		
+		for (curArg = argbase; curArg < argc; curArg ++)
+		{
+			if (IsDirectory(argv[curArg]))
+				AddDirectoryFiles(argv[curArg], fileList);
+			else
+				fileArgs.push_back(argv[curArg]);
+		}
+		retVal = ParseSongFiles(fileArgs, songList, plList);
+		if (retVal)
+			fprintf(stderr, "One or more playlists couldn't be read!\n");
+		for (curFile = 0; curFile < songList.size(); curFile ++)
+			fileList.push_back(songList[curFile].fileName);
+		
+		jobList.resize(fileList.size());
+		for (curFile = 0; curFile < fileList.size(); curFile ++)
+		{
+			ScanJob& job = jobList[curFile];
+			job.fileName = fileList[curFile];
+			job.result = 0xFF;
+			job.done = false;
+			job.songLen = 0.0;
+		}
+	}
+	if (jobList.empty())
+	{
+		fprintf(stderr, "No files to scan.\n");
+		return 0;
+	}
+	// The text output of a single file stays the same as in the single-file version of the tool.
+	printFileNames = (jobList.size() > 1);
+	
+	// The instrument banks are loaded only once and shared by all threads.
 	retVal = LoadInstrumentList("_MidiInsSets/gs.ins", &insBankGS);
 	if (retVal)
-		printf("GS Load: 0x%02X\n", retVal);
+		fprintf(stderr, "GS Load: 0x%02X\n", retVal);
 	retVal = LoadInstrumentList("_MidiInsSets/xg.ins", &insBankXG);
 	if (retVal)
-		printf("XG Load: 0x%02X\n", retVal);
+		fprintf(stderr, "XG Load: 0x%02X\n", retVal);
 	{
 		INS_BANK tmpBank;
 		retVal = LoadInstrumentList("_MidiInsSets/y-plg.ins", &tmpBank);
 		if (retVal)
-			printf("XG-PLG Load: 0x%02X\n", retVal);
+			fprintf(stderr, "XG-PLG Load: 0x%02X\n", retVal);
 		MergeInstrumentBanks(&insBankXG, &tmpBank);
 		FreeInstrumentBank(&tmpBank);
 	}
 	//retVal = LoadInstrumentList("_MidiInsSets/ygs.ins", &insBankYGS);
 	//if (retVal)
-	//	printf("YGS Load: 0x%02X\n", retVal);
+	//	fprintf(stderr, "YGS Load: 0x%02X\n", retVal);
 	retVal = LoadInstrumentList("_MidiInsSets/gml2.ins", &insBankGM2);
 	if (retVal)
-		printf("GM2 Load: 0x%02X\n", retVal);
+		fprintf(stderr, "GM2 Load: 0x%02X\n", retVal);
 	
-	//std::cout << "Opening ...\n";
-	retVal = cMidi.LoadFile(argv[argbase + 0]);
-	if (retVal)
+	memset(&bscanInsSet, 0x00, sizeof(BANKSCAN_INSSET));
+	SetBankScanInstruments(&bscanInsSet, MODULE_TYPE_GS, &insBankGS);
+	SetBankScanInstruments(&bscanInsSet, MODULE_TYPE_XG, &insBankXG);
+	//SetBankScanInstruments(&bscanInsSet, MODULE_TG300B, &insBankYGS);
+	//SetBankScanInstruments(&bscanInsSet, MODULE_GM_1, &insBankGM1);
+	SetBankScanInstruments(&bscanInsSet, MODULE_GM_2, &insBankGM2);
+	//SetBankScanInstruments(&bscanInsSet, MODULE_TYPE_K5, &insBankK5);
+	//SetBankScanInstruments(&bscanInsSet, MODULE_MT32, &insBankMT32);
+	InitModuleNames();
+	
+	if (outFormat == OUTFMT_CSV)
 	{
-		printf("Error opening %s\n", argv[argbase + 0]);
-		printf("Errorcode: %02X\n", retVal);
-		return retVal;
+		printf("file,error,songLen,modType,modName,numPorts,hasReset,spcFeature,chnUseMask,"
+			"GS_Min,GS_Opt,XG_Opt,fmGM,fmGS,fmXG,fmOther,maxDrumKit,maxDrumMSB,"
+			"gsimAllMap,gsimNot,gsMaxLSB,xgMapSel,charset\n");
 	}
 	
-	SetBankScanInstruments(MODULE_TYPE_GS, &insBankGS);
-	SetBankScanInstruments(MODULE_TYPE_XG, &insBankXG);
-	//SetBankScanInstruments(MODULE_TG300B, &insBankYGS);
-	//SetBankScanInstruments(MODULE_GM_1, &insBankGM1);
-	SetBankScanInstruments(MODULE_GM_2, &insBankGM2);
-	//SetBankScanInstruments(MODULE_TYPE_K5, &insBankK5);
-	//SetBankScanInstruments(MODULE_MT32, &insBankMT32);
-	InitModuleNames();
+	if (numThreads == 0)
+		numThreads = GetCPUCount();
+	if (numThreads > jobList.size())
+		numThreads = (UINT32)jobList.size();
+	nextJob = 0;
+	nextPrint = 0;
+	OSMutex_Init(&hJobMutex, 0);
+	{
+		std::vector<OS_THREAD*> threads(numThreads, NULL);
+		for (curThr = 0; curThr < threads.size(); curThr ++)
+		{
+			retVal = OSThread_Init(&threads[curThr], &ScanThread, NULL);
+			if (retVal)
+				threads[curThr] = NULL;
+		}
+		if (threads[0] == NULL)
+			ScanThread(NULL);	// fall back to scanning in the main thread
+		for (curThr = 0; curThr < threads.size(); curThr ++)
+		{
+			if (threads[curThr] == NULL)
+				continue;
+			OSThread_Join(threads[curThr]);
+			OSThread_Deinit(threads[curThr]);
+		}
+	}
+	OSMutex_Deinit(hJobMutex);
 	
-	_cMidi = &cMidi;
+	//CMidi.ClearAll();
+#ifdef _DEBUG
+	//getchar();
+#endif
 	
-	BANKSCAN_RESULT scanRes;
-	CalcSongLength();
-	MidiBankScan(&cMidi, ignoreEmptyChns, &scanRes);
-	printf("SongLen:\t%.3f s\n", _songLength / (double)_tmrFreq);
+	FreeInstrumentBank(&insBankGS);
+	FreeInstrumentBank(&insBankXG);
+	//FreeInstrumentBank(&insBankYGS);
+	FreeInstrumentBank(&insBankGM2);
+	
+	if (jobList.size() == 1)
+		return jobList[0].result;
+	return 0;
+}
+
+static UINT32 GetCPUCount(void)
+{
+#ifdef _WIN32
+	SYSTEM_INFO sysInfo;
+	GetSystemInfo(&sysInfo);
+	return sysInfo.dwNumberOfProcessors;
+#else
+	long cpuCnt = sysconf(_SC_NPROCESSORS_ONLN);
+	return (cpuCnt > 0) ? (UINT32)cpuCnt : 1;
+#endif
+}
+
+static bool IsDirectory(const std::string& path)
+{
+#ifdef _WIN32
+	DWORD attrs = GetFileAttributesA(path.c_str());
+	return (attrs != INVALID_FILE_ATTRIBUTES) && (attrs & FILE_ATTRIBUTE_DIRECTORY);
+#else
+	struct stat st;
+	if (stat(path.c_str(), &st))
+		return false;
+	return S_ISDIR(st.st_mode);
+#endif
+}
+
+static bool IsSongFile(const char* fileName)
+{
+	static const char* SONG_EXTS[] = {"mid", "midi", "kar", NULL};
+	const char* fileExt = GetFileExtension(fileName);
+	size_t curExt;
+	
+	if (fileExt == NULL)
+		return false;
+	for (curExt = 0; SONG_EXTS[curExt] != NULL; curExt ++)
+	{
+		if (! stricmp(fileExt, SONG_EXTS[curExt]))
+			return true;
+	}
+	return false;
+}
+
+static void AddDirectoryFiles(const std::string& dirPath, std::vector<std::string>& fileList)
+{
+	std::vector<std::string> dirList;
+	std::vector<std::string> songList;
+	size_t curEnt;
+	
+#ifdef _WIN32
+	WIN32_FIND_DATAA findData;
+	HANDLE hFind = FindFirstFileA(CombinePaths(dirPath, "*").c_str(), &findData);
+	if (hFind == INVALID_HANDLE_VALUE)
+		return;
+	do
+	{
+		if (! strcmp(findData.cFileName, ".") || ! strcmp(findData.cFileName, ".."))
+			continue;
+		if (findData.dwFileAttributes & FILE_ATTRIBUTE_DIRECTORY)
+			dirList.push_back(CombinePaths(dirPath, findData.cFileName));
+		else if (IsSongFile(findData.cFileName))
+			songList.push_back(CombinePaths(dirPath, findData.cFileName));
+	} while(FindNextFileA(hFind, &findData));
+	FindClose(hFind);
+#else
+	DIR* hDir = opendir(dirPath.c_str());
+	struct dirent* dirEnt;
+	if (hDir == NULL)
+		return;
+	while((dirEnt = readdir(hDir)) != NULL)
+	{
+		if (! strcmp(dirEnt->d_name, ".") || ! strcmp(dirEnt->d_name, ".."))
+			continue;
+		std::string path = CombinePaths(dirPath, dirEnt->d_name);
+		if (IsDirectory(path))
+			dirList.push_back(path);
+		else if (IsSongFile(dirEnt->d_name))
+			songList.push_back(path);
+	}
+	closedir(hDir);
+#endif
+	
+	// sort, so that the order doesn't depend on the file system
+	std::sort(dirList.begin(), dirList.end());
+	std::sort(songList.begin(), songList.end());
+	fileList.insert(fileList.end(), songList.begin(), songList.end());
+	for (curEnt = 0; curEnt < dirList.size(); curEnt ++)
+		AddDirectoryFiles(dirList[curEnt], fileList);
+	
+	return;
+}
+
+static void ScanThread(void* args)
+{
+	(void)args;
+	while(true)
+	{
+		size_t jobID;
+		
+		// fetch the next file from the queue, so that fast threads take over work from slow ones
+		OSMutex_Lock(hJobMutex);
+		jobID = nextJob;
+		if (nextJob < jobList.size())
+			nextJob ++;
+		OSMutex_Unlock(hJobMutex);
+		if (jobID >= jobList.size())
+			break;
+		
+		ScanJob& job = jobList[jobID];
+		{
+			MidiFile cMidi;
+			
+			job.result = cMidi.LoadFile(job.fileName.c_str());
+			if (! job.result)
+			{
+				job.songLen = CalcSongLength(&cMidi) / (double)_tmrFreq;
+				MidiBankScan(&cMidi, ignoreEmptyChns, &job.scanRes, &bscanInsSet);
+			}
+		}
+		
+		OSMutex_Lock(hJobMutex);
+		job.done = true;
+		// print all results that are complete up to this point
+		while(nextPrint < jobList.size() && jobList[nextPrint].done)
+		{
+			const ScanJob& prtJob = jobList[nextPrint];
+			if (outFormat == OUTFMT_CSV)
+				PrintResult_CSV(prtJob);
+			else if (outFormat == OUTFMT_JSON)
+				PrintResult_JSON(prtJob);
+			else
+				PrintResult_Text(prtJob);
+			jobList[nextPrint].scanRes.charset = std::string();	// free memory early
+			nextPrint ++;
+		}
+		fflush(stdout);
+		OSMutex_Unlock(hJobMutex);
+	}
+	
+	return;
+}
+
+static void PrintResult_Text(const ScanJob& job)
+{
+	const BANKSCAN_RESULT& scanRes = job.scanRes;
+	
+	if (printFileNames)
+		printf("File:\t%s\n", job.fileName.c_str());
+	if (job.result)
+	{
+		printf("Error opening %s\n", job.fileName.c_str());
+		printf("Errorcode: %02X\n", job.result);
+		if (printFileNames)
+			printf("\n");
+		return;
+	}
+	printf("SongLen:\t%.3f s\n", job.songLen);
 	printf("modType:\t0x%02X (%s)\n", scanRes.modType, shortIDName[scanRes.modType].c_str());
 	printf("numPorts:\t%u\n", scanRes.numPorts);
 	printf("hasReset:\t0x%02X\n", scanRes.hasReset);
@@ -185,18 +482,106 @@ int main(int argc, char* argv[])
 	printf("GSInsMap_NoSupport:\t0b%s\n", Bin2Str(scanRes.details.gsimNot, 4).c_str());
 	printf("GS_MaxLSB:\t%u\n", scanRes.details.gsMaxLSB);
 	printf("XG_InsMap:\t%d\n", (INT8)scanRes.details.xgMapSel);
+	if (printFileNames)
+		printf("\n");
 	
-	//CMidi.ClearAll();
-#ifdef _DEBUG
-	//getchar();
-#endif
+	return;
+}
+
+static std::string EscapeCSV(const std::string& str)
+{
+	std::string result;
+	size_t curChr;
 	
-	FreeInstrumentBank(&insBankGS);
-	FreeInstrumentBank(&insBankXG);
-	//FreeInstrumentBank(&insBankYGS);
-	FreeInstrumentBank(&insBankGM2);
+	if (str.find_first_of(",\"\r\n") == std::string::npos)
+		return str;
+	// quote the field and double all quotation marks
+	result = "\"";
+	for (curChr = 0; curChr < str.length(); curChr ++)
+	{
+		if (str[curChr] == '"')
+			result += '"';
+		result += str[curChr];
+	}
+	result += '"';
+	return result;
+}
+
+static void PrintResult_CSV(const ScanJob& job)
+{
+	const BANKSCAN_RESULT& scanRes = job.scanRes;
+	const MODULE_CHECK& details = scanRes.details;
 	
-	return 0;
+	if (job.result)
+	{
+		printf("%s,0x%02X%s\n", EscapeCSV(job.fileName).c_str(), job.result, std::string(21, ',').c_str());
+		return;
+	}
+	printf("%s,0x00,%.3f,0x%02X,%s,%u,0x%02X,0x%02X,0x%04X,", EscapeCSV(job.fileName).c_str(), job.songLen,
+		scanRes.modType, EscapeCSV(shortIDName[scanRes.modType]).c_str(), scanRes.numPorts,
+		scanRes.hasReset, scanRes.spcFeature, details.chnUseMask);
+	printf("0x%02X,0x%02X,0x%02X,0x%08X,0x%08X,0x%08X,0x%08X,%u,%u,",
+		scanRes.GS_Min, scanRes.GS_Opt, scanRes.XG_Opt,
+		details.fmGM, details.fmGS, details.fmXG, details.fmOther,
+		(UINT8)(1 + details.MaxDrumKit), details.MaxDrumMSB);
+	printf("0x%X,0x%X,%u,%d,%s\n", details.gsimAllMap, details.gsimNot, details.gsMaxLSB,
+		(INT8)details.xgMapSel, EscapeCSV(scanRes.charset).c_str());
+	
+	return;
+}
+
+static std::string EscapeJSON(const std::string& str)
+{
+	std::string result = "\"";
+	size_t curChr;
+	
+	for (curChr = 0; curChr < str.length(); curChr ++)
+	{
+		char chr = str[curChr];
+		if (chr == '"' || chr == '\\')
+		{
+			result += '\\';
+			result += chr;
+		}
+		else if ((UINT8)chr < 0x20)
+		{
+			char escBuf[0x08];
+			snprintf(escBuf, 0x08, "\\u%04X", (UINT8)chr);
+			result += escBuf;
+		}
+		else
+		{
+			result += chr;
+		}
+	}
+	result += '"';
+	return result;
+}
+
+static void PrintResult_JSON(const ScanJob& job)
+{
+	const BANKSCAN_RESULT& scanRes = job.scanRes;
+	const MODULE_CHECK& details = scanRes.details;
+	
+	if (job.result)
+	{
+		printf("{\"file\": %s, \"error\": %u}\n", EscapeJSON(job.fileName).c_str(), job.result);
+		return;
+	}
+	printf("{\"file\": %s, \"error\": 0, \"songLen\": %.3f, \"modType\": %u, \"modName\": %s, "
+		"\"numPorts\": %u, \"hasReset\": %u, \"spcFeature\": %u, \"chnUseMask\": %u, ",
+		EscapeJSON(job.fileName).c_str(), job.songLen, scanRes.modType, EscapeJSON(shortIDName[scanRes.modType]).c_str(),
+		scanRes.numPorts, scanRes.hasReset, scanRes.spcFeature, details.chnUseMask);
+	printf("\"GS_Min\": %u, \"GS_Opt\": %u, \"XG_Opt\": %u, "
+		"\"fmGM\": %u, \"fmGS\": %u, \"fmXG\": %u, \"fmOther\": %u, \"maxDrumKit\": %u, \"maxDrumMSB\": %u, ",
+		scanRes.GS_Min, scanRes.GS_Opt, scanRes.XG_Opt,
+		details.fmGM, details.fmGS, details.fmXG, details.fmOther,
+		(UINT8)(1 + details.MaxDrumKit), details.MaxDrumMSB);
+	printf("\"gsimAllMap\": %u, \"gsimNot\": %u, \"gsMaxLSB\": %u, \"xgMapSel\": %d, \"charset\": %s}\n",
+		details.gsimAllMap, details.gsimNot, details.gsMaxLSB, (INT8)details.xgMapSel,
+		EscapeJSON(scanRes.charset).c_str());
+	
+	return;
 }
 
 static void PrintFeatureMask(UINT8 fmType, UINT32 fm)
@@ -323,9 +708,6 @@ static void InitModuleNames(void)
 	return;
 }
 
-static UINT64 _curTickTime;	// time for 1 MIDI tick at current tempo
-static UINT32 _midiTempo;
-
 static inline UINT32 ReadBE24(const UINT8* data)
 {
 	return (data[0x00] << 16) | (data[0x01] << 8) | (data[0x02] << 0);
@@ -336,37 +718,34 @@ static bool tempo_compare(const TempoChg& first, const TempoChg& second)
 	return (first.tick < second.tick);
 }
 
-static void RefreshTickTime(void)
+static UINT64 CalcTickTime(const MidiFile* cMidi, UINT32 midiTempo)
 {
+	// returns the time for 1 MIDI tick at the specified tempo
 	UINT64 tmrMul;
 	UINT64 tmrDiv;
 	
-	tmrMul = _tmrFreq * _midiTempo;
-	tmrDiv = (UINT64)1000000 * _cMidi->GetMidiResolution();
+	tmrMul = _tmrFreq * midiTempo;
+	tmrDiv = (UINT64)1000000 * cMidi->GetMidiResolution();
 	if (tmrDiv == 0)
 		tmrDiv = 1000000;
-	_curTickTime = (tmrMul + tmrDiv / 2) / tmrDiv;
-	return;
+	return (tmrMul + tmrDiv / 2) / tmrDiv;
 }
 
-static void CalcSongLength(void)
+static UINT64 CalcSongLength(MidiFile* cMidi)
 {
+	// Note: uses only local state, so that multiple threads can call it.
 	UINT16 curTrk;
 	UINT32 tickBase;
 	UINT32 maxTicks;
-	UINT32 ticksWhole;
+	std::list<TempoChg> tempoList;
 	std::list<TempoChg>::iterator tempoIt;
 	std::list<TempoChg>::iterator tPrevIt;
 	
-	_songLength = 0;
-	_tempoList.clear();
-	_tempoList.clear();
-	
 	tickBase = 0;
 	maxTicks = 0;
-	for (curTrk = 0; curTrk < _cMidi->GetTrackCount(); curTrk ++)
+	for (curTrk = 0; curTrk < cMidi->GetTrackCount(); curTrk ++)
 	{
-		MidiTrack* mTrk = _cMidi->GetTrack(curTrk);
+		MidiTrack* mTrk = cMidi->GetTrack(curTrk);
 		midevt_iterator evtIt;
 		
 		for (evtIt = mTrk->GetEventBegin(); evtIt != mTrk->GetEventEnd(); ++evtIt)
@@ -383,13 +762,13 @@ static void CalcSongLength(void)
 						tc.tick = evtIt->tick;
 						tc.tempo = ReadBE24(&evtIt->evtData[0x00]);
 						tc.tmrTick = 0;
-						_tempoList.push_back(tc);
+						tempoList.push_back(tc);
 					}
 					break;
 				}
 			}
 		}
-		if (_cMidi->GetMidiFormat() == 2)
+		if (cMidi->GetMidiFormat() == 2)
 		{
 			maxTicks = mTrk->GetTickCount();
 			tickBase = maxTicks;
@@ -401,37 +780,27 @@ static void CalcSongLength(void)
 		}
 	}
 	
-	_tempoList.sort(tempo_compare);
-	if (_tempoList.empty() || _tempoList.front().tick > 0)
+	tempoList.sort(tempo_compare);
+	if (tempoList.empty() || tempoList.front().tick > 0)
 	{
 		// add initial tempo, if no tempo is set at tick 0
 		TempoChg tc;
 		tc.tick = 0;
 		tc.tempo = 500000;	// 120 BPM
 		tc.tmrTick = 0;
-		_tempoList.push_front(tc);
+		tempoList.push_front(tc);
 	}
 	
 	// calculate time position of tempo events and song length
-	tPrevIt = _tempoList.begin();
+	tPrevIt = tempoList.begin();
 	tempoIt = tPrevIt;	++tempoIt;
-	for (; tempoIt != _tempoList.end(); ++tempoIt)
+	for (; tempoIt != tempoList.end(); ++tempoIt)
 	{
 		UINT32 tickDiff = tempoIt->tick - tPrevIt->tick;
-		_midiTempo = tPrevIt->tempo;
-		RefreshTickTime();
-		
-		tempoIt->tmrTick = tPrevIt->tmrTick + tickDiff * _curTickTime;
+		tempoIt->tmrTick = tPrevIt->tmrTick + tickDiff * CalcTickTime(cMidi, tPrevIt->tempo);
 		
 		tPrevIt = tempoIt;
 	}
 	
-	_midiTempo = tPrevIt->tempo;
-	RefreshTickTime();
-	_songTickLen = maxTicks;
-	_songLength = tPrevIt->tmrTick + (maxTicks - tPrevIt->tick) * _curTickTime;
-	_midiTempo = _tempoList.begin()->tempo;
-	
-	return;
+	return tPrevIt->tmrTick + (maxTicks - tPrevIt->tick) * CalcTickTime(cMidi, tPrevIt->tempo);
 }
-
@@ -0,0 +1,707 @@
+// MIDI Converter
+// --------------
+// Runs songs through the MIDI player (without real-time output) and writes the data
+// that would be sent to the destination module into new MIDI files.
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <vector>
+#include <string>
+#include <map>
+#include <algorithm>
+
+#ifdef _MSC_VER
+#define stricmp	_stricmp
+#else
+#define stricmp	strcasecmp
+#endif
+
+#ifdef _WIN32
+#include <Windows.h>
+#else
+#include <unistd.h>	// for sysconf()
+#include <dirent.h>
+#include <sys/stat.h>
+#endif
+
+#if ENABLE_ZIP_SUPPORT
+#include "unzip.h"
+#endif
+
+#include "INIReader.hpp"
+
+#include <stdtype.h>
+#include "MidiLib.hpp"
+#include "MidiModules.hpp"
+#include "MidiPlay.hpp"
+#include "MidiInsReader.h"
+#include "MidiBankScan.hpp"
+#include "OSThread.h"
+#include "OSMutex.h"
+#include "vis.hpp"
+#include "utils.hpp"
+#include "m3uargparse.hpp"
+#include "RCPLoader.hpp"
+#include "ConfigLoader.hpp"
+
+
+struct ConvertJob
+{
+	std::string inFile;
+	std::string outFile;
+	UINT8 result;
+};
+
+
+static UINT32 GetCPUCount(void);
+static bool IsDirectory(const std::string& path);
+static bool IsSongFile(const char* fileName);
+static void AddDirectoryFiles(const std::string& dirPath, std::vector<std::string>& fileList);
+#if ENABLE_ZIP_SUPPORT
+static void AddZipFiles(const std::string& zipPath, std::vector<std::string>& fileList);
+static FILE* ExtractFromZIP(const std::string& path);
+#endif
+static UINT8 LoadConfig(const std::string& cfgFile, const std::string& modName);
+static UINT8 LoadSongFile(const std::string& fileName, MidiFile& cMidi);
+static UINT8 ConvertSong(MidiPlayer& midPlay, const ConvertJob& job);
+static void ConvertThread(void* args);
+
+
+// configuration (read-only while the worker threads are running)
+static std::string cfgBasePath;
+static PlayerOpts playerCfg;
+static MidiModule dstModule;
+static std::vector<InstrumentSetCfg> insSetFiles;
+static std::vector<INS_BANK> insBanks;
+static BANKSCAN_INSSET bscanInsSet;
+
+// work queue
+static std::vector<ConvertJob> jobList;
+static size_t nextJob;
+static size_t jobsDone;
+static OS_MUTEX* hJobMutex;
+
+
+int main(int argc, char* argv[])
+{
+	int argbase;
+	UINT8 retVal;
+	std::string cfgFilePath;
+	std::string modName;
+	std::string outPath;
+	UINT32 numThreads;
+	UINT32 numLoopsCLI;
+	UINT8 plrCfgFlagsCLI;
+	size_t curInsBnk;
+	size_t curThr;
+	size_t curJob;
+	
+	printf("MIDI Converter\n");
+	printf("--------------\n");
+	if (argc < 3)
+	{
+		printf("Usage: MidiConvert [options] outdir files/directories/playlists ...\n");
+		printf("Options:\n");
+		printf("    -c f - use configuration file \"f\" (default: config.ini)\n");
+		printf("    -m n - destination module: name of a module in the configuration file or a module type\n");
+		printf("    -o n - set option bitmask (see MidiPlayer)\n");
+		printf("    -l n - play looping songs n times (default: 2)\n");
+		printf("    -j n - number of songs to convert in parallel (default: number of CPUs)\n");
+		return 0;
+	}
+	
+	numThreads = 0;
+	numLoopsCLI = 0;
+	plrCfgFlagsCLI = 0xFF;
+	argbase = 1;
+	while(argbase < argc && argv[argbase][0] == '-')
+	{
+		char optChr = argv[argbase][1];
+		
+		argbase ++;
+		if (argbase >= argc)
+			break;
+		if (optChr == 'c')
+			cfgFilePath = argv[argbase];
+		else if (optChr == 'm')
+			modName = argv[argbase];
+		else if (optChr == 'o')
+			plrCfgFlagsCLI = (UINT8)strtoul(argv[argbase], NULL, 0);
+		else if (optChr == 'l')
+			numLoopsCLI = (UINT32)strtoul(argv[argbase], NULL, 0);
+		else if (optChr == 'j')
+			numThreads = (UINT32)strtoul(argv[argbase], NULL, 0);
+		else
+			break;
+		argbase ++;
+	}
+	if (argc < argbase + 2)
+	{
+		printf("Not enough arguments.\n");
+		return 0;
+	}
+	if (modName.empty())
+	{
+		printf("Please specify the destination module.\n");
+		return 1;
+	}
+	outPath = argv[argbase];
+	argbase ++;
+	
+	if (cfgFilePath.empty())
+	{
+		std::vector<std::string> appSearchPaths;
+		const char* appTitle = GetFileTitle(argv[0]);
+		if (appTitle != argv[0])
+			appSearchPaths.push_back(std::string(argv[0], appTitle - argv[0]));
+		appSearchPaths.push_back("./");
+		cfgFilePath = FindFile_Single("config.ini", appSearchPaths);
+		if (cfgFilePath.empty())
+		{
+			printf("config.ini not found!\n");
+			return 1;
+		}
+	}
+	{
+		const char* startPtr = cfgFilePath.c_str();
+		const char* endPtr = GetFileTitle(startPtr);
+		cfgBasePath = std::string(startPtr, endPtr - startPtr);
+	}
+	retVal = LoadConfig(cfgFilePath, modName);
+	if (retVal)
+		return 1;
+	if (numLoopsCLI > 0)
+		playerCfg.numLoops = numLoopsCLI;
+	if (plrCfgFlagsCLI != 0xFF)
+		playerCfg.flags = plrCfgFlagsCLI;
+	if (! playerCfg.numLoops)
+		playerCfg.numLoops = 2;	// endless looping can't be rendered
+	
+	insBanks.resize(insSetFiles.size());
+	memset(&bscanInsSet, 0x00, sizeof(BANKSCAN_INSSET));
+	for (curInsBnk = 0; curInsBnk < insSetFiles.size(); curInsBnk ++)
+	{
+		const InstrumentSetCfg* tmpInsSet = &insSetFiles[curInsBnk];
+		INS_BANK* insBank = &insBanks[curInsBnk];
+		size_t curFile;
+		
+		retVal = LoadInstrumentList(tmpInsSet->pathNames[0].c_str(), insBank);
+		if (retVal)
+		{
+			printf("InsSet %s Load: 0x%02X\n", tmpInsSet->pathNames[0].c_str(), retVal);
+			continue;
+		}
+		
+		for (curFile = 1; curFile < tmpInsSet->pathNames.size(); curFile ++)
+		{
+			INS_BANK tmpBank;
+			
+			retVal = LoadInstrumentList(tmpInsSet->pathNames[curFile].c_str(), &tmpBank);
+			if (retVal)
+			{
+				printf("InsSet %s Load: 0x%02X\n", tmpInsSet->pathNames[curFile].c_str(), retVal);
+				continue;
+			}
+			MergeInstrumentBanks(insBank, &tmpBank);
+			FreeInstrumentBank(&tmpBank);
+		}
+		
+		SetBankScanInstruments(&bscanInsSet, tmpInsSet->setType, insBank);
+	}
+	
+	// collect all songs
+	{
+		std::vector<std::string> fileArgs;
+		std::vector<SongFileList> songList;
+		std::vector<std::string> plList;
+		std::vector<std::string> fileList;
+		std::map<std::string, UINT32> outNames;
+		int curArg;
+		
+		for (curArg = argbase; curArg < argc; curArg ++)
+		{
+			if (IsDirectory(argv[curArg]))
+				AddDirectoryFiles(argv[curArg], fileList);
+			else
+				fileArgs.push_back(argv[curArg]);
+		}
+		retVal = ParseSongFiles(fileArgs, songList, plList);
+		if (retVal)
+			printf("One or more playlists couldn't be read!\n");
+		for (curJob = 0; curJob < songList.size(); curJob ++)
+		{
+			const std::string& fileName = songList[curJob].fileName;
+#if ENABLE_ZIP_SUPPORT
+			const char* fileExt = GetFileExtension(fileName.c_str());
+			if (fileExt != NULL && ! stricmp(fileExt, "zip"))
+			{
+				AddZipFiles(fileName, fileList);
+				continue;
+			}
+#endif
+			fileList.push_back(fileName);
+		}
+		
+		jobList.resize(fileList.size());
+		for (curJob = 0; curJob < fileList.size(); curJob ++)
+		{
+			ConvertJob& job = jobList[curJob];
+			const char* fTitle = GetFileTitle(fileList[curJob].c_str());
+			const char* fExt = GetFileExtension(fTitle);
+			if (fExt != NULL)
+				fExt --;	// move pointer to '.'
+			else
+				fExt = fTitle + strlen(fTitle);
+			std::string outName = std::string(fTitle, fExt);
+			
+			// make file names unique (songs from different directories may have the same name)
+			UINT32 nameCnt = outNames[outName] ++;
+			if (nameCnt > 0)
+			{
+				char numStr[0x10];
+				snprintf(numStr, 0x10, "_%u", nameCnt);
+				outName += numStr;
+			}
+			
+			job.inFile = fileList[curJob];
+			job.outFile = CombinePaths(outPath, outName + ".mid");
+			job.result = 0xFF;
+		}
+	}
+	if (jobList.empty())
+	{
+		printf("No songs to convert.\n");
+		return 0;
+	}
+	
+	if (numThreads == 0)
+		numThreads = GetCPUCount();
+	if (numThreads > jobList.size())
+		numThreads = (UINT32)jobList.size();
+	printf("Converting %u songs for %s using %u threads ...\n",
+		(unsigned)jobList.size(), dstModule.name.c_str(), numThreads);
+	
+	vis_init();
+	nextJob = 0;
+	jobsDone = 0;
+	OSMutex_Init(&hJobMutex, 0);
+	{
+		std::vector<OS_THREAD*> threads(numThreads, NULL);
+		for (curThr = 0; curThr < threads.size(); curThr ++)
+		{
+			retVal = OSThread_Init(&threads[curThr], &ConvertThread, NULL);
+			if (retVal)
+				threads[curThr] = NULL;
+		}
+		if (threads[0] == NULL)
+			ConvertThread(NULL);	// fall back to converting in the main thread
+		for (curThr = 0; curThr < threads.size(); curThr ++)
+		{
+			if (threads[curThr] == NULL)
+				continue;
+			OSThread_Join(threads[curThr]);
+			OSThread_Deinit(threads[curThr]);
+		}
+	}
+	OSMutex_Deinit(hJobMutex);
+	vis_deinit();
+	
+	{
+		size_t errCnt = 0;
+		for (curJob = 0; curJob < jobList.size(); curJob ++)
+		{
+			if (jobList[curJob].result)
+				errCnt ++;
+		}
+		printf("Done. %u songs converted, %u errors.\n", (unsigned)(jobList.size() - errCnt), (unsigned)errCnt);
+	}
+	
+	for (curInsBnk = 0; curInsBnk < insBanks.size(); curInsBnk ++)
+		FreeInstrumentBank(&insBanks[curInsBnk]);
+	
+	return 0;
+}
+
+static UINT32 GetCPUCount(void)
+{
+#ifdef _WIN32
+	SYSTEM_INFO sysInfo;
+	GetSystemInfo(&sysInfo);
+	return sysInfo.dwNumberOfProcessors;
+#else
+	long cpuCnt = sysconf(_SC_NPROCESSORS_ONLN);
+	return (cpuCnt > 0) ? (UINT32)cpuCnt : 1;
+#endif
+}
+
+static bool IsDirectory(const std::string& path)
+{
+#ifdef _WIN32
+	DWORD attrs = GetFileAttributesA(path.c_str());
+	return (attrs != INVALID_FILE_ATTRIBUTES) && (attrs & FILE_ATTRIBUTE_DIRECTORY);
+#else
+	struct stat st;
+	if (stat(path.c_str(), &st))
+		return false;
+	return S_ISDIR(st.st_mode);
+#endif
+}
+
+static bool IsSongFile(const char* fileName)
+{
+	static const char* SONG_EXTS[] = {"mid", "midi", "kar", "rmi", "rcp", "r36", "g18", "g36", "zip", NULL};
+	const char* fileExt = GetFileExtension(fileName);
+	size_t curExt;
+	
+	if (fileExt == NULL)
+		return false;
+	for (curExt = 0; SONG_EXTS[curExt] != NULL; curExt ++)
+	{
+		if (! stricmp(fileExt, SONG_EXTS[curExt]))
+			return true;
+	}
+	return false;
+}
+
+static void AddDirectoryFiles(const std::string& dirPath, std::vector<std::string>& fileList)
+{
+	std::vector<std::string> dirList;
+	std::vector<std::string> songList;
+	size_t curEnt;
+
+#ifdef _WIN32
+	WIN32_FIND_DATAA findData;
+	HANDLE hFind = FindFirstFileA(CombinePaths(dirPath, "*").c_str(), &findData);
+	if (hFind == INVALID_HANDLE_VALUE)
+		return;
+	do
+	{
+		if (! strcmp(findData.cFileName, ".") || ! strcmp(findData.cFileName, ".."))
+			continue;
+		if (findData.dwFileAttributes & FILE_ATTRIBUTE_DIRECTORY)
+			dirList.push_back(CombinePaths(dirPath, findData.cFileName));
+		else if (IsSongFile(findData.cFileName))
+			songList.push_back(CombinePaths(dirPath, findData.cFileName));
+	} while(FindNextFileA(hFind, &findData));
+	FindClose(hFind);
+#else
+	DIR* hDir = opendir(dirPath.c_str());
+	struct dirent* dirEnt;
+	if (hDir == NULL)
+		return;
+	while((dirEnt = readdir(hDir)) != NULL)
+	{
+		if (! strcmp(dirEnt->d_name, ".") || ! strcmp(dirEnt->d_name, ".."))
+			continue;
+		std::string path = CombinePaths(dirPath, dirEnt->d_name);
+		if (IsDirectory(path))
+			dirList.push_back(path);
+		else if (IsSongFile(dirEnt->d_name))
+			songList.push_back(path);
+	}
+	closedir(hDir);
+#endif
+	
+	// sort, so that the order doesn't depend on the file system
+	std::sort(dirList.begin(), dirList.end());
+	std::sort(songList.begin(), songList.end());
+	for (curEnt = 0; curEnt < songList.size(); curEnt ++)
+	{
+#if ENABLE_ZIP_SUPPORT
+		const char* fileExt = GetFileExtension(songList[curEnt].c_str());
+		if (fileExt != NULL && ! stricmp(fileExt, "zip"))
+		{
+			AddZipFiles(songList[curEnt], fileList);
+			continue;
+		}
+#endif
+		fileList.push_back(songList[curEnt]);
+	}
+	for (curEnt = 0; curEnt < dirList.size(); curEnt ++)
+		AddDirectoryFiles(dirList[curEnt], fileList);
+	
+	return;
+}
+
+#if ENABLE_ZIP_SUPPORT
+static void AddZipFiles(const std::string& zipPath, std::vector<std::string>& fileList)
+{
+	FILE* hFileZip;
+	ZIP_FILE zipFile;
+	UINT64 curEnt;
+	UINT8 retVal;
+	
+	hFileZip = fopen(zipPath.c_str(), "rb");
+	if (hFileZip == NULL)
+		return;
+	retVal = ZIP_LoadFromFile(hFileZip, &zipFile);
+	fclose(hFileZip);
+	if (retVal)
+	{
+		printf("Error reading ZIP file: %s\n", zipPath.c_str());
+		return;
+	}
+	
+	for (curEnt = 0; curEnt < zipFile.eocd.totalEntries; curEnt ++)
+	{
+		const ZIP_DIR_ENTRY* zde = &zipFile.entries[curEnt];
+		if (IsSongFile(zde->filename))
+			fileList.push_back(zipPath + '/' + zde->filename);
+	}
+	ZIP_Unload(&zipFile);
+	
+	return;
+}
+
+static FILE* ExtractFromZIP(const std::string& path)
+{
+	// The path is expected to be "path/to/file.zip/packed/file.mid".
+	std::string normPath;	// path with normalized dir separators
+	size_t pathSepPos;
+	std::string zipPath;
+	FILE* hFileZip;
+	FILE* hFileOut;
+	ZIP_FILE zipFile;
+	const ZIP_DIR_ENTRY* zde;
+	UINT8 retVal;
+	
+	normPath = path;
+	StandardizeDirSeparators(normPath);
+	
+	pathSepPos = normPath.rfind('/');
+	hFileZip = NULL;
+	while(pathSepPos != std::string::npos)
+	{
+		zipPath = path.substr(0, pathSepPos);
+		hFileZip = fopen(zipPath.c_str(), "rb");
+		if (hFileZip != NULL)
+			break;
+		if (pathSepPos > 0)
+			pathSepPos = normPath.rfind('/', pathSepPos - 1);
+		else
+			pathSepPos = std::string::npos;
+	}
+	if (hFileZip == NULL)
+		return NULL;	// no ZIP file is part of the path
+	
+	// Note: Each call loads the ZIP directory again, so that worker threads don't share any state.
+	retVal = ZIP_LoadFromFile(hFileZip, &zipFile);
+	if (retVal)
+	{
+		fclose(hFileZip);
+		return NULL;
+	}
+	zde = ZIP_GetEntryFromName(&zipFile, normPath.c_str() + pathSepPos + 1);
+	if (zde == NULL)
+	{
+		ZIP_Unload(&zipFile);
+		fclose(hFileZip);
+		return NULL;
+	}
+	
+	hFileOut = tmpfile();	// deleted automatically when closed
+	if (hFileOut != NULL)
+	{
+		retVal = ZIP_ExtractToFile(hFileZip, zde, hFileOut);
+		if (retVal >= 0x80)
+		{
+			fclose(hFileOut);
+			hFileOut = NULL;
+		}
+		else
+		{
+			rewind(hFileOut);
+		}
+	}
+	ZIP_Unload(&zipFile);
+	fclose(hFileZip);
+	
+	return hFileOut;
+}
+#endif	// ENABLE_ZIP_SUPPORT
+
+static UINT8 LoadConfig(const std::string& cfgFile, const std::string& modName)
+{
+	std::vector<std::string> modList;
+	UINT8 retVal;
+	
+	INIReader iniFile;
+	if (iniFile.ReadFile(cfgFile))
+	{
+		printf("Error reading %s!\n", cfgFile.c_str());
+		return 0xFF;
+	}
+	
+	LoadPlayerOptions(iniFile, playerCfg);
+	playerCfg.outLookahead = 0;	// not used when rendering
+	LoadInstrumentSetCfg(iniFile, cfgBasePath, insSetFiles);
+	
+	// The destination module is either a module from the configuration file or just a module type.
+	dstModule.name = modName;
+	dstModule.options = GetDefaultMidiModOpts();
+	CfgString2Vector(iniFile.GetString("General", "Modules", ""), modList);
+	if (std::find(modList.begin(), modList.end(), modName) == modList.end())
+	{
+		if (! MidiModule::GetIDFromNameOrNumber(modName, MidiModuleCollection::GetShortModNameLUT(), dstModule.modType))
+		{
+			printf("Unknown module: %s\n", modName.c_str());
+			return 0xFF;
+		}
+		dstModule.options.resetType = GetMidiModResetType(dstModule.modType);
+		dstModule.options.masterVol = GetMidiModMasterVolType(dstModule.modType);
+		dstModule.options.defInsMap = GetMidiModDefInsMap(dstModule.modType);
+		return 0x00;
+	}
+	
+	// Note: The "Ports" setting is ignored. The number of ports is taken from each song.
+	retVal = LoadModuleConfig(iniFile, dstModule);
+	if (retVal)
+	{
+		printf("Module %s: Invalid module type!\n", modName.c_str());
+		return 0xFF;
+	}
+	
+	return 0x00;
+}
+
+static UINT8 LoadSongFile(const std::string& fileName, MidiFile& cMidi)
+{
+	FILE* hFile;
+	UINT8 retVal;
+	
+	hFile = fopen(fileName.c_str(), "rb");
+#if ENABLE_ZIP_SUPPORT
+	if (hFile == NULL)
+		hFile = ExtractFromZIP(fileName);
+#endif
+	if (hFile == NULL)
+		return 0xFF;
+	
+	retVal = cMidi.LoadFile(hFile);
+	if (retVal >= 0x10)
+	{
+		char fileSig[4];
+		rewind(hFile);
+		fread(fileSig, 1, 4, hFile);
+		if (! memcmp(fileSig, "RIFF", 4))	// .rmi file?
+		{
+			fseek(hFile, 0x14, SEEK_SET);	// attempt to seek over to actual MIDI data
+			retVal = cMidi.LoadFile(hFile);	// and try reading again from there
+		}
+	}
+	if (retVal >= 0x10)
+	{
+		std::vector<std::string> initFiles;	// Note: CM6/GSD setup files are not supported here.
+		rewind(hFile);
+		retVal = LoadRCPAsMidi(hFile, cMidi, initFiles);
+	}
+	fclose(hFile);
+	
+	return retVal;
+}
+
+static UINT8 ConvertSong(MidiPlayer& midPlay, const ConvertJob& job)
+{
+	MidiFile cMidi;
+	MidiFile outMidi;
+	BANKSCAN_RESULT scanRes;
+	PlayerOpts plrOpts;
+	size_t portCnt;
+	UINT64 time;
+	UINT8 retVal;
+	
+	retVal = LoadSongFile(job.inFile, cMidi);
+	if (retVal)
+		return retVal;
+	
+	MidiBankScan(&cMidi, true, &scanRes, &bscanInsSet);
+	if (scanRes.modType == 0xFF)
+		scanRes.modType = MODULE_GM_1;
+	
+	plrOpts = playerCfg;
+	plrOpts.srcType = scanRes.modType;
+	plrOpts.dstType = dstModule.modType;
+	if (scanRes.hasReset != 0xFF)
+	{
+		bool resetOff = true;
+		if (MMASK_TYPE(scanRes.hasReset) == MODULE_TYPE_GM && MMASK_TYPE(dstModule.modType) != MODULE_TYPE_GM)
+			resetOff = false;	// disable GM reset
+		else if (MMASK_TYPE(scanRes.hasReset) != MMASK_TYPE(dstModule.modType))
+			resetOff = false;	// enforce manual reset when MIDI and device types differ
+		else if (MMASK_TYPE(dstModule.modType) == MODULE_TYPE_GS && dstModule.modType >= MODULE_SC88)
+		{
+			if (! (scanRes.details.fmGS & (1 << FMBGS_SC_RESET)))
+				resetOff = false;	// enforce SC-88 reset when missing
+		}
+		if (resetOff)
+			plrOpts.flags &= ~PLROPTS_RESET;
+	}
+	
+	portCnt = scanRes.numPorts;
+	if (! dstModule.chnMask.empty())
+		portCnt *= dstModule.chnMask.size();
+	midPlay.SetDstModuleType(dstModule.modType, false);
+	midPlay.SetOutputPorts(std::vector<MIDIOUT_PORT*>(portCnt, NULL), &dstModule);
+	midPlay.SetOptions(plrOpts);
+	midPlay.SetMidiFile(&cMidi);
+	
+	midPlay.SetRenderOutput(&outMidi);
+	midPlay.AdvanceManualTiming(0, 0);
+	retVal = midPlay.Start();
+	if (! retVal)
+	{
+		time = 0;
+		while(midPlay.GetState() & 0x01)
+		{
+			time += 1000000;	// 1 ms steps
+			midPlay.AdvanceManualTiming(time, 0);
+			midPlay.DoPlaybackStep();
+		}
+		midPlay.Stop();
+	}
+	midPlay.SetRenderOutput(NULL);
+	if (retVal)
+		return retVal;
+	
+	return outMidi.SaveFile(job.outFile.c_str());
+}
+
+static void ConvertThread(void* args)
+{
+	MidiPlayer midPlay;	// each thread uses its own player instance
+	size_t curInsBnk;
+	
+	(void)args;
+	for (curInsBnk = 0; curInsBnk < insSetFiles.size(); curInsBnk ++)
+		midPlay.SetInstrumentBank(insSetFiles[curInsBnk].setType, &insBanks[curInsBnk]);
+	midPlay.AdvanceManualTiming(1, -1);
+	
+	while(true)
+	{
+		size_t jobID;
+		
+		// fetch the next song from the queue, so that fast threads take over work from slow ones
+		OSMutex_Lock(hJobMutex);
+		jobID = nextJob;
+		if (nextJob < jobList.size())
+			nextJob ++;
+		OSMutex_Unlock(hJobMutex);
+		if (jobID >= jobList.size())
+			break;
+		
+		ConvertJob& job = jobList[jobID];
+		job.result = ConvertSong(midPlay, job);
+		
+		OSMutex_Lock(hJobMutex);
+		jobsDone ++;
+		if (job.result)
+			printf("[%u/%u] Error 0x%02X converting %s\n", (unsigned)jobsDone, (unsigned)jobList.size(),
+				job.result, job.inFile.c_str());
+		else
+			printf("[%u/%u] %s -> %s\n", (unsigned)jobsDone, (unsigned)jobList.size(),
+				job.inFile.c_str(), job.outFile.c_str());
+		OSMutex_Unlock(hJobMutex);
+	}
+	
+	return;
+}
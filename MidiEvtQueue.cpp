@@ -0,0 +1,125 @@
+#include <string.h>
+#include <vector>
+#include <atomic>
+
+#include <stdtype.h>
+#include "MidiEvtQueue.hpp"
+
+
+MidiEvtQueue::MidiEvtQueue(UINT32 evtCount, UINT32 dataSize) :
+	_evtRdIdx(0),
+	_evtWrIdx(0),
+	_dataRdPos(0),
+	_dataWrPos(0)
+{
+	UINT32 evtCap;
+	
+	evtCap = 1;
+	while(evtCap < evtCount)
+		evtCap <<= 1;
+	_events.resize(evtCap);
+	_evtMask = evtCap - 1;
+	_data.resize(dataSize);
+}
+
+UINT32 MidiEvtQueue::GetCapacity(void) const
+{
+	return (UINT32)_events.size();
+}
+
+bool MidiEvtQueue::Push(UINT64 time, UINT8 flag, UINT32 dataLen, const void* data)
+{
+	UINT32 wrIdx = _evtWrIdx.load(std::memory_order_relaxed);
+	UINT32 rdIdx = _evtRdIdx.load(std::memory_order_acquire);
+	UINT32 dataOfs = 0;
+	
+	if (wrIdx - rdIdx >= _events.size())
+		return false;
+	if (dataLen > sizeof(MidiQueueEvt::data))
+	{
+		// The data is always stored in one piece, so we may skip the end of the buffer.
+		// free space: [wrPos .. end) + [0 .. rdPos) OR [wrPos .. rdPos)
+		// wrPos == rdPos means "empty", so the data must never fill the space completely.
+		UINT32 dataRd = _dataRdPos.load(std::memory_order_acquire);
+		if (_dataWrPos >= dataRd)
+		{
+			if (_data.size() - _dataWrPos >= dataLen)
+				dataOfs = _dataWrPos;
+			else if (dataRd > dataLen)
+				dataOfs = 0;
+			else
+				return false;
+		}
+		else
+		{
+			if (dataRd - _dataWrPos > dataLen)
+				dataOfs = _dataWrPos;
+			else
+				return false;
+		}
+		memcpy(&_data[dataOfs], data, dataLen);
+		_dataWrPos = dataOfs + dataLen;
+	}
+	
+	MidiQueueEvt& evt = _events[wrIdx & _evtMask];
+	evt.time = time;
+	evt.flag = flag;
+	memset(evt.data, 0x00, sizeof(evt.data));
+	if (dataLen > 0)
+		memcpy(evt.data, data, (dataLen < sizeof(evt.data)) ? dataLen : sizeof(evt.data));
+	evt.dataLen = dataLen;
+	evt.dataOfs = dataOfs;
+	_evtWrIdx.store(wrIdx + 1, std::memory_order_release);
+	
+	return true;
+}
+
+bool MidiEvtQueue::IsEmpty(void) const
+{
+	return _evtRdIdx.load(std::memory_order_relaxed) == _evtWrIdx.load(std::memory_order_acquire);
+}
+
+UINT32 MidiEvtQueue::GetCount(void) const
+{
+	return _evtWrIdx.load(std::memory_order_acquire) - _evtRdIdx.load(std::memory_order_relaxed);
+}
+
+MidiQueueEvt& MidiEvtQueue::Front(void)
+{
+	return _events[_evtRdIdx.load(std::memory_order_relaxed) & _evtMask];
+}
+
+const UINT8* MidiEvtQueue::GetData(const MidiQueueEvt& evt) const
+{
+	if (evt.dataLen > sizeof(evt.data))
+		return &_data[evt.dataOfs];
+	else
+		return evt.data;
+}
+
+void MidiEvtQueue::Pop(void)
+{
+	UINT32 rdIdx = _evtRdIdx.load(std::memory_order_relaxed);
+	const MidiQueueEvt& evt = _events[rdIdx & _evtMask];
+	
+	if (evt.dataLen > sizeof(evt.data))
+		_dataRdPos.store(evt.dataOfs + evt.dataLen, std::memory_order_release);
+	_evtRdIdx.store(rdIdx + 1, std::memory_order_release);
+	
+	return;
+}
+
+MidiQueueEvt& MidiEvtQueue::GetEvent(UINT32 idx)
+{
+	return _events[(_evtRdIdx.load(std::memory_order_relaxed) + idx) & _evtMask];
+}
+
+void MidiEvtQueue::Clear(void)
+{
+	_evtRdIdx.store(0);
+	_evtWrIdx.store(0);
+	_dataRdPos.store(0);
+	_dataWrPos = 0;
+	
+	return;
+}
@@ -0,0 +1,54 @@
+#ifndef __MIDI_EVT_QUEUE_HPP__
+#define __MIDI_EVT_QUEUE_HPP__
+
+#include <stdtype.h>
+#include <vector>
+#include <atomic>
+
+struct MidiQueueEvt
+{
+	UINT64 time;
+	UINT8 flag;
+	UINT8 data[3];	// short messages are stored here, for SysEx it contains the first bytes
+	UINT32 dataLen;
+	UINT32 dataOfs;	// offset of the SysEx data in the data buffer
+};
+
+// Fixed-size queue for delayed MIDI events.
+// Short messages are stored inline, SysEx data goes into a separate ring buffer,
+// so that adding events never allocates memory.
+// It can be used by one producer thread (Push) and one consumer thread (Front/Pop) at the same time.
+class MidiEvtQueue
+{
+public:
+	MidiEvtQueue(UINT32 evtCount, UINT32 dataSize);	// evtCount is rounded up to a power of 2
+	
+	UINT32 GetCapacity(void) const;
+	
+	// --- producer ---
+	// returns false if there is not enough space
+	bool Push(UINT64 time, UINT8 flag, UINT32 dataLen, const void* data);
+	
+	// --- consumer ---
+	bool IsEmpty(void) const;
+	UINT32 GetCount(void) const;
+	MidiQueueEvt& Front(void);
+	const UINT8* GetData(const MidiQueueEvt& evt) const;
+	void Pop(void);
+	// Access to all queued events for reordering. SysEx events must keep their relative order.
+	MidiQueueEvt& GetEvent(UINT32 idx);	// idx 0 = front
+	
+	void Clear(void);	// Note: Neither side may access the queue while clearing.
+	
+private:
+	std::vector<MidiQueueEvt> _events;
+	UINT32 _evtMask;
+	std::atomic<UINT32> _evtRdIdx;	// free-running indices, (wrIdx - rdIdx) = number of events
+	std::atomic<UINT32> _evtWrIdx;
+	
+	std::vector<UINT8> _data;
+	std::atomic<UINT32> _dataRdPos;	// end of the last SysEx data that was popped
+	UINT32 _dataWrPos;	// used only by the producer
+};
+
+#endif	// __MIDI_EVT_QUEUE_HPP__
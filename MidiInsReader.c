@@ -2,6 +2,8 @@
 #include <stdlib.h>
 #include <string.h>
 #include <ctype.h>	// for isspace()
+#include <sys/types.h>
+#include <sys/stat.h>	// for stat()
 
 #include <stdtype.h>
 #include "MidiInsReader.h"
@@ -44,6 +46,39 @@ N 001 000 017 036 000 MONDO K
 #define INSCOL_KEY	3	// key/note
 #define INSCOL_GRA	4	// layout ID
 
+/*
+Instrument cache file format (all values are Little Endian):
+Pos	Len	Description
+000	04	signature "INSC"
+004	04	format version
+008	08	size of the .ins file
+010	08	modification time of the .ins file
+018	01	module type
+019	01	maximum Bank MSB
+01A	01	maximum Bank LSB
+01B	01	maximum drum kit
+01C	04	size of the string pool
+020	400	number of instruments of program 00..FF (4 bytes each)
+420	...	instruments of all programs, 8 bytes each:
+	00	01	Bank MSB
+	01	01	Bank LSB
+	02	01	program
+	03	01	module ID
+	04	04	offset of the name in the string pool
+...	...	bank index of all programs, 4 bytes per instrument
+...	...	string pool (null-terminated instrument names)
+*/
+#define INSCACHE_SIG		"INSC"
+#define INSCACHE_VER		0x01
+#define INSCACHE_HDR_SIZE	0x420
+#define INSCACHE_INS_SIZE	0x08
+
+static UINT8 LoadInstrumentText(const char* fileName, INS_BANK* insBank);
+static char* GetCacheFileName(const char* fileName);
+static UINT8 LoadInstrumentCache(const char* fileName, UINT64 srcSize, UINT64 srcTime, INS_BANK* insBank);
+static UINT8 WriteInstrumentCache(const char* fileName, UINT64 srcSize, UINT64 srcTime, const INS_BANK* insBank);
+static UINT32 GetBankKey(const INS_DATA* insData);
+
 static void RemoveNewLines(char* str)
 {
 	char* strPtr;
@@ -159,6 +194,31 @@ static void AddInstrument(INS_BANK* insBank, const INS_DATA* newIns, UINT8 drumM
 }
 
 UINT8 LoadInstrumentList(const char* fileName, INS_BANK* insBank)
+{
+	struct stat insStat;
+	char* cacheName;
+	UINT8 retVal;
+	
+	memset(insBank, 0x00, sizeof(INS_BANK));
+	if (stat(fileName, &insStat))
+		return 0xFF;
+	
+	cacheName = GetCacheFileName(fileName);
+	if (cacheName == NULL)
+		return LoadInstrumentText(fileName, insBank);
+	retVal = LoadInstrumentCache(cacheName, (UINT64)insStat.st_size, (UINT64)insStat.st_mtime, insBank);
+	if (retVal)
+	{
+		retVal = LoadInstrumentText(fileName, insBank);
+		if (! retVal)
+			WriteInstrumentCache(cacheName, (UINT64)insStat.st_size, (UINT64)insStat.st_mtime, insBank);	// the cache is optional, so errors are ignored
+	}
+	free(cacheName);
+	
+	return retVal;
+}
+
+static UINT8 LoadInstrumentText(const char* fileName, INS_BANK* insBank)
 {
 	FILE* hFile;
 	UINT32 insAlloc;
@@ -236,17 +296,21 @@ UINT8 LoadInstrumentList(const char* fileName, INS_BANK* insBank)
 	}
 	
 	fclose(hFile);
+	BuildInstrumentIndex(insBank);
 	
 	return 0x00;
 }
 
-static void FreeInstrumentList(UINT32 insCount, INS_DATA* insList)
+static void FreeInstrumentList(UINT32 insCount, INS_DATA* insList, const UINT8* cacheData, UINT32 cacheSize)
 {
 	UINT32 curIns;
 	
 	for (curIns = 0; curIns < insCount; curIns ++)
 	{
-		free(insList[curIns].insName);
+		const UINT8* namePtr = (const UINT8*)insList[curIns].insName;
+		// names from the cache file are freed together with the cache data
+		if (namePtr < cacheData || namePtr >= cacheData + cacheSize)
+			free(insList[curIns].insName);
 	}
 	free(insList);
 	
@@ -261,10 +325,13 @@ void FreeInstrumentBank(INS_BANK* insBank)
 	for (curPrg = 0x00; curPrg < 0x100; curPrg ++)
 	{
 		tempPrg = &insBank->prg[curPrg];
-		FreeInstrumentList(tempPrg->count, tempPrg->instruments);
+		FreeInstrumentList(tempPrg->count, tempPrg->instruments, insBank->cacheData, insBank->cacheSize);
 		tempPrg->instruments = NULL;
 		tempPrg->alloc = tempPrg->count = 0;
+		free(tempPrg->bankIdx);	tempPrg->bankIdx = NULL;
 	}
+	free(insBank->cacheData);	insBank->cacheData = NULL;
+	insBank->cacheSize = 0;
 	
 	return;
 }
@@ -289,6 +356,7 @@ void PatchInstrumentBank(INS_BANK* insBank, UINT8 flags, UINT8 msb, UINT8 lsb)
 				insData->bankLSB = lsb;
 		}
 	}
+	BuildInstrumentIndex(insBank);
 	
 	return;
 }
@@ -360,7 +428,11 @@ void CopyInstrumentBank(INS_BANK* dest, const INS_BANK* source, UINT8 moduleID)
 		dstPrg->alloc = CountFilteredIns(srcPrg->count, srcPrg->instruments, moduleID);
 		dstPrg->instruments = (INS_DATA*)malloc(dstPrg->alloc * sizeof(INS_DATA));
 		dstPrg->count = CopyFilteredInsList(dstPrg->alloc, dstPrg->instruments, srcPrg->count, srcPrg->instruments, moduleID);
+		dstPrg->bankIdx = NULL;
 	}
+	dest->cacheData = NULL;	// all names were copied
+	dest->cacheSize = 0;
+	BuildInstrumentIndex(dest);
 	
 	return;
 }
@@ -414,6 +486,395 @@ void MergeInstrumentBanks(INS_BANK* dest, const INS_BANK* source)
 		dstPrg->instruments = (INS_DATA*)realloc(dstPrg->instruments, dstPrg->alloc * sizeof(INS_DATA));
 		dstPrg->count = MergeInsList(dstPrg->alloc, dstPrg->count, dstPrg->instruments, srcPrg->count, srcPrg->instruments);
 	}
+	BuildInstrumentIndex(dest);
+	
+	return;
+}
+
+static UINT32 GetBankKey(const INS_DATA* insData)
+{
+	return ((UINT32)insData->bankMSB << 8) | (insData->bankLSB << 0);
+}
+
+static int Compare_UINT64(const void* p1, const void* p2)
+{
+	UINT64 v1 = *(const UINT64*)p1;
+	UINT64 v2 = *(const UINT64*)p2;
+	
+	return (v1 < v2) ? -1 : ((v1 > v2) ? +1 : 0);
+}
+
+void BuildInstrumentIndex(INS_BANK* insBank)
+{
+	UINT16 curPrg;
+	UINT32 curIns;
+	UINT64* sortKeys;
+	UINT32 keyAlloc;
+	
+	keyAlloc = 0;
+	sortKeys = NULL;
+	for (curPrg = 0x00; curPrg < 0x100; curPrg ++)
+	{
+		INS_PRG_LST* tempPrg = &insBank->prg[curPrg];
+		
+		free(tempPrg->bankIdx);	tempPrg->bankIdx = NULL;
+		if (! tempPrg->count)
+			continue;
+		
+		if (keyAlloc < tempPrg->count)
+		{
+			keyAlloc = tempPrg->count;
+			sortKeys = (UINT64*)realloc(sortKeys, keyAlloc * sizeof(UINT64));
+		}
+		// sort key: bank in the upper 32 bits, list index in the lower 32 bits
+		// This keeps instruments with the same bank in list order.
+		for (curIns = 0; curIns < tempPrg->count; curIns ++)
+			sortKeys[curIns] = ((UINT64)GetBankKey(&tempPrg->instruments[curIns]) << 32) | curIns;
+		qsort(sortKeys, tempPrg->count, sizeof(UINT64), &Compare_UINT64);
+		
+		tempPrg->bankIdx = (UINT32*)malloc(tempPrg->count * sizeof(UINT32));
+		for (curIns = 0; curIns < tempPrg->count; curIns ++)
+			tempPrg->bankIdx[curIns] = (UINT32)(sortKeys[curIns] & 0xFFFFFFFF);
+	}
+	free(sortKeys);
+	
+	return;
+}
+
+static UINT32 FindBankKey(const INS_PRG_LST* insPrg, UINT32 bankKey)
+{
+	// returns the first position in the index whose instrument has a bank >= bankKey
+	UINT32 posStart;
+	UINT32 posEnd;
+	
+	posStart = 0;
+	posEnd = insPrg->count;
+	while(posStart < posEnd)
+	{
+		UINT32 posMid = posStart + (posEnd - posStart) / 2;
+		if (GetBankKey(&insPrg->instruments[insPrg->bankIdx[posMid]]) < bankKey)
+			posStart = posMid + 1;
+		else
+			posEnd = posMid;
+	}
+	
+	return posStart;
+}
+
+UINT32 GetInsBankEntries(const INS_PRG_LST* insPrg, UINT8 msb, UINT8 lsb, const UINT32** idxList)
+{
+	UINT32 bankKey;
+	UINT32 posStart;
+	UINT32 posEnd;
 	
+	if (insPrg->bankIdx == NULL)
+	{
+		*idxList = NULL;
+		return 0;
+	}
+	if (msb == 0xFF)
+	{
+		*idxList = insPrg->bankIdx;
+		return insPrg->count;
+	}
+	
+	bankKey = (UINT32)msb << 8;
+	if (lsb == 0xFF)
+	{
+		posStart = FindBankKey(insPrg, bankKey);
+		posEnd = FindBankKey(insPrg, bankKey + 0x100);
+	}
+	else
+	{
+		posStart = FindBankKey(insPrg, bankKey | lsb);
+		posEnd = FindBankKey(insPrg, (bankKey | lsb) + 1);
+	}
+	*idxList = &insPrg->bankIdx[posStart];
+	return posEnd - posStart;
+}
+
+
+static char* GetCacheFileName(const char* fileName)
+{
+	size_t nameLen = strlen(fileName);
+	char* cacheName = (char*)malloc(nameLen + 2);
+	
+	if (cacheName == NULL)
+		return NULL;
+	memcpy(cacheName, fileName, nameLen);
+	cacheName[nameLen + 0] = 'c';	// "gs.ins" -> "gs.insc"
+	cacheName[nameLen + 1] = '\0';
+	return cacheName;
+}
+
+static UINT32 ReadLE32(const UINT8* data)
+{
+	return	(data[0x00] <<  0) | (data[0x01] <<  8) |
+			(data[0x02] << 16) | ((UINT32)data[0x03] << 24);
+}
+
+static UINT64 ReadLE64(const UINT8* data)
+{
+	return ((UINT64)ReadLE32(&data[0x04]) << 32) | ReadLE32(&data[0x00]);
+}
+
+static void WriteLE32(UINT8* buffer, UINT32 value)
+{
+	buffer[0x00] = (value >>  0) & 0xFF;
+	buffer[0x01] = (value >>  8) & 0xFF;
+	buffer[0x02] = (value >> 16) & 0xFF;
+	buffer[0x03] = (value >> 24) & 0xFF;
+	return;
+}
+
+static void WriteLE64(UINT8* buffer, UINT64 value)
+{
+	WriteLE32(&buffer[0x00], (UINT32)(value >>  0));
+	WriteLE32(&buffer[0x04], (UINT32)(value >> 32));
 	return;
 }
+
+static UINT8 ReadCachedPrograms(INS_BANK* insBank, const UINT8* data, UINT32 insPos, UINT32 idxPos, UINT32 poolPos, UINT32 poolSize)
+{
+	UINT16 curPrg;
+	UINT32 curIns;
+	
+	for (curPrg = 0x00; curPrg < 0x100; curPrg ++)
+	{
+		INS_PRG_LST* tempPrg = &insBank->prg[curPrg];
+		UINT32 insCount = ReadLE32(&data[0x20 + curPrg * 0x04]);
+		
+		if (! insCount)
+			continue;
+		tempPrg->instruments = (INS_DATA*)malloc(insCount * sizeof(INS_DATA));
+		tempPrg->bankIdx = (UINT32*)malloc(insCount * sizeof(UINT32));
+		if (tempPrg->instruments == NULL || tempPrg->bankIdx == NULL)
+			return 0xFF;
+		tempPrg->alloc = insCount;
+		// The count is increased only for entries with valid names,
+		// so that FreeInstrumentBank() never sees uninitialized name pointers.
+		tempPrg->count = 0;
+		for (curIns = 0; curIns < insCount; curIns ++, insPos += INSCACHE_INS_SIZE)
+		{
+			INS_DATA* insData = &tempPrg->instruments[curIns];
+			UINT32 nameOfs = ReadLE32(&data[insPos + 0x04]);
+			
+			insData->bankMSB = data[insPos + 0x00];
+			insData->bankLSB = data[insPos + 0x01];
+			insData->program = data[insPos + 0x02];
+			insData->moduleID = data[insPos + 0x03];
+			if (nameOfs >= poolSize)
+				return 0x80;	// invalid name offset
+			insData->insName = (char*)&data[poolPos + nameOfs];
+			tempPrg->count ++;
+		}
+		for (curIns = 0; curIns < insCount; curIns ++, idxPos += 0x04)
+		{
+			tempPrg->bankIdx[curIns] = ReadLE32(&data[idxPos]);
+			if (tempPrg->bankIdx[curIns] >= insCount)
+				return 0x81;	// invalid index entry
+		}
+		for (curIns = 1; curIns < insCount; curIns ++)
+		{
+			const INS_DATA* insPrev = &tempPrg->instruments[tempPrg->bankIdx[curIns - 1]];
+			const INS_DATA* insCur = &tempPrg->instruments[tempPrg->bankIdx[curIns]];
+			if (GetBankKey(insPrev) > GetBankKey(insCur))
+				return 0x81;	// index not sorted
+		}
+	}
+	
+	return 0x00;
+}
+
+static UINT8 LoadInstrumentCache(const char* fileName, UINT64 srcSize, UINT64 srcTime, INS_BANK* insBank)
+{
+	FILE* hFile;
+	UINT8* data;
+	UINT32 fileSize;
+	UINT32 readBytes;
+	UINT16 curPrg;
+	UINT64 insTotal;
+	UINT32 insPos;
+	UINT32 idxPos;
+	UINT32 poolPos;
+	UINT32 poolSize;
+	UINT8 retVal;
+	
+	hFile = fopen(fileName, "rb");
+	if (hFile == NULL)
+		return 0xFF;
+	
+	fseek(hFile, 0, SEEK_END);
+	fileSize = (UINT32)ftell(hFile);
+	fseek(hFile, 0, SEEK_SET);
+	if (fileSize < INSCACHE_HDR_SIZE)
+	{
+		fclose(hFile);
+		return 0x80;	// file too small
+	}
+	// The whole file is read at once and kept in memory, so that the instrument names can stay in the string pool.
+	data = (UINT8*)malloc(fileSize);
+	if (data == NULL)
+	{
+		fclose(hFile);
+		return 0xFF;
+	}
+	readBytes = (UINT32)fread(data, 0x01, fileSize, hFile);
+	fclose(hFile);
+	if (readBytes < fileSize)
+	{
+		free(data);
+		return 0xFF;
+	}
+	
+	if (memcmp(&data[0x00], INSCACHE_SIG, 4) || ReadLE32(&data[0x04]) != INSCACHE_VER)
+	{
+		free(data);
+		return 0x80;	// unknown file format
+	}
+	if (ReadLE64(&data[0x08]) != srcSize || ReadLE64(&data[0x10]) != srcTime)
+	{
+		free(data);
+		return 0x01;	// .ins file was modified
+	}
+	
+	insTotal = 0;
+	for (curPrg = 0x00; curPrg < 0x100; curPrg ++)
+		insTotal += ReadLE32(&data[0x20 + curPrg * 0x04]);
+	poolSize = ReadLE32(&data[0x1C]);
+	if (INSCACHE_HDR_SIZE + insTotal * (INSCACHE_INS_SIZE + 0x04) + poolSize != fileSize ||
+		(poolSize > 0 && data[fileSize - 1] != '\0'))
+	{
+		free(data);
+		return 0x80;	// sizes don't match (truncated file)
+	}
+	insPos = INSCACHE_HDR_SIZE;
+	idxPos = insPos + (UINT32)insTotal * INSCACHE_INS_SIZE;
+	poolPos = idxPos + (UINT32)insTotal * 0x04;
+	
+	insBank->moduleType = data[0x18];
+	insBank->maxBankMSB = data[0x19];
+	insBank->maxBankLSB = data[0x1A];
+	insBank->maxDrumKit = data[0x1B];
+	insBank->cacheData = data;
+	insBank->cacheSize = fileSize;
+	retVal = ReadCachedPrograms(insBank, data, insPos, idxPos, poolPos, poolSize);
+	if (retVal)
+	{
+		FreeInstrumentBank(insBank);
+		memset(insBank, 0x00, sizeof(INS_BANK));
+		return retVal;
+	}
+	
+	return 0x00;
+}
+
+static UINT8 WriteInstrumentCache(const char* fileName, UINT64 srcSize, UINT64 srcTime, const INS_BANK* insBank)
+{
+	FILE* hFile;
+	char* tmpName;
+	UINT8* data;
+	UINT32 fileSize;
+	UINT32 writtenBytes;
+	UINT16 curPrg;
+	UINT32 curIns;
+	UINT32 insTotal;
+	UINT32 insPos;
+	UINT32 idxPos;
+	UINT32 poolStart;
+	UINT32 poolPos;
+	UINT32 poolSize;
+	
+	insTotal = 0;
+	poolSize = 0;
+	for (curPrg = 0x00; curPrg < 0x100; curPrg ++)
+	{
+		const INS_PRG_LST* tempPrg = &insBank->prg[curPrg];
+		
+		if (tempPrg->count && tempPrg->bankIdx == NULL)
+			return 0xFE;	// the index is required
+		insTotal += tempPrg->count;
+		for (curIns = 0; curIns < tempPrg->count; curIns ++)
+			poolSize += (UINT32)strlen(tempPrg->instruments[curIns].insName) + 1;
+	}
+	fileSize = INSCACHE_HDR_SIZE + insTotal * (INSCACHE_INS_SIZE + 0x04) + poolSize;
+	data = (UINT8*)calloc(fileSize, 0x01);
+	if (data == NULL)
+		return 0xFF;
+	
+	memcpy(&data[0x00], INSCACHE_SIG, 4);
+	WriteLE32(&data[0x04], INSCACHE_VER);
+	WriteLE64(&data[0x08], srcSize);
+	WriteLE64(&data[0x10], srcTime);
+	data[0x18] = insBank->moduleType;
+	data[0x19] = insBank->maxBankMSB;
+	data[0x1A] = insBank->maxBankLSB;
+	data[0x1B] = insBank->maxDrumKit;
+	WriteLE32(&data[0x1C], poolSize);
+	
+	insPos = INSCACHE_HDR_SIZE;
+	idxPos = insPos + insTotal * INSCACHE_INS_SIZE;
+	poolStart = idxPos + insTotal * 0x04;
+	poolPos = poolStart;
+	for (curPrg = 0x00; curPrg < 0x100; curPrg ++)
+	{
+		const INS_PRG_LST* tempPrg = &insBank->prg[curPrg];
+		
+		WriteLE32(&data[0x20 + curPrg * 0x04], tempPrg->count);
+		for (curIns = 0; curIns < tempPrg->count; curIns ++, insPos += INSCACHE_INS_SIZE)
+		{
+			const INS_DATA* insData = &tempPrg->instruments[curIns];
+			size_t nameSize = strlen(insData->insName) + 1;
+			
+			data[insPos + 0x00] = insData->bankMSB;
+			data[insPos + 0x01] = insData->bankLSB;
+			data[insPos + 0x02] = insData->program;
+			data[insPos + 0x03] = insData->moduleID;
+			WriteLE32(&data[insPos + 0x04], poolPos - poolStart);
+			memcpy(&data[poolPos], insData->insName, nameSize);
+			poolPos += (UINT32)nameSize;
+		}
+		for (curIns = 0; curIns < tempPrg->count; curIns ++, idxPos += 0x04)
+			WriteLE32(&data[idxPos], tempPrg->bankIdx[curIns]);
+	}
+	
+	// The data is written to a temporary file that replaces the cache only when complete,
+	// so that an interrupted write can't leave a truncated cache file.
+	tmpName = (char*)malloc(strlen(fileName) + 5);
+	if (tmpName == NULL)
+	{
+		free(data);
+		return 0xFF;
+	}
+	strcpy(tmpName, fileName);
+	strcat(tmpName, ".tmp");
+	hFile = fopen(tmpName, "wb");
+	if (hFile == NULL)
+	{
+		free(tmpName);
+		free(data);
+		return 0xFF;
+	}
+	writtenBytes = (UINT32)fwrite(data, 0x01, fileSize, hFile);
+	if (fclose(hFile))
+		writtenBytes = 0;
+	free(data);
+	if (writtenBytes < fileSize)
+	{
+		remove(tmpName);
+		free(tmpName);
+		return 0xFF;
+	}
+#ifdef _WIN32
+	remove(fileName);	// rename() doesn't overwrite existing files on Windows
+#endif
+	if (rename(tmpName, fileName))
+	{
+		remove(tmpName);
+		free(tmpName);
+		return 0xFF;
+	}
+	free(tmpName);
+	
+	return 0x00;
+}
@@ -23,6 +23,7 @@ typedef struct
 	UINT32 alloc;
 	UINT32 count;
 	INS_DATA* instruments;
+	UINT32* bankIdx;	// indices into "instruments", sorted by bank MSB, bank LSB and index
 } INS_PRG_LST;
 typedef struct
 {
@@ -31,6 +32,8 @@ typedef struct
 	UINT8 maxBankLSB;
 	UINT8 maxDrumKit;
 	INS_PRG_LST prg[0x100];	// program IDs: 00..7F - melody instruments, 80-FF - drum instruments
+	UINT8* cacheData;	// contents of the cache file the bank was loaded from (instrument names point into it)
+	UINT32 cacheSize;
 } INS_BANK;
 
 
@@ -98,6 +101,8 @@ typedef struct
 #define MODULE_CM64		(MODULE_TYPE_LA | MTLA_CM64)
 
 
+// The parsed list is stored in a binary cache file next to the .ins file (fileName + "c").
+// It is used instead of the text file as long as the size and modification time of the .ins file match.
 UINT8 LoadInstrumentList(const char* fileName, INS_BANK* insBank);
 void FreeInstrumentBank(INS_BANK* insBank);
 
@@ -108,6 +113,12 @@ void PatchInstrumentBank(INS_BANK* insBank, UINT8 flags, UINT8 msb, UINT8 lsb);
 // moduleID: copy only instruments of a specific module (0xFF - copy everything)
 void CopyInstrumentBank(INS_BANK* dest, const INS_BANK* source, UINT8 moduleID);
 void MergeInstrumentBanks(INS_BANK* dest, const INS_BANK* source);
+// (re)builds the bank index of all programs, the functions above do this automatically
+void BuildInstrumentIndex(INS_BANK* insBank);
+// Returns the number of instruments with a specific bank MSB/LSB (0xFF = any LSB) using the bank index.
+// idxList receives a pointer to their indices. When there are multiple LSBs, the indices are not in list order.
+// msb = 0xFF returns all instruments, the caller has to check the LSB then.
+UINT32 GetInsBankEntries(const INS_PRG_LST* insPrg, UINT8 msb, UINT8 lsb, const UINT32** idxList);
 
 
 #ifdef __cplusplus
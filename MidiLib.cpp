@@ -9,89 +9,174 @@
 
 #include <stdtype.h>
 #include "MidiLib.hpp"
+#include "OSThread.h"
 
 
 #define FCC_MTHD	0x6468544D	// 'MThd'
 #define FCC_MTRK	0x6B72544D	// 'MTrk'
 
+#define EVTPOOL_BLK_SIZE	0x4000	// size of a data pool block for SysEx/Meta events
 
-static UINT16 ReadBE16(FILE* infile);
-static UINT32 ReadBE32(FILE* infile);
-static UINT32 ReadMidiValue(FILE* infile);
+#define TRKLOAD_MAX_THREADS	4		// maximum number of threads for decoding tracks
+#define TRKLOAD_MIN_PARALLEL	0x10000	// minimum amount of track data for using multiple threads
+
+struct TRK_LOAD_TASK
+{
+	UINT32 dataLen;
+	const UINT8* data;
+	MidiTrack* trk;
+	UINT8 retVal;
+};
+struct TRK_LOAD_WORKER
+{
+	std::vector<TRK_LOAD_TASK>* tasks;
+	size_t startIdx;	// worker N decodes tracks N, N+step, N+2*step, ...
+	size_t stepSize;
+};
+
+
+static UINT16 ReadBE16(const UINT8* data);
+static UINT32 ReadBE32(const UINT8* data);
+static UINT8 ReadMidiValue(UINT32 dataLen, const UINT8* data, UINT32* pos, UINT32* retValue);
 static void WriteBE16(FILE* outfile, UINT16 Value);
 static void WriteBE32(FILE* outfile, UINT32 Value);
 static void WriteMidiValue(FILE* outfile, UINT32 Value);
+static bool EventTickLess(const MidiEvent& evt, UINT32 tick);
+static void LoadTrack_Decode(TRK_LOAD_TASK* tlt);
+static void LoadTrack_WorkerThread(void* args);
 
 
 // --- MidiTrack Class ---
 MidiTrack::MidiTrack(void)
 {
+	_dataBlkPos = EVTPOOL_BLK_SIZE;
+	
 	return;
 }
 
 MidiTrack::~MidiTrack()
 {
+	FreeEventData();
+	
 	return;
 }
 
-UINT8 MidiTrack::ReadFromFile(FILE* infile)
+UINT8* MidiTrack::AllocEventData(UINT32 dataLen)
 {
-	UINT32 TempLng;
+	UINT8* dataPtr;
+	
+	if (! dataLen)
+		return NULL;
+	
+	if (dataLen > EVTPOOL_BLK_SIZE / 4)
+	{
+		// large data gets its own block, so that the current block can still be filled
+		dataPtr = new UINT8[dataLen];
+		if (_dataBlkPos < EVTPOOL_BLK_SIZE)
+			_dataBlocks.insert(_dataBlocks.end() - 1, dataPtr);
+		else
+			_dataBlocks.push_back(dataPtr);
+		return dataPtr;
+	}
+	
+	if (_dataBlkPos + dataLen > EVTPOOL_BLK_SIZE)
+	{
+		_dataBlocks.push_back(new UINT8[EVTPOOL_BLK_SIZE]);
+		_dataBlkPos = 0;
+	}
+	dataPtr = _dataBlocks.back() + _dataBlkPos;
+	_dataBlkPos += dataLen;
+	
+	return dataPtr;
+}
+
+void MidiTrack::StoreEventData(MidiEvent& evt)
+{
+	// copy the event's data into the pool of this track
+	UINT8* dataPtr = AllocEventData(evt.evtData.len);
+	if (dataPtr != NULL)
+		memcpy(dataPtr, evt.evtData.ptr, evt.evtData.len);
+	evt.evtData.ptr = dataPtr;
+	
+	return;
+}
+
+void MidiTrack::FreeEventData(void)
+{
+	std::vector<UINT8*>::iterator blkIt;
+	
+	for (blkIt = _dataBlocks.begin(); blkIt != _dataBlocks.end(); ++blkIt)
+		delete[] *blkIt;
+	_dataBlocks.clear();
+	_dataBlkPos = EVTPOOL_BLK_SIZE;
+	
+	return;
+}
+
+UINT8 MidiTrack::ReadFromData(UINT32 DataLen, const UINT8* Data, UINT32* RetChunkSize)
+{
+	UINT32 TrkLen;
 	UINT32 TrkPos;
 	UINT32 TrkEnd;
 	UINT8 LastEvt;
 	UINT8 CurEvt;
 	UINT8 EvtVal;
 	UINT32 CurTick;
+	UINT32 TempLng;
 	
-	fread(&TempLng, 0x04, 1, infile);
-	if (TempLng != FCC_MTRK)
+	if (DataLen < 0x08 || memcmp(&Data[0x00], "MTrk", 0x04))
 		return 0x10;
 	
-	TempLng = ReadBE32(infile);	// Read Track Length
-	TrkPos = (UINT32)ftell(infile);
-	TrkEnd = TrkPos + TempLng;
+	TrkLen = ReadBE32(&Data[0x04]);	// Read Track Length
+	if (RetChunkSize != NULL)
+		*RetChunkSize = (TrkLen <= 0xFFFFFFFF - 0x08) ? (0x08 + TrkLen) : 0xFFFFFFFF;
+	TrkPos = 0x08;
+	TrkEnd = (TrkLen <= DataLen - TrkPos) ? (TrkPos + TrkLen) : DataLen;	// ignore data beyond the end of the buffer
 	
 	_events.clear();
-	//_events.reserve(TempLng / 4);
+	FreeEventData();
+	_events.reserve(TrkLen / 4);
 	
 	LastEvt = 0x00;
 	CurTick = 0;
 	// read events
-	while(! feof(infile) && (UINT32)ftell(infile) < TrkEnd)
+	while(TrkPos < TrkEnd)
 	{
-		MidiEvent* newEvt;
-		bool rsUse;
+		MidiEvent newEvt;
+		bool evtEnd;
 		
-		CurTick += ReadMidiValue(infile);
-		if (feof(infile))
+		if (ReadMidiValue(TrkEnd, Data, &TrkPos, &TempLng))
+			break;
+		CurTick += TempLng;
+		if (TrkPos >= TrkEnd)
 			break;
 		
-		fread(&CurEvt, 0x01, 1, infile);
+		CurEvt = Data[TrkPos];	TrkPos ++;
 		if (CurEvt < 0x80)
 		{
 			if (LastEvt < 0x80 || LastEvt >= 0xF0)
 				return 0x01;
 			EvtVal = CurEvt;
 			CurEvt = LastEvt;
-			rsUse = true;
+			newEvt.rsUse = true;
 		}
 		else
 		{
 			if (CurEvt < 0xF0)
 			{
 				LastEvt = CurEvt;
-				fread(&EvtVal, 0x01, 1, infile);
+				if (TrkPos >= TrkEnd)
+					break;
+				EvtVal = Data[TrkPos];	TrkPos ++;
 			}
-			rsUse = false;
+			newEvt.rsUse = false;
 		}
 		
-		_events.push_back(MidiEvent());
-		newEvt = &_events.back();
-		
-		newEvt->tick = CurTick;
-		newEvt->rsUse = rsUse;
-		newEvt->evtType = CurEvt;
+		newEvt.tick = CurTick;
+		newEvt.evtType = CurEvt;
+		newEvt.evtValA = 0x00;
+		newEvt.evtValB = 0x00;
+		evtEnd = false;	// set when the event is cut off by the end of the track
 		switch(CurEvt & 0xF0)
 		{
 		case 0x80:
@@ -99,30 +184,53 @@ UINT8 MidiTrack::ReadFromFile(FILE* infile)
 		case 0xA0:
 		case 0xB0:
 		case 0xE0:
-			newEvt->evtValA = EvtVal;
-			fread(&newEvt->evtValB, 0x01, 1, infile);
+			newEvt.evtValA = EvtVal;
+			if (TrkPos >= TrkEnd)
+			{
+				evtEnd = true;
+				break;
+			}
+			newEvt.evtValB = Data[TrkPos];	TrkPos ++;
 			break;
 		case 0xC0:
 		case 0xD0:
-			newEvt->evtValA = EvtVal;
-			newEvt->evtValB = 0x00;
+			newEvt.evtValA = EvtVal;
 			break;
 		case 0xF0:
 			switch(CurEvt)
 			{
 			case 0xFF:
-				fread(&newEvt->evtValA, 0x01, 1, infile);
+				if (TrkPos >= TrkEnd)
+				{
+					evtEnd = true;
+					break;
+				}
+				newEvt.evtValA = Data[TrkPos];	TrkPos ++;
 				// fall through
 			case 0xF0:
 			case 0xF7:
-				newEvt->evtData.resize(ReadMidiValue(infile));
-				if (newEvt->evtData.size())
-					fread(&newEvt->evtData[0x00], 0x01, newEvt->evtData.size(), infile);
+				if (ReadMidiValue(TrkEnd, Data, &TrkPos, &TempLng))
+				{
+					evtEnd = true;
+					break;
+				}
+				if (TempLng > TrkEnd - TrkPos)
+					TempLng = TrkEnd - TrkPos;	// truncated event
+				if (TempLng)
+				{
+					UINT8* dataPtr = AllocEventData(TempLng);
+					memcpy(dataPtr, &Data[TrkPos], TempLng);
+					newEvt.evtData.ptr = dataPtr;
+					newEvt.evtData.len = TempLng;
+					TrkPos += TempLng;
+				}
 				break;
 			}
 		}
+		if (evtEnd)
+			break;
+		_events.push_back(newEvt);
 	}
-	fseek(infile, TrkEnd, SEEK_SET);
 	
 	return 0x00;
 }
@@ -254,18 +362,10 @@ midevt_iterator MidiTrack::GetEventEnd(void)
 
 midevt_iterator MidiTrack::GetEventFromTick(UINT32 tick)
 {
-	midevt_iterator evtIt;
-	
 	if (tick > GetTickCount())	//tick >= GetTickCount()
 		return _events.end();
 	
-	for (evtIt = _events.begin(); evtIt != _events.end(); ++evtIt)
-	{
-		if (evtIt->tick >= tick)
-			return evtIt;
-	}
-	
-	return _events.end();
+	return std::lower_bound(_events.begin(), _events.end(), tick, EventTickLess);
 }
 
 /*static*/ MidiEvent MidiTrack::CreateEvent_Std(UINT8 Event, UINT8 Val1, UINT8 Val2)
@@ -277,7 +377,7 @@ midevt_iterator MidiTrack::GetEventFromTick(UINT32 tick)
 	newEvt.evtType = Event;
 	newEvt.evtValA = Val1;
 	newEvt.evtValB = Val2;
-	newEvt.evtData.clear();
+	newEvt.evtData = MidiEvtData();
 	
 	return newEvt;
 }
@@ -291,9 +391,8 @@ midevt_iterator MidiTrack::GetEventFromTick(UINT32 tick)
 	newEvt.evtType = 0xF0;
 	newEvt.evtValA = 0x00;
 	newEvt.evtValB = 0x00;
-	newEvt.evtData.resize(DataLen);
-	if (DataLen)
-		memcpy(&newEvt.evtData[0x00], Data, DataLen);
+	newEvt.evtData.ptr = (const UINT8*)Data;
+	newEvt.evtData.len = DataLen;
 	
 	return newEvt;
 }
@@ -307,9 +406,8 @@ midevt_iterator MidiTrack::GetEventFromTick(UINT32 tick)
 	newEvt.evtType = 0xFF;
 	newEvt.evtValA = Type;
 	newEvt.evtValB = 0x00;
-	newEvt.evtData.resize(DataLen);
-	if (DataLen)
-		memcpy(&newEvt.evtData[0x00], Data, DataLen);
+	newEvt.evtData.ptr = (const UINT8*)Data;
+	newEvt.evtData.len = DataLen;
 	
 	return newEvt;
 }
@@ -320,6 +418,7 @@ void MidiTrack::AppendEvent(const MidiEvent& Event)
 		return;
 	
 	_events.push_back(Event);
+	StoreEventData(_events.back());
 	
 	return;
 }
@@ -359,7 +458,8 @@ void MidiTrack::InsertEventT(const MidiEvent& Event)
 	midevt_iterator evtIt;
 	
 	evtIt = GetFirstEventAtTick(Event.tick);
-	_events.insert(evtIt, Event);
+	evtIt = _events.insert(evtIt, Event);
+	StoreEventData(*evtIt);
 	
 	return;
 }
@@ -403,7 +503,7 @@ void MidiTrack::InsertEventD(midevt_iterator prevEvt, const MidiEvent& Event)
 		if (Event.tick >= GetTickCount())
 			AppendEvent(Event);
 		else if (! Event.tick)
-			_events.insert(_events.begin(), Event);
+			StoreEventData(*_events.insert(_events.begin(), Event));
 		return;
 	}
 	if (Event.tick < prevEvt->tick)
@@ -414,7 +514,8 @@ void MidiTrack::InsertEventD(midevt_iterator prevEvt, const MidiEvent& Event)
 	if (nextEvt != _events.end() && Event.tick > nextEvt->tick)
 		return;
 	
-	_events.insert(nextEvt, Event);
+	nextEvt = _events.insert(nextEvt, Event);
+	StoreEventData(*nextEvt);
 	
 	return;
 }
@@ -459,6 +560,7 @@ void MidiTrack::InsertMetaEventD(midevt_iterator prevEvt, UINT32 Delay, UINT8 Ty
 
 void MidiTrack::RemoveEvent(midevt_iterator evtIt)
 {
+	// Note: The event's data stays in the pool until the track is freed.
 	_events.erase(evtIt);
 	
 	return;
@@ -469,15 +571,7 @@ midevt_iterator MidiTrack::GetFirstEventAtTick(UINT32 tick)
 	if (tick > GetTickCount())
 		return _events.end();
 	
-	midevt_iterator evtIt;
-	
-	for (evtIt = _events.begin(); evtIt != _events.end(); ++evtIt)
-	{
-		if (evtIt->tick >= tick)
-			return evtIt;
-	}
-	
-	return _events.end();
+	return std::lower_bound(_events.begin(), _events.end(), tick, EventTickLess);
 }
 
 
@@ -626,43 +720,137 @@ UINT8 MidiFile::LoadFile(const char* fileName)
 
 UINT8 MidiFile::LoadFile(FILE* infile)
 {
-	UINT32 TempLng;
-	UINT32 HdrPos;
-	UINT32 HdrEnd;
+	std::vector<UINT8> fileData;
+	long startPos;
+	long endPos;
+	size_t readBytes;
+	
+	// read everything from the current position until the end of the file at once
+	startPos = ftell(infile);
+	endPos = -1;
+	if (startPos != -1 && ! fseek(infile, 0, SEEK_END))
+	{
+		endPos = ftell(infile);
+		fseek(infile, startPos, SEEK_SET);
+	}
+	if (endPos >= startPos && startPos != -1)
+	{
+		fileData.resize((size_t)(endPos - startPos));
+		readBytes = fileData.empty() ? 0 : fread(&fileData[0], 0x01, fileData.size(), infile);
+	}
+	else
+	{
+		// not seekable - read in chunks
+		readBytes = 0;
+		while(! feof(infile) && ! ferror(infile))
+		{
+			fileData.resize(readBytes + 0x10000);
+			readBytes += fread(&fileData[readBytes], 0x01, 0x10000, infile);
+		}
+	}
+	if (! readBytes)
+		return 0x10;
+	
+	return LoadFile((UINT32)readBytes, &fileData[0]);
+}
+
+UINT8 MidiFile::LoadFile(UINT32 FileLen, const UINT8* FileData)
+{
+	UINT32 HdrLen;
+	UINT32 FilePos;
+	UINT32 ChunkSize;
 	UINT16 trkCnt;
 	UINT16 CurTrk;
 	UINT8 RetVal;
+	std::vector<TRK_LOAD_TASK> trkTasks;
+	UINT32 trkDataSize;
 	
-//	fseek(infile, 0, SEEK_END);
-//	file_size = ftell(infile);
-//	fseek(infile, 0, SEEK_SET);
-	
-	fread(&TempLng, 0x04, 1, infile);
-	if (TempLng != FCC_MTHD)
+	if (FileLen < 0x0E || memcmp(&FileData[0x00], "MThd", 0x04))
 		return 0x10;
 	
 	ClearAll();
 	
-	TempLng = ReadBE32(infile);	// Read Header Length
-	HdrPos = (UINT32)ftell(infile);
-	HdrEnd = HdrPos + TempLng;
-	
-	_format = ReadBE16(infile);
-	trkCnt = ReadBE16(infile);
-	_resolution = ReadBE16(infile);
+	HdrLen = ReadBE32(&FileData[0x04]);	// Read Header Length
+	_format = ReadBE16(&FileData[0x08]);
+	trkCnt = ReadBE16(&FileData[0x0A]);
+	_resolution = ReadBE16(&FileData[0x0C]);
 	
-	fseek(infile, HdrEnd, SEEK_SET);
+	FilePos = (HdrLen <= FileLen - 0x08) ? (0x08 + HdrLen) : FileLen;
 	
-	RetVal = 0x00;
-	_tracks.reserve(trkCnt);
+	// The MTrk chunks are independent from each other, so we locate all of them first
+	// and then decode them in parallel.
+	trkTasks.reserve(trkCnt);
+	trkDataSize = 0;
 	for (CurTrk = 0; CurTrk < trkCnt; CurTrk ++)
 	{
-		MidiTrack* newTrk = new MidiTrack;
-		RetVal = newTrk->ReadFromFile(infile);
-		if (RetVal)
+		TRK_LOAD_TASK tlt;
+		
+		tlt.dataLen = FileLen - FilePos;
+		tlt.data = FileData + FilePos;
+		tlt.trk = NULL;
+		tlt.retVal = 0x00;
+		if (tlt.dataLen < 0x08 || memcmp(&tlt.data[0x00], "MTrk", 0x04))
+		{
+			trkTasks.push_back(tlt);	// decoding will return the error code
 			break;
+		}
 		
-		Track_Append(newTrk);
+		ChunkSize = ReadBE32(&tlt.data[0x04]);
+		ChunkSize = (ChunkSize <= 0xFFFFFFFF - 0x08) ? (0x08 + ChunkSize) : 0xFFFFFFFF;
+		if (ChunkSize < tlt.dataLen)
+			tlt.dataLen = ChunkSize;
+		trkTasks.push_back(tlt);
+		trkDataSize += tlt.dataLen;
+		FilePos += tlt.dataLen;
+	}
+	
+	if (trkTasks.size() >= 2 && trkDataSize >= TRKLOAD_MIN_PARALLEL)
+	{
+		std::vector<TRK_LOAD_WORKER> workers;
+		std::vector<OS_THREAD*> threads;
+		size_t curThr;
+		
+		workers.resize((trkTasks.size() < TRKLOAD_MAX_THREADS) ? trkTasks.size() : TRKLOAD_MAX_THREADS);
+		threads.resize(workers.size(), NULL);
+		for (curThr = 0; curThr < workers.size(); curThr ++)
+		{
+			workers[curThr].tasks = &trkTasks;
+			workers[curThr].startIdx = curThr;
+			workers[curThr].stepSize = workers.size();
+		}
+		// worker 0 runs on the current thread
+		for (curThr = 1; curThr < workers.size(); curThr ++)
+		{
+			if (OSThread_Init(&threads[curThr], &LoadTrack_WorkerThread, &workers[curThr]))
+				threads[curThr] = NULL;	// failed - the remaining tracks are decoded below
+		}
+		LoadTrack_WorkerThread(&workers[0]);
+		for (curThr = 1; curThr < workers.size(); curThr ++)
+		{
+			if (threads[curThr] == NULL)
+				continue;
+			OSThread_Join(threads[curThr]);
+			OSThread_Deinit(threads[curThr]);
+		}
+	}
+	for (CurTrk = 0; CurTrk < trkTasks.size(); CurTrk ++)
+	{
+		if (trkTasks[CurTrk].trk == NULL)
+			LoadTrack_Decode(&trkTasks[CurTrk]);
+	}
+	
+	// append tracks in order, stopping at the first one that failed
+	RetVal = 0x00;
+	_tracks.reserve(trkTasks.size());
+	for (CurTrk = 0; CurTrk < trkTasks.size(); CurTrk ++)
+	{
+		TRK_LOAD_TASK& tlt = trkTasks[CurTrk];
+		if (! RetVal && tlt.retVal)
+			RetVal = tlt.retVal;
+		if (RetVal)
+			delete tlt.trk;
+		else
+			Track_Append(tlt.trk);
 	}
 	
 	return RetVal;
@@ -718,40 +906,40 @@ UINT8 MidiFile::SaveFile(FILE* outfile)
 	return RetVal;
 }
 
-static UINT16 ReadBE16(FILE* infile)
+static UINT16 ReadBE16(const UINT8* data)
 {
-	UINT8 InData[0x02];
-	
-	fread(InData, 0x02, 1, infile);
-	return (InData[0x00] << 8) | (InData[0x01] << 0);
+	return (data[0x00] << 8) | (data[0x01] << 0);
 }
 
-static UINT32 ReadBE32(FILE* infile)
+static UINT32 ReadBE32(const UINT8* data)
 {
-	UINT8 InData[0x04];
-	
-	fread(InData, 0x04, 1, infile);
-	return	(InData[0x00] << 24) | (InData[0x01] << 16) |
-			(InData[0x02] <<  8) | (InData[0x03] <<  0);
+	return	(data[0x00] << 24) | (data[0x01] << 16) |
+			(data[0x02] <<  8) | (data[0x03] <<  0);
 }
 
-static UINT32 ReadMidiValue(FILE* infile)
+static UINT8 ReadMidiValue(UINT32 dataLen, const UINT8* data, UINT32* pos, UINT32* retValue)
 {
+	UINT32 curPos;
 	UINT8 TempByt;
 	UINT32 ResVal;
-	size_t readBytes;
 	
+	curPos = *pos;
 	ResVal = 0x00;
 	do
 	{
-		readBytes = fread(&TempByt, 0x01, 1, infile);
-		if (! readBytes)
-			break;
+		if (curPos >= dataLen)
+		{
+			*pos = curPos;
+			return 0x01;	// unexpected end of data
+		}
+		TempByt = data[curPos];	curPos ++;
 		ResVal <<= 7;
 		ResVal |= (TempByt & 0x7F);
 	} while(TempByt & 0x80);
 	
-	return ResVal;
+	*pos = curPos;
+	*retValue = ResVal;
+	return 0x00;
 }
 
 static void WriteBE16(FILE* outfile, UINT16 Value)
@@ -806,3 +994,27 @@ static void WriteMidiValue(FILE* outfile, UINT32 Value)
 	
 	return;
 }
+
+static bool EventTickLess(const MidiEvent& evt, UINT32 tick)
+{
+	return evt.tick < tick;
+}
+
+static void LoadTrack_Decode(TRK_LOAD_TASK* tlt)
+{
+	tlt->trk = new MidiTrack;
+	tlt->retVal = tlt->trk->ReadFromData(tlt->dataLen, tlt->data, NULL);
+	
+	return;
+}
+
+static void LoadTrack_WorkerThread(void* args)
+{
+	TRK_LOAD_WORKER* tlw = (TRK_LOAD_WORKER*)args;
+	size_t curTask;
+	
+	for (curTask = tlw->startIdx; curTask < tlw->tasks->size(); curTask += tlw->stepSize)
+		LoadTrack_Decode(&(*tlw->tasks)[curTask]);
+	
+	return;
+}
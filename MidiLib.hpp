@@ -7,6 +7,26 @@
 #include <vector>
 #include <stdio.h>	// for FILE
 
+// SysEx/Meta event data
+// Note: This only references the data. For events that are part of a MidiTrack,
+//       the data is located in the data pool of the track.
+//       Events returned by MidiTrack::CreateEvent_* reference the caller's buffer
+//       until they are added to a track.
+struct MidiEvtData
+{
+	const UINT8* ptr;
+	UINT32 len;
+	
+	MidiEvtData() : ptr(NULL), len(0)	{}
+	void assign(const UINT8* first, const UINT8* last)	{ ptr = first;	len = (UINT32)(last - first);	}
+	size_t size(void) const	{ return len;	}
+	bool empty(void) const	{ return ! len;	}
+	const UINT8* data(void) const	{ return ptr;	}
+	const UINT8* begin(void) const	{ return ptr;	}
+	const UINT8* end(void) const	{ return ptr + len;	}
+	const UINT8& operator[](size_t idx) const	{ return ptr[idx];	}
+};
+
 struct MidiEvent
 {
 	UINT32 tick;
@@ -14,10 +34,12 @@ struct MidiEvent
 	UINT8 evtType;
 	UINT8 evtValA;	// Note Height, Controller Type, ...
 	UINT8 evtValB;
-	std::vector<UINT8> evtData;
+	MidiEvtData evtData;
 };
 
-typedef std::list<MidiEvent> MidiEvtList;
+// events are stored in a contiguous array, sorted by tick
+// Note: Inserting/removing events invalidates iterators.
+typedef std::vector<MidiEvent> MidiEvtList;
 typedef MidiEvtList::iterator midevt_iterator;
 typedef MidiEvtList::const_iterator midevt_const_it;
 
@@ -66,13 +88,22 @@ public:
 	
 	void RemoveEvent(midevt_iterator evtIt);
 	
-	UINT8 ReadFromFile(FILE* infile);
+	// reads an MTrk chunk from memory, RetChunkSize receives the chunk size (including the header)
+	UINT8 ReadFromData(UINT32 DataLen, const UINT8* Data, UINT32* RetChunkSize);
 	UINT8 WriteToFile(FILE* outfile) const;
 	
 private:
 	MidiEvtList _events;
+	std::vector<UINT8*> _dataBlocks;	// data pool for SysEx/Meta events
+	UINT32 _dataBlkPos;	// used bytes in the current pool block
+	
+	MidiTrack(const MidiTrack&);	// not copyable (owns the data pool)
+	MidiTrack& operator=(const MidiTrack&);
 	
 	midevt_iterator GetFirstEventAtTick(UINT32 Tick);
+	UINT8* AllocEventData(UINT32 dataLen);
+	void StoreEventData(MidiEvent& evt);
+	void FreeEventData(void);
 };
 
 class MidiFile
@@ -89,8 +120,8 @@ public:
 	void ClearAll(void);
 	
 	UINT8 LoadFile(const char* fileName);
-	UINT8 LoadFile(FILE* infile);
-	//UINT8 LoadFile(UINT32 FileLen, UINT8* FileData);
+	UINT8 LoadFile(FILE* infile);	// reads from the current file position
+	UINT8 LoadFile(UINT32 FileLen, const UINT8* FileData);
 	
 	UINT8 SaveFile(const char* fileName);
 	UINT8 SaveFile(FILE* outfile);
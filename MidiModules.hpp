@@ -18,6 +18,9 @@ struct MidiModOpts
 	UINT8 masterVol;	// master volume control type
 	bool remapMVolSyx;	// remap master volume SysEx to the one defined in 'masterVol'
 	UINT8 defInsMap;	// default instrument map
+	UINT8 wireModel;	// MIDI link model for hardware connections (see MMO_WIRE_* constants)
+	bool dropRepeatCtrl;	// don't send controllers/pitch bends that don't change the current value
+	UINT16 ctrlMaxRate;	// maximum number of messages per second for each controller/pitch bend (0 = no limit)
 };
 // most reset types map to the respective GM/GS/XG module types
 #define MMO_RESET_XG		0x20	// "normal" XG reset
@@ -30,6 +33,10 @@ struct MidiModOpts
 // master volume types
 #define MMO_MSTVOL_CC_VOL	0xF0	// Control Change: Main Volume
 #define MMO_MSTVOL_CC_EXPR	0xF1	// Control Change: Expression
+// MIDI link model flags
+#define MMO_WIRE_STATS		0x01	// model the transfer time on the 31250 baud link and collect saturation statistics
+#define MMO_WIRE_REORDER	0x02	// saturated link: send Note Ons before other channel messages of the same tick
+#define MMO_WIRE_DROPCC		0x04	// remove controller/pitch bend messages that are overwritten within the same tick
 
 MidiModOpts GetDefaultMidiModOpts(void);
 UINT8 GetMidiModResetType(UINT8 modType);
@@ -0,0 +1,199 @@
+// MIDI Output
+// -----------
+// dispatches all port functions to the selected MIDI output driver
+#include <stdlib.h>
+#include <string.h>
+
+#include <stdtype.h>
+#include "MidiOut.h"
+#include "MidiOut_Drv.h"
+
+#ifdef _MSC_VER
+#define stricmp	_stricmp
+#else
+#define stricmp	strcasecmp
+#endif
+
+//typedef struct _midiout_port MIDIOUT_PORT;
+struct _midiout_port
+{
+	const MIDIOUT_DRIVER* drv;
+	void* drvPort;
+};
+
+
+static const MIDIOUT_DRIVER* const DRIVER_LIST[] =
+{
+#ifdef _WIN32
+	&MidiOutDrv_WinMM,
+#else
+	&MidiOutDrv_ALSA,
+	&MidiOutDrv_RawMIDI,
+#endif
+	&MidiOutDrv_Null,
+	&MidiOutDrv_Capture,
+	NULL
+};
+
+static const MIDIOUT_DRIVER* curDriver = DRIVER_LIST[0];
+
+
+UINT8 MidiOut_SetDriver(UINT8 drvType)
+{
+	const MIDIOUT_DRIVER* const* drvPtr;
+	
+	for (drvPtr = DRIVER_LIST; *drvPtr != NULL; drvPtr ++)
+	{
+		if ((*drvPtr)->drvType == drvType)
+		{
+			curDriver = *drvPtr;
+			return 0x00;
+		}
+	}
+	return 0xFF;	// driver not available
+}
+
+UINT8 MidiOut_GetDriver(void)
+{
+	return curDriver->drvType;
+}
+
+UINT8 MidiOut_GetDriverFromName(const char* drvName)
+{
+	const MIDIOUT_DRIVER* const* drvPtr;
+	
+	for (drvPtr = DRIVER_LIST; *drvPtr != NULL; drvPtr ++)
+	{
+		if (! stricmp((*drvPtr)->name, drvName))
+			return (*drvPtr)->drvType;
+	}
+	if (! stricmp(drvName, "system"))
+		return MODRV_TYPE_SYSTEM;
+	return 0xFF;
+}
+
+MIDIOUT_PORT* MidiOutPort_Init(void)
+{
+	MIDIOUT_PORT* mop;
+	
+	mop = (MIDIOUT_PORT*)calloc(1, sizeof(MIDIOUT_PORT));
+	if (mop == NULL)
+		return NULL;
+	
+	// The port keeps its driver, even if another one is selected later.
+	mop->drv = curDriver;
+	mop->drvPort = mop->drv->Init();
+	if (mop->drvPort == NULL)
+	{
+		free(mop);
+		return NULL;
+	}
+	
+	return mop;
+}
+
+void MidiOutPort_Deinit(MIDIOUT_PORT* mop)
+{
+	mop->drv->Deinit(mop->drvPort);
+	free(mop);
+	
+	return;
+}
+
+UINT8 MidiOutPort_OpenDevice(MIDIOUT_PORT* mop, UINT32 id)
+{
+	return mop->drv->OpenDevice(mop->drvPort, id);
+}
+
+UINT8 MidiOutPort_CloseDevice(MIDIOUT_PORT* mop)
+{
+	return mop->drv->CloseDevice(mop->drvPort);
+}
+
+void MidiOutPort_SendShortMsg(MIDIOUT_PORT* mop, UINT8 event, UINT8 data1, UINT8 data2)
+{
+	mop->drv->SendShortMsg(mop->drvPort, event, data1, data2);
+	return;
+}
+
+UINT8 MidiOutPort_SendLongMsg(MIDIOUT_PORT* mop, size_t dataLen, const void* data)
+{
+	return mop->drv->SendLongMsg(mop->drvPort, dataLen, data);
+}
+
+UINT8 MidiOutPort_SendBatch(MIDIOUT_PORT* mop, size_t count, const MIDI_MSG* msgs)
+{
+	size_t curMsg;
+	
+	if (mop->drv->SendBatch != NULL)
+		return mop->drv->SendBatch(mop->drvPort, count, msgs);
+	
+	for (curMsg = 0; curMsg < count; curMsg ++)
+	{
+		const MIDI_MSG* msg = &msgs[curMsg];
+		MidiOutPort_SendShortMsgDelayed(mop, msg->delayUS, msg->data[0], msg->data[1], msg->data[2]);
+	}
+	return 0x00;
+}
+
+UINT8 MidiOutPort_SetScheduling(MIDIOUT_PORT* mop, UINT8 enable)
+{
+	if (mop->drv->SetScheduling == NULL)
+		return enable ? 0xFF : 0x00;
+	return mop->drv->SetScheduling(mop->drvPort, enable);
+}
+
+void MidiOutPort_SendShortMsgDelayed(MIDIOUT_PORT* mop, UINT32 delayUS, UINT8 event, UINT8 data1, UINT8 data2)
+{
+	if (mop->drv->SendShortMsgDelayed == NULL)
+		mop->drv->SendShortMsg(mop->drvPort, event, data1, data2);
+	else
+		mop->drv->SendShortMsgDelayed(mop->drvPort, delayUS, event, data1, data2);
+	return;
+}
+
+UINT8 MidiOutPort_SendLongMsgDelayed(MIDIOUT_PORT* mop, UINT32 delayUS, size_t dataLen, const void* data)
+{
+	if (mop->drv->SendLongMsgDelayed == NULL)
+		return mop->drv->SendLongMsg(mop->drvPort, dataLen, data);
+	return mop->drv->SendLongMsgDelayed(mop->drvPort, delayUS, dataLen, data);
+}
+
+void MidiOutPort_Flush(MIDIOUT_PORT* mop)
+{
+	if (mop->drv->Flush != NULL)
+		mop->drv->Flush(mop->drvPort);
+	return;
+}
+
+void MidiOutPort_DropPending(MIDIOUT_PORT* mop)
+{
+	if (mop->drv->DropPending != NULL)
+		mop->drv->DropPending(mop->drvPort);
+	return;
+}
+
+UINT8 MidiOutPort_WaitForOutput(MIDIOUT_PORT* mop)
+{
+	if (mop->drv->WaitForOutput == NULL)
+		return 0xFF;
+	return mop->drv->WaitForOutput(mop->drvPort);
+}
+
+UINT8 MidiOut_GetPortList(MIDI_PORT_LIST* mpl)
+{
+	return curDriver->GetPortList(mpl);
+}
+
+void MidiOut_FreePortList(MIDI_PORT_LIST* mpl)
+{
+	UINT32 curPort;
+	
+	for (curPort = 0; curPort < mpl->count; curPort ++)
+		free(mpl->ports[curPort].name);
+	
+	mpl->count = 0;
+	free(mpl->ports);	mpl->ports = NULL;
+	
+	return;
+}
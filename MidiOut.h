@@ -10,12 +10,39 @@ extern "C"
 
 typedef struct _midiout_port MIDIOUT_PORT;
 
+typedef struct _midi_message
+{
+	UINT32 delayUS;	// delay for scheduled output (ignored without scheduling)
+	UINT8 data[3];	// status byte + data bytes of a short message
+} MIDI_MSG;
+
+#define MODRV_TYPE_SYSTEM	0x00	// OS MIDI API (ALSA sequencer / WinMM)
+#define MODRV_TYPE_NULL		0x01	// discards all data
+#define MODRV_TYPE_CAPTURE	0x02	// records all data into a log file
+#define MODRV_TYPE_RAWMIDI	0x03	// writes directly to raw MIDI devices (Linux only)
+
+// Note: The driver must be selected before any port is opened.
+UINT8 MidiOut_SetDriver(UINT8 drvType);
+UINT8 MidiOut_GetDriver(void);
+UINT8 MidiOut_GetDriverFromName(const char* drvName);	// returns 0xFF for unknown names
+
 MIDIOUT_PORT* MidiOutPort_Init(void);
 void MidiOutPort_Deinit(MIDIOUT_PORT* mop);
 UINT8 MidiOutPort_OpenDevice(MIDIOUT_PORT* mop, UINT32 id);
 UINT8 MidiOutPort_CloseDevice(MIDIOUT_PORT* mop);
 void MidiOutPort_SendShortMsg(MIDIOUT_PORT* mop, UINT8 event, UINT8 data1, UINT8 data2);
 UINT8 MidiOutPort_SendLongMsg(MIDIOUT_PORT* mop, size_t dataLen, const void* data);
+// sends multiple short messages with a single driver call
+UINT8 MidiOutPort_SendBatch(MIDIOUT_PORT* mop, size_t count, const MIDI_MSG* msgs);
+
+// Scheduled output: Messages are timestamped and delivered by the driver/OS at the respective time.
+// Without scheduling, the "Delayed" functions send the message immediately.
+UINT8 MidiOutPort_SetScheduling(MIDIOUT_PORT* mop, UINT8 enable);	// returns 0xFF if not supported by the driver
+void MidiOutPort_SendShortMsgDelayed(MIDIOUT_PORT* mop, UINT32 delayUS, UINT8 event, UINT8 data1, UINT8 data2);
+UINT8 MidiOutPort_SendLongMsgDelayed(MIDIOUT_PORT* mop, UINT32 delayUS, size_t dataLen, const void* data);
+void MidiOutPort_Flush(MIDIOUT_PORT* mop);	// pass all buffered messages to the driver/OS
+void MidiOutPort_DropPending(MIDIOUT_PORT* mop);	// remove all messages that weren't delivered yet
+UINT8 MidiOutPort_WaitForOutput(MIDIOUT_PORT* mop);	// wait until all data was transferred to the device, returns 0xFF if not supported by the driver
 
 
 typedef struct _midi_port_description
@@ -33,6 +60,19 @@ typedef struct _midi_port_list
 UINT8 MidiOut_GetPortList(MIDI_PORT_LIST* portList);
 void MidiOut_FreePortList(MIDI_PORT_LIST* portList);
 
+
+// Capture driver
+#define MOCAP_FMT_BINARY	0x00
+#define MOCAP_FMT_TEXT		0x01
+#define MOCAP_FLAG_EXT_TIME	0x01	// use the time set via MidiOutCapture_SetTime() instead of the system time
+
+// Opens the log file that receives the data of all capture ports.
+// Call MidiOutCapture_CloseLog() after closing all ports.
+UINT8 MidiOutCapture_OpenLog(const char* fileName, UINT8 format, UINT8 flags);
+void MidiOutCapture_CloseLog(void);
+// sets the time [ns] for messages that are sent from now on (MOCAP_FLAG_EXT_TIME only)
+void MidiOutCapture_SetTime(UINT64 timeNS);
+
 #ifdef __cplusplus
 }
 #endif
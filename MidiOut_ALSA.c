@@ -6,18 +6,38 @@
 
 #include <stdtype.h>
 #include "MidiOut.h"
+#include "MidiOut_Drv.h"
 
-//typedef struct _midiout_port MIDIOUT_PORT;
-struct _midiout_port
+typedef struct _alsa_port
 {
 	snd_seq_t* hSeq;
 	snd_seq_addr_t srcPort;
 	snd_seq_addr_t dstPort;
-};
+	int queueID;	// queue for scheduled output, -1 = direct output
+} ALSA_PORT;
+
+#define NO_DELAY	((UINT32)-1)
 
 
-static UINT8 FindPortAddress(MIDIOUT_PORT* mop, UINT32 portID, snd_seq_addr_t* portAddr);
-static void SetupSourcePort(MIDIOUT_PORT* mop);
+static void* ALSA_Init(void);
+static void ALSA_Deinit(void* drvPort);
+static UINT8 ALSA_OpenDevice(void* drvPort, UINT32 id);
+static UINT8 FindPortAddress(ALSA_PORT* mop, UINT32 portID, snd_seq_addr_t* portAddr);
+static void SetupSourcePort(ALSA_PORT* mop);
+static UINT8 ALSA_CloseDevice(void* drvPort);
+static void ALSA_SendShortMsg(void* drvPort, UINT8 event, UINT8 data1, UINT8 data2);
+static UINT8 ALSA_SendLongMsg(void* drvPort, size_t dataLen, const void* data);
+static UINT8 ALSA_GetPortList(MIDI_PORT_LIST* mpl);
+static UINT8 ALSA_SetScheduling(void* drvPort, UINT8 enable);
+static void ALSA_SendShortMsgDelayed(void* drvPort, UINT32 delayUS, UINT8 event, UINT8 data1, UINT8 data2);
+static UINT8 ALSA_SendLongMsgDelayed(void* drvPort, UINT32 delayUS, size_t dataLen, const void* data);
+static void ALSA_Flush(void* drvPort);
+static void ALSA_DropPending(void* drvPort);
+static UINT8 ALSA_SendBatch(void* drvPort, size_t count, const MIDI_MSG* msgs);
+static void PrepareEvent(ALSA_PORT* mop, snd_seq_event_t* seqEvt, UINT32 delayUS);
+static UINT8 SetShortEventData(snd_seq_event_t* seqEvt, UINT8 event, UINT8 data1, UINT8 data2);
+static void OutputLongEvent(ALSA_PORT* mop, snd_seq_event_t* seqEvt, UINT8 syncBlocks);
+static void DrainOutput(ALSA_PORT* mop);
 
 
 static const UINT8 snd_cmd_type[] =
@@ -32,32 +52,46 @@ static const UINT8 snd_cmd_type[] =
 	SND_SEQ_EVENT_SYSEX			// 0xF0
 };
 
+const MIDIOUT_DRIVER MidiOutDrv_ALSA =
+{
+	MODRV_TYPE_SYSTEM, "ALSA",
+	ALSA_Init, ALSA_Deinit, ALSA_OpenDevice, ALSA_CloseDevice,
+	ALSA_SendShortMsg, ALSA_SendLongMsg, ALSA_GetPortList,
+	ALSA_SetScheduling, ALSA_SendShortMsgDelayed, ALSA_SendLongMsgDelayed,
+	ALSA_Flush, ALSA_DropPending,
+	ALSA_SendBatch, NULL
+};
+
 
-MIDIOUT_PORT* MidiOutPort_Init(void)
+static void* ALSA_Init(void)
 {
-	MIDIOUT_PORT* mop;
+	ALSA_PORT* mop;
 	
-	mop = (MIDIOUT_PORT*)calloc(1, sizeof(MIDIOUT_PORT));
+	mop = (ALSA_PORT*)calloc(1, sizeof(ALSA_PORT));
 	if (mop == NULL)
 		return NULL;
 	
 	mop->hSeq = NULL;
+	mop->queueID = -1;
 	
 	return mop;
 }
 
-void MidiOutPort_Deinit(MIDIOUT_PORT* mop)
+static void ALSA_Deinit(void* drvPort)
 {
+	ALSA_PORT* mop = (ALSA_PORT*)drvPort;
+	
 	if (mop->hSeq != NULL)
-		MidiOutPort_CloseDevice(mop);
+		ALSA_CloseDevice(mop);
 	
 	free(mop);
 	
 	return;
 }
 
-UINT8 MidiOutPort_OpenDevice(MIDIOUT_PORT* mop, UINT32 id)
+static UINT8 ALSA_OpenDevice(void* drvPort, UINT32 id)
 {
+	ALSA_PORT* mop = (ALSA_PORT*)drvPort;
 	int retVal;
 	
 	if (mop->hSeq != NULL)
@@ -93,7 +127,7 @@ UINT8 MidiOutPort_OpenDevice(MIDIOUT_PORT* mop, UINT32 id)
 	return 0x00;
 }
 
-static UINT8 FindPortAddress(MIDIOUT_PORT* mop, UINT32 portID, snd_seq_addr_t* portAddr)
+static UINT8 FindPortAddress(ALSA_PORT* mop, UINT32 portID, snd_seq_addr_t* portAddr)
 {
 	snd_seq_client_info_t* cinfo;
 	snd_seq_port_info_t* pinfo;
@@ -138,7 +172,7 @@ static UINT8 FindPortAddress(MIDIOUT_PORT* mop, UINT32 portID, snd_seq_addr_t* p
 	return 0x01;	// not found
 }
 
-static void SetupSourcePort(MIDIOUT_PORT* mop)
+static void SetupSourcePort(ALSA_PORT* mop)
 {
 	snd_seq_port_info_t* pinfo;
 	int retVal;
@@ -163,13 +197,16 @@ static void SetupSourcePort(MIDIOUT_PORT* mop)
 	return;
 }
 
-UINT8 MidiOutPort_CloseDevice(MIDIOUT_PORT* mop)
+static UINT8 ALSA_CloseDevice(void* drvPort)
 {
+	ALSA_PORT* mop = (ALSA_PORT*)drvPort;
 	int retVal;
 	
 	if (mop->hSeq == NULL)
 		return 0xFE;
 	
+	if (mop->queueID >= 0)
+		ALSA_SetScheduling(mop, 0);	// wait for all scheduled events to be delivered
 	retVal = snd_seq_close(mop->hSeq);
 	if (retVal < 0)
 		return 0xFF;	// close error
@@ -178,105 +215,43 @@ UINT8 MidiOutPort_CloseDevice(MIDIOUT_PORT* mop)
 	return 0x00;
 }
 
-void MidiOutPort_SendShortMsg(MIDIOUT_PORT* mop, UINT8 event, UINT8 data1, UINT8 data2)
+static void ALSA_SendShortMsg(void* drvPort, UINT8 event, UINT8 data1, UINT8 data2)
 {
+	ALSA_PORT* mop = (ALSA_PORT*)drvPort;
 	snd_seq_event_t seqEvt;
 	int retVal;
 	
 	if (mop->hSeq == NULL)
 		return;
-	if (event < 0x80 || event >= 0xF0)
-		return;	// ignore invalid message types
-	
-	snd_seq_ev_clear(&seqEvt);
-	seqEvt.flags = 0x00;
-	snd_seq_ev_set_source(&seqEvt, mop->srcPort.port);
-	snd_seq_ev_set_direct(&seqEvt);
-	seqEvt.dest = mop->dstPort;
 	
-	seqEvt.type = snd_cmd_type[(event >> 4) & 0x07];
-	snd_seq_ev_set_fixed(&seqEvt);
-	switch(seqEvt.type)
-	{
-	case SND_SEQ_EVENT_NOTEOFF:
-	case SND_SEQ_EVENT_NOTEON:
-	case SND_SEQ_EVENT_KEYPRESS:
-		seqEvt.data.note.channel = event & 0x0F;
-		seqEvt.data.note.note = data1;
-		seqEvt.data.note.velocity = data2;
-		break;
-	case SND_SEQ_EVENT_CONTROLLER:
-		seqEvt.data.control.channel = event & 0x0F;
-		seqEvt.data.control.param = data1;
-		seqEvt.data.control.value = data2;
-		break;
-	case SND_SEQ_EVENT_PGMCHANGE:
-	case SND_SEQ_EVENT_CHANPRESS:
-		seqEvt.data.control.channel = event & 0x0F;
-		seqEvt.data.control.value = data1;
-		break;
-	case SND_SEQ_EVENT_PITCHBEND:
-		seqEvt.data.control.channel = event & 0x0F;
-		seqEvt.data.control.value = ((data2 << 7) | (data1 << 0)) - 0x2000;
-		break;
-	default:
-		return;	// ignore
-	}
+	PrepareEvent(mop, &seqEvt, NO_DELAY);
+	if (SetShortEventData(&seqEvt, event, data1, data2))
+		return;	// ignore invalid message types
 	retVal = snd_seq_event_output(mop->hSeq, &seqEvt);
 	if (retVal < 0)
 		printf("snd_seq_event_output error %d\n", retVal);
-	retVal = snd_seq_drain_output(mop->hSeq);
-	if (retVal < 0)
-		printf("snd_seq_drain_output error %d\n", retVal);
+	DrainOutput(mop);
 	
 	return;
 }
 
-#define SYSEX_BLOCK_SIZE	0x400
-
-UINT8 MidiOutPort_SendLongMsg(MIDIOUT_PORT* mop, size_t dataLen, const void* data)
+static UINT8 ALSA_SendLongMsg(void* drvPort, size_t dataLen, const void* data)
 {
+	ALSA_PORT* mop = (ALSA_PORT*)drvPort;
 	snd_seq_event_t seqEvt;
-	size_t remLen;
-	int retVal;
 	
 	if (mop->hSeq == NULL)
 		return 0xFE;
 	
-	snd_seq_ev_clear(&seqEvt);
-	seqEvt.flags = 0x00;
-	snd_seq_ev_set_source(&seqEvt, mop->srcPort.port);
-	snd_seq_ev_set_direct(&seqEvt);
-	seqEvt.dest = mop->dstPort;
-	
+	PrepareEvent(mop, &seqEvt, NO_DELAY);
 	seqEvt.type = SND_SEQ_EVENT_SYSEX;
 	snd_seq_ev_set_variable(&seqEvt, dataLen, (void*)data);
-	
-	// Note: aplaymidi does something like this,
-	//       but this does definitely NOT work with TiMidity.
-	remLen = seqEvt.data.ext.len;
-	while(remLen > 0)
-	{
-		seqEvt.data.ext.len = (remLen < SYSEX_BLOCK_SIZE) ? remLen : SYSEX_BLOCK_SIZE;
-		
-		retVal = snd_seq_event_output(mop->hSeq, &seqEvt);
-		if (retVal < 0)
-			printf("snd_seq_event_output error %d\n", retVal);
-		retVal = snd_seq_drain_output(mop->hSeq);
-		if (retVal < 0)
-			printf("snd_seq_drain_output error %d\n", retVal);
-		retVal = snd_seq_sync_output_queue(mop->hSeq);
-		if (retVal < 0)
-			printf("snd_seq_sync_output_queue error %d\n", retVal);
-		
-		seqEvt.data.ext.ptr = (char*)seqEvt.data.ext.ptr + seqEvt.data.ext.len;
-		remLen -= seqEvt.data.ext.len;
-	}
+	OutputLongEvent(mop, &seqEvt, 1);
 	
 	return 0x00;
 }
 
-UINT8 MidiOut_GetPortList(MIDI_PORT_LIST* mpl)
+static UINT8 ALSA_GetPortList(MIDI_PORT_LIST* mpl)
 {
 	snd_seq_t* hSeq;
 	snd_seq_client_info_t* cinfo;
@@ -347,15 +322,242 @@ UINT8 MidiOut_GetPortList(MIDI_PORT_LIST* mpl)
 	return 0x00;
 }
 
-void MidiOut_FreePortList(MIDI_PORT_LIST* mpl)
+static UINT8 ALSA_SetScheduling(void* drvPort, UINT8 enable)
 {
-	UINT32 curPort;
+	ALSA_PORT* mop = (ALSA_PORT*)drvPort;
+	int retVal;
+	
+	if (mop->hSeq == NULL)
+		return 0xFE;
 	
-	for (curPort = 0; curPort < mpl->count; curPort ++)
-		free(mpl->ports[curPort].name);
+	if (enable)
+	{
+		if (mop->queueID >= 0)
+			return 0x00;	// already enabled
+		retVal = snd_seq_alloc_queue(mop->hSeq);
+		if (retVal < 0)
+		{
+			printf("snd_seq_alloc_queue error %d\n", retVal);
+			return 0xFF;
+		}
+		mop->queueID = retVal;
+		snd_seq_start_queue(mop->hSeq, mop->queueID, NULL);
+		DrainOutput(mop);
+	}
+	else
+	{
+		if (mop->queueID < 0)
+			return 0x00;	// already disabled
+		DrainOutput(mop);
+		retVal = snd_seq_sync_output_queue(mop->hSeq);
+		if (retVal < 0)
+			printf("snd_seq_sync_output_queue error %d\n", retVal);
+		snd_seq_stop_queue(mop->hSeq, mop->queueID, NULL);
+		DrainOutput(mop);
+		snd_seq_free_queue(mop->hSeq, mop->queueID);
+		mop->queueID = -1;
+	}
 	
-	mpl->count = 0;
-	free(mpl->ports);	mpl->ports = NULL;
+	return 0x00;
+}
+
+static void ALSA_SendShortMsgDelayed(void* drvPort, UINT32 delayUS, UINT8 event, UINT8 data1, UINT8 data2)
+{
+	ALSA_PORT* mop = (ALSA_PORT*)drvPort;
+	snd_seq_event_t seqEvt;
+	int retVal;
 	
+	if (mop->hSeq == NULL)
+		return;
+	if (mop->queueID < 0)
+	{
+		ALSA_SendShortMsg(mop, event, data1, data2);
+		return;
+	}
+	
+	PrepareEvent(mop, &seqEvt, delayUS);
+	if (SetShortEventData(&seqEvt, event, data1, data2))
+		return;	// ignore invalid message types
+	// The event stays in the output buffer until ALSA_Flush is called. (or the buffer is full)
+	retVal = snd_seq_event_output(mop->hSeq, &seqEvt);
+	if (retVal < 0)
+		printf("snd_seq_event_output error %d\n", retVal);
+	if (! delayUS)
+		DrainOutput(mop);
+	
+	return;
+}
+
+static UINT8 ALSA_SendLongMsgDelayed(void* drvPort, UINT32 delayUS, size_t dataLen, const void* data)
+{
+	ALSA_PORT* mop = (ALSA_PORT*)drvPort;
+	snd_seq_event_t seqEvt;
+	
+	if (mop->hSeq == NULL)
+		return 0xFE;
+	if (mop->queueID < 0)
+		return ALSA_SendLongMsg(mop, dataLen, data);
+	
+	PrepareEvent(mop, &seqEvt, delayUS);
+	seqEvt.type = SND_SEQ_EVENT_SYSEX;
+	snd_seq_ev_set_variable(&seqEvt, dataLen, (void*)data);
+	// The queue keeps the order of the blocks, so there is no need to wait for each of them.
+	OutputLongEvent(mop, &seqEvt, 0);
+	if (! delayUS)
+		DrainOutput(mop);
+	
+	return 0x00;
+}
+
+static void ALSA_Flush(void* drvPort)
+{
+	ALSA_PORT* mop = (ALSA_PORT*)drvPort;
+	
+	if (mop->hSeq == NULL)
+		return;
+	DrainOutput(mop);
+	return;
+}
+
+static void ALSA_DropPending(void* drvPort)
+{
+	ALSA_PORT* mop = (ALSA_PORT*)drvPort;
+	int retVal;
+	
+	if (mop->hSeq == NULL)
+		return;
+	// removes all events from the output buffer and all scheduled events from the kernel queue
+	retVal = snd_seq_drop_output(mop->hSeq);
+	if (retVal < 0)
+		printf("snd_seq_drop_output error %d\n", retVal);
+	return;
+}
+
+static UINT8 ALSA_SendBatch(void* drvPort, size_t count, const MIDI_MSG* msgs)
+{
+	ALSA_PORT* mop = (ALSA_PORT*)drvPort;
+	snd_seq_event_t seqEvt;
+	size_t curMsg;
+	int retVal;
+	
+	if (mop->hSeq == NULL)
+		return 0xFE;
+	
+	// fill the output buffer with all events and drain it only once
+	for (curMsg = 0; curMsg < count; curMsg ++)
+	{
+		const MIDI_MSG* msg = &msgs[curMsg];
+		
+		PrepareEvent(mop, &seqEvt, msg->delayUS);
+		if (SetShortEventData(&seqEvt, msg->data[0], msg->data[1], msg->data[2]))
+			continue;	// ignore invalid message types
+		retVal = snd_seq_event_output(mop->hSeq, &seqEvt);
+		if (retVal < 0)
+			printf("snd_seq_event_output error %d\n", retVal);
+	}
+	DrainOutput(mop);
+	
+	return 0x00;
+}
+
+static void PrepareEvent(ALSA_PORT* mop, snd_seq_event_t* seqEvt, UINT32 delayUS)
+{
+	// delayUS: relative time for scheduled output, NO_DELAY for direct output
+	snd_seq_ev_clear(seqEvt);
+	seqEvt->flags = 0x00;
+	snd_seq_ev_set_source(seqEvt, mop->srcPort.port);
+	seqEvt->dest = mop->dstPort;
+	if (delayUS == NO_DELAY || mop->queueID < 0)
+	{
+		snd_seq_ev_set_direct(seqEvt);
+	}
+	else
+	{
+		snd_seq_real_time_t rTime;
+		
+		rTime.tv_sec = delayUS / 1000000;
+		rTime.tv_nsec = (delayUS % 1000000) * 1000;
+		snd_seq_ev_schedule_real(seqEvt, mop->queueID, 1, &rTime);
+	}
+	
+	return;
+}
+
+static UINT8 SetShortEventData(snd_seq_event_t* seqEvt, UINT8 event, UINT8 data1, UINT8 data2)
+{
+	if (event < 0x80 || event >= 0xF0)
+		return 0xFF;
+	
+	seqEvt->type = snd_cmd_type[(event >> 4) & 0x07];
+	snd_seq_ev_set_fixed(seqEvt);
+	switch(seqEvt->type)
+	{
+	case SND_SEQ_EVENT_NOTEOFF:
+	case SND_SEQ_EVENT_NOTEON:
+	case SND_SEQ_EVENT_KEYPRESS:
+		seqEvt->data.note.channel = event & 0x0F;
+		seqEvt->data.note.note = data1;
+		seqEvt->data.note.velocity = data2;
+		break;
+	case SND_SEQ_EVENT_CONTROLLER:
+		seqEvt->data.control.channel = event & 0x0F;
+		seqEvt->data.control.param = data1;
+		seqEvt->data.control.value = data2;
+		break;
+	case SND_SEQ_EVENT_PGMCHANGE:
+	case SND_SEQ_EVENT_CHANPRESS:
+		seqEvt->data.control.channel = event & 0x0F;
+		seqEvt->data.control.value = data1;
+		break;
+	case SND_SEQ_EVENT_PITCHBEND:
+		seqEvt->data.control.channel = event & 0x0F;
+		seqEvt->data.control.value = ((data2 << 7) | (data1 << 0)) - 0x2000;
+		break;
+	default:
+		return 0xFF;
+	}
+	
+	return 0x00;
+}
+
+#define SYSEX_BLOCK_SIZE	0x400
+
+static void OutputLongEvent(ALSA_PORT* mop, snd_seq_event_t* seqEvt, UINT8 syncBlocks)
+{
+	size_t remLen;
+	int retVal;
+	
+	// Note: aplaymidi does something like this,
+	//       but this does definitely NOT work with TiMidity.
+	remLen = seqEvt->data.ext.len;
+	while(remLen > 0)
+	{
+		seqEvt->data.ext.len = (remLen < SYSEX_BLOCK_SIZE) ? remLen : SYSEX_BLOCK_SIZE;
+		
+		retVal = snd_seq_event_output(mop->hSeq, seqEvt);
+		if (retVal < 0)
+			printf("snd_seq_event_output error %d\n", retVal);
+		if (syncBlocks)
+		{
+			DrainOutput(mop);
+			retVal = snd_seq_sync_output_queue(mop->hSeq);
+			if (retVal < 0)
+				printf("snd_seq_sync_output_queue error %d\n", retVal);
+		}
+		
+		seqEvt->data.ext.ptr = (char*)seqEvt->data.ext.ptr + seqEvt->data.ext.len;
+		remLen -= seqEvt->data.ext.len;
+	}
+	
+	return;
+}
+
+static void DrainOutput(ALSA_PORT* mop)
+{
+	int retVal;
+	
+	retVal = snd_seq_drain_output(mop->hSeq);
+	if (retVal < 0)
+		printf("snd_seq_drain_output error %d\n", retVal);
 	return;
 }
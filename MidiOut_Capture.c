@@ -0,0 +1,582 @@
+// Capture MIDI Output
+// -------------------
+// records all messages with timestamps and writes them into a log file
+//
+// The messages of all ports are stored in one preallocated buffer, so that sending a message
+// doesn't involve any file access. The buffer is written to the log file when it is full
+// and when the log file is closed. Records are written in the order of their timestamps
+// (messages with the same timestamp keep the order in which they were sent), so that the
+// log doesn't depend on which port sent first.
+//
+// Binary log format (all values Little Endian):
+//	Header: "MOCP" signature, UINT32 version (1)
+//	Record: UINT64 time [ns], UINT16 port number, UINT16 reserved, UINT32 data length, data
+// Text log format: one line per message "seconds.nanoseconds<TAB>port<TAB>hex data"
+//
+// With scheduling enabled, delayed messages are logged with the time they are scheduled for.
+// With MOCAP_FLAG_EXT_TIME, the timestamps are the times set via MidiOutCapture_SetTime()
+// (e.g. the player time) instead of the system time, so logs of different runs can be compared.
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+
+#include <stdtype.h>
+#include "MidiOut.h"
+#include "MidiOut_Drv.h"
+#include "OSTimer.h"
+#include "OSMutex.h"
+
+#define CAP_EVT_COUNT	0x10000		// number of messages in the buffer
+#define CAP_DATA_SIZE	0x100000	// size of the long message data in the buffer
+#define NO_DATA_OFS		((UINT32)-1)
+
+typedef struct _capture_event
+{
+	UINT64 time;
+	UINT32 seqID;	// keeps the order of messages with the same timestamp
+	UINT16 portNum;
+	UINT32 dataLen;
+	UINT32 dataOfs;	// offset into capData, NO_DATA_OFS for short messages
+	UINT8 data[4];	// short message data
+} CAPTURE_EVENT;
+
+typedef struct _capture_port CAPTURE_PORT;
+struct _capture_port
+{
+	CAPTURE_PORT* next;	// next open port
+	UINT8 isOpen;
+	UINT8 scheduling;
+	UINT16 portNum;	// number used in the log file
+};
+
+
+static void* Capture_Init(void);
+static void Capture_Deinit(void* drvPort);
+static UINT8 Capture_OpenDevice(void* drvPort, UINT32 id);
+static UINT8 Capture_CloseDevice(void* drvPort);
+static void Capture_SendShortMsg(void* drvPort, UINT8 event, UINT8 data1, UINT8 data2);
+static UINT8 Capture_SendLongMsg(void* drvPort, size_t dataLen, const void* data);
+static UINT8 Capture_GetPortList(MIDI_PORT_LIST* mpl);
+static UINT8 Capture_SetScheduling(void* drvPort, UINT8 enable);
+static void Capture_SendShortMsgDelayed(void* drvPort, UINT32 delayUS, UINT8 event, UINT8 data1, UINT8 data2);
+static UINT8 Capture_SendLongMsgDelayed(void* drvPort, UINT32 delayUS, size_t dataLen, const void* data);
+static void Capture_DropPending(void* drvPort);
+static UINT8 Capture_SendBatch(void* drvPort, size_t count, const MIDI_MSG* msgs);
+static UINT64 Capture_GetTime(void);
+static void AddShortMsg(CAPTURE_PORT* mop, UINT64 time, UINT8 event, UINT8 data1, UINT8 data2);
+static UINT8 AddLongMsg(CAPTURE_PORT* mop, UINT64 time, size_t dataLen, const void* data);
+static UINT64 GetDelayedTime(const CAPTURE_PORT* mop, UINT64 time, UINT32 delayUS);
+static int CompareEvents(const void* p1, const void* p2);
+static void FlushBuffer(UINT8 flushAll);
+static void WriteEvent(const CAPTURE_EVENT* cEvt);
+static void WriteLE32(UINT8* buffer, UINT32 value);
+
+
+const MIDIOUT_DRIVER MidiOutDrv_Capture =
+{
+	MODRV_TYPE_CAPTURE, "Capture",
+	Capture_Init, Capture_Deinit, Capture_OpenDevice, Capture_CloseDevice,
+	Capture_SendShortMsg, Capture_SendLongMsg, Capture_GetPortList,
+	Capture_SetScheduling, Capture_SendShortMsgDelayed, Capture_SendLongMsgDelayed,
+	NULL, Capture_DropPending,
+	Capture_SendBatch, NULL
+};
+
+static FILE* hLogFile = NULL;
+static UINT8 logFormat;
+static UINT8 logFlags;
+static OS_MUTEX* hLogMutex = NULL;	// protects the log file, the message buffer and the list of open ports
+static CAPTURE_PORT* openPorts = NULL;
+static OS_TIMER* hTimer = NULL;
+static UINT64 tmrFreq;
+static UINT64 tmrStart;
+static UINT64 extTime;	// time set via MidiOutCapture_SetTime() [ns]
+static UINT16 nextPortNum;
+
+static CAPTURE_EVENT* capEvents = NULL;
+static size_t capEvtCount;
+static UINT8* capData = NULL;
+static UINT8* capDataTmp = NULL;	// for moving the data of messages that stay in the buffer
+static size_t capDataUsed;
+static UINT32 capSeqID;
+
+
+UINT8 MidiOutCapture_OpenLog(const char* fileName, UINT8 format, UINT8 flags)
+{
+	UINT8 retVal;
+	
+	if (hLogFile != NULL)
+		return 0xFE;
+	
+	capEvents = (CAPTURE_EVENT*)malloc(CAP_EVT_COUNT * sizeof(CAPTURE_EVENT));
+	capData = (UINT8*)malloc(CAP_DATA_SIZE);
+	capDataTmp = (UINT8*)malloc(CAP_DATA_SIZE);
+	if (capEvents == NULL || capData == NULL || capDataTmp == NULL)
+	{
+		free(capEvents);	capEvents = NULL;
+		free(capData);		capData = NULL;
+		free(capDataTmp);	capDataTmp = NULL;
+		return 0xFF;
+	}
+	hLogFile = fopen(fileName, (format == MOCAP_FMT_TEXT) ? "wt" : "wb");
+	if (hLogFile == NULL)
+	{
+		free(capEvents);	capEvents = NULL;
+		free(capData);		capData = NULL;
+		free(capDataTmp);	capDataTmp = NULL;
+		return 0xFF;
+	}
+	retVal = OSMutex_Init(&hLogMutex, 0);
+	if (retVal)
+	{
+		fclose(hLogFile);	hLogFile = NULL;
+		free(capEvents);	capEvents = NULL;
+		free(capData);		capData = NULL;
+		free(capDataTmp);	capDataTmp = NULL;
+		return 0xFF;
+	}
+	logFormat = format;
+	logFlags = flags;
+	if (logFlags & MOCAP_FLAG_EXT_TIME)
+	{
+		hTimer = NULL;
+		tmrFreq = 1000000000;	// the time is set in ns
+		tmrStart = 0;
+	}
+	else
+	{
+		hTimer = OSTimer_Init();
+		tmrFreq = OSTimer_GetFrequency(hTimer);
+		tmrStart = OSTimer_GetTime(hTimer);
+	}
+	extTime = 0;
+	nextPortNum = 0;
+	capEvtCount = 0;
+	capDataUsed = 0;
+	capSeqID = 0;
+	
+	if (logFormat == MOCAP_FMT_TEXT)
+	{
+		fprintf(hLogFile, "# MIDI output capture\n");
+	}
+	else
+	{
+		UINT8 fileHdr[0x08];
+		memcpy(&fileHdr[0x00], "MOCP", 0x04);
+		WriteLE32(&fileHdr[0x04], 1);
+		fwrite(fileHdr, 0x01, 0x08, hLogFile);
+	}
+	
+	return 0x00;
+}
+
+void MidiOutCapture_CloseLog(void)
+{
+	if (hLogFile == NULL)
+		return;
+	
+	// write the remaining data and disable ports that are still open
+	OSMutex_Lock(hLogMutex);
+	FlushBuffer(1);
+	while(openPorts != NULL)
+	{
+		openPorts->isOpen = 0;
+		openPorts = openPorts->next;
+	}
+	OSMutex_Unlock(hLogMutex);
+	
+	if (hTimer != NULL)
+	{
+		OSTimer_Deinit(hTimer);	hTimer = NULL;
+	}
+	OSMutex_Deinit(hLogMutex);	hLogMutex = NULL;
+	fclose(hLogFile);	hLogFile = NULL;
+	free(capEvents);	capEvents = NULL;
+	free(capData);		capData = NULL;
+	free(capDataTmp);	capDataTmp = NULL;
+	
+	return;
+}
+
+void MidiOutCapture_SetTime(UINT64 timeNS)
+{
+	if (hLogFile == NULL)
+		return;
+	
+	OSMutex_Lock(hLogMutex);
+	if (timeNS < extTime)
+		FlushBuffer(1);	// new time base (e.g. next song): write everything from the old one first
+	extTime = timeNS;
+	OSMutex_Unlock(hLogMutex);
+	
+	return;
+}
+
+static void* Capture_Init(void)
+{
+	CAPTURE_PORT* mop;
+	
+	mop = (CAPTURE_PORT*)calloc(1, sizeof(CAPTURE_PORT));
+	if (mop == NULL)
+		return NULL;
+	
+	return mop;
+}
+
+static void Capture_Deinit(void* drvPort)
+{
+	CAPTURE_PORT* mop = (CAPTURE_PORT*)drvPort;
+	
+	if (mop->isOpen)
+		Capture_CloseDevice(mop);
+	
+	free(mop);
+	
+	return;
+}
+
+static UINT8 Capture_OpenDevice(void* drvPort, UINT32 id)
+{
+	CAPTURE_PORT* mop = (CAPTURE_PORT*)drvPort;
+	
+	if (mop->isOpen)
+		return 0xFE;
+	if (hLogFile == NULL)
+		return 0xFF;	// the log file must be opened first
+	
+	OSMutex_Lock(hLogMutex);
+	mop->portNum = nextPortNum;
+	nextPortNum ++;
+	if (logFormat == MOCAP_FMT_TEXT)
+		fprintf(hLogFile, "# Port %u: device ID %d\n", mop->portNum, (int)id);
+	mop->scheduling = 0;
+	mop->isOpen = 1;
+	mop->next = openPorts;
+	openPorts = mop;
+	OSMutex_Unlock(hLogMutex);
+	
+	return 0x00;
+}
+
+static UINT8 Capture_CloseDevice(void* drvPort)
+{
+	CAPTURE_PORT* mop = (CAPTURE_PORT*)drvPort;
+	CAPTURE_PORT** listPtr;
+	
+	if (! mop->isOpen)
+		return 0xFE;
+	
+	// Note: The buffered messages of the port stay in the buffer until it is written.
+	OSMutex_Lock(hLogMutex);
+	mop->isOpen = 0;
+	for (listPtr = &openPorts; *listPtr != NULL; listPtr = &(*listPtr)->next)
+	{
+		if (*listPtr == mop)
+		{
+			*listPtr = mop->next;
+			break;
+		}
+	}
+	OSMutex_Unlock(hLogMutex);
+	
+	return 0x00;
+}
+
+static void Capture_SendShortMsg(void* drvPort, UINT8 event, UINT8 data1, UINT8 data2)
+{
+	CAPTURE_PORT* mop = (CAPTURE_PORT*)drvPort;
+	
+	if (! mop->isOpen)
+		return;
+	OSMutex_Lock(hLogMutex);
+	AddShortMsg(mop, Capture_GetTime(), event, data1, data2);
+	OSMutex_Unlock(hLogMutex);
+	return;
+}
+
+static UINT8 Capture_SendLongMsg(void* drvPort, size_t dataLen, const void* data)
+{
+	CAPTURE_PORT* mop = (CAPTURE_PORT*)drvPort;
+	UINT8 retVal;
+	
+	if (! mop->isOpen)
+		return 0xFE;
+	OSMutex_Lock(hLogMutex);
+	retVal = AddLongMsg(mop, Capture_GetTime(), dataLen, data);
+	OSMutex_Unlock(hLogMutex);
+	return retVal;
+}
+
+static UINT8 Capture_GetPortList(MIDI_PORT_LIST* mpl)
+{
+	// There are no named ports. Any port ID can be opened.
+	mpl->count = 0;
+	mpl->ports = NULL;
+	return 0x00;
+}
+
+static UINT8 Capture_SetScheduling(void* drvPort, UINT8 enable)
+{
+	CAPTURE_PORT* mop = (CAPTURE_PORT*)drvPort;
+	
+	if (! mop->isOpen)
+		return 0xFE;
+	mop->scheduling = enable;
+	return 0x00;
+}
+
+static void Capture_SendShortMsgDelayed(void* drvPort, UINT32 delayUS, UINT8 event, UINT8 data1, UINT8 data2)
+{
+	CAPTURE_PORT* mop = (CAPTURE_PORT*)drvPort;
+	
+	if (! mop->isOpen)
+		return;
+	OSMutex_Lock(hLogMutex);
+	AddShortMsg(mop, GetDelayedTime(mop, Capture_GetTime(), delayUS), event, data1, data2);
+	OSMutex_Unlock(hLogMutex);
+	return;
+}
+
+static UINT8 Capture_SendLongMsgDelayed(void* drvPort, UINT32 delayUS, size_t dataLen, const void* data)
+{
+	CAPTURE_PORT* mop = (CAPTURE_PORT*)drvPort;
+	UINT8 retVal;
+	
+	if (! mop->isOpen)
+		return 0xFE;
+	OSMutex_Lock(hLogMutex);
+	retVal = AddLongMsg(mop, GetDelayedTime(mop, Capture_GetTime(), delayUS), dataLen, data);
+	OSMutex_Unlock(hLogMutex);
+	return retVal;
+}
+
+static void Capture_DropPending(void* drvPort)
+{
+	CAPTURE_PORT* mop = (CAPTURE_PORT*)drvPort;
+	UINT64 curTime;
+	size_t curEvt;
+	size_t newCount;
+	
+	if (! mop->isOpen || ! mop->scheduling)
+		return;
+	
+	// remove all messages of this port that are scheduled for the future
+	// (Messages that were already written to the log file can not be removed.)
+	OSMutex_Lock(hLogMutex);
+	curTime = Capture_GetTime();
+	newCount = 0;
+	for (curEvt = 0; curEvt < capEvtCount; curEvt ++)
+	{
+		const CAPTURE_EVENT* cEvt = &capEvents[curEvt];
+		if (cEvt->portNum != mop->portNum || cEvt->time <= curTime)
+		{
+			capEvents[newCount] = *cEvt;
+			newCount ++;
+		}
+	}
+	capEvtCount = newCount;
+	OSMutex_Unlock(hLogMutex);
+	
+	return;
+}
+
+static UINT8 Capture_SendBatch(void* drvPort, size_t count, const MIDI_MSG* msgs)
+{
+	CAPTURE_PORT* mop = (CAPTURE_PORT*)drvPort;
+	UINT64 time;
+	size_t curMsg;
+	
+	if (! mop->isOpen)
+		return 0xFE;
+	
+	OSMutex_Lock(hLogMutex);
+	time = Capture_GetTime();	// all messages of the batch are sent at the same time
+	for (curMsg = 0; curMsg < count; curMsg ++)
+	{
+		const MIDI_MSG* msg = &msgs[curMsg];
+		AddShortMsg(mop, GetDelayedTime(mop, time, msg->delayUS), msg->data[0], msg->data[1], msg->data[2]);
+	}
+	OSMutex_Unlock(hLogMutex);
+	
+	return 0x00;
+}
+
+static UINT64 Capture_GetTime(void)
+{
+	// Note: The caller has to lock hLogMutex when using the external time.
+	if (logFlags & MOCAP_FLAG_EXT_TIME)
+		return extTime;
+	else
+		return OSTimer_GetTime(hTimer);
+}
+
+static void AddShortMsg(CAPTURE_PORT* mop, UINT64 time, UINT8 event, UINT8 data1, UINT8 data2)
+{
+	// Note: The caller has to lock hLogMutex.
+	CAPTURE_EVENT* cEvt;
+	
+	if (capEvtCount >= CAP_EVT_COUNT)
+		FlushBuffer(0);
+	
+	cEvt = &capEvents[capEvtCount];
+	cEvt->time = time;
+	cEvt->seqID = capSeqID;
+	cEvt->portNum = mop->portNum;
+	cEvt->dataOfs = NO_DATA_OFS;
+	cEvt->data[0] = event;
+	cEvt->data[1] = data1;
+	cEvt->data[2] = data2;
+	switch(event & 0xF0)
+	{
+	case 0xC0:
+	case 0xD0:
+		cEvt->dataLen = 2;
+		break;
+	case 0xF0:
+		cEvt->dataLen = (event == 0xF1 || event == 0xF3) ? 2 : ((event == 0xF2) ? 3 : 1);
+		break;
+	default:
+		cEvt->dataLen = 3;
+		break;
+	}
+	capEvtCount ++;
+	capSeqID ++;
+	
+	return;
+}
+
+static UINT8 AddLongMsg(CAPTURE_PORT* mop, UINT64 time, size_t dataLen, const void* data)
+{
+	// Note: The caller has to lock hLogMutex.
+	CAPTURE_EVENT* cEvt;
+	
+	if (dataLen > CAP_DATA_SIZE)
+		return 0xFF;	// message too large for the buffer
+	
+	if (capEvtCount >= CAP_EVT_COUNT || capDataUsed + dataLen > CAP_DATA_SIZE)
+		FlushBuffer(0);
+	if (capDataUsed + dataLen > CAP_DATA_SIZE)
+		FlushBuffer(1);	// the data of scheduled messages takes up the space
+	
+	cEvt = &capEvents[capEvtCount];
+	cEvt->time = time;
+	cEvt->seqID = capSeqID;
+	cEvt->portNum = mop->portNum;
+	cEvt->dataLen = (UINT32)dataLen;
+	cEvt->dataOfs = (UINT32)capDataUsed;
+	memcpy(&capData[capDataUsed], data, dataLen);
+	capDataUsed += dataLen;
+	capEvtCount ++;
+	capSeqID ++;
+	
+	return 0x00;
+}
+
+static UINT64 GetDelayedTime(const CAPTURE_PORT* mop, UINT64 time, UINT32 delayUS)
+{
+	if (mop->scheduling)
+		time += (UINT64)delayUS * tmrFreq / 1000000;
+	return time;
+}
+
+static int CompareEvents(const void* p1, const void* p2)
+{
+	const CAPTURE_EVENT* evt1 = (const CAPTURE_EVENT*)p1;
+	const CAPTURE_EVENT* evt2 = (const CAPTURE_EVENT*)p2;
+	
+	if (evt1->time != evt2->time)
+		return (evt1->time < evt2->time) ? -1 : +1;
+	if (evt1->seqID != evt2->seqID)
+		return (evt1->seqID < evt2->seqID) ? -1 : +1;
+	return 0;
+}
+
+static void FlushBuffer(UINT8 flushAll)
+{
+	// Note: The caller has to lock hLogMutex.
+	// Messages that are scheduled for the future stay in the buffer, unless flushAll is set,
+	// as messages that are sent later can still have an earlier timestamp.
+	UINT64 curTime;
+	size_t writeCnt;
+	size_t curEvt;
+	size_t newCount;
+	size_t dataUsed;
+	UINT8* tempPtr;
+	
+	if (! capEvtCount)
+		return;
+	qsort(capEvents, capEvtCount, sizeof(CAPTURE_EVENT), &CompareEvents);
+	
+	writeCnt = capEvtCount;
+	if (! flushAll)
+	{
+		curTime = Capture_GetTime();
+		for (writeCnt = 0; writeCnt < capEvtCount; writeCnt ++)
+		{
+			if (capEvents[writeCnt].time > curTime)
+				break;
+		}
+		if (writeCnt == 0)
+			writeCnt = capEvtCount;	// the buffer is filled with scheduled messages - write them anyway
+	}
+	for (curEvt = 0; curEvt < writeCnt; curEvt ++)
+		WriteEvent(&capEvents[curEvt]);
+	
+	// move the remaining messages to the beginning of the buffer
+	newCount = 0;
+	dataUsed = 0;
+	for (curEvt = writeCnt; curEvt < capEvtCount; curEvt ++)
+	{
+		CAPTURE_EVENT* cEvt = &capEvents[curEvt];
+		if (cEvt->dataOfs != NO_DATA_OFS)
+		{
+			memcpy(&capDataTmp[dataUsed], &capData[cEvt->dataOfs], cEvt->dataLen);
+			cEvt->dataOfs = (UINT32)dataUsed;
+			dataUsed += cEvt->dataLen;
+		}
+		capEvents[newCount] = *cEvt;
+		newCount ++;
+	}
+	tempPtr = capData;	capData = capDataTmp;	capDataTmp = tempPtr;
+	capEvtCount = newCount;
+	capDataUsed = dataUsed;
+	
+	return;
+}
+
+static void WriteEvent(const CAPTURE_EVENT* cEvt)
+{
+	const UINT8* data = (cEvt->dataOfs != NO_DATA_OFS) ? &capData[cEvt->dataOfs] : cEvt->data;
+	UINT64 tDiff = cEvt->time - tmrStart;
+	UINT64 timeNS = tDiff / tmrFreq * 1000000000 + (tDiff % tmrFreq) * 1000000000 / tmrFreq;
+	UINT32 curByte;
+	
+	if (logFormat == MOCAP_FMT_TEXT)
+	{
+		fprintf(hLogFile, "%u.%09u\t%u\t", (unsigned)(timeNS / 1000000000), (unsigned)(timeNS % 1000000000), cEvt->portNum);
+		for (curByte = 0; curByte < cEvt->dataLen; curByte ++)
+			fprintf(hLogFile, (curByte > 0) ? " %02X" : "%02X", data[curByte]);
+		fputc('\n', hLogFile);
+	}
+	else
+	{
+		UINT8 recHdr[0x10];
+		WriteLE32(&recHdr[0x00], (UINT32)(timeNS >>  0));
+		WriteLE32(&recHdr[0x04], (UINT32)(timeNS >> 32));
+		WriteLE32(&recHdr[0x08], cEvt->portNum);
+		WriteLE32(&recHdr[0x0C], cEvt->dataLen);
+		fwrite(recHdr, 0x01, 0x10, hLogFile);
+		fwrite(data, 0x01, cEvt->dataLen, hLogFile);
+	}
+	
+	return;
+}
+
+static void WriteLE32(UINT8* buffer, UINT32 value)
+{
+	buffer[0x00] = (value >>  0) & 0xFF;
+	buffer[0x01] = (value >>  8) & 0xFF;
+	buffer[0x02] = (value >> 16) & 0xFF;
+	buffer[0x03] = (value >> 24) & 0xFF;
+	return;
+}
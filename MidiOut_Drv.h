@@ -0,0 +1,48 @@
+#ifndef __MIDIOUT_DRV_H__
+#define __MIDIOUT_DRV_H__
+
+// internal interface between MidiOut.c and the MIDI output drivers
+
+#ifdef __cplusplus
+extern "C"
+{
+#endif
+
+#include <stdtype.h>
+#include "MidiOut.h"
+
+typedef struct _midiout_driver
+{
+	UINT8 drvType;	// MODRV_TYPE_*
+	const char* name;
+	void* (*Init)(void);
+	void (*Deinit)(void* drvPort);
+	UINT8 (*OpenDevice)(void* drvPort, UINT32 id);
+	UINT8 (*CloseDevice)(void* drvPort);
+	void (*SendShortMsg)(void* drvPort, UINT8 event, UINT8 data1, UINT8 data2);
+	UINT8 (*SendLongMsg)(void* drvPort, size_t dataLen, const void* data);
+	UINT8 (*GetPortList)(MIDI_PORT_LIST* portList);
+	// optional functions for scheduled output (NULL when not supported)
+	UINT8 (*SetScheduling)(void* drvPort, UINT8 enable);
+	void (*SendShortMsgDelayed)(void* drvPort, UINT32 delayUS, UINT8 event, UINT8 data1, UINT8 data2);
+	UINT8 (*SendLongMsgDelayed)(void* drvPort, UINT32 delayUS, size_t dataLen, const void* data);
+	void (*Flush)(void* drvPort);
+	void (*DropPending)(void* drvPort);
+	UINT8 (*SendBatch)(void* drvPort, size_t count, const MIDI_MSG* msgs);	// optional (NULL = send messages separately)
+	UINT8 (*WaitForOutput)(void* drvPort);	// optional (NULL = not supported)
+} MIDIOUT_DRIVER;
+
+#ifdef _WIN32
+extern const MIDIOUT_DRIVER MidiOutDrv_WinMM;
+#else
+extern const MIDIOUT_DRIVER MidiOutDrv_ALSA;
+extern const MIDIOUT_DRIVER MidiOutDrv_RawMIDI;
+#endif
+extern const MIDIOUT_DRIVER MidiOutDrv_Null;
+extern const MIDIOUT_DRIVER MidiOutDrv_Capture;
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif	// __MIDIOUT_DRV_H__
@@ -0,0 +1,101 @@
+// Null MIDI Output
+// ----------------
+// accepts all ports and discards all data, for running without MIDI hardware
+#include <stdlib.h>
+
+#include <stdtype.h>
+#include "MidiOut.h"
+#include "MidiOut_Drv.h"
+
+typedef struct _null_port
+{
+	UINT8 isOpen;
+} NULL_PORT;
+
+
+static void* Null_Init(void);
+static void Null_Deinit(void* drvPort);
+static UINT8 Null_OpenDevice(void* drvPort, UINT32 id);
+static UINT8 Null_CloseDevice(void* drvPort);
+static void Null_SendShortMsg(void* drvPort, UINT8 event, UINT8 data1, UINT8 data2);
+static UINT8 Null_SendLongMsg(void* drvPort, size_t dataLen, const void* data);
+static UINT8 Null_SendBatch(void* drvPort, size_t count, const MIDI_MSG* msgs);
+static UINT8 Null_GetPortList(MIDI_PORT_LIST* mpl);
+
+
+const MIDIOUT_DRIVER MidiOutDrv_Null =
+{
+	MODRV_TYPE_NULL, "Null",
+	Null_Init, Null_Deinit, Null_OpenDevice, Null_CloseDevice,
+	Null_SendShortMsg, Null_SendLongMsg, Null_GetPortList,
+	NULL, NULL, NULL, NULL, NULL,
+	Null_SendBatch, NULL
+};
+
+
+static void* Null_Init(void)
+{
+	return calloc(1, sizeof(NULL_PORT));
+}
+
+static void Null_Deinit(void* drvPort)
+{
+	free(drvPort);
+	return;
+}
+
+static UINT8 Null_OpenDevice(void* drvPort, UINT32 id)
+{
+	NULL_PORT* mop = (NULL_PORT*)drvPort;
+	
+	(void)id;
+	if (mop->isOpen)
+		return 0xFE;
+	mop->isOpen = 1;
+	return 0x00;
+}
+
+static UINT8 Null_CloseDevice(void* drvPort)
+{
+	NULL_PORT* mop = (NULL_PORT*)drvPort;
+	
+	if (! mop->isOpen)
+		return 0xFE;
+	mop->isOpen = 0;
+	return 0x00;
+}
+
+static void Null_SendShortMsg(void* drvPort, UINT8 event, UINT8 data1, UINT8 data2)
+{
+	(void)drvPort;
+	(void)event;
+	(void)data1;
+	(void)data2;
+	return;
+}
+
+static UINT8 Null_SendLongMsg(void* drvPort, size_t dataLen, const void* data)
+{
+	NULL_PORT* mop = (NULL_PORT*)drvPort;
+	
+	(void)dataLen;
+	(void)data;
+	return mop->isOpen ? 0x00 : 0xFE;
+}
+
+static UINT8 Null_SendBatch(void* drvPort, size_t count, const MIDI_MSG* msgs)
+{
+	NULL_PORT* mop = (NULL_PORT*)drvPort;
+	
+	(void)count;
+	(void)msgs;
+	return mop->isOpen ? 0x00 : 0xFE;
+}
+
+static UINT8 Null_GetPortList(MIDI_PORT_LIST* mpl)
+{
+	// There are no named ports. Any port ID can be opened.
+	mpl->count = 0;
+	mpl->ports = NULL;
+	return 0x00;
+}
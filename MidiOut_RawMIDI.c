@@ -0,0 +1,476 @@
+// Raw MIDI Output
+// ---------------
+// writes MIDI data directly to raw MIDI character devices
+// (ALSA rawmidi: /dev/snd/midiC#D#, OSS: /dev/midi#)
+//
+// This bypasses the sequencer layer, which is useful for hardware modules on MIDI/USB-MIDI interfaces.
+// - all messages of a batch are written using a single write() call
+// - running status is used for channel messages, which saves up to a third of the bytes
+// - SysEx data is paced according to the MIDI transfer rate (31250 baud = 3125 bytes per second),
+//   so that simple USB-MIDI interfaces don't drop data due to buffer overflows
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <errno.h>
+#include <dirent.h>
+#include <limits.h>	// for NAME_MAX
+
+#include <stdtype.h>
+#include "MidiOut.h"
+#include "MidiOut_Drv.h"
+#include "OSTimer.h"
+
+#define RAW_BUF_SIZE	0x400	// size of the write buffer for batches
+#define RAW_SYX_CHUNK	0x40	// SysEx data is sent in chunks of this size
+#define MIDI_BYTE_RATE	3125	// 31250 bits per second, 1 byte of payload = 10 bits (start bit, 8 data bits, stop bit)
+
+typedef struct _rawmidi_port
+{
+	int hDev;	// file descriptor, -1 = closed
+	UINT8 runStatus;	// status byte of the last channel message, 0x00 = none
+	OS_TIMER* hTimer;
+	UINT64 tmrFreq;
+	UINT64 wireFreeTime;	// time when all data written so far has been transferred
+	UINT8 buffer[RAW_BUF_SIZE];
+} RAWMIDI_PORT;
+
+typedef struct _rawmidi_device
+{
+	UINT32 sortKey;
+	char path[0x10 + NAME_MAX + 1];	// device directory + file name
+} RAWMIDI_DEV;
+
+
+static void* RawMIDI_Init(void);
+static void RawMIDI_Deinit(void* drvPort);
+static UINT8 RawMIDI_OpenDevice(void* drvPort, UINT32 id);
+static UINT8 RawMIDI_CloseDevice(void* drvPort);
+static void RawMIDI_SendShortMsg(void* drvPort, UINT8 event, UINT8 data1, UINT8 data2);
+static UINT8 RawMIDI_SendLongMsg(void* drvPort, size_t dataLen, const void* data);
+static UINT8 RawMIDI_GetPortList(MIDI_PORT_LIST* mpl);
+static UINT8 RawMIDI_SendBatch(void* drvPort, size_t count, const MIDI_MSG* msgs);
+static UINT8 RawMIDI_WaitForOutput(void* drvPort);
+static size_t EncodeShortMsg(RAWMIDI_PORT* mop, UINT8* buffer, UINT8 event, UINT8 data1, UINT8 data2);
+static UINT8 WriteData(RAWMIDI_PORT* mop, size_t dataLen, const UINT8* data);
+static void WaitForWire(RAWMIDI_PORT* mop, size_t maxPending);
+static UINT32 ScanDevices(RAWMIDI_DEV** retDevList);
+static int DevSortCompare(const void* a, const void* b);
+static char* GetDeviceName(const RAWMIDI_DEV* dev);
+
+
+const MIDIOUT_DRIVER MidiOutDrv_RawMIDI =
+{
+	MODRV_TYPE_RAWMIDI, "RawMIDI",
+	RawMIDI_Init, RawMIDI_Deinit, RawMIDI_OpenDevice, RawMIDI_CloseDevice,
+	RawMIDI_SendShortMsg, RawMIDI_SendLongMsg, RawMIDI_GetPortList,
+	NULL, NULL, NULL, NULL, NULL,
+	RawMIDI_SendBatch, RawMIDI_WaitForOutput
+};
+
+
+static void* RawMIDI_Init(void)
+{
+	RAWMIDI_PORT* mop;
+	
+	mop = (RAWMIDI_PORT*)calloc(1, sizeof(RAWMIDI_PORT));
+	if (mop == NULL)
+		return NULL;
+	
+	mop->hTimer = OSTimer_Init();
+	if (mop->hTimer == NULL)
+	{
+		free(mop);
+		return NULL;
+	}
+	mop->tmrFreq = OSTimer_GetFrequency(mop->hTimer);
+	mop->hDev = -1;
+	
+	return mop;
+}
+
+static void RawMIDI_Deinit(void* drvPort)
+{
+	RAWMIDI_PORT* mop = (RAWMIDI_PORT*)drvPort;
+	
+	if (mop->hDev >= 0)
+		RawMIDI_CloseDevice(mop);
+	OSTimer_Deinit(mop->hTimer);
+	free(mop);
+	
+	return;
+}
+
+static UINT8 RawMIDI_OpenDevice(void* drvPort, UINT32 id)
+{
+	RAWMIDI_PORT* mop = (RAWMIDI_PORT*)drvPort;
+	RAWMIDI_DEV* devList;
+	UINT32 devCount;
+	
+	if (mop->hDev >= 0)
+		return 0xFE;
+	
+	devCount = ScanDevices(&devList);
+	if (id >= devCount)
+	{
+		free(devList);
+		printf("Port not found\n");
+		return 0xF0;
+	}
+	
+	mop->hDev = open(devList[id].path, O_WRONLY);
+	if (mop->hDev < 0)
+	{
+		printf("Error opening %s: %s\n", devList[id].path, strerror(errno));
+		free(devList);
+		return 0xFF;
+	}
+	free(devList);
+	
+	mop->runStatus = 0x00;
+	mop->wireFreeTime = OSTimer_GetTime(mop->hTimer);
+	
+	return 0x00;
+}
+
+static UINT8 RawMIDI_CloseDevice(void* drvPort)
+{
+	RAWMIDI_PORT* mop = (RAWMIDI_PORT*)drvPort;
+	
+	if (mop->hDev < 0)
+		return 0xFE;
+	
+	// Closing the device discards data that is still in the kernel buffer.
+	WaitForWire(mop, 0);
+	close(mop->hDev);
+	mop->hDev = -1;
+	
+	return 0x00;
+}
+
+static void RawMIDI_SendShortMsg(void* drvPort, UINT8 event, UINT8 data1, UINT8 data2)
+{
+	RAWMIDI_PORT* mop = (RAWMIDI_PORT*)drvPort;
+	size_t dataLen;
+	
+	if (mop->hDev < 0)
+		return;
+	
+	dataLen = EncodeShortMsg(mop, mop->buffer, event, data1, data2);
+	WriteData(mop, dataLen, mop->buffer);
+	
+	return;
+}
+
+static UINT8 RawMIDI_SendLongMsg(void* drvPort, size_t dataLen, const void* data)
+{
+	RAWMIDI_PORT* mop = (RAWMIDI_PORT*)drvPort;
+	const UINT8* dataPtr = (const UINT8*)data;
+	size_t chunkLen;
+	UINT8 retVal;
+	
+	if (mop->hDev < 0)
+		return 0xFE;
+	if (! dataLen)
+		return 0x00;
+	
+	// SysEx and System Common messages cancel the running status.
+	mop->runStatus = 0x00;
+	while(dataLen > 0)
+	{
+		chunkLen = (dataLen < RAW_SYX_CHUNK) ? dataLen : RAW_SYX_CHUNK;
+		// don't write more data than the MIDI interface can transfer in time
+		WaitForWire(mop, RAW_SYX_CHUNK);
+		retVal = WriteData(mop, chunkLen, dataPtr);
+		if (retVal)
+			return retVal;
+		dataPtr += chunkLen;
+		dataLen -= chunkLen;
+	}
+	
+	return 0x00;
+}
+
+static UINT8 RawMIDI_GetPortList(MIDI_PORT_LIST* mpl)
+{
+	RAWMIDI_DEV* devList;
+	UINT32 curPort;
+	
+	mpl->count = ScanDevices(&devList);
+	mpl->ports = (MIDI_PORT_DESC*)calloc(mpl->count, sizeof(MIDI_PORT_DESC));
+	if (mpl->ports == NULL && mpl->count > 0)
+	{
+		mpl->count = 0;
+		free(devList);
+		return 0xFF;
+	}
+	
+	for (curPort = 0; curPort < mpl->count; curPort ++)
+	{
+		mpl->ports[curPort].id = curPort;
+		mpl->ports[curPort].name = GetDeviceName(&devList[curPort]);
+	}
+	free(devList);
+	
+	return 0x00;
+}
+
+static UINT8 RawMIDI_SendBatch(void* drvPort, size_t count, const MIDI_MSG* msgs)
+{
+	RAWMIDI_PORT* mop = (RAWMIDI_PORT*)drvPort;
+	size_t curMsg;
+	size_t bufPos;
+	UINT8 retVal;
+	
+	if (mop->hDev < 0)
+		return 0xFE;
+	
+	// The driver has no scheduling, so delayUS is always 0.
+	bufPos = 0;
+	for (curMsg = 0; curMsg < count; curMsg ++)
+	{
+		const MIDI_MSG* msg = &msgs[curMsg];
+		
+		if (bufPos + 3 > RAW_BUF_SIZE)
+		{
+			retVal = WriteData(mop, bufPos, mop->buffer);
+			if (retVal)
+				return retVal;
+			bufPos = 0;
+		}
+		bufPos += EncodeShortMsg(mop, &mop->buffer[bufPos], msg->data[0], msg->data[1], msg->data[2]);
+	}
+	if (bufPos > 0)
+		return WriteData(mop, bufPos, mop->buffer);
+	
+	return 0x00;
+}
+
+static UINT8 RawMIDI_WaitForOutput(void* drvPort)
+{
+	RAWMIDI_PORT* mop = (RAWMIDI_PORT*)drvPort;
+	
+	if (mop->hDev < 0)
+		return 0xFE;
+	
+	WaitForWire(mop, 0);
+	return 0x00;
+}
+
+static size_t EncodeShortMsg(RAWMIDI_PORT* mop, UINT8* buffer, UINT8 event, UINT8 data1, UINT8 data2)
+{
+	size_t dataLen;
+	size_t bufPos;
+	
+	if (event < 0x80)
+		return 0;	// ignore invalid messages
+	if (event >= 0xF8)
+	{
+		// System Realtime messages don't affect the running status
+		buffer[0] = event;
+		return 1;
+	}
+	
+	switch(event & 0xF0)
+	{
+	case 0xC0:
+	case 0xD0:
+		dataLen = 1;
+		break;
+	case 0xF0:
+		if (event == 0xF1 || event == 0xF3)
+			dataLen = 1;
+		else if (event == 0xF2)
+			dataLen = 2;
+		else
+			dataLen = 0;
+		break;
+	default:
+		dataLen = 2;
+		break;
+	}
+	
+	bufPos = 0;
+	if (event >= 0xF0)
+	{
+		mop->runStatus = 0x00;	// System Common messages cancel the running status
+		buffer[bufPos++] = event;
+	}
+	else if (event != mop->runStatus)
+	{
+		mop->runStatus = event;
+		buffer[bufPos++] = event;
+	}
+	if (dataLen >= 1)
+		buffer[bufPos++] = data1 & 0x7F;
+	if (dataLen >= 2)
+		buffer[bufPos++] = data2 & 0x7F;
+	
+	return bufPos;
+}
+
+static UINT8 WriteData(RAWMIDI_PORT* mop, size_t dataLen, const UINT8* data)
+{
+	UINT64 curTime;
+	ssize_t wrtBytes;
+	size_t remLen;
+	
+	if (! dataLen)
+		return 0x00;
+	
+	curTime = OSTimer_GetTime(mop->hTimer);
+	if (mop->wireFreeTime < curTime)
+		mop->wireFreeTime = curTime;
+	mop->wireFreeTime += dataLen * mop->tmrFreq / MIDI_BYTE_RATE;
+	
+	remLen = dataLen;
+	while(remLen > 0)
+	{
+		wrtBytes = write(mop->hDev, data, remLen);
+		if (wrtBytes < 0)
+		{
+			if (errno == EINTR || errno == EAGAIN)
+				continue;
+			printf("Raw MIDI write error: %s\n", strerror(errno));
+			mop->runStatus = 0x00;	// the device may have received only a part of the data
+			return 0xFF;
+		}
+		data += wrtBytes;
+		remLen -= (size_t)wrtBytes;
+	}
+	
+	return 0x00;
+}
+
+static void WaitForWire(RAWMIDI_PORT* mop, size_t maxPending)
+{
+	// wait until at most "maxPending" bytes are still waiting to be transferred
+	UINT64 maxTime;
+	
+	maxTime = maxPending * mop->tmrFreq / MIDI_BYTE_RATE;
+	if (mop->wireFreeTime <= maxTime)
+		return;
+	maxTime = mop->wireFreeTime - maxTime;
+	OSTimer_SleepUntil(mop->hTimer, maxTime);
+	
+	return;
+}
+
+static UINT32 ScanDevices(RAWMIDI_DEV** retDevList)
+{
+	// The list is sorted, so that port IDs stay the same as long as no devices are added or removed.
+	static const char* DEV_DIRS[2] = {"/dev/snd", "/dev"};
+	RAWMIDI_DEV* devList;
+	UINT32 devCount;
+	UINT32 devAlloc;
+	UINT8 curDir;
+	DIR* hDir;
+	struct dirent* dirEnt;
+	unsigned int card;
+	unsigned int device;
+	char endChr;
+	
+	devCount = 0;
+	devAlloc = 0x10;
+	devList = (RAWMIDI_DEV*)malloc(devAlloc * sizeof(RAWMIDI_DEV));
+	if (devList == NULL)
+	{
+		*retDevList = NULL;
+		return 0;
+	}
+	
+	for (curDir = 0; curDir < 2; curDir ++)
+	{
+		hDir = opendir(DEV_DIRS[curDir]);
+		if (hDir == NULL)
+			continue;
+		while((dirEnt = readdir(hDir)) != NULL)
+		{
+			RAWMIDI_DEV* dev;
+			UINT32 sortKey;
+			int pathLen;
+			
+			if (curDir == 0)
+			{
+				// ALSA: midiC[card]D[device]
+				if (sscanf(dirEnt->d_name, "midiC%uD%u%c", &card, &device, &endChr) != 2)
+					continue;
+				sortKey = ((card & 0xFF) << 8) | ((device & 0xFF) << 0);
+			}
+			else
+			{
+				// OSS: midi[number]
+				if (sscanf(dirEnt->d_name, "midi%u%c", &device, &endChr) != 1)
+					continue;
+				sortKey = 0x10000 | (device & 0xFFFF);
+			}
+			
+			if (devCount >= devAlloc)
+			{
+				RAWMIDI_DEV* newList;
+				
+				newList = (RAWMIDI_DEV*)realloc(devList, devAlloc * 2 * sizeof(RAWMIDI_DEV));
+				if (newList == NULL)
+					break;
+				devList = newList;
+				devAlloc *= 2;
+			}
+			dev = &devList[devCount];
+			dev->sortKey = sortKey;
+			pathLen = snprintf(dev->path, sizeof(dev->path), "%s/%s", DEV_DIRS[curDir], dirEnt->d_name);
+			if (pathLen < 0 || (size_t)pathLen >= sizeof(dev->path))
+				continue;	// truncated path - skip the device, it couldn't be opened anyway
+			devCount ++;
+		}
+		closedir(hDir);
+	}
+	
+	qsort(devList, devCount, sizeof(RAWMIDI_DEV), DevSortCompare);
+	*retDevList = devList;
+	return devCount;
+}
+
+static int DevSortCompare(const void* a, const void* b)
+{
+	const RAWMIDI_DEV* devA = (const RAWMIDI_DEV*)a;
+	const RAWMIDI_DEV* devB = (const RAWMIDI_DEV*)b;
+	
+	if (devA->sortKey != devB->sortKey)
+		return (devA->sortKey < devB->sortKey) ? -1 : +1;
+	return strcmp(devA->path, devB->path);
+}
+
+static char* GetDeviceName(const RAWMIDI_DEV* dev)
+{
+	// returns "device name [device path]", the name is read from /proc/asound for ALSA devices
+	char procPath[0x40];
+	char devName[0x80];
+	char* result;
+	FILE* hFile;
+	size_t nameLen;
+	
+	strcpy(devName, "Raw MIDI");
+	if (! (dev->sortKey & 0x10000))
+	{
+		snprintf(procPath, sizeof(procPath), "/proc/asound/card%u/midi%u",
+				(dev->sortKey >> 8) & 0xFF, (dev->sortKey >> 0) & 0xFF);
+		hFile = fopen(procPath, "rt");
+		if (hFile != NULL)
+		{
+			// The first line of the file contains the device name.
+			if (fgets(devName, sizeof(devName), hFile) == NULL)
+				strcpy(devName, "Raw MIDI");
+			fclose(hFile);
+		}
+		nameLen = strlen(devName);
+		while(nameLen > 0 && (devName[nameLen - 1] == '\n' || devName[nameLen - 1] == ' '))
+			nameLen --;
+		devName[nameLen] = '\0';
+	}
+	
+	result = (char*)malloc(strlen(devName) + 3 + strlen(dev->path) + 1 + 1);
+	if (result != NULL)
+		sprintf(result, "%s [%s]", devName, dev->path);
+	return result;
+}
@@ -9,22 +9,44 @@
 
 #include <stdtype.h>
 #include "MidiOut.h"
+#include "MidiOut_Drv.h"
 
 #ifdef _MSC_VER
 #define strdup	_strdup
 #endif
 
-//typedef struct _midiout_port MIDIOUT_PORT;
-struct _midiout_port
+typedef struct _winmm_port
 {
 	HMIDIOUT hMidiOut;
+} WINMM_PORT;
+
+
+static void* WinMM_Init(void);
+static void WinMM_Deinit(void* drvPort);
+static UINT8 WinMM_OpenDevice(void* drvPort, UINT32 id);
+static UINT8 WinMM_CloseDevice(void* drvPort);
+static void WinMM_SendShortMsg(void* drvPort, UINT8 event, UINT8 data1, UINT8 data2);
+static UINT8 WinMM_DoLongMsg(WINMM_PORT* mop, size_t dataLen, const void* data);
+static UINT8 WinMM_SendLongMsg(void* drvPort, size_t dataLen, const void* data);
+static UINT8 WinMM_SendBatch(void* drvPort, size_t count, const MIDI_MSG* msgs);
+static UINT8 WinMM_GetPortList(MIDI_PORT_LIST* mpl);
+
+
+const MIDIOUT_DRIVER MidiOutDrv_WinMM =
+{
+	MODRV_TYPE_SYSTEM, "WinMM",
+	WinMM_Init, WinMM_Deinit, WinMM_OpenDevice, WinMM_CloseDevice,
+	WinMM_SendShortMsg, WinMM_SendLongMsg, WinMM_GetPortList,
+	NULL, NULL, NULL, NULL, NULL,
+	WinMM_SendBatch, NULL
 };
 
-MIDIOUT_PORT* MidiOutPort_Init(void)
+
+static void* WinMM_Init(void)
 {
-	MIDIOUT_PORT* mop;
+	WINMM_PORT* mop;
 	
-	mop = (MIDIOUT_PORT*)calloc(1, sizeof(MIDIOUT_PORT));
+	mop = (WINMM_PORT*)calloc(1, sizeof(WINMM_PORT));
 	if (mop == NULL)
 		return NULL;
 	
@@ -33,18 +55,21 @@ MIDIOUT_PORT* MidiOutPort_Init(void)
 	return mop;
 }
 
-void MidiOutPort_Deinit(MIDIOUT_PORT* mop)
+static void WinMM_Deinit(void* drvPort)
 {
+	WINMM_PORT* mop = (WINMM_PORT*)drvPort;
+	
 	if (mop->hMidiOut != NULL)
-		MidiOutPort_CloseDevice(mop);
+		WinMM_CloseDevice(mop);
 	
 	free(mop);
 	
 	return;
 }
 
-UINT8 MidiOutPort_OpenDevice(MIDIOUT_PORT* mop, UINT32 id)
+static UINT8 WinMM_OpenDevice(void* drvPort, UINT32 id)
 {
+	WINMM_PORT* mop = (WINMM_PORT*)drvPort;
 	MMRESULT retMM;
 	
 	if (mop->hMidiOut != NULL)
@@ -56,8 +81,9 @@ UINT8 MidiOutPort_OpenDevice(MIDIOUT_PORT* mop, UINT32 id)
 	return 0x00;
 }
 
-UINT8 MidiOutPort_CloseDevice(MIDIOUT_PORT* mop)
+static UINT8 WinMM_CloseDevice(void* drvPort)
 {
+	WINMM_PORT* mop = (WINMM_PORT*)drvPort;
 	MMRESULT retMM;
 	
 	if (mop->hMidiOut == NULL)
@@ -71,8 +97,9 @@ UINT8 MidiOutPort_CloseDevice(MIDIOUT_PORT* mop)
 	return 0x00;
 }
 
-void MidiOutPort_SendShortMsg(MIDIOUT_PORT* mop, UINT8 event, UINT8 data1, UINT8 data2)
+static void WinMM_SendShortMsg(void* drvPort, UINT8 event, UINT8 data1, UINT8 data2)
 {
+	WINMM_PORT* mop = (WINMM_PORT*)drvPort;
 	DWORD midiMsg;
 	
 	if (mop->hMidiOut == NULL)
@@ -84,7 +111,7 @@ void MidiOutPort_SendShortMsg(MIDIOUT_PORT* mop, UINT8 event, UINT8 data1, UINT8
 	return;
 }
 
-static UINT8 MidiOutPort_DoLongMsg(MIDIOUT_PORT* mop, size_t dataLen, const void* data)
+static UINT8 WinMM_DoLongMsg(WINMM_PORT* mop, size_t dataLen, const void* data)
 {
 	MIDIHDR mHdr;
 	MMRESULT retMM;
@@ -115,11 +142,13 @@ static UINT8 MidiOutPort_DoLongMsg(MIDIOUT_PORT* mop, size_t dataLen, const void
 	return 0x00;
 }
 
-UINT8 MidiOutPort_SendLongMsg(MIDIOUT_PORT* mop, size_t dataLen, const void* data)
+static UINT8 WinMM_SendLongMsg(void* drvPort, size_t dataLen, const void* data)
 {
+	WINMM_PORT* mop = (WINMM_PORT*)drvPort;
+	
 	if (! IsBadWritePtr((LPVOID)data, dataLen))
 	{
-		return MidiOutPort_DoLongMsg(mop, dataLen, data);
+		return WinMM_DoLongMsg(mop, dataLen, data);
 	}
 	else
 	{
@@ -131,14 +160,33 @@ UINT8 MidiOutPort_SendLongMsg(MIDIOUT_PORT* mop, size_t dataLen, const void* dat
 		dupData = malloc(dataLen);
 		memcpy(dupData, data, dataLen);
 		
-		retVal = MidiOutPort_DoLongMsg(mop, dataLen, dupData);
+		retVal = WinMM_DoLongMsg(mop, dataLen, dupData);
 		
 		free(dupData);
 		return retVal;
 	}
 }
 
-UINT8 MidiOut_GetPortList(MIDI_PORT_LIST* mpl)
+static UINT8 WinMM_SendBatch(void* drvPort, size_t count, const MIDI_MSG* msgs)
+{
+	WINMM_PORT* mop = (WINMM_PORT*)drvPort;
+	size_t curMsg;
+	
+	if (mop->hMidiOut == NULL)
+		return 0xFE;
+	
+	// WinMM has no API for sending multiple short messages at once,
+	// but this saves the driver dispatch and checks for each message.
+	for (curMsg = 0; curMsg < count; curMsg ++)
+	{
+		const UINT8* data = msgs[curMsg].data;
+		midiOutShortMsg(mop->hMidiOut, (data[0] << 0) | (data[1] << 8) | (data[2] << 16));
+	}
+	
+	return 0x00;
+}
+
+static UINT8 WinMM_GetPortList(MIDI_PORT_LIST* mpl)
 {
 	UINT32 curPort;
 	UINT devID;
@@ -172,16 +220,3 @@ UINT8 MidiOut_GetPortList(MIDI_PORT_LIST* mpl)
 	
 	return 0x00;
 }
-
-void MidiOut_FreePortList(MIDI_PORT_LIST* mpl)
-{
-	UINT32 curPort;
-	
-	for (curPort = 0; curPort < mpl->count; curPort ++)
-		free(mpl->ports[curPort].name);
-	
-	mpl->count = 0;
-	free(mpl->ports);	mpl->ports = NULL;
-	
-	return;
-}
@@ -4,9 +4,9 @@
 #include <math.h>	// for pow()
 #include <vector>
 #include <list>
-#include <queue>
 #include <string>
 #include <algorithm>
+#include <functional>	// for std::greater
 
 #include "MidiLib.hpp"
 #include "MidiOut.h"
@@ -32,9 +32,28 @@
 #define snprintf	_snprintf
 #endif
 
+// track heap key: bits 16..47 = tick of the next event, bits 0..15 = track ID
+#define TRKHEAP_KEY(tick, trkID)	(((UINT64)(tick) << 16) | (UINT16)(trkID))
+#define TRKHEAP_TICK(key)			(UINT32)((key) >> 16)
+#define TRKHEAP_TRACK(key)			(UINT16)((key) & 0xFFFF)
+
+// size of the event queue for delayed ports
+#define MEQ_EVT_COUNT	0x1000
+#define MEQ_DATA_SIZE	0x10000	// buffer size for SysEx data
+
+#define CHKPT_INTERVAL	15	// song time (in seconds) between two seek checkpoints
+#define INSCACHE_MAX_SIZE	0x4000	// instrument resolution cache: number of entries before it is flushed
+
+#define RENDER_RESOLUTION	1000	// render mode: ticks per quarter note
+#define RENDER_TEMPO		500000	// render mode: 120 BPM
+#define RENDER_TICK_RATE	(RENDER_RESOLUTION * 1000000 / RENDER_TEMPO)	// render mode: ticks per second
+
 #define TICK_FP_SHIFT	8
 #define TICK_FP_MUL		(1 << TICK_FP_SHIFT)
 
+#define MIDI_BYTE_RATE	3125	// MIDI transfer rate: 31250 bits per second, 10 bits per byte
+#define WIRE_SAT_TIME	5		// link model: transfers that take longer than this [ms] are considered saturated
+
 #define FULL_CHN_ID(portID, midChn)	(((portID) << 4) | ((midChn) << 0))
 
 #define BNKBIT_MSB		0
@@ -75,8 +94,6 @@ static const UINT8 CM32P_DEF_INS[0x40] =
 	75, 77, 78, 79, 80, 81, 82, 83,
 };
 
-static DisplayOptions* dispOpts;
-static bool tmpSyxIgnore = false;
 
 static inline UINT32 ReadBE24(const UINT8* data)
 {
@@ -93,18 +110,121 @@ static inline UINT32 ReadBE21(const UINT8* data)	// 3 bytes, 7 bits per byte
 	return ((data[0x00] & 0x7F) << 14) | ((data[0x01] & 0x7F) << 7) | ((data[0x02] & 0x7F) << 0);
 }
 
+static UINT32 GetShortMsgSize(UINT8 event)
+{
+	switch(event & 0xF0)
+	{
+	case 0xC0:
+	case 0xD0:
+		return 2;
+	case 0xF0:
+		if (event == 0xF1 || event == 0xF3)
+			return 2;
+		else if (event == 0xF2)
+			return 3;
+		return 1;
+	default:
+		return 3;
+	}
+}
+
+// message classes for the link model, in the order they are sent when the link is saturated
+// (Messages are only moved across channels, the order within a channel is always kept.)
+#define WMC_NOTE_OFF	0	// Note Off, frees voices
+#define WMC_SETUP		1	// instrument changes, RPNs, switches, channel mode and system messages
+#define WMC_NOTE_ON		2
+#define WMC_DEFER		3	// continuous controllers, pitch bend, aftertouch
+static UINT8 GetWireMsgClass(const MIDI_MSG& msg)
+{
+	switch(msg.data[0] & 0xF0)
+	{
+	case 0x80:
+		return WMC_NOTE_OFF;
+	case 0x90:
+		return msg.data[2] ? WMC_NOTE_ON : WMC_NOTE_OFF;
+	case 0xA0:
+	case 0xD0:
+	case 0xE0:
+		return WMC_DEFER;
+	case 0xB0:
+		switch(msg.data[1])
+		{
+		case 0x00:	// Bank MSB
+		case 0x20:	// Bank LSB
+		case 0x06:	// Data Entry MSB
+		case 0x26:	// Data Entry LSB
+			return WMC_SETUP;
+		default:
+			if (msg.data[1] >= 0x40 && msg.data[1] <= 0x45)
+				return WMC_SETUP;	// switches (Sustain, Portamento, Sostenuto, ...)
+			if (msg.data[1] >= 0x60 && msg.data[1] <= 0x65)
+				return WMC_SETUP;	// Data Increment/Decrement, NRPN, RPN
+			if (msg.data[1] >= 0x78)
+				return WMC_SETUP;	// Channel Mode messages
+			return WMC_DEFER;
+		}
+	default:
+		return WMC_SETUP;
+	}
+}
+
+static UINT8 GetFilterCtrlID(const MIDI_MSG& msg)
+{
+	// returns the index for the controller output filter, 0xFF = message isn't filtered
+	if (GetWireMsgClass(msg) != WMC_DEFER)
+		return 0xFF;
+	switch(msg.data[0] & 0xF0)
+	{
+	case 0xB0:
+		return msg.data[1];
+	case 0xE0:
+		return 0x80;
+	case 0xD0:
+		return 0x81;
+	default:
+		return 0xFF;	// Polyphonic Aftertouch is bound to the note
+	}
+}
+
+static UINT8 GetLateBucket(UINT32 lateUS)
+{
+	// 0..3 us get a bucket each, above that there are 4 buckets per power of 2 (error < 25 %)
+	UINT8 msb;
+	
+	if (lateUS < 4)
+		return (UINT8)lateUS;
+	for (msb = 2; (lateUS >> msb) > 1; msb ++)
+		;
+	return (UINT8)(((msb - 1) << 2) | ((lateUS >> (msb - 2)) & 0x03));
+}
+
+static UINT32 GetLateBucketMax(UINT8 bucket)
+{
+	UINT8 shift;
+	
+	if (bucket < 4)
+		return bucket;
+	shift = (bucket >> 2) - 1;
+	return ((UINT32)(0x04 | (bucket & 0x03)) << shift) + ((1U << shift) - 1);
+}
+
 MidiPlayer::MidiPlayer() :
 	_useManualTiming(false), _cMidi(NULL), _songLength(0),
 	_insBankGM1(NULL), _insBankGM2(NULL), _insBankGS(NULL), _insBankXG(NULL), _insBankYGS(NULL), _insBankKorg(NULL), _insBankMT32(NULL),
-	_hardReset(true), _manTimeTick(0)
+	_outBatchDepth(0), _ctrlMinDist(0), _ctrlPendCount(0), _timingStats(), _renderFile(NULL),
+	_manTimeTick(0), _outLookahead(0), _outQueuedUntil(0), _trkHeapDirty(true), _compActive(false), _hardReset(true), _chaseMode(false), _tmpSyxIgnore(false)
 {
-	dispOpts = vis_get_options();
+	_dispOpts = vis_get_options();
 	_osTimer = OSTimer_Init();
 	_tmrFreq = OSTimer_GetFrequency(_osTimer) << TICK_FP_SHIFT;
 }
 
 MidiPlayer::~MidiPlayer()
 {
+	size_t curPort;
+	
+	for (curPort = 0; curPort < _midiEvtQueue.size(); curPort ++)
+		delete _midiEvtQueue[curPort];
 	OSTimer_Deinit(_osTimer);
 }
 
@@ -144,13 +264,23 @@ void MidiPlayer::SetOutputPorts(const std::vector<MIDIOUT_PORT*>& outPorts, cons
 	
 	_outPorts = outPorts;
 	_outPortDelay.resize(_outPorts.size(), 0);	// resize + fill with value 0
-	_midiEvtQueue.resize(_outPorts.size());
+	InvalidateCheckpoints();
+	for (size_t curPort = _outPorts.size(); curPort < _midiEvtQueue.size(); curPort ++)
+		delete _midiEvtQueue[curPort];
+	_midiEvtQueue.resize(_outPorts.size(), NULL);
+	for (size_t curPort = 0; curPort < _midiEvtQueue.size(); curPort ++)
+	{
+		if (_outPortDelay[curPort] > 0 && _midiEvtQueue[curPort] == NULL)
+			_midiEvtQueue[curPort] = new MidiEvtQueue(MEQ_EVT_COUNT, MEQ_DATA_SIZE);
+	}
 	
 	size_t portCnt = _outPorts.size();
 	if (! _portChnMask.empty())
 		portCnt = (portCnt + _portChnMask.size() - 1) / _portChnMask.size();
-	if (! _outPorts.empty() && _outPorts[0] == NULL)
+	if (! _outPorts.empty() && _outPorts[0] == NULL && _renderFile == NULL)
 		_outPorts.clear();	// was filled with NULLs to indicate number of devices in "dummy output" mode
+	_outBatchMsgs.assign(_outPorts.size(), std::vector<MIDI_MSG>());
+	_outBatchTimes.assign(_outPorts.size(), std::vector<UINT64>());
 	
 	if (_noteVis.GetChnGroupCount() == portCnt)
 	{
@@ -172,11 +302,14 @@ void MidiPlayer::SetOutputPorts(const std::vector<MIDIOUT_PORT*>& outPorts, cons
 void MidiPlayer::SetOutPortMapping(size_t numPorts, const size_t* outPorts)
 {
 	_portMap.assign(outPorts, outPorts + numPorts);
+	InvalidateCheckpoints();
 }
 
 void MidiPlayer::SetOptions(const PlayerOpts& plrOpts)
 {
 	_options = plrOpts;
+	InvalidateCheckpoints();
+	_insCache.clear();
 	if (_playing)
 		RefreshSrcDevSettings();
 	
@@ -201,6 +334,8 @@ MidiModOpts MidiPlayer::GetPortOptions(void) const
 void MidiPlayer::SetSrcModuleType(UINT8 modType, bool insRefresh)
 {
 	_options.srcType = modType;
+	InvalidateCheckpoints();
+	_insCache.clear();
 	if (_playing)
 	{
 		RefreshSrcDevSettings();
@@ -214,6 +349,8 @@ void MidiPlayer::SetSrcModuleType(UINT8 modType, bool insRefresh)
 void MidiPlayer::SetDstModuleType(UINT8 modType, bool chnRefresh)
 {
 	_options.dstType = modType;
+	InvalidateCheckpoints();
+	_insCache.clear();
 	if (_playing && chnRefresh)
 		AllChannelRefresh();
 	
@@ -222,6 +359,8 @@ void MidiPlayer::SetDstModuleType(UINT8 modType, bool chnRefresh)
 
 void MidiPlayer::SetInstrumentBank(UINT8 moduleType, const INS_BANK* insBank)
 {
+	InvalidateCheckpoints();
+	_insCache.clear();
 	switch(moduleType)
 	{
 	case MODULE_GM_1:
@@ -255,6 +394,54 @@ void MidiPlayer::SetInstrumentBank(UINT8 moduleType, const INS_BANK* insBank)
 	return;
 }
 
+void MidiPlayer::SetRenderOutput(MidiFile* outFile)
+{
+	size_t curTrk;
+	
+	if (_renderFile != NULL)
+	{
+		// finish the current file: end all tracks at the same tick
+		UINT32 endTick = 0;
+		for (curTrk = 0; curTrk < _renderFile->GetTrackCount(); curTrk ++)
+		{
+			UINT32 trkTick = _renderFile->GetTrack(curTrk)->GetTickCount();
+			if (endTick < trkTick)
+				endTick = trkTick;
+		}
+		for (curTrk = 0; curTrk < _renderFile->GetTrackCount(); curTrk ++)
+		{
+			MidiTrack* mTrk = _renderFile->GetTrack(curTrk);
+			mTrk->AppendMetaEvent(endTick - mTrk->GetTickCount(), 0x2F, 0, NULL);
+		}
+	}
+	
+	_renderFile = outFile;
+	_renderTrks.clear();
+	if (_renderFile != NULL)
+	{
+		static const UINT8 tempoData[3] = {(RENDER_TEMPO >> 16) & 0xFF, (RENDER_TEMPO >> 8) & 0xFF, (RENDER_TEMPO >> 0) & 0xFF};
+		
+		_renderFile->ClearAll();
+		_renderFile->SetMidiFormat(1);
+		_renderFile->SetMidiResolution(RENDER_RESOLUTION);
+		_renderFile->NewTrack_Append()->AppendMetaEvent(0, 0x51, 3, tempoData);	// conductor track
+		
+		if (_outPorts.empty() && ! _outPortDelay.empty())
+		{
+			// "dummy output" mode: restore the port list, so that all ports get rendered
+			_outPorts.resize(_outPortDelay.size(), NULL);
+			InitChannelAssignment();
+		}
+	}
+	else if (! _outPorts.empty() && _outPorts[0] == NULL)
+	{
+		_outPorts.clear();	// back to "dummy output" mode
+		InitChannelAssignment();
+	}
+	
+	return;
+}
+
 UINT64 MidiPlayer::Timer_GetTime(void) const
 {
 	if (! _useManualTiming)
@@ -265,35 +452,43 @@ UINT64 MidiPlayer::Timer_GetTime(void) const
 
 void MidiPlayer::SendMidiEventS(size_t portID, UINT8 event, UINT8 data1, UINT8 data2)
 {
-	if (portID >= _outPorts.size())
-		return;
+	if (portID >= _outPorts.size() || _chaseMode)
+		return;	// Note: the channel state is sent by AllChannelRefresh() after seeking
+	if (! _ctrlOutStates.empty())
+	{
+		// A note must start with the current controller/pitch bend values of its channel.
+		if ((event & 0xF0) == 0x90 && data2 > 0 && _ctrlPendCount)
+			CtrlFilter_FlushChannel(portID, event & 0x0F);
+		if (CtrlFilter_Check(portID, event, data1, data2))
+			return;	// repeated value or held back by the rate limit
+	}
 	if (_outPortDelay[portID] == 0)
 	{
-		MidiOutPort_SendShortMsg(_outPorts[portID], event, data1, data2);
+		PortSendShortMsg(portID, _tmrStep, event, data1, data2);
 		return;
 	}
-	MidiQueueEvt evt;
-	evt.time = _tmrStep + _outPortDelay[portID] * _tmrFreq / 1000;
-	evt.flag = 0x00;
+	UINT8 evtFlag;
+	UINT8 evtData[3];
+	
+	evtFlag = 0x00;
 	{
 		UINT16 portChnID = FULL_CHN_ID(portID, event & 0x0F) % _chnStates.size();
 		if (! _chnStates[portChnID].notes.empty())
-			evt.flag |= 0x01;	// mark as "unmovable" when notes are still playing
+			evtFlag |= 0x01;	// mark as "unmovable" when notes are still playing
 	}
 	if ((event & 0xE0) == 0x80)
 	{
-		evt.flag |= 0x01;	// mark Note Off/On
+		evtFlag |= 0x01;	// mark Note Off/On
 	}
 	else if ((event & 0xF0) == 0xC0)
 	{
-		evt.flag |= 0x02;	// mark patch change
+		evtFlag |= 0x02;	// mark patch change
 		_meqDoSort = true;
 	}
-	evt.data.resize(3);
-	evt.data[0] = event;
-	evt.data[1] = data1;
-	evt.data[2] = data2;
-	_midiEvtQueue[portID].emplace(evt);
+	evtData[0] = event;
+	evtData[1] = data1;
+	evtData[2] = data2;
+	EvtQueue_Push(portID, evtFlag, 3, evtData);
 	return;
 }
 
@@ -301,19 +496,743 @@ void MidiPlayer::SendMidiEventL(size_t portID, size_t dataLen, const void* data)
 {
 	if (portID >= _outPorts.size())
 		return;
+	if (_chaseMode)
+	{
+		const UINT8* dataPtr = (const UINT8*)data;
+		std::vector<ChaseSyxMsg>::iterator msgIt;
+		
+		// keep only the last instance of repeated messages (e.g. multiple resets or parameter changes)
+		if (dataLen >= 2 && dataPtr[0] == 0xF0 && dataPtr[dataLen - 1] == 0xF7)
+		{
+			for (msgIt = _chaseSyx.begin(); msgIt != _chaseSyx.end(); ++msgIt)
+			{
+				if (msgIt->portID == portID && msgIt->data.size() == dataLen &&
+					! memcmp(&msgIt->data[0], dataPtr, dataLen))
+				{
+					_chaseSyx.erase(msgIt);
+					break;
+				}
+			}
+		}
+		ChaseSyxMsg csm;
+		csm.portID = (UINT8)portID;
+		csm.data.assign(dataPtr, dataPtr + dataLen);
+		_chaseSyx.push_back(csm);
+		return;
+	}
+	if (! _ctrlOutStates.empty())
+		CtrlFilter_InvalidatePort(portID);	// SysEx messages may change any controller (e.g. resets)
 	if (_outPortDelay[portID] == 0)
 	{
-		MidiOutPort_SendLongMsg(_outPorts[portID], dataLen, data);
+		PortSendLongMsg(portID, _tmrStep, dataLen, data);
+		return;
+	}
+	EvtQueue_Push(portID, 0x00, (UINT32)dataLen, (const UINT8*)data);
+	return;
+}
+
+void MidiPlayer::EvtQueue_Push(size_t portID, UINT8 flag, UINT32 dataLen, const UINT8* data)
+{
+	MidiEvtQueue* meq = _midiEvtQueue[portID];
+	UINT64 evtTime = _tmrStep + _outPortDelay[portID] * _tmrFreq / 1000;
+	
+	while(! meq->Push(evtTime, flag, dataLen, data))
+	{
+		if (meq->IsEmpty())
+		{
+			// The message doesn't fit into the empty queue, so it must be sent right away.
+			PortSendLongMsg(portID, evtTime, dataLen, data);
+			return;
+		}
+		// The queue is full: send the oldest event early to make room.
+		// Note: This consumes events, which is fine as long as the player also drains the queue.
+		EvtQueue_SendFront(portID);
+	}
+	return;
+}
+
+void MidiPlayer::EvtQueue_SendFront(size_t portID)
+{
+	MidiEvtQueue* meq = _midiEvtQueue[portID];
+	const MidiQueueEvt& evt = meq->Front();
+	
+	if (portID < _outPorts.size())
+	{
+		if (evt.data[0] < 0xF0)
+			PortSendShortMsg(portID, evt.time, evt.data[0], evt.data[1], evt.data[2]);
+		else
+			PortSendLongMsg(portID, evt.time, evt.dataLen, meq->GetData(evt));
+	}
+	meq->Pop();
+	return;
+}
+
+void MidiPlayer::PortSendShortMsg(size_t portID, UINT64 time, UINT8 event, UINT8 data1, UINT8 data2)
+{
+	if (_renderFile == NULL)
+	{
+		if (_outBatchDepth && portID < _outBatchMsgs.size())
+		{
+			MIDI_MSG msg;
+			msg.delayUS = 0;
+			msg.data[0] = event;
+			msg.data[1] = data1;
+			msg.data[2] = data2;
+			_outBatchMsgs[portID].push_back(msg);
+			_outBatchTimes[portID].push_back(time);
+		}
+		else
+		{
+			if (portID < _wireStats.size())
+				Wire_SendData(portID, time, GetShortMsgSize(event));
+			Timing_RecordSend(1, &time);
+			if (_outLookahead)
+				MidiOutPort_SendShortMsgDelayed(_outPorts[portID], GetOutputDelay(time), event, data1, data2);
+			else
+				MidiOutPort_SendShortMsg(_outPorts[portID], event, data1, data2);
+		}
+		return;
+	}
+	if (event >= 0xF0)
+		return;	// System Common/Realtime messages can't be stored in MIDI files
+	
+	MidiEvent midiEvt = MidiTrack::CreateEvent_Std(event, data1, data2);
+	MidiTrack* mTrk = GetRenderTrack(portID, time, &midiEvt.tick);
+	mTrk->AppendEvent(midiEvt);
+	return;
+}
+
+void MidiPlayer::PortSendLongMsg(size_t portID, UINT64 time, size_t dataLen, const void* data)
+{
+	if (_renderFile == NULL)
+	{
+		SendOutputBatch(portID);	// keep the order of the messages
+		if (portID < _wireStats.size())
+			Wire_SendData(portID, time, (UINT32)dataLen);
+		Timing_RecordSend(1, &time);
+		if (_outLookahead)
+			MidiOutPort_SendLongMsgDelayed(_outPorts[portID], GetOutputDelay(time), dataLen, data);
+		else
+			MidiOutPort_SendLongMsg(_outPorts[portID], dataLen, data);
+		return;
+	}
+	if (! dataLen)
+		return;
+	
+	const UINT8* dataPtr = (const UINT8*)data;
+	MidiEvent midiEvt;
+	if (dataPtr[0] == 0xF0)
+	{
+		midiEvt = MidiTrack::CreateEvent_SysEx((UINT32)dataLen - 1, &dataPtr[1]);
+	}
+	else
+	{
+		// store anything else as "escaped" data (F7 event)
+		midiEvt = MidiTrack::CreateEvent_SysEx((UINT32)dataLen, dataPtr);
+		midiEvt.evtType = 0xF7;
+	}
+	MidiTrack* mTrk = GetRenderTrack(portID, time, &midiEvt.tick);
+	mTrk->AppendEvent(midiEvt);
+	return;
+}
+
+UINT32 MidiPlayer::GetOutputDelay(UINT64 time)
+{
+	UINT64 curTime = Timer_GetTime();
+	
+	if (time <= curTime)
+		return 0;	// send as soon as possible
+	if (_outQueuedUntil < time)
+		_outQueuedUntil = time;
+	return (UINT32)((time - curTime) * 1000000 / _tmrFreq);
+}
+
+void MidiPlayer::ApplyOutputScheduling(void)
+{
+	// Scheduled output lets the driver deliver the messages at the right time, so that
+	// the timing doesn't depend on how fast the player thread wakes up.
+	// The player processes the song ahead of time by the "lookahead" amount for this.
+	bool useSched = (_options.outLookahead > 0 && ! _useManualTiming && _renderFile == NULL);
+	size_t curPort;
+	
+	_outLookahead = 0;
+	_outQueuedUntil = 0;
+	for (curPort = 0; curPort < _outPorts.size() && useSched; curPort ++)
+	{
+		if (_outPorts[curPort] != NULL && MidiOutPort_SetScheduling(_outPorts[curPort], 1))
+			useSched = false;	// not supported by the driver
+	}
+	if (! useSched)
+	{
+		// use direct output on all ports
+		for (curPort = 0; curPort < _outPorts.size(); curPort ++)
+		{
+			if (_outPorts[curPort] != NULL)
+				MidiOutPort_SetScheduling(_outPorts[curPort], 0);
+		}
+		return;
+	}
+	_outLookahead = (UINT64)_options.outLookahead * _tmrFreq / 1000;
+	
+	return;
+}
+
+void MidiPlayer::FlushOutputPorts(void)
+{
+	size_t curPort;
+	
+	if (! _outLookahead)
+		return;
+	// pass all scheduled messages of this processing step to the driver at once
+	for (curPort = 0; curPort < _outPorts.size(); curPort ++)
+	{
+		if (_outPorts[curPort] != NULL)
+			MidiOutPort_Flush(_outPorts[curPort]);
+	}
+	
+	return;
+}
+
+void MidiPlayer::BeginOutputBatch(void)
+{
+	_outBatchDepth ++;
+	return;
+}
+
+void MidiPlayer::EndOutputBatch(void)
+{
+	size_t curPort;
+	
+	if (! _outBatchDepth)
+		return;
+	_outBatchDepth --;
+	if (_outBatchDepth)
+		return;	// nested batch - the outermost one sends the messages
+	
+	for (curPort = 0; curPort < _outBatchMsgs.size(); curPort ++)
+		SendOutputBatch(curPort);
+	
+	return;
+}
+
+void MidiPlayer::SendOutputBatch(size_t portID)
+{
+	if (portID >= _outBatchMsgs.size() || _outBatchMsgs[portID].empty())
+		return;
+	
+	std::vector<MIDI_MSG>& msgs = _outBatchMsgs[portID];
+	std::vector<UINT64>& times = _outBatchTimes[portID];
+	size_t curMsg;
+	
+	if (portID < _wireStats.size())
+		Wire_PrepareBatch(portID);
+	if (_outLookahead)
+	{
+		// calculate the delays right before sending, so that they are as exact as possible
+		for (curMsg = 0; curMsg < msgs.size(); curMsg ++)
+			msgs[curMsg].delayUS = GetOutputDelay(times[curMsg]);
+	}
+	Timing_RecordSend(times.size(), &times[0]);
+	MidiOutPort_SendBatch(_outPorts[portID], msgs.size(), &msgs[0]);
+	msgs.clear();
+	times.clear();
+	
+	return;
+}
+
+void MidiPlayer::Wire_Reset(void)
+{
+	// The link model is used for hardware modules that are connected via a "real" MIDI cable.
+	// It isn't needed when rendering into a file.
+	size_t portCnt = _outPorts.size();
+	
+	if (! (_portOpts.wireModel & MMO_WIRE_STATS) || _renderFile != NULL)
+		portCnt = 0;
+	_wireBusyUntil.assign(portCnt, 0);
+	_wireStats.assign(portCnt, WireStats());	// value-initialized = all 0
+	
+	return;
+}
+
+void MidiPlayer::Wire_SendData(size_t portID, UINT64 time, UINT32 bytes)
+{
+	UINT64& busyUntil = _wireBusyUntil[portID];
+	WireStats& ws = _wireStats[portID];
+	UINT64 delay;
+	
+	ws.batches ++;
+	if (busyUntil > time)
+		ws.satBatches ++;	// the data has to wait until the previous data is transferred
+	else
+		busyUntil = time;
+	busyUntil += (UINT64)bytes * _tmrFreq / MIDI_BYTE_RATE;
+	ws.bytes += bytes;
+	
+	delay = (busyUntil - time) * 1000000 / _tmrFreq;
+	if (ws.maxDelayUS < delay)
+		ws.maxDelayUS = (UINT32)delay;
+	
+	return;
+}
+
+void MidiPlayer::Wire_PrepareBatch(size_t portID)
+{
+	std::vector<MIDI_MSG>& msgs = _outBatchMsgs[portID];
+	const std::vector<UINT64>& times = _outBatchTimes[portID];
+	UINT64 startTime;
+	UINT64 endTime;
+	UINT32 bytes;
+	size_t curMsg;
+	
+	if (_portOpts.wireModel & MMO_WIRE_DROPCC)
+		Wire_DropRedundantMsgs(portID);
+	if (msgs.empty())
+		return;
+	
+	bytes = 0;
+	for (curMsg = 0; curMsg < msgs.size(); curMsg ++)
+		bytes += GetShortMsgSize(msgs[curMsg].data[0]);
+	
+	// When the transfer takes too long, the notes are smeared over time.
+	// Sending Note Ons first keeps them in sync, the controllers follow shortly after.
+	startTime = (_wireBusyUntil[portID] > times[0]) ? _wireBusyUntil[portID] : times[0];
+	endTime = startTime + (UINT64)bytes * _tmrFreq / MIDI_BYTE_RATE;
+	if ((_portOpts.wireModel & MMO_WIRE_REORDER) && (endTime - times[0]) * 1000 > WIRE_SAT_TIME * _tmrFreq)
+	{
+		if (Wire_ReorderBatch(portID))
+			_wireStats[portID].reordered ++;
+	}
+	Wire_SendData(portID, times[0], bytes);
+	
+	return;
+}
+
+void MidiPlayer::Wire_DropRedundantMsgs(size_t portID)
+{
+	// Remove controller/pitch bend messages that are followed by another one of the same type
+	// on the same channel, as long as there is no note event between them.
+	std::vector<MIDI_MSG>& msgs = _outBatchMsgs[portID];
+	std::vector<UINT64>& times = _outBatchTimes[portID];
+	std::vector<bool> keepMsg(msgs.size(), true);
+	UINT8 seenCtrl[0x10][0x82];	// 00..7F - controllers, 80 - pitch bend, 81 - channel aftertouch
+	size_t curMsg;
+	size_t dstMsg;
+	
+	memset(seenCtrl, 0x00, sizeof(seenCtrl));
+	for (curMsg = msgs.size(); curMsg > 0; curMsg --)
+	{
+		const MIDI_MSG& msg = msgs[curMsg - 1];
+		UINT8 msgClass = GetWireMsgClass(msg);
+		UINT8 evtChn = msg.data[0] & 0x0F;
+		UINT8 ctrlID;
+		
+		if (msgClass == WMC_NOTE_OFF || msgClass == WMC_NOTE_ON)
+		{
+			memset(seenCtrl[evtChn], 0x00, sizeof(seenCtrl[evtChn]));
+			continue;
+		}
+		ctrlID = GetFilterCtrlID(msg);
+		if (ctrlID == 0xFF)
+			continue;
+		if (seenCtrl[evtChn][ctrlID])
+			keepMsg[curMsg - 1] = false;
+		seenCtrl[evtChn][ctrlID] = 1;
+	}
+	
+	dstMsg = 0;
+	for (curMsg = 0; curMsg < msgs.size(); curMsg ++)
+	{
+		if (! keepMsg[curMsg])
+			continue;
+		msgs[dstMsg] = msgs[curMsg];
+		times[dstMsg] = times[curMsg];
+		dstMsg ++;
+	}
+	_wireStats[portID].dropped += (UINT32)(msgs.size() - dstMsg);
+	msgs.resize(dstMsg);
+	times.resize(dstMsg);
+	
+	return;
+}
+
+bool MidiPlayer::Wire_ReorderBatch(size_t portID)
+{
+	// Messages with the same timestamp are sorted by their class. (Note Off, setup messages, Note On, controllers)
+	// The messages of each channel stay in their original order, as their meaning may depend on it.
+	// (e.g. Sustain + Note Off, Pitch Bend + Note On)
+	// So the channels are merged like sorted queues, by taking the channel whose next message has the lowest class.
+	// System messages are never moved.
+	std::vector<MIDI_MSG>& msgs = _outBatchMsgs[portID];
+	std::vector<UINT64>& times = _outBatchTimes[portID];
+	std::vector<MIDI_MSG> newMsgs;
+	size_t chnPos[0x10];
+	size_t grpStart;
+	size_t grpEnd;
+	size_t curMsg;
+	UINT8 curChn;
+	bool changed = false;
+	
+	newMsgs.reserve(msgs.size());
+	for (grpStart = 0; grpStart < msgs.size(); grpStart = grpEnd)
+	{
+		// a group ends at a different timestamp or a system message
+		for (grpEnd = grpStart; grpEnd < msgs.size(); grpEnd ++)
+		{
+			if (times[grpEnd] != times[grpStart] || msgs[grpEnd].data[0] >= 0xF0)
+				break;
+		}
+		if (grpEnd == grpStart)
+		{
+			newMsgs.push_back(msgs[grpEnd]);	// system message
+			grpEnd ++;
+			continue;
+		}
+		
+		for (curChn = 0x00; curChn < 0x10; curChn ++)
+			chnPos[curChn] = grpStart;
+		while(newMsgs.size() < grpEnd)
+		{
+			UINT8 bestClass = 0xFF;
+			UINT8 bestChn = 0xFF;
+			
+			for (curChn = 0x00; curChn < 0x10; curChn ++)
+			{
+				UINT8 msgClass;
+				
+				// find the next message of this channel
+				for (curMsg = chnPos[curChn]; curMsg < grpEnd; curMsg ++)
+				{
+					if ((msgs[curMsg].data[0] & 0x0F) == curChn)
+						break;
+				}
+				chnPos[curChn] = curMsg;
+				if (curMsg >= grpEnd)
+					continue;
+				msgClass = GetWireMsgClass(msgs[curMsg]);
+				// lowest class wins, within the same class the original order is kept
+				if (msgClass < bestClass || (msgClass == bestClass && curMsg < chnPos[bestChn]))
+				{
+					bestClass = msgClass;
+					bestChn = curChn;
+				}
+			}
+			curMsg = chnPos[bestChn];
+			if (newMsgs.size() != curMsg)
+				changed = true;
+			newMsgs.push_back(msgs[curMsg]);
+			chnPos[bestChn] ++;
+		}
+	}
+	if (changed)
+		msgs.swap(newMsgs);
+	
+	return changed;
+}
+
+void MidiPlayer::CtrlFilter_Reset(void)
+{
+	// The state of the device is unknown when starting, so the first message of each controller is always sent.
+	size_t stateCnt = _outPorts.size() * 0x10;
+	
+	_ctrlPendCount = 0;
+	_ctrlPendNext = (UINT64)-1;
+	_ctrlMinDist = _portOpts.ctrlMaxRate ? (_tmrFreq / _portOpts.ctrlMaxRate) : 0;
+	if (! _portOpts.dropRepeatCtrl && ! _ctrlMinDist)
+		stateCnt = 0;
+	_ctrlOutStates.resize(stateCnt);
+	for (size_t curPort = 0; curPort < _outPorts.size() && stateCnt > 0; curPort ++)
+		CtrlFilter_InvalidatePort(curPort);
+	
+	return;
+}
+
+bool MidiPlayer::CtrlFilter_Check(size_t portID, UINT8 event, UINT8 data1, UINT8 data2)
+{
+	// returns true when the message must not be sent now
+	CtrlOutState& cos = _ctrlOutStates[(portID << 4) | (event & 0x0F)];
+	MIDI_MSG msg;
+	UINT8 ctrlID;
+	UINT16 value;
+	
+	msg.data[0] = event;
+	msg.data[1] = data1;
+	msg.data[2] = data2;
+	if ((event & 0xF0) == 0xB0 && data1 == 0x79)
+	{
+		// Reset All Controllers: The held back values are outdated now.
+		for (ctrlID = 0x00; ctrlID < 0x82; ctrlID ++)
+		{
+			if (cos.pendVal[ctrlID] != 0xFFFF)
+				_ctrlPendCount --;
+			cos.sentVal[ctrlID] = 0xFFFF;
+			cos.pendVal[ctrlID] = 0xFFFF;
+		}
+		return false;
+	}
+	ctrlID = GetFilterCtrlID(msg);
+	if (ctrlID == 0xFF)
+		return false;
+	
+	if ((event & 0xF0) == 0xE0)
+		value = (data2 << 7) | (data1 << 0);
+	else if ((event & 0xF0) == 0xD0)
+		value = data1;
+	else
+		value = data2;
+	
+	if (_portOpts.dropRepeatCtrl && value == cos.sentVal[ctrlID])
+	{
+		// The device already has this value. (A ramp may also return to the value that was sent last.)
+		if (cos.pendVal[ctrlID] != 0xFFFF)
+		{
+			cos.pendVal[ctrlID] = 0xFFFF;
+			_ctrlPendCount --;
+		}
+		return true;
+	}
+	if (_ctrlMinDist && cos.sentVal[ctrlID] != 0xFFFF && _tmrStep < cos.sentTime[ctrlID] + _ctrlMinDist)
+	{
+		// too soon after the last message: keep only the latest value and send it when the time has come
+		if (cos.pendVal[ctrlID] == 0xFFFF)
+			_ctrlPendCount ++;
+		cos.pendVal[ctrlID] = value;
+		if (_ctrlPendNext > cos.sentTime[ctrlID] + _ctrlMinDist)
+			_ctrlPendNext = cos.sentTime[ctrlID] + _ctrlMinDist;
+		return true;
+	}
+	if (cos.pendVal[ctrlID] != 0xFFFF)
+	{
+		cos.pendVal[ctrlID] = 0xFFFF;	// replaced by the current message
+		_ctrlPendCount --;
+	}
+	cos.sentVal[ctrlID] = value;
+	cos.sentTime[ctrlID] = _tmrStep;
+	return false;
+}
+
+void MidiPlayer::CtrlFilter_InvalidatePort(size_t portID)
+{
+	size_t curChn;
+	
+	// send held back values first, so that they don't overwrite the new device state
+	if (_ctrlPendCount)
+		CtrlFilter_Flush((UINT64)-1);
+	for (curChn = 0x00; curChn < 0x10; curChn ++)
+	{
+		CtrlOutState& cos = _ctrlOutStates[(portID << 4) | curChn];
+		for (UINT8 ctrlID = 0x00; ctrlID < 0x82; ctrlID ++)
+		{
+			cos.sentVal[ctrlID] = 0xFFFF;
+			cos.pendVal[ctrlID] = 0xFFFF;
+			cos.sentTime[ctrlID] = 0;
+		}
+	}
+	
+	return;
+}
+
+void MidiPlayer::CtrlFilter_Flush(UINT64 time)
+{
+	// send all held back values that are due at "time" (-1 = send everything)
+	UINT64 tmrStepBak = _tmrStep;
+	size_t curState;
+	UINT8 ctrlID;
+	
+	if (! _ctrlPendCount || time < _ctrlPendNext)
+		return;
+	
+	_ctrlPendNext = (UINT64)-1;
+	BeginOutputBatch();
+	for (curState = 0; curState < _ctrlOutStates.size() && _ctrlPendCount > 0; curState ++)
+	{
+		CtrlOutState& cos = _ctrlOutStates[curState];
+		size_t portID = curState >> 4;
+		UINT8 midChn = (UINT8)(curState & 0x0F);
+		
+		for (ctrlID = 0x00; ctrlID < 0x82; ctrlID ++)
+		{
+			UINT64 dueTime;
+			
+			if (cos.pendVal[ctrlID] == 0xFFFF)
+				continue;
+			dueTime = cos.sentTime[ctrlID] + _ctrlMinDist;
+			if (dueTime > time)
+			{
+				if (_ctrlPendNext > dueTime)
+					_ctrlPendNext = dueTime;
+				continue;
+			}
+			
+			// send the message with the time it was due at (but not later than the current position)
+			_tmrStep = (dueTime < tmrStepBak) ? dueTime : tmrStepBak;
+			CtrlFilter_SendPending(portID, midChn, ctrlID);
+		}
+	}
+	EndOutputBatch();
+	_tmrStep = tmrStepBak;
+	
+	return;
+}
+
+void MidiPlayer::CtrlFilter_FlushChannel(size_t portID, UINT8 midChn)
+{
+	// send all held back values of a channel immediately
+	CtrlOutState& cos = _ctrlOutStates[(portID << 4) | midChn];
+	UINT8 ctrlID;
+	
+	for (ctrlID = 0x00; ctrlID < 0x82 && _ctrlPendCount > 0; ctrlID ++)
+	{
+		if (cos.pendVal[ctrlID] != 0xFFFF)
+			CtrlFilter_SendPending(portID, midChn, ctrlID);
+	}
+	
+	return;
+}
+
+void MidiPlayer::CtrlFilter_SendPending(size_t portID, UINT8 midChn, UINT8 ctrlID)
+{
+	CtrlOutState& cos = _ctrlOutStates[(portID << 4) | midChn];
+	UINT16 value = cos.pendVal[ctrlID];
+	
+	cos.pendVal[ctrlID] = 0xFFFF;
+	_ctrlPendCount --;
+	cos.sentVal[ctrlID] = 0xFFFF;	// make CtrlFilter_Check() pass the message
+	if (ctrlID == 0x80)
+		SendMidiEventS(portID, 0xE0 | midChn, (value >> 0) & 0x7F, (value >> 7) & 0x7F);
+	else if (ctrlID == 0x81)
+		SendMidiEventS(portID, 0xD0 | midChn, (UINT8)value, 0x00);
+	else
+		SendMidiEventS(portID, 0xB0 | midChn, ctrlID, (UINT8)value);
+	
+	return;
+}
+
+void MidiPlayer::CtrlFilter_DiscardPending(void)
+{
+	size_t curState;
+	UINT8 ctrlID;
+	
+	for (curState = 0; curState < _ctrlOutStates.size() && _ctrlPendCount > 0; curState ++)
+	{
+		CtrlOutState& cos = _ctrlOutStates[curState];
+		for (ctrlID = 0x00; ctrlID < 0x82; ctrlID ++)
+		{
+			if (cos.pendVal[ctrlID] == 0xFFFF)
+				continue;
+			cos.pendVal[ctrlID] = 0xFFFF;
+			_ctrlPendCount --;
+		}
+	}
+	_ctrlPendNext = (UINT64)-1;
+	
+	return;
+}
+
+const std::vector<MidiPlayer::WireStats>& MidiPlayer::GetWireStats(void) const
+{
+	return _wireStats;
+}
+
+void MidiPlayer::Timing_RecordSend(size_t count, const UINT64* times)
+{
+	// measures how late messages are passed to the driver, compared to when they were due
+	// Note: The statistics are only written by the playback thread, so recording needs no lock.
+	UINT64 curTime;
+	size_t curMsg;
+	
+	if (_useManualTiming || ! _tmrStep)
+		return;	// no real-time playback or the song wasn't started yet (device reset)
+	
+	curTime = Timer_GetTime() + _outLookahead;
+	for (curMsg = 0; curMsg < count; curMsg ++)
+	{
+		UINT64 late = (curTime > times[curMsg]) ? (curTime - times[curMsg]) : 0;
+		UINT64 lateUS = late * 1000000 / _tmrFreq;
+		if (lateUS > 0xFFFFFFFF)
+			lateUS = 0xFFFFFFFF;
+		
+		_timingStats.events ++;
+		_timingStats.lateHist[GetLateBucket((UINT32)lateUS)] ++;
+		if (_timingStats.maxLateUS < (UINT32)lateUS)
+			_timingStats.maxLateUS = (UINT32)lateUS;
+	}
+	
+	return;
+}
+
+const MidiPlayer::TimingStats& MidiPlayer::GetTimingStats(void) const
+{
+	return _timingStats;
+}
+
+/*static*/ UINT32 MidiPlayer::GetTimingPercentile(const TimingStats& ts, double fraction)
+{
+	UINT64 evtLimit;
+	UINT64 evtCount;
+	UINT8 curBkt;
+	
+	if (! ts.events)
+		return 0;
+	evtLimit = (UINT64)ceil(ts.events * fraction);
+	if (! evtLimit)
+		evtLimit = 1;
+	evtCount = 0;
+	for (curBkt = 0; curBkt < 0x80; curBkt ++)
+	{
+		evtCount += ts.lateHist[curBkt];
+		if (evtCount >= evtLimit)
+		{
+			// report the upper end of the bucket, but never more than the actual maximum
+			UINT32 bktMax = GetLateBucketMax(curBkt);
+			return (bktMax < ts.maxLateUS) ? bktMax : ts.maxLateUS;
+		}
+	}
+	return ts.maxLateUS;
+}
+
+void MidiPlayer::DropPendingOutput(void)
+{
+	size_t curPort;
+	size_t curChn;
+	
+	if (! _outLookahead)
 		return;
+	for (curPort = 0; curPort < _outPorts.size(); curPort ++)
+	{
+		if (_outPorts[curPort] != NULL)
+			MidiOutPort_DropPending(_outPorts[curPort]);
+	}
+	_outQueuedUntil = 0;
+	
+	// The dropped messages may include Note Off events, so silence all channels.
+	_tmrStep = Timer_GetTime();
+	for (curChn = 0x00; curChn < _chnStates.size(); curChn ++)
+	{
+		const ChannelState& chnSt = _chnStates[curChn];
+		SendMidiEventS(chnSt.portID, 0xB0 | chnSt.midChn, 0x7B, 0x00);
 	}
-	MidiQueueEvt evt;
-	evt.time = _tmrStep + _outPortDelay[portID] * _tmrFreq / 1000;
-	evt.flag = 0x00;
-	evt.data.assign((const UINT8*)data, (const UINT8*)data + dataLen);
-	_midiEvtQueue[portID].emplace(evt);
+	
 	return;
 }
 
+MidiTrack* MidiPlayer::GetRenderTrack(size_t portID, UINT64 time, UINT32* tick)
+{
+	// create all tracks up to the requested one, so that the track order matches the port order
+	while(_renderTrks.size() <= portID)
+	{
+		UINT8 portData = (UINT8)_renderTrks.size();
+		MidiTrack* mTrk = _renderFile->NewTrack_Append();
+		mTrk->AppendMetaEvent(0, 0x21, 1, &portData);	// MIDI Port
+		_renderTrks.push_back(mTrk);
+	}
+	
+	MidiTrack* mTrk = _renderTrks[portID];
+	*tick = (UINT32)(time / (_tmrFreq / RENDER_TICK_RATE));
+	if (*tick < mTrk->GetTickCount())
+		*tick = mTrk->GetTickCount();	// events sent early (e.g. full event queue) must not go back in time
+	return mTrk;
+}
+
 const INS_BANK* MidiPlayer::SelectInsMap(UINT8 moduleType, UINT8* insMapModule) const
 {
 	if (insMapModule != NULL)
@@ -385,10 +1304,19 @@ UINT8 MidiPlayer::Start(void)
 		mTS.evtPos = mTrk->GetEventBegin();
 		_trkStates.push_back(mTS);
 	}
+	_trkHeapDirty = true;
+	_compActive = _options.compiledTimeline;
+	if (_compActive && _compEvts.empty())
+		CompileTimeline();	// option was enabled after loading the song
+	_compEvtPos = 0;
+	_compTmrTick = 0;
 	
 	// clear event queues
 	for (curTrk = 0; curTrk < _midiEvtQueue.size(); curTrk ++)
-		_midiEvtQueue[curTrk] = std::queue<MidiQueueEvt>();
+	{
+		if (_midiEvtQueue[curTrk] != NULL)
+			_midiEvtQueue[curTrk]->Clear();
+	}
 	_meqDoSort = false;
 	
 	_tempoPos = _tempoList.begin();
@@ -413,7 +1341,12 @@ UINT8 MidiPlayer::Start(void)
 	
 	_defSrcInsMap = 0xFF;
 	_defDstInsMap = 0xFF;
+	ApplyOutputScheduling();
+	Wire_Reset();
+	CtrlFilter_Reset();
+	_timingStats = TimingStats();
 	RefreshSrcDevSettings();
+	BeginOutputBatch();
 	if (_options.flags & PLROPTS_RESET)
 	{
 		size_t curPort;
@@ -552,12 +1485,14 @@ UINT8 MidiPlayer::Start(void)
 	InitializeChannels();
 	InitializeChannels_Post();
 	ProcessEventQueue(true);
+	EndOutputBatch();
 	
-	if (initDelay && _useManualTiming)
+	if (initDelay && _useManualTiming && _renderFile == NULL)
 		initDelay = 0;
 	_tmrMinStart += initDelay * _tmrFreq / 1000;
 	_playing = true;
 	_paused = false;
+	FlushOutputPorts();
 	
 	return 0x00;
 }
@@ -565,6 +1500,7 @@ UINT8 MidiPlayer::Start(void)
 UINT8 MidiPlayer::Stop(void)
 {
 	AllNotesStop();
+	CtrlFilter_DiscardPending();	// controller ramps don't matter anymore
 	ProcessEventQueue(true);
 	
 	_playing = false;
@@ -577,6 +1513,7 @@ UINT8 MidiPlayer::Pause(void)
 	if (_paused)
 		return 0x00;
 	
+	CtrlFilter_Flush((UINT64)-1);	// the timing is reset when resuming, so don't keep anything back
 	AllNotesStop();
 	
 	_paused = true;
@@ -643,6 +1580,56 @@ UINT8 MidiPlayer::FadeOutT(double fadeTime)
 	return 0x00;
 }
 
+UINT8 MidiPlayer::Seek(double seconds)
+{
+	if (! _playing)
+		return 0xFF;
+	
+	UINT64 tmrTick;
+	
+	if (seconds < 0.0)
+		seconds = 0.0;
+	tmrTick = DBL_TO_U64(seconds * _tmrFreq);
+	if (tmrTick > _songLength)
+		tmrTick = _songLength;
+	
+	return SeekToTick(TimeToTick(tmrTick));
+}
+
+UINT8 MidiPlayer::SeekM(UINT32 bar, UINT32 beat, UINT32 tick)
+{
+	if (! _playing)
+		return 0xFF;
+	
+	std::list<TimeSigChg>::const_iterator tscIt;
+	std::list<TimeSigChg>::const_iterator tscNextIt;
+	UINT32 tickDiv;
+	INT64 tickPos;
+	
+	// find the last time signature that begins before the destination
+	tscIt = _timeSigList.begin();
+	for (tscNextIt = tscIt, ++tscNextIt; tscNextIt != _timeSigList.end(); ++tscNextIt)
+	{
+		const UINT32* mPos = tscNextIt->measPos;
+		if (mPos[0] > bar || (mPos[0] == bar && (mPos[1] > beat || (mPos[1] == beat && mPos[2] > tick))))
+			break;
+		tscIt = tscNextIt;
+	}
+	
+	// This is the inverse of CalcMeasureTime().
+	tickDiv = (_cMidi->GetMidiResolution() * 4) >> tscIt->timeSig[1];	// ticks per time signature beat
+	tickPos = (INT64)bar - tscIt->measPos[0];
+	tickPos = tickPos * tscIt->timeSig[0] + ((INT64)beat - tscIt->measPos[1]);
+	tickPos = tickPos * tickDiv + ((INT64)tick - tscIt->measPos[2]);
+	tickPos += tscIt->tick;
+	if (tickPos < 0)
+		tickPos = 0;
+	else if (tickPos > _songTickLen)
+		tickPos = _songTickLen;
+	
+	return SeekToTick((UINT32)tickPos);
+}
+
 UINT8 MidiPlayer::GetState(void) const
 {
 	return (_playing << 0) | (_paused << 1);
@@ -783,16 +1770,37 @@ NoteVisualization* MidiPlayer::GetNoteVis(void)
 }
 
 
-void MidiPlayer::RefreshTickTime(void)
+UINT64 MidiPlayer::CalcTickTime(UINT32 tempo) const
 {
 	UINT64 tmrMul;
 	UINT64 tmrDiv;
 	
-	tmrMul = _tmrFreq * _midiTempo;
+	tmrMul = _tmrFreq * tempo;
 	tmrDiv = (UINT64)1000000 * _cMidi->GetMidiResolution();
 	if (tmrDiv == 0)
 		tmrDiv = 1000000;
-	_curTickTime = (tmrMul + tmrDiv / 2) / tmrDiv;
+	return (tmrMul + tmrDiv / 2) / tmrDiv;
+}
+
+UINT32 MidiPlayer::TimeToTick(UINT64 tmrTick) const
+{
+	std::list<TempoChg>::const_iterator tempoIt;
+	std::list<TempoChg>::const_iterator tNextIt;
+	
+	// find the tempo that is active at the requested time and calculate the tick from it
+	tempoIt = _tempoList.begin();
+	for (tNextIt = tempoIt, ++tNextIt; tNextIt != _tempoList.end(); ++tNextIt)
+	{
+		if (tNextIt->tmrTick > tmrTick)
+			break;
+		tempoIt = tNextIt;
+	}
+	return tempoIt->tick + (UINT32)((tmrTick - tempoIt->tmrTick) / CalcTickTime(tempoIt->tempo));
+}
+
+void MidiPlayer::RefreshTickTime(void)
+{
+	_curTickTime = CalcTickTime(_midiTempo);
 	return;
 }
 
@@ -863,10 +1871,10 @@ void MidiPlayer::HandleRawEvent(size_t dataLen, const UINT8* data)
 		return;
 	}
 	_tmrStep = Timer_GetTime();
-	tmpSyxIgnore = true;
+	_tmpSyxIgnore = true;
 	DoEvent(&_trkStates[0], &midiEvt);
 	ProcessEventQueue();
-	tmpSyxIgnore = false;
+	_tmpSyxIgnore = false;
 	
 	return;
 }
@@ -881,6 +1889,8 @@ void MidiPlayer::DoEvent(TrackState* trkState, const MidiEvent* midiEvt)
 		ChannelState* chnSt = &_chnStates[portChnID];
 		bool didEvt = false;
 		
+		if (_chaseMode && (evtType == 0x80 || evtType == 0x90))
+			return;	// seeking: skip all notes
 		switch(evtType)
 		{
 		case 0x80:
@@ -956,7 +1966,7 @@ void MidiPlayer::DoEvent(TrackState* trkState, const MidiEvent* midiEvt)
 		//case 0x00:	// Sequence Number
 		case 0x01:	// Text
 			{
-				std::string text = Vector2String(midiEvt->evtData);
+				std::string text = Vector2String(midiEvt->evtData.data(), 0, midiEvt->evtData.size());
 				if (text.empty())
 					break;
 				if (text == "@KMIDI KARAOKE FILE")
@@ -997,7 +2007,7 @@ void MidiPlayer::DoEvent(TrackState* trkState, const MidiEvent* midiEvt)
 		case 0x03:	// Track/Sequence Name
 			if (trkState->trkID == 0 || _cMidi->GetMidiFormat() == 2)
 			{
-				std::string text = Vector2String(midiEvt->evtData);
+				std::string text = Vector2String(midiEvt->evtData.data(), 0, midiEvt->evtData.size());
 				//printf("Text: %s\n", text.c_str());
 				if (trkState->trkID == 0 && _rcpMidTextMode < 2)
 				{
@@ -1034,9 +2044,10 @@ void MidiPlayer::DoEvent(TrackState* trkState, const MidiEvent* midiEvt)
 			return;	// don't print for now
 		case 0x06:	// Marker
 			{
-				std::string text = Vector2String(midiEvt->evtData);
+				std::string text = Vector2String(midiEvt->evtData.data(), 0, midiEvt->evtData.size());
 				// print now, so that the marker value is shown *before* any loop info.
-				vis_print_meta(trkState->trkID, midiEvt->evtValA, text.length(), text.data());
+				if (! _chaseMode)
+					vis_print_meta(trkState->trkID, midiEvt->evtValA, text.length(), text.data());
 				if (text == _options.loopStartText)
 				{
 					SaveLoopState(_loopPt, trkState);
@@ -1045,7 +2056,8 @@ void MidiPlayer::DoEvent(TrackState* trkState, const MidiEvent* midiEvt)
 				}
 				else if (text == _options.loopEndText)
 				{
-					if (_loopPt.used && _loopPt.tick < _nextEvtTick)
+					// Note: Seeking goes beyond the loop end instead of looping.
+					if (_loopPt.used && _loopPt.tick < _nextEvtTick && ! _chaseMode)
 					{
 						_curLoop ++;
 						if (! _options.numLoops || _curLoop < _options.numLoops)
@@ -1091,6 +2103,8 @@ void MidiPlayer::DoEvent(TrackState* trkState, const MidiEvent* midiEvt)
 			break;
 		//case 0x7F:	// Sequencer Specific
 		}
+		if (_chaseMode)
+			break;	// The display is refreshed after seeking.
 		if (midiEvt->evtData.empty())
 			vis_print_meta(trkState->trkID, midiEvt->evtValA, 0, NULL);
 		else
@@ -1116,36 +2130,34 @@ void MidiPlayer::ProcessEventQueue(bool flush)
 		
 		for (curPort = 0; curPort < _midiEvtQueue.size(); curPort ++)
 		{
-			std::queue<MidiQueueEvt>& meq = _midiEvtQueue[curPort];
-			if (! meq.empty())
-				EvtQueue_OptimizePortEvts(meq, dtMove);
+			MidiEvtQueue* meq = _midiEvtQueue[curPort];
+			if (meq != NULL && ! meq->IsEmpty())
+				EvtQueue_OptimizePortEvts(*meq, dtMove);
 		}
 	}
 	
-	curTime = Timer_GetTime();
+	curTime = Timer_GetTime() + _outLookahead;
+	BeginOutputBatch();
 	for (curPort = 0; curPort < _midiEvtQueue.size(); curPort ++)
 	{
-		std::queue<MidiQueueEvt>& meq = _midiEvtQueue[curPort];
-		while(! meq.empty())
+		MidiEvtQueue* meq = _midiEvtQueue[curPort];
+		if (meq == NULL)
+			continue;
+		if (_timingStats.maxQueueDepth < meq->GetCount())
+			_timingStats.maxQueueDepth = meq->GetCount();
+		while(! meq->IsEmpty())
 		{
-			MidiQueueEvt& evt = meq.front();
-			if (! flush && evt.time > curTime)
+			if (! flush && meq->Front().time > curTime)
 				break;
-			if (curPort < _outPorts.size())
-			{
-				if (evt.data[0] < 0xF0)
-					MidiOutPort_SendShortMsg(_outPorts[curPort], evt.data[0], evt.data[1], evt.data[2]);
-				else
-					MidiOutPort_SendLongMsg(_outPorts[curPort], evt.data.size(), &evt.data[0]);
-			}
-			meq.pop();
+			EvtQueue_SendFront(curPort);
 		}
 	}
+	EndOutputBatch();
 	
 	return;
 }
 
-void MidiPlayer::EvtQueue_OptimizePortEvts(std::queue<MidiQueueEvt>& meq, INT64 dtMove)
+void MidiPlayer::EvtQueue_OptimizePortEvts(MidiEvtQueue& meq, INT64 dtMove)
 {
 	// optimize events by sending patch changes (and surrounding controllers) earlier
 	// Note On/Off events are untouched.
@@ -1154,11 +2166,15 @@ void MidiPlayer::EvtQueue_OptimizePortEvts(std::queue<MidiQueueEvt>& meq, INT64
 	size_t curChn;
 	UINT64 minTime;
 	UINT64 maxTime;
+	UINT32 evtCnt;
+	UINT32 curEvt;
 	
+	// The events are reordered in-place. (SysEx events keep their order, as they are never moved.)
 	minTime = 0;
-	while(! meq.empty())
+	evtCnt = meq.GetCount();
+	for (curEvt = 0; curEvt < evtCnt; curEvt ++)
 	{
-		MidiQueueEvt& evt = meq.front();
+		MidiQueueEvt& evt = meq.GetEvent(curEvt);
 		curChn = evt.data[0] & 0x0F;
 		if (evt.data[0] >= 0xF0)
 		{
@@ -1166,7 +2182,6 @@ void MidiPlayer::EvtQueue_OptimizePortEvts(std::queue<MidiQueueEvt>& meq, INT64
 			minTime = evt.time;
 		}
 		tmpMEQ[curChn].push_back(evt);
-		meq.pop();
 	}
 	
 	maxTime = 0;
@@ -1180,6 +2195,7 @@ void MidiPlayer::EvtQueue_OptimizePortEvts(std::queue<MidiQueueEvt>& meq, INT64
 		chnPos[curChn] = 0;
 	}
 	
+	curEvt = 0;
 	do
 	{
 		minTime = (UINT64)-1;
@@ -1196,7 +2212,8 @@ void MidiPlayer::EvtQueue_OptimizePortEvts(std::queue<MidiQueueEvt>& meq, INT64
 			std::vector<MidiQueueEvt>& meqList = tmpMEQ[curChn];
 			while(chnPos[curChn] < meqList.size() && meqList[chnPos[curChn]].time <= minTime)
 			{
-				meq.push(meqList[chnPos[curChn]]);
+				meq.GetEvent(curEvt) = meqList[chnPos[curChn]];
+				curEvt ++;
 				chnPos[curChn] ++;
 			}
 		}
@@ -1282,52 +2299,134 @@ void MidiPlayer::AdvanceManualTiming(UINT64 time, INT8 mode)
 
 void MidiPlayer::DoPlaybackStep(void)
 {
+	_timingStats.steps ++;
 	ProcessEventQueue();
 	if (_paused)
 		return;
 	
 	UINT64 curTime;
+	UINT64 evtTime;	// events up to this time are processed
+	
+	curTime = Timer_GetTime();
+	evtTime = curTime + _outLookahead;
+	if (! _tmrStep && evtTime < _tmrMinStart)
+		_tmrStep = _tmrMinStart;	// handle "initial delay" after starting the song
+	if (_tmrFadeLen && _tmrFadeStart == (UINT64)-1)
+	{
+		_tmrFadeStart = curTime;	// start fading
+		_tmrFadeNext = _tmrFadeStart;
+	}
+	
+	if (_tmrFadeLen && curTime >= _tmrFadeNext && _playing)
+	{
+		UINT64 fadeStep;
+		
+		_tmrFadeNext += _tmrFreq * 100 / 1000;	// update once every 0.1 s
+		
+		fadeStep = (curTime - _tmrFadeStart) * 0x100 / _tmrFadeLen;
+		_fadeVol = (fadeStep < 0x100) ? (UINT16)(0x100 - fadeStep) : 0x00;
+		
+		BeginOutputBatch();
+		FadeVolRefresh();
+		EndOutputBatch();
+		
+		if (_fadeVol == 0x00)
+			Stop();
+	}
+	CtrlFilter_Flush(evtTime);
+	if (evtTime + _curTickTime / 16 < _tmrStep)	// rounding here, for nicer tick display at 120 BPM/192 TpQ
+	{
+		FlushOutputPorts();
+		return;
+	}
+	
+	if (_compActive)
+		DoPlaybackLoop_Compiled(evtTime);
+	else
+		DoPlaybackLoop_Tracks(evtTime);
+	ProcessEventQueue();	// process events that were just added
+	UpdateSongCtrlEvts();
+	FlushOutputPorts();
+	
+	return;
+}
+
+UINT64 MidiPlayer::GetNextEventDelay(void) const
+{
+	UINT64 curTime;
+	UINT64 nextTime;
+	
+	if (_useManualTiming)
+		return 0;	// the caller controls the time, so there is nothing to wait for
+	
+	nextTime = GetNextWorkTime();
+	if (nextTime == (UINT64)-1)
+		return (UINT64)-1;
+	
+	curTime = Timer_GetTime() + _outLookahead;
+	if (nextTime <= curTime)
+		return 0;
+	return (UINT64)((nextTime - curTime) * 1000000000.0 / _tmrFreq);
+}
+
+UINT64 MidiPlayer::GetNextEventTime(void) const
+{
+	UINT64 nextTime;
+	
+	if (_useManualTiming)
+		return 0;
+	
+	nextTime = GetNextWorkTime();
+	if (nextTime == (UINT64)-1)
+		return (UINT64)-1;
+	if (nextTime <= _outLookahead)
+		return 0;
+	nextTime -= _outLookahead;
+	// round up, so that the caller doesn't wake up a fraction of a timer tick too early
+	return (nextTime + TICK_FP_MUL - 1) >> TICK_FP_SHIFT;
+}
+
+UINT64 MidiPlayer::GetNextWorkTime(void) const
+{
+	// returns the player time (including output lookahead) of the next thing DoPlaybackStep has to do
+	UINT64 nextTime;
+	size_t curPort;
 	
-	curTime = Timer_GetTime();
-	if (! _tmrStep && curTime < _tmrMinStart)
-		_tmrStep = _tmrMinStart;	// handle "initial delay" after starting the song
-	if (_tmrFadeLen && _tmrFadeStart == (UINT64)-1)
+	nextTime = (UINT64)-1;
+	for (curPort = 0; curPort < _midiEvtQueue.size(); curPort ++)
 	{
-		_tmrFadeStart = curTime;	// start fading
-		_tmrFadeNext = _tmrFadeStart;
+		MidiEvtQueue* meq = _midiEvtQueue[curPort];
+		if (meq != NULL && ! meq->IsEmpty() && meq->Front().time < nextTime)
+			nextTime = meq->Front().time;
 	}
-	
-	if (_tmrFadeLen && curTime >= _tmrFadeNext && _playing)
+	if (_playing && ! _paused)
 	{
-		UINT64 fadeStep;
-		
-		_tmrFadeNext += _tmrFreq * 100 / 1000;	// update once every 0.1 s
-		
-		fadeStep = (curTime - _tmrFadeStart) * 0x100 / _tmrFadeLen;
-		_fadeVol = (fadeStep < 0x100) ? (UINT16)(0x100 - fadeStep) : 0x00;
-		
-		FadeVolRefresh();
-		
-		if (_fadeVol == 0x00)
-			Stop();
+		if (! _tmrStep || (_tmrFadeLen && _tmrFadeStart == (UINT64)-1))
+			return 0;	// DoPlaybackStep still needs to initialize the timing
+		UINT64 stepTime = _tmrStep - _curTickTime / 16;	// same rounding as in DoPlaybackStep
+		if (stepTime > _tmrStep)
+			stepTime = 0;
+		if (stepTime < nextTime)
+			nextTime = stepTime;
+		if (_tmrFadeLen && _tmrFadeNext + _outLookahead < nextTime)
+			nextTime = _tmrFadeNext + _outLookahead;	// fading uses the actual time
+		if (_ctrlPendCount && _ctrlPendNext < nextTime)
+			nextTime = _ctrlPendNext;
 	}
-	if (curTime + _curTickTime / 16 < _tmrStep)	// rounding here, for nicer tick display at 120 BPM/192 TpQ
-		return;
 	
+	return nextTime;
+}
+
+void MidiPlayer::DoPlaybackLoop_Tracks(UINT64 curTime)
+{
 	while(_playing)
 	{
-		UINT32 minNextTick = (UINT32)-1;
+		UINT32 minNextTick;
 		
-		size_t curTrk;
-		for (curTrk = 0; curTrk < _trkStates.size(); curTrk ++)
-		{
-			TrackState* mTS = &_trkStates[curTrk];
-			if (mTS->evtPos == mTS->endPos)
-				continue;
-			
-			if (mTS->evtPos->tick < minNextTick)
-				minNextTick = mTS->evtPos->tick;
-		}
+		if (_trkHeapDirty)
+			RebuildTrackHeap();
+		// The heap is sorted by (tick, track ID), so its top is the track with the next event.
+		minNextTick = _trkHeap.empty() ? (UINT32)-1 : TRKHEAP_TICK(_trkHeap.front());
 		if (minNextTick == (UINT32)-1)	// -1 -> end of sequence
 		{
 			if (_loopPt.used && _loopPt.tick < _nextEvtTick)
@@ -1340,6 +2439,7 @@ void MidiPlayer::DoPlaybackStep(void)
 					continue;
 				}
 			}
+			CtrlFilter_Flush((UINT64)-1);	// send the final values of controller ramps
 			_playing = false;
 			break;
 		}
@@ -1355,13 +2455,24 @@ void MidiPlayer::DoPlaybackStep(void)
 		if (curTime + _curTickTime / 4 < _tmrStep)
 			break;	// exit the loop when going beyond "current time"
 		if (_tmrStep + _tmrFreq * 1 < curTime)
+		{
 			_tmrStep = curTime;	// reset time when lagging behind >= 1 second
+			if (_timingStats.ticks)
+				_timingStats.lagResets ++;	// (not counting the first tick, which initializes the time)
+		}
 		
 		_breakMidiProc = false;
 		_curEvtTick = _nextEvtTick;
-		for (curTrk = 0; curTrk < _trkStates.size(); curTrk ++)
-		{
-			TrackState* mTS = &_trkStates[curTrk];
+		_timingStats.ticks ++;
+		BeginOutputBatch();	// send all messages of this tick together
+		CtrlFilter_Flush(_tmrStep);	// values that were held back by the rate limit come first
+		// process all tracks with events at the current tick, in order of their track ID
+		while(! _trkHeap.empty() && TRKHEAP_TICK(_trkHeap.front()) <= _nextEvtTick)
+		{
+			TrackState* mTS = &_trkStates[TRKHEAP_TRACK(_trkHeap.front())];
+			std::pop_heap(_trkHeap.begin(), _trkHeap.end(), std::greater<UINT64>());
+			_trkHeap.pop_back();
+			
 			while(mTS->evtPos != mTS->endPos && mTS->evtPos->tick <= _nextEvtTick)
 			{
 				DoEvent(mTS, &*mTS->evtPos);
@@ -1370,11 +2481,94 @@ void MidiPlayer::DoPlaybackStep(void)
 				++mTS->evtPos;
 			}
 			if (_breakMidiProc)
+			{
+				_trkHeapDirty = true;	// track positions were changed
 				break;
+			}
+			if (mTS->evtPos != mTS->endPos)
+			{
+				_trkHeap.push_back(TRKHEAP_KEY(mTS->evtPos->tick, mTS->trkID));
+				std::push_heap(_trkHeap.begin(), _trkHeap.end(), std::greater<UINT64>());
+			}
 		}
+		EndOutputBatch();
+	}
+	
+	return;
+}
+
+void MidiPlayer::RebuildTrackHeap(void)
+{
+	size_t curTrk;
+	
+	_trkHeap.clear();
+	for (curTrk = 0; curTrk < _trkStates.size(); curTrk ++)
+	{
+		const TrackState* mTS = &_trkStates[curTrk];
+		if (mTS->evtPos != mTS->endPos)
+			_trkHeap.push_back(TRKHEAP_KEY(mTS->evtPos->tick, curTrk));
+	}
+	std::make_heap(_trkHeap.begin(), _trkHeap.end(), std::greater<UINT64>());
+	_trkHeapDirty = false;
+	
+	return;
+}
+
+void MidiPlayer::DoPlaybackLoop_Compiled(UINT64 curTime)
+{
+	while(_playing)
+	{
+		if (_compEvtPos >= _compEvts.size())	// end of sequence
+		{
+			if (_loopPt.used && _loopPt.tick < _nextEvtTick)
+			{
+				_curLoop ++;
+				if (! _options.numLoops || _curLoop < _options.numLoops)
+				{
+					vis_printf("Loop %u / %u\n", 1 + _curLoop, _options.numLoops);
+					RestoreLoopState(_loopPt);
+					continue;
+				}
+			}
+			CtrlFilter_Flush((UINT64)-1);	// send the final values of controller ramps
+			_playing = false;
+			break;
+		}
+		
+		const CompiledEvt& nextEvt = _compEvts[_compEvtPos];
+		if (nextEvt.tick > _nextEvtTick)
+		{
+			// The song time of each event is precomputed, so the distance
+			// between two events doesn't need to be calculated from the tempo.
+			_tmrStep += nextEvt.tmrTick - _compTmrTick;
+			_nextEvtTick = nextEvt.tick;
+			_compTmrTick = nextEvt.tmrTick;
+		}
+		
+		if (curTime + _curTickTime / 4 < _tmrStep)
+			break;	// exit the loop when going beyond "current time"
+		if (_tmrStep + _tmrFreq * 1 < curTime)
+		{
+			_tmrStep = curTime;	// reset time when lagging behind >= 1 second
+			if (_timingStats.ticks)
+				_timingStats.lagResets ++;	// (not counting the first tick, which initializes the time)
+		}
+		
+		_breakMidiProc = false;
+		_curEvtTick = _nextEvtTick;
+		_timingStats.ticks ++;
+		BeginOutputBatch();	// send all messages of this tick together
+		CtrlFilter_Flush(_tmrStep);	// values that were held back by the rate limit come first
+		while(_compEvtPos < _compEvts.size() && _compEvts[_compEvtPos].tick <= _nextEvtTick)
+		{
+			const CompiledEvt& cEvt = _compEvts[_compEvtPos];
+			DoEvent(&_trkStates[cEvt.trkID], cEvt.evt);
+			if (_breakMidiProc)
+				break;
+			_compEvtPos ++;
+		}
+		EndOutputBatch();
 	}
-	ProcessEventQueue();	// process events that were just added
-	UpdateSongCtrlEvts();
 	
 	return;
 }
@@ -1405,6 +2599,262 @@ void MidiPlayer::UpdateSongCtrlEvts(void)
 	return;
 }
 
+UINT8 MidiPlayer::SeekToTick(UINT32 tick)
+{
+	bool wasPaused = _paused;
+	size_t curMsg;
+	size_t curChn;
+	UINT32 syxBytes;
+	
+	bool fullState;
+	size_t curChk;
+	
+	DropPendingOutput();	// the state at the new position is sent again anyway
+	StopAllNotes();
+	ProcessEventQueue(true);
+	
+	_chaseMode = true;
+	_chaseSyx.clear();
+	fullState = false;	// set when _chaseSyx contains all SysEx messages since the beginning of the song
+	if (tick <= _curEvtTick)
+	{
+		// The song state can only be built going forward, so going back requires restarting the song.
+		// This also "sends" the device reset, which ends up in the list of collected SysEx messages.
+		Start();
+		_paused = wasPaused;
+		fullState = true;
+	}
+	// skip ahead to the nearest checkpoint, if there is one between the current position and the destination
+	for (curChk = _chkPts.size(); curChk > 0; curChk --)
+	{
+		const StateCheckpoint& cp = _chkPts[curChk - 1];
+		if (cp.tick <= _curEvtTick)
+			break;
+		if (cp.used && cp.tick <= tick)
+		{
+			RestoreCheckpoint(cp);
+			fullState = true;
+			break;
+		}
+	}
+	ChaseToTick(tick, fullState);
+	_chaseMode = false;
+	
+	// send state of the song at the new position: SysEx messages first, then the channel settings
+	_tmrStep = Timer_GetTime();
+	BeginOutputBatch();
+	syxBytes = 0;
+	for (curMsg = 0; curMsg < _chaseSyx.size(); curMsg ++)
+	{
+		const ChaseSyxMsg& csm = _chaseSyx[curMsg];
+		SendMidiEventL(csm.portID, csm.data.size(), &csm.data[0]);
+		syxBytes += (UINT32)csm.data.size();
+	}
+	_chaseSyx.clear();
+	for (curChn = 0x00; curChn < _chnStates.size(); curChn ++)
+	{
+		const ChannelState& chnSt = _chnStates[curChn];
+		// clear controllers that were changed before seeking (AllChannelRefresh sends non-default values only)
+		SendMidiEventS(chnSt.portID, 0xB0 | chnSt.midChn, 0x79, 0x00);
+	}
+	AllChannelRefresh();
+	EndOutputBatch();
+	
+	// The device needs time to receive all SysEx data. (MIDI transfer rate: 3125 bytes per second)
+	if (! _useManualTiming)
+		_tmrStep += (UINT64)syxBytes * _tmrFreq / MIDI_BYTE_RATE;
+	if (_tmrStep < _tmrMinStart)
+		_tmrStep = _tmrMinStart;	// wait for device reset
+	
+	UpdateSongCtrlEvts();
+	FlushOutputPorts();
+	vis_print_meta(0xFF, 0x51, 0, NULL);
+	vis_print_meta(0xFF, 0x58, 0, NULL);
+	vis_print_meta(0xFF, 0x59, 0, NULL);
+	
+	return 0x00;
+}
+
+void MidiPlayer::ChaseToTick(UINT32 tick, bool saveChkPts)
+{
+	size_t chkPos;
+	
+	// checkpoints can only be recorded when the state (including all SysEx messages) is complete
+	chkPos = _chkPts.size();
+	if (saveChkPts)
+	{
+		for (chkPos = 0; chkPos < _chkPts.size(); chkPos ++)
+		{
+			if (_chkPts[chkPos].tick > _curEvtTick)
+				break;
+		}
+	}
+	
+	// process all events before "tick", using the same order as the playback loops
+	if (_compActive)
+	{
+		while(_compEvtPos < _compEvts.size() && _compEvts[_compEvtPos].tick < tick)
+		{
+			const CompiledEvt& cEvt = _compEvts[_compEvtPos];
+			for (; chkPos < _chkPts.size() && _chkPts[chkPos].tick <= cEvt.tick; chkPos ++)
+			{
+				if (! _chkPts[chkPos].used)
+					SaveCheckpoint(_chkPts[chkPos]);
+			}
+			_curEvtTick = _nextEvtTick = cEvt.tick;
+			_compTmrTick = cEvt.tmrTick;
+			DoEvent(&_trkStates[cEvt.trkID], cEvt.evt);
+			_compEvtPos ++;
+		}
+		// song time of the destination tick
+		_compTmrTick += (INT64)((INT32)(tick - _nextEvtTick)) * (INT64)_curTickTime;
+	}
+	else
+	{
+		if (_trkHeapDirty)
+			RebuildTrackHeap();
+		while(! _trkHeap.empty() && TRKHEAP_TICK(_trkHeap.front()) < tick)
+		{
+			TrackState* mTS = &_trkStates[TRKHEAP_TRACK(_trkHeap.front())];
+			for (; chkPos < _chkPts.size() && _chkPts[chkPos].tick <= mTS->evtPos->tick; chkPos ++)
+			{
+				if (! _chkPts[chkPos].used)
+					SaveCheckpoint(_chkPts[chkPos]);
+			}
+			std::pop_heap(_trkHeap.begin(), _trkHeap.end(), std::greater<UINT64>());
+			_trkHeap.pop_back();
+			
+			_curEvtTick = _nextEvtTick = mTS->evtPos->tick;
+			while(mTS->evtPos != mTS->endPos && mTS->evtPos->tick <= _nextEvtTick)
+			{
+				DoEvent(mTS, &*mTS->evtPos);
+				if (mTS->evtPos == mTS->endPos)
+					break;
+				++mTS->evtPos;
+			}
+			if (mTS->evtPos != mTS->endPos)
+			{
+				_trkHeap.push_back(TRKHEAP_KEY(mTS->evtPos->tick, mTS->trkID));
+				std::push_heap(_trkHeap.begin(), _trkHeap.end(), std::greater<UINT64>());
+			}
+		}
+	}
+	_curEvtTick = _nextEvtTick = tick;
+	for (; chkPos < _chkPts.size() && _chkPts[chkPos].tick <= tick; chkPos ++)
+	{
+		if (! _chkPts[chkPos].used)
+			SaveCheckpoint(_chkPts[chkPos]);
+	}
+	
+	return;
+}
+
+void MidiPlayer::InvalidateCheckpoints(void)
+{
+	size_t curChk;
+	
+	for (curChk = 0; curChk < _chkPts.size(); curChk ++)
+	{
+		StateCheckpoint& cp = _chkPts[curChk];
+		if (! cp.used)
+			continue;
+		cp.used = false;
+		// free memory
+		std::vector<TrackState>().swap(cp.trkStates);
+		std::vector<ChannelState>().swap(cp.chnStates);
+		std::vector<ChaseSyxMsg>().swap(cp.chaseSyx);
+		cp.loopPt.trkEvtPos.clear();
+	}
+	
+	return;
+}
+
+void MidiPlayer::SaveCheckpoint(StateCheckpoint& cp)
+{
+	size_t curIdx;
+	
+	cp.curEvtTick = _curEvtTick;
+	cp.nextEvtTick = _nextEvtTick;
+	cp.tempoPos = _tempoPos;
+	cp.timeSigPos = _timeSigPos;
+	cp.keySigPos = _keySigPos;
+	cp.midiTempo = _midiTempo;
+	memcpy(cp.midiTimeSig, _midiTimeSig, 4);
+	memcpy(cp.midiKeySig, _midiKeySig, 2);
+	cp.trkStates = _trkStates;
+	cp.compEvtPos = _compEvtPos;
+	cp.compTmrTick = _compTmrTick;
+	cp.chnStates = _chnStates;
+	cp.noteVis = _noteVis;
+	cp.loopPt = _loopPt;
+	cp.chaseSyx = _chaseSyx;
+	cp.mstVol = _mstVol;
+	cp.defSrcInsMap = _defSrcInsMap;
+	cp.defDstInsMap = _defDstInsMap;
+	cp.hardReset = _hardReset;
+	cp.rcpMidTextMode = _rcpMidTextMode;
+	cp.karaokeMode = _karaokeMode;
+	cp.softKarTrack = _softKarTrack;
+	memcpy(cp.pixelPageMem, _pixelPageMem, sizeof(_pixelPageMem));
+	memcpy(cp.sc88usrIns, _sc88usrIns, sizeof(_sc88usrIns));
+	for (curIdx = 0; curIdx < 2; curIdx ++)
+		cp.sc88UsrDrmNames[curIdx] = _sc88UsrDrmNames[curIdx];
+	for (curIdx = 0; curIdx < 0x40; curIdx ++)
+		cp.mt32TimbreNames[curIdx] = _mt32TimbreNames[curIdx];
+	memcpy(cp.mt32PatchTGrp, _mt32PatchTGrp, sizeof(_mt32PatchTGrp));
+	memcpy(cp.mt32PatchTNum, _mt32PatchTNum, sizeof(_mt32PatchTNum));
+	memcpy(cp.cm32pPatchTMedia, _cm32pPatchTMedia, sizeof(_cm32pPatchTMedia));
+	memcpy(cp.cm32pPatchTNum, _cm32pPatchTNum, sizeof(_cm32pPatchTNum));
+	cp.used = true;
+	
+	return;
+}
+
+void MidiPlayer::RestoreCheckpoint(const StateCheckpoint& cp)
+{
+	size_t curIdx;
+	
+	_curEvtTick = cp.curEvtTick;
+	_nextEvtTick = cp.nextEvtTick;
+	_tempoPos = cp.tempoPos;
+	_timeSigPos = cp.timeSigPos;
+	_keySigPos = cp.keySigPos;
+	_midiTempo = cp.midiTempo;
+	memcpy(_midiTimeSig, cp.midiTimeSig, 4);
+	memcpy(_midiKeySig, cp.midiKeySig, 2);
+	RefreshTickTime();
+	_trkStates = cp.trkStates;
+	_trkHeapDirty = true;
+	_compEvtPos = cp.compEvtPos;
+	_compTmrTick = cp.compTmrTick;
+	_chnStates = cp.chnStates;
+	for (curIdx = 0; curIdx < _chnStates.size(); curIdx ++)
+		_chnStates[curIdx].userInsName = NULL;	// may point to strings of the checkpoint, AllChannelRefresh() sets it again
+	_noteVis = cp.noteVis;
+	_loopPt = cp.loopPt;
+	_chaseSyx = cp.chaseSyx;
+	_mstVol = cp.mstVol;
+	_defSrcInsMap = cp.defSrcInsMap;
+	_defDstInsMap = cp.defDstInsMap;
+	_hardReset = cp.hardReset;
+	_rcpMidTextMode = cp.rcpMidTextMode;
+	_karaokeMode = cp.karaokeMode;
+	_softKarTrack = cp.softKarTrack;
+	memcpy(_pixelPageMem, cp.pixelPageMem, sizeof(_pixelPageMem));
+	memcpy(_sc88usrIns, cp.sc88usrIns, sizeof(_sc88usrIns));
+	for (curIdx = 0; curIdx < 2; curIdx ++)
+		_sc88UsrDrmNames[curIdx] = cp.sc88UsrDrmNames[curIdx];
+	for (curIdx = 0; curIdx < 0x40; curIdx ++)
+		_mt32TimbreNames[curIdx] = cp.mt32TimbreNames[curIdx];
+	memcpy(_mt32PatchTGrp, cp.mt32PatchTGrp, sizeof(_mt32PatchTGrp));
+	memcpy(_mt32PatchTNum, cp.mt32PatchTNum, sizeof(_mt32PatchTNum));
+	memcpy(_cm32pPatchTMedia, cp.cm32pPatchTMedia, sizeof(_cm32pPatchTMedia));
+	memcpy(_cm32pPatchTNum, cp.cm32pPatchTNum, sizeof(_cm32pPatchTNum));
+	_insCache.clear();	// the cached instruments depend on the MT-32 patch assignment
+	
+	return;
+}
+
 void MidiPlayer::ForceNoteOff(ChannelState* chnSt, UINT8 note)
 {
 	// forcefully turn off all currently playing instances of the note
@@ -1680,7 +3130,7 @@ bool MidiPlayer::HandleControlEvent(ChannelState* chnSt, const TrackState* trkSt
 		}
 		else if (chnSt->ctrls[ctrlID] == 30)
 		{
-			if (_loopPt.used && _loopPt.tick < _nextEvtTick)
+			if (_loopPt.used && _loopPt.tick < _nextEvtTick && ! _chaseMode)
 			{
 				_curLoop ++;
 				if (! _options.numLoops || _curLoop < _options.numLoops)
@@ -1755,26 +3205,39 @@ bool MidiPlayer::HandleControlEvent(ChannelState* chnSt, const TrackState* trkSt
 
 static const INS_DATA* GetInsMapData(const INS_PRG_LST* insPrg, UINT8 msb, UINT8 lsb, UINT8 maxModuleID)
 {
-	const INS_DATA* insData;
-	const INS_DATA* idLowerMod;
-	UINT32 curIns;
-	
-	idLowerMod = NULL;
-	for (curIns = 0; curIns < insPrg->count; curIns ++)
+	const UINT32* idxList;
+	UINT32 idxCount;
+	UINT32 curPos;
+	UINT32 idxExact;
+	UINT32 idxLowerMod;
+	
+	// The bank index returns only instruments with a matching bank.
+	// They may not be in list order (when searching for any LSB), so the lowest index is searched
+	// in order to return the same instrument as a linear search of the list.
+	idxCount = GetInsBankEntries(insPrg, msb, lsb, &idxList);
+	idxExact = (UINT32)-1;
+	idxLowerMod = (UINT32)-1;
+	for (curPos = 0; curPos < idxCount; curPos ++)
 	{
-		insData = &insPrg->instruments[curIns];
-		if (msb == 0xFF || insData->bankMSB == msb)
+		UINT32 curIdx = idxList[curPos];
+		const INS_DATA* insData = &insPrg->instruments[curIdx];
+		if (lsb != 0xFF && insData->bankLSB != lsb)
+			continue;	// required when searching for any MSB
+		if (insData->moduleID == maxModuleID || (insData->moduleID & 0x80))
 		{
-			if (lsb == 0xFF || insData->bankLSB == lsb)
-			{
-				if (insData->moduleID == maxModuleID || (insData->moduleID & 0x80))
-					return insData;
-				else if (insData->moduleID < maxModuleID && idLowerMod == NULL)
-					idLowerMod = insData;
-			}
+			if (curIdx < idxExact)
+				idxExact = curIdx;
+		}
+		else if (insData->moduleID < maxModuleID && curIdx < idxLowerMod)
+		{
+			idxLowerMod = curIdx;
 		}
 	}
-	return idLowerMod;
+	if (idxExact != (UINT32)-1)
+		return &insPrg->instruments[idxExact];
+	if (idxLowerMod != (UINT32)-1)
+		return &insPrg->instruments[idxLowerMod];
+	return NULL;
 }
 
 static const INS_DATA* GetExactInstrument(const INS_BANK* insBank, const MidiPlayer::InstrumentInfo* insInf, UINT8 maxModuleID)
@@ -2498,6 +3961,80 @@ void MidiPlayer::HandleIns_GetRemapped(const ChannelState* chnSt, InstrumentInfo
 	return;
 }
 
+UINT64 MidiPlayer::GetInsCacheKey(const ChannelState* chnSt) const
+{
+	// all channel state and player state that HandleIns_GetOriginal/GetRemapped depend on
+	// Options, instrument banks and the MT-32 patch assignment are not part of the key.
+	// The cache is cleared when they change.
+	UINT64 key;
+	
+	key  = (UINT64)(chnSt->ctrls[0x00] & 0x7F) << 0;
+	key |= (UINT64)(chnSt->ctrls[0x20] & 0x7F) << 7;
+	key |= (UINT64)chnSt->curIns << 14;
+	key |= (UINT64)((chnSt->flags & 0x80) >> 7) << 22;	// drum mode
+	key |= (UINT64)(chnSt->midChn <= 0x09) << 23;	// MT-32/CM-32L or CM-32P part
+	key |= (UINT64)(chnSt->userInsID != 0xFFFF) << 24;
+	key |= (UINT64)chnSt->defInsMap << 32;
+	key |= (UINT64)_defSrcInsMap << 40;
+	key |= (UINT64)_defDstInsMap << 48;
+	return key;
+}
+
+void MidiPlayer::HandleIns_Resolve(ChannelState* chnSt)
+{
+	UINT64 key = GetInsCacheKey(chnSt);
+	std::unordered_map<UINT64, InsCacheEntry>::const_iterator ceIt;
+	InsCacheEntry ce;
+	
+	ceIt = _insCache.find(key);
+	if (ceIt != _insCache.end())
+	{
+		chnSt->insOrg = ceIt->second.insOrg;
+		chnSt->insSend = ceIt->second.insSend;
+		return;
+	}
+	
+	HandleIns_GetOriginal(chnSt, &chnSt->insOrg);
+	HandleIns_GetRemapped(chnSt, &chnSt->insSend);
+	if (_insCache.size() >= INSCACHE_MAX_SIZE)
+		_insCache.clear();
+	ce.insOrg = chnSt->insOrg;
+	ce.insSend = chnSt->insSend;
+	_insCache[key] = ce;
+	
+	return;
+}
+
+void MidiPlayer::PrewarmInsCache(void)
+{
+	size_t curSel;
+	ChannelState tmpSt;
+	
+	if (_chnStates.size() < 0x10)
+		return;
+	
+	// Resolve all instruments the song selects, using the default mode of the respective channel.
+	// Channels that switch to drum mode or user instruments fill the cache on first use.
+	for (curSel = 0; curSel < _songInsSel.size(); curSel ++)
+	{
+		UINT32 insSel = _songInsSel[curSel];
+		const ChannelState& chnSt = _chnStates[(insSel >> 24) & 0x0F];
+		UINT8 bankMSB = (insSel >> 16) & 0xFF;
+		UINT8 bankLSB = (insSel >>  8) & 0xFF;
+		
+		tmpSt.midChn = chnSt.midChn;
+		tmpSt.flags = chnSt.flags;
+		tmpSt.defInsMap = chnSt.defInsMap;
+		tmpSt.userInsID = 0xFFFF;
+		tmpSt.ctrls[0x00] = (bankMSB == 0xFF) ? chnSt.ctrls[0x00] : bankMSB;	// 0xFF = not set by the song
+		tmpSt.ctrls[0x20] = (bankLSB == 0xFF) ? chnSt.ctrls[0x20] : bankLSB;
+		tmpSt.curIns = (insSel >> 0) & 0x7F;
+		HandleIns_Resolve(&tmpSt);
+	}
+	
+	return;
+}
+
 static void PrintHexCtrlVal(char* buffer, UINT8 data, char wcChar)
 {
 	if (wcChar != '\0' && (data & 0x80))	// invalid value
@@ -2603,8 +4140,7 @@ bool MidiPlayer::HandleInstrumentEvent(ChannelState* chnSt, const MidiEvent* mid
 		nvChn->_chnMode |= (chnSt->flags & 0x80) >> 7;
 	}
 	
-	HandleIns_GetOriginal(chnSt, &chnSt->insOrg);
-	HandleIns_GetRemapped(chnSt, &chnSt->insSend);
+	HandleIns_Resolve(chnSt);
 	if (MMASK_TYPE(_options.dstType) == MODULE_TYPE_LA && ! (chnSt->flags & 0x80))
 	{
 		// On the MT-32, you can remap the patch set to other timbres.
@@ -2670,7 +4206,7 @@ bool MidiPlayer::HandleInstrumentEvent(ChannelState* chnSt, const MidiEvent* mid
 		}
 	}
 	
-	if (dispOpts->showInsChange && ! (noact & 0x10))
+	if (_dispOpts->showInsChange && ! (noact & 0x10))
 	{
 		const char* oldName;
 		const char* newName;
@@ -3260,7 +4796,7 @@ bool MidiPlayer::HandleSysEx_MT32(UINT8 portID, size_t syxSize, const UINT8* syx
 	case 0x030000:	// Patch Temporary Area
 		if ((addr & 0x0F) > 0x00)
 			break;	// Right now we can only handle bulk writes.
-		if (tmpSyxIgnore && true)
+		if (_tmpSyxIgnore && true)
 			break;	// ignore during initialization
 		if (addr < 0x030100)
 		{
@@ -3336,6 +4872,7 @@ bool MidiPlayer::HandleSysEx_MT32(UINT8 portID, size_t syxSize, const UINT8* syx
 					break;
 				}
 			}
+			_insCache.clear();
 		}
 		break;
 	case 0x080000:	// Timbre Memory
@@ -3638,12 +5175,12 @@ bool MidiPlayer::HandleSysEx_GS(UINT8 portID, size_t syxSize, const UINT8* syxDa
 				else if (tune > +0x3E8)
 					tune = +0x3E8;
 				_noteVis.GetAttributes().detune[0] = tune >> 2;
-				if (! tmpSyxIgnore)
+				if (! _tmpSyxIgnore)
 					vis_printf("SysEx GS: Master Tune = %+.1f cent", tune / 10.0);
 			}
 			break;
 		case 0x400004:	// Master Volume
-			if (! tmpSyxIgnore)
+			if (! _tmpSyxIgnore)
 				vis_printf("SysEx GS: Master Volume = %u", xData[0x00]);
 			if (MMASK_TYPE(_options.dstType) >= MODULE_TYPE_LA)
 				break;
@@ -3682,7 +5219,7 @@ bool MidiPlayer::HandleSysEx_GS(UINT8 portID, size_t syxSize, const UINT8* syxDa
 		case 0x40007F:	// GS reset
 			if (xLen < 0x01)
 				break;	// when there is no parameter, the message has no effect
-			if (! tmpSyxIgnore)
+			if (! _tmpSyxIgnore)
 				vis_addstr("SysEx: GS Reset\n");
 			if ((_options.flags & PLROPTS_RESET) && MMASK_TYPE(_options.dstType) != MODULE_TYPE_GS)
 				return true;	// prevent GS reset on other devices
@@ -3987,12 +5524,12 @@ bool MidiPlayer::HandleSysEx_XG(UINT8 portID, size_t syxSize, const UINT8* syxDa
 				else if (tune > +0x3FF)
 					tune = +0x3FF;
 				_noteVis.GetAttributes().detune[0] = tune >> 2;
-				if (! tmpSyxIgnore)
+				if (! _tmpSyxIgnore)
 					vis_printf("SysEx XG: Master Tune = %+.1f cent", tune / 10.0);
 			}
 			break;
 		case 0x000004:	// Master Volume
-			if (! tmpSyxIgnore)
+			if (! _tmpSyxIgnore)
 				vis_printf("SysEx XG: Master Volume = %u", xData[0x00]);
 			if (MMASK_TYPE(_options.dstType) >= MODULE_TYPE_LA)
 				break;
@@ -4007,7 +5544,7 @@ bool MidiPlayer::HandleSysEx_XG(UINT8 portID, size_t syxSize, const UINT8* syxDa
 			}
 			break;
 		case 0x000005:	// Master Attenuator
-			if (! tmpSyxIgnore)
+			if (! _tmpSyxIgnore)
 				vis_printf("SysEx XG: Master Attenuator = %u", xData[0x00]);
 			if (MMASK_TYPE(_options.dstType) >= MODULE_TYPE_LA)
 				break;
@@ -4282,8 +5819,13 @@ void MidiPlayer::AllNotesStop(void)
 	size_t curChn;
 	std::list<NoteInfo>::iterator ntIt;
 	
+	BeginOutputBatch();
 	if (! _useManualTiming)
+	{
 		_tmrStep = Timer_GetTime();	// properly time the following events
+		if (_tmrStep < _outQueuedUntil)
+			_tmrStep = _outQueuedUntil;	// scheduled output: stop notes after the messages that are still queued
+	}
 	for (curChn = 0x00; curChn < _chnStates.size(); curChn ++)
 	{
 		ChannelState& chnSt = _chnStates[curChn];
@@ -4296,6 +5838,8 @@ void MidiPlayer::AllNotesStop(void)
 		if (chnSt.ctrls[0x42] & 0x40)	// turn Sostenuto off
 			SendMidiEventS(chnSt.portID, 0xB0 | chnSt.midChn, 0x42, 0x00);
 	}
+	EndOutputBatch();
+	FlushOutputPorts();
 	
 	return;
 }
@@ -4305,6 +5849,7 @@ void MidiPlayer::AllNotesRestart(void)
 	size_t curChn;
 	std::list<NoteInfo>::iterator ntIt;
 	
+	BeginOutputBatch();
 	if (! _useManualTiming)
 		_tmrStep = Timer_GetTime();	// properly time the following events
 	for (curChn = 0x00; curChn < _chnStates.size(); curChn ++)
@@ -4322,6 +5867,7 @@ void MidiPlayer::AllNotesRestart(void)
 		for (ntIt = chnSt.notes.begin(); ntIt != chnSt.notes.end(); ++ntIt)
 			SendMidiEventS(chnSt.portID, 0x90 | ntIt->chn, ntIt->note, ntIt->vel);
 	}
+	EndOutputBatch();
 	
 	return;
 }
@@ -4464,6 +6010,7 @@ void MidiPlayer::AllChannelRefresh(void)
 	std::list<NoteInfo>::iterator ntIt;
 	UINT8 defDstPbRange;
 	
+	BeginOutputBatch();
 	_tmrStep = Timer_GetTime();	// properly time the following events
 	if (MMASK_TYPE(_options.dstType) == MODULE_TYPE_LA)
 		defDstPbRange = 12;
@@ -4558,6 +6105,7 @@ void MidiPlayer::AllChannelRefresh(void)
 			SendMidiEventS(chnSt.portID, 0xB0 | chnSt.midChn, 0x62, chnSt.rpnCtrl[0x01]);
 		// TODO: restore NRPNs
 	}
+	EndOutputBatch();
 	
 	return;
 }
@@ -4591,6 +6139,7 @@ void MidiPlayer::PrepareMidi(void)
 	_tempoList.clear();
 	_timeSigList.clear();
 	_keySigList.clear();
+	_songInsSel.clear();
 	
 	tickBase = 0;
 	maxTicks = 0;
@@ -4598,12 +6147,27 @@ void MidiPlayer::PrepareMidi(void)
 	{
 		MidiTrack* mTrk = _cMidi->GetTrack(curTrk);
 		midevt_iterator evtIt;
+		UINT8 chnBank[0x10][2];	// Bank MSB/LSB per MIDI channel, 0xFF = not set
 		
+		memset(chnBank, 0xFF, sizeof(chnBank));
 		for (evtIt = mTrk->GetEventBegin(); evtIt != mTrk->GetEventEnd(); ++evtIt)
 		{
 			evtIt->tick += tickBase;	// for Format 2 files, apply track offset
 			
-			if (evtIt->evtType == 0xFF)
+			if ((evtIt->evtType & 0xF0) == 0xB0)
+			{
+				if (evtIt->evtValA == 0x00)
+					chnBank[evtIt->evtType & 0x0F][0] = evtIt->evtValB & 0x7F;
+				else if (evtIt->evtValA == 0x20)
+					chnBank[evtIt->evtType & 0x0F][1] = evtIt->evtValB & 0x7F;
+			}
+			else if ((evtIt->evtType & 0xF0) == 0xC0)
+			{
+				UINT8 midChn = evtIt->evtType & 0x0F;
+				_songInsSel.push_back((midChn << 24) | (chnBank[midChn][0] << 16) |
+									(chnBank[midChn][1] << 8) | (evtIt->evtValA & 0x7F));
+			}
+			else if (evtIt->evtType == 0xFF)
 			{
 				switch(evtIt->evtValA)
 				{
@@ -4647,6 +6211,9 @@ void MidiPlayer::PrepareMidi(void)
 		}
 	}
 	
+	std::sort(_songInsSel.begin(), _songInsSel.end());
+	_songInsSel.erase(std::unique(_songInsSel.begin(), _songInsSel.end()), _songInsSel.end());
+	
 	_tempoList.sort(tempo_compare);
 	if (_tempoList.empty() || _tempoList.front().tick > 0)
 	{
@@ -4715,6 +6282,87 @@ void MidiPlayer::PrepareMidi(void)
 	}
 	CalcMeasureTime(*tscPrevIt, ticksWhole, _songTickLen, &_songMeasLen[0], &_songMeasLen[1], &_songMeasLen[2]);
 	
+	_compEvts.clear();
+	if (_options.compiledTimeline)
+		CompileTimeline();
+	PrepareCheckpoints();
+	
+	return;
+}
+
+void MidiPlayer::PrepareCheckpoints(void)
+{
+	UINT64 chkTime;
+	UINT32 chkTick;
+	
+	// Only the positions are set here. The song state depends on the device settings,
+	// so it is recorded when seeking passes a checkpoint for the first time.
+	_chkPts.clear();
+	_chkPts.reserve((size_t)(_songLength / (CHKPT_INTERVAL * _tmrFreq)));
+	for (chkTime = CHKPT_INTERVAL * _tmrFreq; chkTime < _songLength; chkTime += CHKPT_INTERVAL * _tmrFreq)
+	{
+		chkTick = TimeToTick(chkTime);
+		if (chkTick == 0 || (! _chkPts.empty() && chkTick <= _chkPts.back().tick))
+			continue;
+		_chkPts.push_back(StateCheckpoint());
+		_chkPts.back().used = false;
+		_chkPts.back().tick = chkTick;
+	}
+	
+	return;
+}
+
+/*static*/ bool MidiPlayer::compevt_compare(const MidiPlayer::CompiledEvt& first, const MidiPlayer::CompiledEvt& second)
+{
+	return (first.tick < second.tick);
+}
+
+void MidiPlayer::CompileTimeline(void)
+{
+	UINT16 curTrk;
+	size_t curEvt;
+	UINT32 lastTick;
+	UINT64 tmrTick;
+	
+	_compEvts.clear();
+	for (curTrk = 0; curTrk < _cMidi->GetTrackCount(); curTrk ++)
+	{
+		MidiTrack* mTrk = _cMidi->GetTrack(curTrk);
+		midevt_const_it evtIt;
+		
+		for (evtIt = mTrk->GetEventBegin(); evtIt != mTrk->GetEventEnd(); ++evtIt)
+		{
+			CompiledEvt cEvt;
+			cEvt.tick = evtIt->tick;
+			cEvt.trkID = curTrk;
+			cEvt.tmrTick = 0;
+			cEvt.evt = &*evtIt;
+			_compEvts.push_back(cEvt);
+			if (evtIt->evtType == 0xFF && evtIt->evtValA == 0x2F)
+				break;	// the player ignores everything after the Track End event
+		}
+	}
+	// stable sort keeps the (track, event) order for events on the same tick
+	std::stable_sort(_compEvts.begin(), _compEvts.end(), compevt_compare);
+	
+	// calculate song time for all events, applying tempo changes in playback order
+	_midiTempo = _tempoList.front().tempo;
+	RefreshTickTime();
+	lastTick = 0;
+	tmrTick = 0;
+	for (curEvt = 0; curEvt < _compEvts.size(); curEvt ++)
+	{
+		CompiledEvt& cEvt = _compEvts[curEvt];
+		tmrTick += (cEvt.tick - lastTick) * _curTickTime;
+		lastTick = cEvt.tick;
+		cEvt.tmrTick = tmrTick;
+		if (cEvt.evt->evtType == 0xFF && cEvt.evt->evtValA == 0x51 && cEvt.evt->evtData.size() >= 3)
+		{
+			_midiTempo = ReadBE24(&cEvt.evt->evtData[0x00]);
+			RefreshTickTime();
+		}
+	}
+	
 	return;
 }
 
@@ -4829,6 +6477,7 @@ void MidiPlayer::InitializeChannels(void)
 			_mt32PatchTGrp[curIns] = (curIns >> 6) & 0x03;
 			_mt32PatchTNum[curIns] = (curIns >> 0) & 0x3F;
 		}
+		_insCache.clear();
 		for (curIns = 0x00; curIns < 0x40; curIns ++)
 		{
 			// initialize default CM-32P patch assignment
@@ -4932,6 +6581,7 @@ void MidiPlayer::InitializeChannels_Post(void)
 	size_t curChn;
 	UINT8 defDstPbRange;
 	
+	BeginOutputBatch();
 	_initChnPost = false;
 	_partModeChg_ModType = 0xFF;
 	_partModeChg_PortChnID = 0xFFFF;
@@ -5038,6 +6688,8 @@ void MidiPlayer::InitializeChannels_Post(void)
 			}
 		}
 	}
+	EndOutputBatch();
+	PrewarmInsCache();
 	
 	return;
 }
@@ -5057,6 +6709,11 @@ void MidiPlayer::SaveLoopState(LoopPoint& lp, const TrackState* loopMarkTrk)
 		if (&_trkStates[curTrk] == loopMarkTrk)
 			lp.trkEvtPos[curTrk] ++;	// skip loop event
 	}
+	lp.compEvtPos = _compEvtPos;
+	if (loopMarkTrk != NULL)
+		lp.compEvtPos ++;	// skip loop event
+	lp.compTmrTick = _compTmrTick;
+	lp.compTempo = _midiTempo;
 	lp.used = true;
 	
 	return;
@@ -5078,6 +6735,16 @@ void MidiPlayer::RestoreLoopState(const LoopPoint& lp)
 	_keySigPos = lp.keySigPos;
 	for (curTrk = 0; curTrk < _loopPt.trkEvtPos.size(); curTrk ++)
 		_trkStates[curTrk].evtPos = _loopPt.trkEvtPos[curTrk];
+	_trkHeapDirty = true;
+	_compEvtPos = lp.compEvtPos;
+	_compTmrTick = lp.compTmrTick;
+	if (_compActive)
+	{
+		// The precomputed event times use the tempo from the loop start,
+		// so the tick time has to match it.
+		_midiTempo = lp.compTempo;
+		RefreshTickTime();
+	}
 	
 	return;
 }
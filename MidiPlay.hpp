@@ -5,7 +5,7 @@
 #include <string>
 #include <vector>
 #include <list>
-#include <queue>
+#include <unordered_map>
 
 #include "MidiLib.hpp"
 #include "NoteVis.hpp"
@@ -13,6 +13,9 @@
 #include "OSTimer.h"
 #include "MidiInsReader.h"
 #include "MidiModules.hpp"	// for MidiModOpts and MidiModule
+#include "MidiEvtQueue.hpp"
+
+struct DisplayOptions;
 
 
 #define PLROPTS_RESET		0x01	// needs GM/GS/XG reset
@@ -35,13 +38,8 @@ struct PlayerOpts
 	bool noNoteOverlap;
 	UINT8 gmDrumFallback;
 	bool fixSysExChksum;
-};
-
-struct MidiQueueEvt
-{
-	UINT64 time;
-	UINT8 flag;
-	std::vector<UINT8> data;
+	bool compiledTimeline;	// merge all tracks into a single time-sorted event list for playback
+	UINT32 outLookahead;	// scheduled output: process events this many ms in advance (0 = send directly)
 };
 
 class MidiPlayer
@@ -96,6 +94,25 @@ public:
 		std::string insNameBuf;
 		std::list<NoteInfo> notes;	// currently running notes
 	};
+	struct WireStats
+	{
+		UINT64 bytes;		// number of bytes sent over the link
+		UINT32 batches;		// number of transfers (usually one per tick)
+		UINT32 satBatches;	// transfers that had to wait for previous data
+		UINT32 reordered;	// saturated transfers whose messages were reordered
+		UINT32 dropped;		// number of redundant messages that were removed
+		UINT32 maxDelayUS;	// maximum time until all data of a transfer arrived [microseconds]
+	};
+	struct TimingStats
+	{
+		UINT64 events;		// number of messages that were passed to the output driver
+		UINT32 lateHist[0x80];	// histogram of the send delays, 4 logarithmic buckets per power of 2 [microseconds]
+		UINT32 maxLateUS;	// maximum send delay [microseconds]
+		UINT64 steps;		// number of DoPlaybackStep calls
+		UINT64 ticks;		// number of processed song ticks
+		UINT32 lagResets;	// number of timer resets due to lagging behind >= 1 second
+		UINT32 maxQueueDepth;	// maximum number of events in a delay queue
+	};
 private:
 	struct TrackState
 	{
@@ -104,6 +121,13 @@ private:
 		midevt_const_it endPos;
 		midevt_const_it evtPos;
 	};
+	struct CompiledEvt
+	{
+		UINT32 tick;
+		UINT16 trkID;
+		UINT64 tmrTick;		// song time of the event (in timer ticks)
+		const MidiEvent* evt;
+	};
 	struct TempoChg
 	{
 		UINT32 tick;
@@ -129,6 +153,61 @@ private:
 		std::list<TimeSigChg>::const_iterator timeSigPos;
 		std::list<KeySigChg>::const_iterator keySigPos;
 		std::vector<midevt_const_it> trkEvtPos;	// evtPos of each track
+		size_t compEvtPos;		// compiled timeline: event index
+		UINT64 compTmrTick;		// compiled timeline: song time at "tick"
+		UINT32 compTempo;		// compiled timeline: MIDI tempo at "tick"
+	};
+	struct CtrlOutState
+	{
+		// index: 00..7F - controllers, 80 - pitch bend, 81 - channel aftertouch
+		UINT16 sentVal[0x82];	// last value sent to the device, 0xFFFF = unknown
+		UINT16 pendVal[0x82];	// value held back by the rate limit, 0xFFFF = none
+		UINT64 sentTime[0x82];
+	};
+	struct InsCacheEntry
+	{
+		InstrumentInfo insOrg;
+		InstrumentInfo insSend;
+	};
+	struct ChaseSyxMsg
+	{
+		UINT8 portID;
+		std::vector<UINT8> data;
+	};
+	struct StateCheckpoint
+	{
+		bool used;		// the state was recorded
+		UINT32 tick;	// all events before this tick were processed
+		UINT32 curEvtTick;
+		UINT32 nextEvtTick;
+		std::list<TempoChg>::const_iterator tempoPos;
+		std::list<TimeSigChg>::const_iterator timeSigPos;
+		std::list<KeySigChg>::const_iterator keySigPos;
+		UINT32 midiTempo;
+		UINT8 midiTimeSig[4];
+		INT8 midiKeySig[2];
+		std::vector<TrackState> trkStates;
+		size_t compEvtPos;
+		UINT64 compTmrTick;
+		std::vector<ChannelState> chnStates;
+		NoteVisualization noteVis;
+		LoopPoint loopPt;
+		std::vector<ChaseSyxMsg> chaseSyx;	// all SysEx messages up to this point
+		UINT8 mstVol;
+		UINT8 defSrcInsMap;
+		UINT8 defDstInsMap;
+		bool hardReset;
+		UINT8 rcpMidTextMode;
+		UINT8 karaokeMode;
+		UINT16 softKarTrack;
+		UINT8 pixelPageMem[10][0x40];
+		InstrumentInfo sc88usrIns[0x100];
+		std::string sc88UsrDrmNames[2];
+		std::string mt32TimbreNames[0x40];
+		UINT8 mt32PatchTGrp[0x80];
+		UINT8 mt32PatchTNum[0x80];
+		UINT8 cm32pPatchTMedia[0x80];
+		UINT8 cm32pPatchTNum[0x80];
 	};
 	
 public:
@@ -146,6 +225,7 @@ public:
 	void SetSrcModuleType(UINT8 modType, bool insRefresh = false);
 	void SetDstModuleType(UINT8 modType, bool chnRefresh = false);
 	void SetInstrumentBank(UINT8 moduleType, const INS_BANK* insBank);
+	void SetRenderOutput(MidiFile* outFile);	// write the output into a MIDI file instead of sending it (NULL = finish file)
 	UINT8 Start(void);
 	UINT8 Stop(void);
 	UINT8 Pause(void);
@@ -153,6 +233,8 @@ public:
 	UINT8 FlushEvents(void);
 	UINT8 StopAllNotes(void);
 	UINT8 FadeOutT(double fadeTime);	// fade out over x seconds
+	UINT8 Seek(double seconds);	// jump to song position (in seconds)
+	UINT8 SeekM(UINT32 bar, UINT32 beat, UINT32 tick);	// jump to bar:beat:tick (0-based, like GetPlaybackPosM)
 	UINT8 GetState(void) const;
 	double GetSongLength(void) const;	// returns length in seconds
 	void GetSongLengthM(UINT32* bar, UINT32* beat, UINT32* tick) const;	// return length in bar:beat:tick
@@ -164,12 +246,18 @@ public:
 	INT8 GetCurKeySig(void) const;
 	const std::vector<ChannelState>& GetChannelStates(void) const;
 	NoteVisualization* GetNoteVis(void);
+	const std::vector<WireStats>& GetWireStats(void) const;	// empty when the link model is disabled
+	const TimingStats& GetTimingStats(void) const;
+	static UINT32 GetTimingPercentile(const TimingStats& ts, double fraction);	// returns the send delay [microseconds]
 	void HandleRawEvent(size_t dataLen, const UINT8* data);
 	
 	void AdvanceManualTiming(UINT64 time, INT8 mode);	// mode: 0 - set, 1 - accumulate, -1 - set mode
 	void DoPlaybackStep(void);
+	UINT64 GetNextEventDelay(void) const;	// time (in ns) until DoPlaybackStep has work to do, -1 = nothing scheduled
+	UINT64 GetNextEventTime(void) const;	// OSTimer_GetTime value at which DoPlaybackStep has work to do, -1 = nothing scheduled
 private:
 	UINT64 Timer_GetTime(void) const;
+	UINT64 GetNextWorkTime(void) const;
 	void SendMidiEventS(size_t portID, UINT8 event, UINT8 data1, UINT8 data2);	// short MIDI event
 	void SendMidiEventL(size_t portID, size_t dataLen, const void* data);	// long MIDI event
 	
@@ -177,19 +265,57 @@ private:
 	static bool tempo_compare(const TempoChg& first, const TempoChg& second);
 	static bool timesig_compare(const MidiPlayer::TimeSigChg& first, const MidiPlayer::TimeSigChg& second);
 	static bool keysig_compare(const MidiPlayer::KeySigChg& first, const MidiPlayer::KeySigChg& second);
+	static bool compevt_compare(const MidiPlayer::CompiledEvt& first, const MidiPlayer::CompiledEvt& second);
 	void PrepareMidi(void);
+	void PrepareCheckpoints(void);
+	void CompileTimeline(void);
 	void RefreshSrcDevSettings(void);
 	void InitChannelAssignment(void);
 	void InitializeChannels(void);
 	void InitializeChannels_Post(void);
+	UINT64 CalcTickTime(UINT32 tempo) const;
+	UINT32 TimeToTick(UINT64 tmrTick) const;
 	void RefreshTickTime(void);
 	static void CalcMeasureTime(const TimeSigChg& tsc, UINT32 ticksWhole, UINT32 tickPos,
 								UINT32* mtBar, UINT32* mtBeat, UINT32* mtTick);
 	void DoEvent(TrackState* trkState, const MidiEvent* midiEvt);
 	void ProcessEventQueue(bool flush = false);
-	void EvtQueue_OptimizePortEvts(std::queue<MidiQueueEvt>& meq, INT64 dtMove);
+	void EvtQueue_Push(size_t portID, UINT8 flag, UINT32 dataLen, const UINT8* data);
+	void EvtQueue_SendFront(size_t portID);
+	void PortSendShortMsg(size_t portID, UINT64 time, UINT8 event, UINT8 data1, UINT8 data2);
+	void PortSendLongMsg(size_t portID, UINT64 time, size_t dataLen, const void* data);
+	UINT32 GetOutputDelay(UINT64 time);
+	void ApplyOutputScheduling(void);
+	void FlushOutputPorts(void);
+	void DropPendingOutput(void);
+	void BeginOutputBatch(void);
+	void EndOutputBatch(void);
+	void SendOutputBatch(size_t portID);
+	void Wire_Reset(void);
+	void Wire_SendData(size_t portID, UINT64 time, UINT32 bytes);
+	void Wire_PrepareBatch(size_t portID);
+	void Wire_DropRedundantMsgs(size_t portID);
+	bool Wire_ReorderBatch(size_t portID);
+	void CtrlFilter_Reset(void);
+	bool CtrlFilter_Check(size_t portID, UINT8 event, UINT8 data1, UINT8 data2);
+	void CtrlFilter_InvalidatePort(size_t portID);
+	void CtrlFilter_Flush(UINT64 time);
+	void CtrlFilter_FlushChannel(size_t portID, UINT8 midChn);
+	void CtrlFilter_SendPending(size_t portID, UINT8 midChn, UINT8 ctrlID);
+	void CtrlFilter_DiscardPending(void);
+	void Timing_RecordSend(size_t count, const UINT64* times);
+	MidiTrack* GetRenderTrack(size_t portID, UINT64 time, UINT32* tick);
+	void EvtQueue_OptimizePortEvts(MidiEvtQueue& meq, INT64 dtMove);
 	void EvtQueue_OptimizeChnEvts(std::vector<MidiQueueEvt>& meList, INT64 dtMove, UINT64 limitMinTime);
+	void DoPlaybackLoop_Tracks(UINT64 curTime);
+	void RebuildTrackHeap(void);
+	void DoPlaybackLoop_Compiled(UINT64 curTime);
 	void UpdateSongCtrlEvts(void);
+	UINT8 SeekToTick(UINT32 tick);
+	void ChaseToTick(UINT32 tick, bool saveChkPts);
+	void InvalidateCheckpoints(void);
+	void SaveCheckpoint(StateCheckpoint& cp);
+	void RestoreCheckpoint(const StateCheckpoint& cp);
 	void ForceNoteOff(ChannelState* chnSt, UINT8 note);
 	bool HandleNoteEvent(ChannelState* chnSt, const TrackState* trkSt, const MidiEvent* midiEvt);
 	bool HandleControlEvent(ChannelState* chnSt, const TrackState* trkSt, const MidiEvent* midiEvt);
@@ -197,6 +323,9 @@ private:
 	void HandleIns_DoFallback(const ChannelState* chnSt, InstrumentInfo* insInf, UINT8 devType, UINT8 maxModuleID, const INS_BANK* insBank);
 	void HandleIns_GetOriginal(const ChannelState* chnSt, InstrumentInfo* insInf);
 	void HandleIns_GetRemapped(const ChannelState* chnSt, InstrumentInfo* insInf);
+	UINT64 GetInsCacheKey(const ChannelState* chnSt) const;
+	void HandleIns_Resolve(ChannelState* chnSt);
+	void PrewarmInsCache(void);
 	bool HandleInstrumentEvent(ChannelState* chnSt, const MidiEvent* midiEvt, UINT8 noact = 0x00);
 	void DoChangedPartMode(ChannelState* chnSt, UINT8 moduleType);
 	void DoChangedPartMode_Post(void);
@@ -241,8 +370,21 @@ private:
 	std::vector<UINT32> _outPortDelay;	// delay (in ms) for all event on this port (for sync'ing HW/SW)
 	std::vector<UINT16> _portChnMask;	// delay (in ms) for all event on this port (for sync'ing HW/SW)
 	MidiModOpts _portOpts;
-	std::vector< std::queue<MidiQueueEvt> > _midiEvtQueue;
+	std::vector<MidiEvtQueue*> _midiEvtQueue;	// only allocated for ports with delay
+	UINT32 _outBatchDepth;	// >0: collect short messages and send them using MidiOutPort_SendBatch
+	std::vector< std::vector<MIDI_MSG> > _outBatchMsgs;	// per port: collected messages
+	std::vector< std::vector<UINT64> > _outBatchTimes;	// per port: timestamps of the collected messages
+	std::vector<UINT64> _wireBusyUntil;	// link model, per port: time when all data sent so far is transferred
+	std::vector<WireStats> _wireStats;	// link model, per port: statistics
+	std::vector<CtrlOutState> _ctrlOutStates;	// output filter: per output port and MIDI channel (empty = disabled)
+	UINT64 _ctrlMinDist;	// output filter: minimum time between two messages of the same controller (0 = no limit)
+	UINT32 _ctrlPendCount;	// output filter: number of held back values
+	UINT64 _ctrlPendNext;	// output filter: time when the earliest held back value is due
+	TimingStats _timingStats;
+	MidiFile* _renderFile;	// render mode: receives the output instead of the MIDI ports
+	std::vector<MidiTrack*> _renderTrks;	// render mode: one track per output port
 	
+	const DisplayOptions* _dispOpts;
 	OS_TIMER* _osTimer;
 	UINT64 _tmrFreq;		// number of virtual timer ticks for 1 second
 	UINT64 _tmrStep;		// timestamp: next update of sequence processor
@@ -251,6 +393,8 @@ private:
 	UINT64 _tmrFadeLen;		// duration of fade out (in timer ticks)
 	UINT64 _tmrFadeNext;	// timestamp: next fade out update
 	UINT64 _manTimeTick;
+	UINT64 _outLookahead;	// scheduled output: time (in timer ticks) that events are sent in advance
+	UINT64 _outQueuedUntil;	// scheduled output: timestamp of the latest message that was passed to the driver
 	std::list<TempoChg>::const_iterator _tempoPos;
 	std::list<TimeSigChg>::const_iterator _timeSigPos;
 	std::list<KeySigChg>::const_iterator _keySigPos;
@@ -261,7 +405,15 @@ private:
 							// FF when not set
 	UINT8 _defDstInsMap;	// default instrument map of destination device (for GM -> GS/XG mapping)
 	UINT8 _defPbRange;
+	std::unordered_map<UINT64, InsCacheEntry> _insCache;	// results of HandleIns_Resolve, see GetInsCacheKey
+	std::vector<UINT32> _songInsSel;	// instruments selected by the song: (channel, bank MSB, bank LSB, instrument), for PrewarmInsCache
 	std::vector<TrackState> _trkStates;
+	std::vector<UINT64> _trkHeap;	// min-heap of (next event tick, track ID), see TRKHEAP_KEY
+	bool _trkHeapDirty;		// track positions were changed, heap needs to be rebuilt
+	std::vector<CompiledEvt> _compEvts;	// all events of the song, sorted by (tick, track, event order)
+	bool _compActive;		// playback uses the compiled timeline
+	size_t _compEvtPos;		// compiled timeline: next event to process
+	UINT64 _compTmrTick;	// compiled timeline: song time of _nextEvtTick
 	std::vector<ChannelState> _chnStates;
 	UINT8 _mstVol;			// master volume, according to SysEx
 	UINT8 _mstVolFade;		// master volume, after applying FadeOut value
@@ -287,6 +439,10 @@ private:
 	UINT16 _partModeChg_PortChnID;
 	UINT8 _partModeChg_ModType;	// 0xFF = no action, 0x00..0x7F = MIDI type
 	bool _meqDoSort;		// MIDI Event Queue: do resorting
+	bool _chaseMode;		// seeking: update the channel state only, don't send anything
+	bool _tmpSyxIgnore;		// set while processing an event from HandleRawEvent()
+	std::vector<ChaseSyxMsg> _chaseSyx;	// SysEx messages collected while seeking
+	std::vector<StateCheckpoint> _chkPts;	// song state snapshots for faster seeking, sorted by tick
 	UINT32 _midiTempo;
 	UINT8 _midiTimeSig[4];	// numerator, denominator (pow2), metronome pulse, 32nd notes per beat
 	INT8 _midiKeySig[2];	// number of sharps/flats, scale (major/minor)
@@ -0,0 +1,57 @@
+// Windows Mutexes
+// ---------------
+
+#include <stdlib.h>
+#include <stddef.h>
+
+#include <Windows.h>
+
+#include <stdtype.h>
+#include "OSMutex.h"
+
+//typedef struct _os_mutex OS_MUTEX;
+struct _os_mutex
+{
+	CRITICAL_SECTION cs;	// much cheaper than a kernel mutex, as we only need to sync threads of one process
+};
+
+UINT8 OSMutex_Init(OS_MUTEX** retMutex, UINT8 initLocked)
+{
+	OS_MUTEX* mtx;
+	
+	mtx = (OS_MUTEX*)calloc(1, sizeof(OS_MUTEX));
+	if (mtx == NULL)
+		return 0xFF;
+	
+	InitializeCriticalSection(&mtx->cs);
+	if (initLocked)
+		EnterCriticalSection(&mtx->cs);
+	
+	*retMutex = mtx;
+	return 0x00;
+}
+
+void OSMutex_Deinit(OS_MUTEX* mtx)
+{
+	DeleteCriticalSection(&mtx->cs);
+	free(mtx);
+	
+	return;
+}
+
+UINT8 OSMutex_Lock(OS_MUTEX* mtx)
+{
+	EnterCriticalSection(&mtx->cs);
+	return 0x00;
+}
+
+UINT8 OSMutex_TryLock(OS_MUTEX* mtx)
+{
+	return TryEnterCriticalSection(&mtx->cs) ? 0x00 : 0x01;
+}
+
+UINT8 OSMutex_Unlock(OS_MUTEX* mtx)
+{
+	LeaveCriticalSection(&mtx->cs);
+	return 0x00;
+}
@@ -14,6 +14,7 @@ OS_TIMER* OSTimer_Init(void);
 void OSTimer_Deinit(OS_TIMER* tmr);
 UINT64 OSTimer_GetFrequency(const OS_TIMER* tmr);
 UINT64 OSTimer_GetTime(const OS_TIMER* tmr);
+void OSTimer_SleepUntil(const OS_TIMER* tmr, UINT64 absTime);	// absTime: value in OSTimer_GetTime units
 
 #ifdef __cplusplus
 }
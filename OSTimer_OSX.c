@@ -1,6 +1,6 @@
 // Mac OS X Timer
 // --------------
-// using mach_absolute_time
+// using mach_absolute_time and mach_wait_until
 
 // see also here https://gist.github.com/alfwatt/3588c5aa1f7a1ef7a3bb
 #include <stdlib.h>
@@ -53,3 +53,13 @@ UINT64 OSTimer_GetTime(const OS_TIMER* tmr)
 	time = mach_absolute_time();
 	return time * tmr->tmrBase.numer / tmr->tmrBase.denom;
 }
+
+void OSTimer_SleepUntil(const OS_TIMER* tmr, UINT64 absTime)
+{
+	// mach_wait_until is precise, only the rounding of the conversion needs to be checked
+	mach_wait_until(absTime * tmr->tmrBase.denom / tmr->tmrBase.numer);
+	while(OSTimer_GetTime(tmr) < absTime)
+		;
+	
+	return;
+}
@@ -1,16 +1,19 @@
 // POSIX Timer
 // -----------
-// using clock_gettime
+// using clock_gettime and clock_nanosleep
 
 #include <stdlib.h>
 //#include <stdio.h>
 #include <stddef.h>
 
 #include <time.h>
+#include <errno.h>
 
 #include <stdtype.h>
 #include "OSTimer.h"
 
+#define SPIN_TIME	200000	// the last 200 us of a wait are done by polling the clock
+
 //typedef struct _os_timer OS_TIMER;
 struct _os_timer
 {
@@ -63,3 +66,27 @@ UINT64 OSTimer_GetTime(const OS_TIMER* tmr)
 	retVal = clock_gettime(tmr->clkType, &clkTS);
 	return TimeSpec2Int64(&clkTS);
 }
+
+void OSTimer_SleepUntil(const OS_TIMER* tmr, UINT64 absTime)
+{
+	struct timespec clkTS;
+	int retVal;
+	
+	// The scheduler wakes threads up late by up to a few 100 us,
+	// so the sleep ends a bit early and the rest of the time is spent spinning.
+	if (absTime > SPIN_TIME)
+	{
+		UINT64 sleepEnd = absTime - SPIN_TIME;
+		
+		clkTS.tv_sec = (time_t)(sleepEnd / 1000000000);
+		clkTS.tv_nsec = (long)(sleepEnd % 1000000000);
+		do
+		{
+			retVal = clock_nanosleep(tmr->clkType, TIMER_ABSTIME, &clkTS, NULL);
+		} while(retVal == EINTR);
+	}
+	while(OSTimer_GetTime(tmr) < absTime)
+		;
+	
+	return;
+}
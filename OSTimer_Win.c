@@ -16,6 +16,7 @@
 #define TMODE_HIGH_PERF	0x01	// use QueryPerformanceCounter()
 
 #define SYSCLK_MULT		1000	// system clock multiplicator (for higher "virtual" precision)
+#define SPIN_TIME_MS	2		// Sleep() can be late by 1 ms, so the last 2 ms of a wait are done by polling the clock
 
 //typedef struct _os_timer OS_TIMER;
 struct _os_timer
@@ -76,3 +77,18 @@ UINT64 OSTimer_GetTime(const OS_TIMER* tmr)
 		return (UINT64)lgInt.QuadPart;
 	}
 }
+
+void OSTimer_SleepUntil(const OS_TIMER* tmr, UINT64 absTime)
+{
+	UINT64 curTime;
+	UINT64 spinTime;
+	
+	curTime = OSTimer_GetTime(tmr);
+	spinTime = tmr->tmrFreq * SPIN_TIME_MS / 1000;
+	if (curTime + spinTime < absTime)
+		Sleep((DWORD)((absTime - spinTime - curTime) * 1000 / tmr->tmrFreq));
+	while(OSTimer_GetTime(tmr) < absTime)
+		Sleep(0);	// give up the rest of the time slice, but stay ready to run
+	
+	return;
+}
@@ -0,0 +1,582 @@
+// Song Info Cache
+// ---------------
+// stores the results of MidiBankScan() on disk, so that songs can be started without scanning them first
+#include <stdtype.h>
+#include <string>
+#include <vector>
+#include <list>
+#include <map>
+#include <stdio.h>
+#include <string.h>
+#include <sys/types.h>
+#include <sys/stat.h>	// for stat()
+
+#ifdef _WIN32
+#include <Windows.h>
+#endif
+
+#include "MidiLib.hpp"
+#include "MidiBankScan.hpp"
+#include "OSThread.h"
+#include "OSMutex.h"
+#include "SongInfoCache.hpp"
+
+/*
+Cache file format (all values Little Endian)
+Header:
+	00	char[4]	signature "SICF"
+	04	UINT32	format version
+	08	UINT64	hash of the instrument set files (path, size, modification time)
+Records: (appended to the file, later records override earlier ones for the same path)
+	00	UINT32	record size (excluding this field)
+	04	UINT64	song file size
+	0C	UINT64	song file modification time
+	14	UINT8[7]	modType, numPorts, hasReset, spcFeature, GS_Min, GS_Opt, XG_Opt
+	1B	UINT32[4]	feature masks fmGM, fmGS, fmXG, fmOther
+	2B	UINT8[6]	MaxDrumKit, MaxDrumMSB, gsimAllMap, gsimNot, gsMaxLSB, xgMapSel
+	31	UINT16	chnUseMask
+	33	UINT16	path length, followed by path (UTF-8, no terminator)
+	..	UINT8	charset length, followed by charset name
+*/
+#define SICACHE_SIG			"SICF"
+#define SICACHE_VER			0x01	// increase when the results of MidiBankScan() change
+#define SICACHE_HDR_SIZE	0x10
+#define SICACHE_REC_FIXED	0x31	// size of the fixed part of a record (excluding the size field)
+#define SICACHE_MAX_REC		0x10000
+
+
+static UINT16 ReadLE16(const UINT8* data)
+{
+	return (data[0x00] << 0) | (data[0x01] << 8);
+}
+
+static UINT32 ReadLE32(const UINT8* data)
+{
+	return	(data[0x00] <<  0) | (data[0x01] <<  8) |
+			(data[0x02] << 16) | ((UINT32)data[0x03] << 24);
+}
+
+static UINT64 ReadLE64(const UINT8* data)
+{
+	return ((UINT64)ReadLE32(&data[0x04]) << 32) | ReadLE32(&data[0x00]);
+}
+
+static void AppendLE16(std::vector<UINT8>& buffer, UINT16 value)
+{
+	buffer.push_back((value >> 0) & 0xFF);
+	buffer.push_back((value >> 8) & 0xFF);
+	return;
+}
+
+static void AppendLE32(std::vector<UINT8>& buffer, UINT32 value)
+{
+	AppendLE16(buffer, (UINT16)(value >>  0));
+	AppendLE16(buffer, (UINT16)(value >> 16));
+	return;
+}
+
+static void AppendLE64(std::vector<UINT8>& buffer, UINT64 value)
+{
+	AppendLE32(buffer, (UINT32)(value >>  0));
+	AppendLE32(buffer, (UINT32)(value >> 32));
+	return;
+}
+
+static FILE* OpenFileUTF8(const std::string& fileName, const char* mode)
+{
+#ifdef _WIN32
+	std::wstring fileNameW;
+	std::wstring modeW(mode, mode + strlen(mode));
+	fileNameW.resize(MultiByteToWideChar(CP_UTF8, 0, fileName.c_str(), -1, NULL, 0) - 1);
+	MultiByteToWideChar(CP_UTF8, 0, fileName.c_str(), -1, &fileNameW[0], fileNameW.size() + 1);
+	return _wfopen(fileNameW.c_str(), modeW.c_str());
+#else
+	return fopen(fileName.c_str(), mode);
+#endif
+}
+
+static int RemoveFileUTF8(const std::string& fileName)
+{
+#ifdef _WIN32
+	std::wstring fileNameW;
+	fileNameW.resize(MultiByteToWideChar(CP_UTF8, 0, fileName.c_str(), -1, NULL, 0) - 1);
+	MultiByteToWideChar(CP_UTF8, 0, fileName.c_str(), -1, &fileNameW[0], fileNameW.size() + 1);
+	return _wremove(fileNameW.c_str());
+#else
+	return remove(fileName.c_str());
+#endif
+}
+
+static int RenameFileUTF8(const std::string& oldName, const std::string& newName)
+{
+#ifdef _WIN32
+	std::wstring oldNameW;
+	std::wstring newNameW;
+	oldNameW.resize(MultiByteToWideChar(CP_UTF8, 0, oldName.c_str(), -1, NULL, 0) - 1);
+	MultiByteToWideChar(CP_UTF8, 0, oldName.c_str(), -1, &oldNameW[0], oldNameW.size() + 1);
+	newNameW.resize(MultiByteToWideChar(CP_UTF8, 0, newName.c_str(), -1, NULL, 0) - 1);
+	MultiByteToWideChar(CP_UTF8, 0, newName.c_str(), -1, &newNameW[0], newNameW.size() + 1);
+	_wremove(newNameW.c_str());	// _wrename() doesn't overwrite existing files
+	return _wrename(oldNameW.c_str(), newNameW.c_str());
+#else
+	return rename(oldName.c_str(), newName.c_str());
+#endif
+}
+
+SongInfoCache::SongInfoCache() :
+	_depHash(0), _hFile(NULL), _fileRecords(0), _mutex(NULL),
+	_pfThread(NULL), _pfStop(false)
+{
+	OSMutex_Init(&_mutex, 0);
+}
+
+SongInfoCache::~SongInfoCache()
+{
+	Close();
+	OSMutex_Deinit(_mutex);
+}
+
+UINT8 SongInfoCache::Open(const std::string& fileName, const std::vector<std::string>& depFiles)
+{
+	UINT8 retVal;
+	
+	Close();
+	
+	_fileName = fileName;
+	_depHash = GetDependencyHash(depFiles);
+	retVal = LoadCacheFile();
+	if (retVal == 0x40 || (! retVal && _fileRecords > _songs.size() * 2 + 0x40))
+	{
+		retVal = RewriteCacheFile();	// remove damaged and outdated records
+	}
+	else if (retVal)
+	{
+		// missing or outdated cache file - start with an empty one
+		_songs.clear();
+		retVal = RewriteCacheFile();
+	}
+	else
+	{
+		_hFile = OpenFileUTF8(_fileName, "ab");
+		retVal = (_hFile != NULL) ? 0x00 : 0xFF;
+	}
+	if (retVal)
+	{
+		_songs.clear();
+		_fileName = std::string();
+	}
+	
+	return retVal;
+}
+
+void SongInfoCache::Close(void)
+{
+	StopPrefetch();
+	
+	OSMutex_Lock(_mutex);
+	if (_hFile != NULL)
+	{
+		fclose(_hFile);
+		_hFile = NULL;
+	}
+	_songs.clear();
+	_fileRecords = 0;
+	_fileName = std::string();
+	OSMutex_Unlock(_mutex);
+	
+	return;
+}
+
+bool SongInfoCache::IsOpen(void) const
+{
+	return (_hFile != NULL);
+}
+
+bool SongInfoCache::Lookup(const std::string& songPath, BANKSCAN_RESULT* scanRes)
+{
+	std::map<std::string, SongInfo>::const_iterator siIt;
+	UINT64 fileSize;
+	UINT64 fileTime;
+	bool found;
+	
+	if (_hFile == NULL)
+		return false;
+	if (GetFileStats(songPath, &fileSize, &fileTime))
+		return false;
+	
+	OSMutex_Lock(_mutex);
+	siIt = _songs.find(songPath);
+	found = (siIt != _songs.end() && siIt->second.fileSize == fileSize && siIt->second.fileTime == fileTime);
+	if (found)
+		*scanRes = siIt->second.scanRes;
+	OSMutex_Unlock(_mutex);
+	
+	return found;
+}
+
+void SongInfoCache::Store(const std::string& songPath, const BANKSCAN_RESULT& scanRes)
+{
+	SongInfo sInfo;
+	std::vector<UINT8> recData;
+	
+	if (_hFile == NULL)
+		return;
+	if (GetFileStats(songPath, &sInfo.fileSize, &sInfo.fileTime))
+		return;	// not a regular file (e.g. inside a ZIP archive)
+	sInfo.scanRes = scanRes;
+	WriteRecord(recData, songPath, sInfo);
+	
+	OSMutex_Lock(_mutex);
+	if (_hFile != NULL)
+	{
+		_songs[songPath] = sInfo;
+		// The record is written immediately, so that nothing is lost when the program is killed.
+		fwrite(&recData[0], 0x01, recData.size(), _hFile);
+		fflush(_hFile);
+		_fileRecords ++;
+	}
+	OSMutex_Unlock(_mutex);
+	
+	return;
+}
+
+void SongInfoCache::Prefetch(const std::vector<std::string>& songPaths)
+{
+	UINT8 retVal;
+	
+	if (_hFile == NULL)
+		return;
+	
+	OSMutex_Lock(_mutex);
+	if (_pfThread != NULL && ! _pfStop)
+	{
+		_pfQueue.assign(songPaths.begin(), songPaths.end());
+		OSMutex_Unlock(_mutex);
+		return;	// the running thread will pick up the new list
+	}
+	OSMutex_Unlock(_mutex);
+	StopPrefetch();	// clean up the thread of the previous list
+	
+	OSMutex_Lock(_mutex);
+	_pfQueue.assign(songPaths.begin(), songPaths.end());
+	_pfStop = false;
+	retVal = OSThread_Init(&_pfThread, &SongInfoCache::PrefetchThread, this);
+	if (retVal)
+		_pfThread = NULL;
+	OSMutex_Unlock(_mutex);
+	
+	return;
+}
+
+void SongInfoCache::StopPrefetch(void)
+{
+	OS_THREAD* thread;
+	
+	OSMutex_Lock(_mutex);
+	_pfStop = true;
+	_pfQueue.clear();
+	thread = _pfThread;
+	OSMutex_Unlock(_mutex);
+	if (thread == NULL)
+		return;
+	
+	OSThread_Join(thread);
+	OSThread_Deinit(thread);
+	_pfThread = NULL;
+	
+	return;
+}
+
+/*static*/ void SongInfoCache::PrefetchThread(void* args)
+{
+	SongInfoCache* sic = (SongInfoCache*)args;
+	
+	while(true)
+	{
+		std::string songPath;
+		BANKSCAN_RESULT scanRes;
+		MidiFile cMidi;
+		FILE* hFile;
+		UINT8 retVal;
+		
+		OSMutex_Lock(sic->_mutex);
+		if (sic->_pfStop || sic->_pfQueue.empty())
+		{
+			// The thread object is cleaned up by the next Prefetch()/StopPrefetch() call.
+			sic->_pfStop = true;
+			OSMutex_Unlock(sic->_mutex);
+			break;
+		}
+		songPath = sic->_pfQueue.front();
+		sic->_pfQueue.pop_front();
+		OSMutex_Unlock(sic->_mutex);
+		
+		if (sic->Lookup(songPath, &scanRes))
+			continue;
+		
+		hFile = OpenFileUTF8(songPath, "rb");
+		if (hFile == NULL)
+			continue;
+		retVal = cMidi.LoadFile(hFile);
+		if (retVal >= 0x10)
+		{
+			char fileSig[4];
+			rewind(hFile);
+			fread(fileSig, 1, 4, hFile);
+			if (! memcmp(fileSig, "RIFF", 4))	// .rmi file?
+			{
+				fseek(hFile, 0x14, SEEK_SET);
+				retVal = cMidi.LoadFile(hFile);
+			}
+		}
+		fclose(hFile);
+		if (retVal)
+			continue;	// other formats (e.g. RCP) are scanned by the player when they are played
+		
+		// uses the same parameters as the player
+		MidiBankScan(&cMidi, true, &scanRes);
+		sic->Store(songPath, scanRes);
+	}
+	
+	return;
+}
+
+/*static*/ UINT8 SongInfoCache::GetFileStats(const std::string& filePath, UINT64* fileSize, UINT64* fileTime)
+{
+#ifdef _WIN32
+	struct __stat64 fileStat;
+	std::wstring filePathW;
+	filePathW.resize(MultiByteToWideChar(CP_UTF8, 0, filePath.c_str(), -1, NULL, 0) - 1);
+	MultiByteToWideChar(CP_UTF8, 0, filePath.c_str(), -1, &filePathW[0], filePathW.size() + 1);
+	if (_wstat64(filePathW.c_str(), &fileStat))
+		return 0xFF;
+	if (! (fileStat.st_mode & _S_IFREG))
+		return 0xFF;
+#else
+	struct stat fileStat;
+	if (stat(filePath.c_str(), &fileStat))
+		return 0xFF;
+	if (! S_ISREG(fileStat.st_mode))
+		return 0xFF;
+#endif
+	
+	*fileSize = (UINT64)fileStat.st_size;
+	*fileTime = (UINT64)fileStat.st_mtime;
+	return 0x00;
+}
+
+/*static*/ UINT64 SongInfoCache::GetDependencyHash(const std::vector<std::string>& depFiles)
+{
+	// 64-bit FNV-1a hash
+	UINT64 hash = 0xCBF29CE484222325ULL;
+	std::vector<UINT8> hashData;
+	size_t curFile;
+	size_t curPos;
+	
+	AppendLE32(hashData, SICACHE_VER);
+	for (curFile = 0; curFile < depFiles.size(); curFile ++)
+	{
+		UINT64 fileSize;
+		UINT64 fileTime;
+		
+		if (GetFileStats(depFiles[curFile], &fileSize, &fileTime))
+		{
+			fileSize = 0;
+			fileTime = 0;
+		}
+		hashData.insert(hashData.end(), depFiles[curFile].begin(), depFiles[curFile].end());
+		hashData.push_back(0x00);
+		AppendLE64(hashData, fileSize);
+		AppendLE64(hashData, fileTime);
+	}
+	for (curPos = 0; curPos < hashData.size(); curPos ++)
+	{
+		hash ^= hashData[curPos];
+		hash *= 0x00000100000001B3ULL;
+	}
+	
+	return hash;
+}
+
+/*static*/ void SongInfoCache::WriteRecord(std::vector<UINT8>& buffer, const std::string& songPath, const SongInfo& sInfo)
+{
+	const BANKSCAN_RESULT& scanRes = sInfo.scanRes;
+	const MODULE_CHECK& details = scanRes.details;
+	size_t pathLen = (songPath.length() < 0xFFFF) ? songPath.length() : 0xFFFF;
+	size_t csLen = (scanRes.charset.length() < 0xFF) ? scanRes.charset.length() : 0xFF;
+	size_t startPos = buffer.size();
+	
+	AppendLE32(buffer, 0);	// record size, patched below
+	AppendLE64(buffer, sInfo.fileSize);
+	AppendLE64(buffer, sInfo.fileTime);
+	buffer.push_back(scanRes.modType);
+	buffer.push_back(scanRes.numPorts);
+	buffer.push_back(scanRes.hasReset);
+	buffer.push_back(scanRes.spcFeature);
+	buffer.push_back(scanRes.GS_Min);
+	buffer.push_back(scanRes.GS_Opt);
+	buffer.push_back(scanRes.XG_Opt);
+	AppendLE32(buffer, details.fmGM);
+	AppendLE32(buffer, details.fmGS);
+	AppendLE32(buffer, details.fmXG);
+	AppendLE32(buffer, details.fmOther);
+	buffer.push_back(details.MaxDrumKit);
+	buffer.push_back(details.MaxDrumMSB);
+	buffer.push_back(details.gsimAllMap);
+	buffer.push_back(details.gsimNot);
+	buffer.push_back(details.gsMaxLSB);
+	buffer.push_back(details.xgMapSel);
+	AppendLE16(buffer, details.chnUseMask);
+	AppendLE16(buffer, (UINT16)pathLen);
+	buffer.insert(buffer.end(), songPath.begin(), songPath.begin() + pathLen);
+	buffer.push_back((UINT8)csLen);
+	buffer.insert(buffer.end(), scanRes.charset.begin(), scanRes.charset.begin() + csLen);
+	
+	UINT32 recSize = (UINT32)(buffer.size() - startPos - 0x04);
+	buffer[startPos + 0x00] = (recSize >>  0) & 0xFF;
+	buffer[startPos + 0x01] = (recSize >>  8) & 0xFF;
+	buffer[startPos + 0x02] = (recSize >> 16) & 0xFF;
+	buffer[startPos + 0x03] = (recSize >> 24) & 0xFF;
+	
+	return;
+}
+
+/*static*/ size_t SongInfoCache::ReadRecord(const std::vector<UINT8>& data, size_t pos, std::string& songPath, SongInfo& sInfo)
+{
+	// returns the position of the next record or 0 for invalid/truncated records
+	BANKSCAN_RESULT& scanRes = sInfo.scanRes;
+	MODULE_CHECK& details = scanRes.details;
+	const UINT8* recData;
+	UINT32 recSize;
+	size_t pathLen;
+	size_t csLen;
+	
+	if (pos + 0x04 > data.size())
+		return 0;
+	recSize = ReadLE32(&data[pos]);
+	pos += 0x04;
+	if (recSize < SICACHE_REC_FIXED + 0x01 || recSize > SICACHE_MAX_REC || pos + recSize > data.size())
+		return 0;
+	recData = &data[pos];
+	
+	sInfo.fileSize = ReadLE64(&recData[0x00]);
+	sInfo.fileTime = ReadLE64(&recData[0x08]);
+	scanRes.modType = recData[0x10];
+	scanRes.numPorts = recData[0x11];
+	scanRes.hasReset = recData[0x12];
+	scanRes.spcFeature = recData[0x13];
+	scanRes.GS_Min = recData[0x14];
+	scanRes.GS_Opt = recData[0x15];
+	scanRes.XG_Opt = recData[0x16];
+	details.fmGM = ReadLE32(&recData[0x17]);
+	details.fmGS = ReadLE32(&recData[0x1B]);
+	details.fmXG = ReadLE32(&recData[0x1F]);
+	details.fmOther = ReadLE32(&recData[0x23]);
+	details.MaxDrumKit = recData[0x27];
+	details.MaxDrumMSB = recData[0x28];
+	details.gsimAllMap = recData[0x29];
+	details.gsimNot = recData[0x2A];
+	details.gsMaxLSB = recData[0x2B];
+	details.xgMapSel = recData[0x2C];
+	details.chnUseMask = ReadLE16(&recData[0x2D]);
+	pathLen = ReadLE16(&recData[0x2F]);
+	if (SICACHE_REC_FIXED + pathLen + 0x01 > recSize)
+		return 0;
+	songPath.assign((const char*)&recData[SICACHE_REC_FIXED], pathLen);
+	csLen = recData[SICACHE_REC_FIXED + pathLen];
+	if (SICACHE_REC_FIXED + pathLen + 0x01 + csLen != recSize)
+		return 0;
+	scanRes.charset.assign((const char*)&recData[SICACHE_REC_FIXED + pathLen + 0x01], csLen);
+	
+	return pos + recSize;
+}
+
+UINT8 SongInfoCache::LoadCacheFile(void)
+{
+	FILE* hFile;
+	std::vector<UINT8> data;
+	size_t fileSize;
+	size_t pos;
+	
+	_songs.clear();
+	_fileRecords = 0;
+	hFile = OpenFileUTF8(_fileName, "rb");
+	if (hFile == NULL)
+		return 0xFF;
+	
+	fseek(hFile, 0, SEEK_END);
+	fileSize = (size_t)ftell(hFile);
+	fseek(hFile, 0, SEEK_SET);
+	if (fileSize < SICACHE_HDR_SIZE)
+	{
+		fclose(hFile);
+		return 0x80;	// file too small
+	}
+	data.resize(fileSize);
+	fileSize = fread(&data[0], 0x01, data.size(), hFile);
+	fclose(hFile);
+	if (fileSize < data.size())
+		return 0xFF;
+	
+	if (memcmp(&data[0x00], SICACHE_SIG, 4) || ReadLE32(&data[0x04]) != SICACHE_VER)
+		return 0x80;	// unknown file format
+	if (ReadLE64(&data[0x08]) != _depHash)
+		return 0x01;	// instrument sets were modified
+	
+	pos = SICACHE_HDR_SIZE;
+	while(pos < data.size())
+	{
+		std::string songPath;
+		SongInfo sInfo;
+		
+		pos = ReadRecord(data, pos, songPath, sInfo);
+		if (! pos)
+			return 0x40;	// truncated file (the records read so far are kept)
+		_songs[songPath] = sInfo;
+		_fileRecords ++;
+	}
+	
+	return 0x00;
+}
+
+UINT8 SongInfoCache::RewriteCacheFile(void)
+{
+	std::map<std::string, SongInfo>::const_iterator siIt;
+	std::vector<UINT8> fileData;
+	std::string tmpName;
+	FILE* hFile;
+	size_t writtenBytes;
+	
+	fileData.insert(fileData.end(), SICACHE_SIG, SICACHE_SIG + 4);
+	AppendLE32(fileData, SICACHE_VER);
+	AppendLE64(fileData, _depHash);
+	for (siIt = _songs.begin(); siIt != _songs.end(); ++siIt)
+		WriteRecord(fileData, siIt->first, siIt->second);
+	
+	// The data is written to a temporary file that replaces the cache only when complete,
+	// so that an interrupted write can't leave a truncated cache file.
+	tmpName = _fileName + ".tmp";
+	hFile = OpenFileUTF8(tmpName, "wb");
+	if (hFile == NULL)
+		return 0xFF;
+	writtenBytes = fwrite(&fileData[0], 0x01, fileData.size(), hFile);
+	if (fclose(hFile))
+		writtenBytes = 0;
+	if (writtenBytes < fileData.size())
+	{
+		RemoveFileUTF8(tmpName);
+		return 0xFF;
+	}
+	if (RenameFileUTF8(tmpName, _fileName))
+	{
+		RemoveFileUTF8(tmpName);
+		return 0xFF;
+	}
+	
+	_hFile = OpenFileUTF8(_fileName, "ab");	// further records are appended
+	if (_hFile == NULL)
+		return 0xFF;
+	_fileRecords = _songs.size();
+	
+	return 0x00;
+}
@@ -0,0 +1,65 @@
+#ifndef __SONGINFOCACHE_HPP__
+#define __SONGINFOCACHE_HPP__
+
+#include <stdtype.h>
+#include <string>
+#include <vector>
+#include <list>
+#include <map>
+#include <stdio.h>	// for FILE
+#include "MidiBankScan.hpp"
+#include "OSThread.h"
+#include "OSMutex.h"
+
+// Persistent cache for song analysis results (bank scan + detected charset).
+// Entries are keyed by the file path and are valid while the file's size and modification time match.
+// The cache file is append-only and gets rewritten when it contains too many outdated entries.
+class SongInfoCache
+{
+public:
+	SongInfoCache();
+	~SongInfoCache();
+	
+	// depFiles: files that the scan results depend on (i.e. instrument sets),
+	//           modifying any of them invalidates the whole cache
+	UINT8 Open(const std::string& fileName, const std::vector<std::string>& depFiles);
+	void Close(void);
+	bool IsOpen(void) const;
+	
+	// Lookup/Store can be called from any thread.
+	bool Lookup(const std::string& songPath, BANKSCAN_RESULT* scanRes);
+	void Store(const std::string& songPath, const BANKSCAN_RESULT& scanRes);
+	
+	// scan the listed files in a background thread (replaces the previous list)
+	void Prefetch(const std::vector<std::string>& songPaths);
+	void StopPrefetch(void);
+private:
+	struct SongInfo
+	{
+		UINT64 fileSize;
+		UINT64 fileTime;
+		BANKSCAN_RESULT scanRes;
+	};
+	
+	static UINT8 GetFileStats(const std::string& filePath, UINT64* fileSize, UINT64* fileTime);
+	static UINT64 GetDependencyHash(const std::vector<std::string>& depFiles);
+	static void WriteRecord(std::vector<UINT8>& buffer, const std::string& songPath, const SongInfo& sInfo);
+	static size_t ReadRecord(const std::vector<UINT8>& data, size_t pos, std::string& songPath, SongInfo& sInfo);
+	UINT8 LoadCacheFile(void);
+	UINT8 RewriteCacheFile(void);
+	
+	static void PrefetchThread(void* args);
+	
+	std::string _fileName;
+	UINT64 _depHash;
+	FILE* _hFile;	// kept open for appending
+	size_t _fileRecords;	// number of records in the file (including outdated ones)
+	std::map<std::string, SongInfo> _songs;
+	OS_MUTEX* _mutex;
+	
+	OS_THREAD* _pfThread;
+	std::list<std::string> _pfQueue;
+	volatile bool _pfStop;
+};
+
+#endif	// __SONGINFOCACHE_HPP__
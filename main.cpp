@@ -8,7 +8,6 @@
 #include <vector>
 #include <string>
 #include <map>
-#include <sstream>
 #include <algorithm>
 
 #ifdef _MSC_VER
@@ -30,6 +29,7 @@
 
 #include <sys/stat.h>	// for mkfifo()
 #include <fcntl.h>	// for open()
+#include <sys/mman.h>	// for mlockall()
 #endif
 #include <iconv.h>
 
@@ -47,10 +47,12 @@
 #include "MidiPlay.hpp"
 #include "MidiInsReader.h"
 #include "MidiBankScan.hpp"
+#include "SongInfoCache.hpp"
 #include "vis.hpp"
 #include "utils.hpp"
 #include "m3uargparse.hpp"
 #include "RCPLoader.hpp"
+#include "ConfigLoader.hpp"
 #if ENABLE_SCREEN_REC
 #include "scr-record.h"
 #endif
@@ -62,12 +64,6 @@
 #endif
 
 
-struct InstrumentSetCfg
-{
-	UINT8 setType;
-	std::vector<std::string> pathNames;
-};
-
 struct StreamServerOptions
 {
 	std::string metaFile;
@@ -76,11 +72,6 @@ struct StreamServerOptions
 	int fixedPID;	// fixed PID set via command line
 	int curPID;		// PID read from pidFile
 };
-struct TypeMap_StrU8
-{
-	UINT8 value;
-	const char* name;
-};
 
 
 //int main(int argc, char* argv[]);
@@ -90,13 +81,7 @@ static char* GetAppFilePath(void);
 #if ENABLE_ZIP_SUPPORT
 static std::string DecompressFromZIP(const std::string& path);
 #endif
-static bool is_no_space(char c);
-static void CfgString2Vector(const std::string& valueStr, std::vector<std::string>& valueVector);
 static size_t GetMidiPortList(const std::vector<std::string>& portStrList, std::vector<UINT32>& portList);
-static void Vector_Str2UInt32(const std::vector<std::string>& strList, std::vector<UINT32>& intList);
-static UINT16 ParseChnMask(const std::string& maskStr);
-static void ParseChnMaskList(const std::vector<std::string>& maskStrList, std::vector<UINT16>& maskList);
-static UINT8 String2Opt_LUT(const TypeMap_StrU8* valMap, const std::string& value, UINT8 defaultVal);
 static UINT8 LoadConfig(const std::string& cfgFile);
 static void SetVisualizationCharsets(const char* preferredCharset);
 static const char* GetStr1or2(const char* str1, const char* str2);
@@ -109,59 +94,30 @@ static void MidiEventCallback(void* userData, const MidiEvent* midiEvt, UINT16 c
 static std::string GetMidiSongTitle(MidiFile* cMidi);
 
 
-static const TypeMap_StrU8 gmDrumFallbackMap[] = {
-	{PLROPTS_GDF_NONE, "None"},
-	{PLROPTS_GDF_ALL, "All"},
-	{PLROPTS_GDF_GS, "KeepGS"},
-	{PLROPTS_GDF_NONE, NULL},
-};
 static const TypeMap_StrU8 barVisModeMap[] = {
 	{BVMODE_OFF, "None"},
 	{BVMODE_VOL, "Volume"},
 	{BVMODE_NOTES, "Notes"},
 	{BVMODE_OFF, NULL},
 };
-static const TypeMap_StrU8 resetModTypeMap[] = {
-	{MODULE_GM_1, "GM"},
-	{MODULE_GM_2, "GM_L2"},
-	{MODULE_SC55, "GS"},
-	{MODULE_SC88, "SC-88"},
-	{MMO_RESET_XG, "XG"},
-	{MMO_RESET_XG_ALL, "XGAll"},
-	{MMO_RESET_LA_HARD, "LAHard"},
-	{MMO_RESET_LA_SOFT, "LASoft"},
-	{MMO_RESET_CC, "CC"},
-	{MMO_RESET_NONE, NULL},
-};
-static const TypeMap_StrU8 masterVolTypeMap[] = {
-	{MMO_MSTVOL_CC_VOL, "VolumeCC"},
-	{MMO_MSTVOL_CC_EXPR, "ExprCC"},
-	{MODULE_TYPE_GM, "GMSyx"},
-	{MODULE_TYPE_GS, "GSSyx"},
-	{MODULE_TYPE_XG, "XGSyx"},
-	{MODULE_TYPE_LA, "LASyx"},
-	{0xFF, NULL},
-};
-static const TypeMap_StrU8 defInsMapMap[] = {
-	{0x00, "Default"},
-	{MTGS_SC55, "SC-55"},
-	{MTGS_SC88, "SC-88"},
-	{MTGS_SC88PRO, "SC-88Pro"},
-	{MTGS_SC8850, "SC-8850"},
-	{MTXG_MU50, "MUBasic"},
-	{MTXG_MU100, "MU100"},
-	{0xFF, NULL},
-};
 
 
-static const char* INS_SET_PATH = "_MidiInsSets/";
+static const size_t SONG_PREFETCH_COUNT = 4;	// number of upcoming songs that are scanned in the background
 static std::string midFileName;
 static MidiFile CMidi;
 static MidiPlayer midPlay;
 
 static bool dummyOutput;
+static std::string captureLogPath;	// log file of the "capture" MIDI output driver
+static bool captureSongTime;	// capture driver: log the player time, run songs as fast as possible
 static bool screenRecordMode;
+static std::string renderPath;	// render mode: write the output into MIDI files in this directory
+static MidiFile renderMidi;
 static bool loadSongSyx;
+static bool pbThreadEnable;	// run the MIDI player in a separate thread
+static bool pbThreadRealtime;	// [Unix only] use SCHED_FIFO for the playback thread
+static bool lockMemory;	// [Unix only] lock all memory pages via mlockall()
+static bool printTimingStats;	// print playback timing statistics after each song
 static UINT32 videoFrameRate;
 static PlayerOpts playerCfg;
 static UINT8 forceSrcType;
@@ -170,6 +126,8 @@ static std::vector<InstrumentSetCfg> insSetFiles;
 static MidiPortAliases midiPortAliases;
 static MidiModuleCollection midiModColl;
 static std::vector<INS_BANK> insBanks;
+static std::string songCachePath;	// song info cache file, empty = disabled
+static SongInfoCache songInfoCache;
 static std::string syxFile;
 static std::vector<UINT8> gblSyxData;
 static std::vector<UINT8> songSyxData;
@@ -242,6 +200,11 @@ int main(int argc, char* argv[])
 		printf("Options:\n");
 		printf("    -L   - list all MIDI devices and quit\n");
 		printf("    -D   - dummy MIDI output\n");
+		printf("    -M d - MIDI output driver: \"system\" (default), \"rawmidi\", \"null\" or \"capture:log.bin\"\n");
+		printf("           The capture driver writes a text log when the file name ends with .txt.\n");
+		printf("    -T   - capture driver: log the player time instead of the system time\n");
+		printf("           Songs are played as fast as possible and the logs of different runs can be compared.\n");
+		printf("    -w d - render songs into MIDI files in directory \"d\" (no playback)\n");
 		printf("    -o n - set option bitmask (default: 0x01)\n");
 		printf("           Bit 0 (0x01) - send GM/GS/XG reset, if missing\n");
 		printf("           Bit 1 (0x02) - strict mode (enforce GS instrument map)\n");
@@ -284,6 +247,7 @@ int main(int argc, char* argv[])
 	playerCfg.loopStartText = "loopStart";
 	playerCfg.loopEndText = "loopEnd";
 	dummyOutput = false;
+	captureSongTime = false;
 	numLoopsCLI = 0;
 	forceSrcType = 0xFF;
 	forceModID = 0xFF;
@@ -378,6 +342,36 @@ int main(int argc, char* argv[])
 		{
 			dummyOutput = true;
 		}
+		else if (optChr == 'M')
+		{
+			argbase ++;
+			if (argbase >= argc)
+				break;
+			
+			std::string drvStr = argv[argbase];
+			size_t sepPos = drvStr.find(':');
+			UINT8 drvType = MidiOut_GetDriverFromName(drvStr.substr(0, sepPos).c_str());
+			if (drvType == 0xFF || MidiOut_SetDriver(drvType))
+			{
+				printf("Unknown MIDI output driver: %s\n", drvStr.c_str());
+				return 1;
+			}
+			if (drvType == MODRV_TYPE_CAPTURE)
+				captureLogPath = (sepPos != std::string::npos) ? drvStr.substr(sepPos + 1) : "midi-capture.bin";
+		}
+		else if (optChr == 'T')
+		{
+			captureSongTime = true;
+		}
+		else if (optChr == 'w')
+		{
+			argbase ++;
+			if (argbase >= argc)
+				break;
+			
+			renderPath = argv[argbase];
+			dummyOutput = true;
+		}
 #if ENABLE_SCREEN_REC
 		else if (optChr == 'R')
 		{
@@ -405,6 +399,19 @@ int main(int argc, char* argv[])
 		printf("Not enough arguments.\n");
 		return 0;
 	}
+	if (captureLogPath.empty())
+		captureSongTime = false;	// only used by the capture driver
+	if (! captureLogPath.empty())
+	{
+		const char* fileExt = GetFileExtension(captureLogPath.c_str());
+		UINT8 logFmt = (fileExt != NULL && ! stricmp(fileExt, "txt")) ? MOCAP_FMT_TEXT : MOCAP_FMT_BINARY;
+		retVal = MidiOutCapture_OpenLog(captureLogPath.c_str(), logFmt, captureSongTime ? MOCAP_FLAG_EXT_TIME : 0x00);
+		if (retVal)
+		{
+			printf("Error opening capture log %s!\n", captureLogPath.c_str());
+			return 1;
+		}
+	}
 	
 	appSearchPaths.clear();
 	{
@@ -431,6 +438,7 @@ int main(int argc, char* argv[])
 	if (cfgFilePath.empty())
 	{
 		printf("config.ini not found!\n");
+		MidiOutCapture_CloseLog();
 		return 1;
 	}
 	
@@ -446,6 +454,7 @@ int main(int argc, char* argv[])
 	if (retVal)
 	{
 		printf("Error: No modules defined!\n");
+		MidiOutCapture_CloseLog();
 		return 0;
 	}
 	// some CLI options can override the config file settings
@@ -453,6 +462,8 @@ int main(int argc, char* argv[])
 		playerCfg.numLoops = numLoopsCLI;
 	if (plrCfgFlagsCLI != 0xFF)
 		playerCfg.flags = plrCfgFlagsCLI;
+	if (! renderPath.empty() && ! playerCfg.numLoops)
+		playerCfg.numLoops = 2;	// endless looping can't be rendered
 	
 	retVal = ParseSongFiles(std::vector<const char*>(argv + argbase, argv + argc), songList, plList);
 	if (retVal)
@@ -460,6 +471,7 @@ int main(int argc, char* argv[])
 	if (songList.empty())
 	{
 		printf("No songs to play.\n");
+		MidiOutCapture_CloseLog();
 		return 0;
 	}
 	
@@ -494,6 +506,17 @@ int main(int argc, char* argv[])
 		SetBankScanInstruments(tmpInsSet->setType, insBank);
 		midPlay.SetInstrumentBank(tmpInsSet->setType, insBank);
 	}
+	if (! songCachePath.empty())
+	{
+		std::vector<std::string> depFiles;
+		
+		// The scan results depend on the instrument sets, so modifying them invalidates the cache.
+		for (curInsBnk = 0; curInsBnk < insSetFiles.size(); curInsBnk ++)
+			depFiles.insert(depFiles.end(), insSetFiles[curInsBnk].pathNames.begin(), insSetFiles[curInsBnk].pathNames.end());
+		retVal = songInfoCache.Open(songCachePath, depFiles);
+		if (retVal)
+			printf("Unable to open song info cache %s!\n", songCachePath.c_str());
+	}
 	
 #if ENABLE_REMOTE_CTRL
 	if (! rmCtrlFilePath.empty())
@@ -505,6 +528,15 @@ int main(int argc, char* argv[])
 	}
 #endif
 	
+#ifndef _WIN32
+	if (lockMemory)
+	{
+		// prevent page faults from delaying the playback thread
+		if (mlockall(MCL_CURRENT | MCL_FUTURE))
+			printf("Unable to lock memory pages!\n");
+	}
+#endif
+	
 #if ENABLE_SCREEN_REC
 	if (screenRecordMode)
 	{
@@ -534,6 +566,14 @@ int main(int argc, char* argv[])
 	if (fileRemoteCtrl >= 0)
 		vis_set_opts(0x5243544C, 1);
 #endif
+	if (pbThreadEnable)
+	{
+#ifdef _WIN32
+		vis_set_opts(0x50425448, 2);	// always boost the playback thread, like in single-thread mode
+#else
+		vis_set_opts(0x50425448, pbThreadRealtime ? 2 : 1);
+#endif
+	}
 	
 	if (! syxFile.empty())
 		LoadSyxData(syxFile, gblSyxData);
@@ -681,6 +721,17 @@ int main(int argc, char* argv[])
 		}
 #endif
 		
+		if (songInfoCache.IsOpen())
+		{
+			std::vector<std::string> pfList;
+			size_t pfSong;
+			
+			// scan the next songs while this one is playing
+			for (pfSong = curSong + 1; pfSong < songList.size() && pfList.size() < SONG_PREFETCH_COUNT; pfSong ++)
+				pfList.push_back(songList[pfSong].fileName);
+			songInfoCache.Prefetch(pfList);
+		}
+		
 		PlayMidi();
 		
 #if ENABLE_SCREEN_REC
@@ -738,10 +789,14 @@ int main(int argc, char* argv[])
 	}
 #endif
 	
+	songInfoCache.Close();	// stops the background scanning, which uses the instrument banks
 	for (curInsBnk = 0; curInsBnk < insBanks.size(); curInsBnk ++)
 		FreeInstrumentBank(&insBanks[curInsBnk]);
 	insBanks.clear();
 	
+	if (! captureLogPath.empty())
+		MidiOutCapture_CloseLog();	// also writes the data of ports that were kept open
+	
 	return 0;
 }
 
@@ -938,34 +993,6 @@ static std::string DecompressFromZIP(const std::string& path)
 }
 #endif	// ENABLE_ZIP_SUPPORT
 
-static bool is_no_space(char c)
-{
-	return ! ::isspace((unsigned char)c);
-}
-
-static void CfgString2Vector(const std::string& valueStr, std::vector<std::string>& valueVector)
-{
-	valueVector.clear();
-	std::stringstream ss(valueStr);
-	std::string item;
-	
-	while(ss.good())
-	{
-		std::getline(ss, item, ',');
-		
-		// ltrim
-		item.erase(item.begin(), std::find_if(item.begin(), item.end(), &is_no_space));
-		// rtrim
-		item.erase(std::find_if(item.rbegin(), item.rend(), &is_no_space).base(), item.end());
-		
-		valueVector.push_back(item);
-	}
-	if (valueVector.size() == 1 && valueVector[0].empty())
-		valueVector.clear();
-	
-	return;
-}
-
 static size_t GetMidiPortList(const std::vector<std::string>& portStrList, std::vector<UINT32>& portList)
 {
 	std::vector<std::string>::const_iterator portIt;
@@ -995,6 +1022,16 @@ static size_t GetMidiPortList(const std::vector<std::string>& portStrList, std::
 				port = (UINT32)pVal;
 		}
 		
+		if (port == (UINT32)-1 && (MidiOut_GetDriver() == MODRV_TYPE_NULL || MidiOut_GetDriver() == MODRV_TYPE_CAPTURE))
+		{
+			// The null/capture drivers accept any port, so each port name gets its own ID.
+			static std::map<std::string, UINT32> virtualPorts;
+			paIt = virtualPorts.find(*portIt);
+			if (paIt == virtualPorts.end())
+				paIt = virtualPorts.insert(std::make_pair(*portIt, 0x100 + (UINT32)virtualPorts.size())).first;
+			port = paIt->second;
+		}
+		
 		if (port != (UINT32)-1)
 			validPorts ++;
 		else
@@ -1005,112 +1042,13 @@ static size_t GetMidiPortList(const std::vector<std::string>& portStrList, std::
 	return validPorts;
 }
 
-static void Vector_Str2UInt32(const std::vector<std::string>& strList, std::vector<UINT32>& intList)
-{
-	std::vector<std::string>::const_iterator slIt;
-	char* endStr;
-	
-	intList.clear();
-	for (slIt = strList.begin(); slIt != strList.end(); ++slIt)
-	{
-		unsigned long val = strtoul(slIt->c_str(), &endStr, 0);
-		intList.push_back((UINT32)val);
-	}
-	
-	return;
-}
-
-static UINT16 ParseChnMask(const std::string& maskStr)
-{
-	if (maskStr.empty())
-		return 0xFFFF;	// empty - default to "all channels"
-	std::string prefix = maskStr.substr(0, 2);
-	if (prefix.length() >= 2)
-		prefix[1] = (char)tolower((UINT8)prefix[1]);
-	if (prefix == "0x")
-	{
-		unsigned long val = strtoul(maskStr.c_str(), NULL, 0);
-		return (UINT16)val;
-	}
-	else if (isdigit((unsigned char)maskStr[0]))
-	{
-		// 1-base channel range
-		char* endStr;
-		unsigned long chn1 = strtoul(maskStr.c_str(), &endStr, 0);
-		UINT16 mask = 0x0000;
-		if (*endStr != '-')
-		{
-			// single channel ID
-			mask = 1 << (chn1 - 1);
-		}
-		else
-		{
-			// range: 1-16
-			unsigned long chn2 = strtoul(&endStr[1], NULL, 0);
-			if (chn1 <= chn2)
-			{
-				mask = (1 << (chn2 - chn1 + 1)) - 1;
-				mask <<= (chn1 - 1);
-			}
-			else
-			{
-				// range overflow: 15-3, results in 15,16,1,2,3
-				UINT16 mask1 = ~((1 << (chn1 - 1)) - 1);	// mask for chn1..15
-				UINT16 mask2 = (1 << chn2) - 1;	// mask for 1..chn2
-				mask = mask1 | mask2;
-			}
-		}
-		return mask;
-	}
-	else
-	{
-		return 0x0000;	// invalid
-	}
-}
-
-static void ParseChnMaskList(const std::vector<std::string>& maskStrList, std::vector<UINT16>& maskList)
-{
-	std::vector<std::string>::const_iterator cmlIt;
-	
-	maskList.clear();
-	for (cmlIt = maskStrList.begin(); cmlIt != maskStrList.end(); ++cmlIt)
-		maskList.push_back(ParseChnMask(*cmlIt));
-	
-	return;
-}
-
-static UINT8 String2Opt_LUT(const TypeMap_StrU8* valMap, const std::string& value, UINT8 defaultVal)
-{
-	const TypeMap_StrU8* vm;
-	for (vm = valMap; vm->name != NULL; vm ++)
-	{
-		if (! stricmp(value.c_str(), vm->name))
-			return vm->value;
-	}
-	return defaultVal;
-}
-
 static UINT8 LoadConfig(const std::string& cfgFile)
 {
-	std::map<std::string, UINT8> INSSET_NAME_MAP;
-	std::string insSetPath;
-	std::map<std::string, UINT8>::const_iterator nmIt;
 	std::vector<std::string> devList;
 	std::vector<std::string> modList;
 	std::vector<std::string>::const_iterator listIt;
 	MIDI_PORT_LIST mpList;
 	UINT8 retVal;
-	size_t insSetXG;
-	size_t insSetPLG;
-	
-	INSSET_NAME_MAP["GM"] = MODULE_GM_1;
-	INSSET_NAME_MAP["GM_L2"] = MODULE_GM_2;
-	INSSET_NAME_MAP["GS"] = MODULE_TYPE_GS;
-	INSSET_NAME_MAP["YGS"] = MODULE_TG300B;
-	INSSET_NAME_MAP["XG"] = MODULE_TYPE_XG;
-	INSSET_NAME_MAP["XG-PLG"] = MODULE_TYPE_XG | 0x08;
-	INSSET_NAME_MAP["Korg5"] = MODULE_TYPE_K5;
-	INSSET_NAME_MAP["MT-32"] = MODULE_MT32;
 	
 	INIReader iniFile;
 	if (iniFile.ReadFile(cfgFile))
@@ -1120,23 +1058,15 @@ static UINT8 LoadConfig(const std::string& cfgFile)
 	}
 	
 	midiModColl._keepPortsOpen = iniFile.GetBoolean("General", "KeepPortsOpen", false);
-	playerCfg.numLoops = iniFile.GetInteger("General", "LoopCount", 2);
-	playerCfg.fadeTime = iniFile.GetFloat("General", "FadeTime", 5.0);
-	playerCfg.endPauseTime = iniFile.GetFloat("General", "EndPause", 0.0);
-	playerCfg.loopStartText = iniFile.GetString("General", "Marker_LoopStart", playerCfg.loopStartText);
-	playerCfg.loopEndText = iniFile.GetString("General", "Marker_LoopEnd", playerCfg.loopEndText);
+	LoadPlayerOptions(iniFile, playerCfg);
 	loadSongSyx = iniFile.GetBoolean("General", "LoadSongSyx", true);
-	playerCfg.flags = 0x00;
-	if (iniFile.GetBoolean("General", "ResetDevice", true))
-		playerCfg.flags |= PLROPTS_RESET;
-	if (iniFile.GetBoolean("General", "StrictMode", false))
-		playerCfg.flags |= PLROPTS_STRICT;
-	if (iniFile.GetBoolean("General", "EnableCTF", false))
-		playerCfg.flags |= PLROPTS_ENABLE_CTF;
-	playerCfg.nrpnLoops = iniFile.GetBoolean("General", "NRPNLoops", false);
-	playerCfg.noNoteOverlap = iniFile.GetBoolean("General", "NoNoteOverlap", false);
-	playerCfg.gmDrumFallback = String2Opt_LUT(gmDrumFallbackMap, iniFile.GetString("General", "GMDrumFallback", "KeepGS"), PLROPTS_GDF_NONE);
-	playerCfg.fixSysExChksum = iniFile.GetBoolean("General", "FixSysExChecksums", false);
+	pbThreadEnable = iniFile.GetBoolean("General", "PlaybackThread", true);
+	pbThreadRealtime = iniFile.GetBoolean("General", "RealtimePriority", false);
+	lockMemory = iniFile.GetBoolean("General", "LockMemory", false);
+	printTimingStats = iniFile.GetBoolean("General", "TimingStats", false);
+	songCachePath = iniFile.GetString("General", "SongInfoCache", "songinfo.cache");
+	if (! songCachePath.empty())
+		songCachePath = CombinePaths(cfgBasePath, songCachePath);
 	
 	strmSrv.pidFile = iniFile.GetString("StreamServer", "PIDFile", "");
 	strmSrv.metaFile = iniFile.GetString("StreamServer", "MetadataFile", "");
@@ -1156,31 +1086,7 @@ static UINT8 LoadConfig(const std::string& cfgFile)
 	
 	dispOpts->barVisMode = String2Opt_LUT(barVisModeMap, iniFile.GetString("Display", "BarVisMode", "Notes"), BVMODE_OFF);
 	
-	insSetFiles.clear();
-	insSetXG = (size_t)-1;
-	insSetPLG = (size_t)-1;
-	insSetPath = iniFile.GetString("InstrumentSets", "DataPath", INS_SET_PATH);
-	insSetPath = CombinePaths(cfgBasePath, insSetPath);
-	for (nmIt = INSSET_NAME_MAP.begin(); nmIt != INSSET_NAME_MAP.end(); ++nmIt)
-	{
-		std::string fileName = iniFile.GetString("InstrumentSets", nmIt->first, "");
-		if (! fileName.empty())
-		{
-			InstrumentSetCfg isc;
-			isc.setType = nmIt->second;
-			if (isc.setType == MODULE_TYPE_XG)
-				insSetXG = insSetFiles.size();
-			else if (isc.setType == (MODULE_TYPE_XG | 0x08))
-				insSetPLG = insSetFiles.size();
-			isc.pathNames.push_back(CombinePaths(insSetPath, fileName));
-			insSetFiles.push_back(isc);
-		}
-	}
-	if (insSetXG != (size_t)-1 && insSetPLG != (size_t)-1)
-	{
-		insSetFiles[insSetXG].pathNames.push_back(insSetFiles[insSetPLG].pathNames[0]);
-		insSetFiles.erase(insSetFiles.begin() + insSetPLG);
-	}
+	LoadInstrumentSetCfg(iniFile, cfgBasePath, insSetFiles);
 	
 	midiPortAliases.ClearAliases();
 	retVal = MidiOut_GetPortList(&mpList);
@@ -1201,33 +1107,13 @@ static UINT8 LoadConfig(const std::string& cfgFile)
 		MidiModule mMod;
 		std::vector<std::string> list;
 		size_t validPorts;
-		std::string iniStr;
 		
 		mMod.name = *listIt;
-		if (! MidiModule::GetIDFromNameOrNumber(iniFile.GetString(*listIt, "ModType", ""), midiModColl.GetShortModNameLUT(), mMod.modType))
+		if (LoadModuleConfig(iniFile, mMod))
 			continue;
 		
 		CfgString2Vector(iniFile.GetString(mMod.name, "Ports", ""), list);
 		validPorts = GetMidiPortList(list, mMod.ports);
-		CfgString2Vector(iniFile.GetString(mMod.name, "PortDelay", ""), list);
-		Vector_Str2UInt32(list, mMod.delayTime);
-		CfgString2Vector(iniFile.GetString(mMod.name, "ChnMask", ""), list);
-		ParseChnMaskList(list, mMod.chnMask);
-		CfgString2Vector(iniFile.GetString(mMod.name, "PlayTypes", ""), list);
-		mMod.SetPlayTypes(list, midiModColl.GetShortModNameLUT());
-		
-		mMod.options = GetDefaultMidiModOpts();
-		mMod.options.simpleVol = iniFile.GetBoolean(mMod.name, "SimpleVolCtrl", false);
-		mMod.options.aotIns = iniFile.GetBoolean(mMod.name, "AoTInsChange", false);
-		mMod.options.instantSyx = iniFile.GetBoolean(mMod.name, "InstantSyx", false);
-		
-		iniStr = iniFile.GetString(mMod.name, "ResetType", "");
-		mMod.options.resetType = String2Opt_LUT(resetModTypeMap, iniStr, GetMidiModResetType(mMod.modType));
-		iniStr = iniFile.GetString(mMod.name, "MasterVolType", "");
-		mMod.options.masterVol = String2Opt_LUT(masterVolTypeMap, iniStr, GetMidiModMasterVolType(mMod.modType));
-		mMod.options.remapMVolSyx = iniFile.GetBoolean(mMod.name, "RemapMasterVolSyx", false);
-		iniStr = iniFile.GetString(mMod.name, "DefaultInsMap", "");
-		mMod.options.defInsMap = String2Opt_LUT(defInsMapMap, iniStr, GetMidiModDefInsMap(mMod.modType));
 		
 		if (mMod.ports.empty())
 		{
@@ -1396,6 +1282,15 @@ UINT8 main_CanQuitAfterSong(void)
 	return 1;
 }
 
+int main_GetRemoteCtrlFD(void)
+{
+#if ! ENABLE_REMOTE_CTRL
+	return -1;
+#else
+	return fileRemoteCtrl;
+#endif
+}
+
 int main_CheckRemoteCommand(void)
 {
 #if ! ENABLE_REMOTE_CTRL
@@ -1475,22 +1370,21 @@ int main_CheckRemoteCommand(void)
 	else if (command == "PAUSE")
 	{
 		vis_rcl_printf("Pause request.\n");
-		midPlay.Pause();
+		vis_player_command(PLRCMD_PAUSE);
 	}
 	else if (command == "RESUME")
 	{
 		vis_rcl_printf("Resume request.\n");
-		midPlay.Resume();
+		vis_player_command(PLRCMD_RESUME);
 	}
 	else if (command == "RESTART")
 	{
 		vis_rcl_printf("Restart request.\n");
-		midPlay.Stop();
-		midPlay.Start();
+		vis_player_command(PLRCMD_RESTART);
 	}
 	else if (command == "FADE")
 	{
-		midPlay.FadeOutT(midPlay.GetOptions().fadeTime);
+		vis_player_command(PLRCMD_FADE);
 	}
 	else if (command == "PREV")
 	{
@@ -1519,7 +1413,11 @@ void PlayMidi(void)
 	MidiModule* mMod;
 	
 	// try to detect the instrument set used by the MIDI
-	MidiBankScan(&CMidi, true, &scanRes);
+	if (! songInfoCache.Lookup(midFileName, &scanRes))
+	{
+		MidiBankScan(&CMidi, true, &scanRes);
+		songInfoCache.Store(midFileName, scanRes);
+	}
 	if (tempSrcType != 0xFF)
 	{
 		if (tempSrcType == MODULE_MT32)
@@ -1571,11 +1469,15 @@ void PlayMidi(void)
 	}
 	vis_update();
 	
-	if (screenRecordMode)
+	if (screenRecordMode || ! renderPath.empty() || captureSongTime)
 	{
 		midPlay.AdvanceManualTiming(1, -1);
 		midPlay.AdvanceManualTiming(0, 0);
 	}
+	if (captureSongTime)
+		MidiOutCapture_SetTime(0);
+	if (! renderPath.empty())
+		midPlay.SetRenderOutput(&renderMidi);
 	
 	plrOpts.srcType = scanRes.modType;
 	plrOpts.dstType = mMod->modType;
@@ -1598,7 +1500,7 @@ void PlayMidi(void)
 	
 	if (dispOpts->detectCP)
 	{
-		std::string charSet = (scanRes.charset != NULL) ? scanRes.charset : "";
+		std::string charSet = scanRes.charset;
 		// do some minor remapping
 		if (charSet == "ASCII")
 			charSet = "";	// ASCII is as good as no detection
@@ -1689,8 +1591,8 @@ void PlayMidi(void)
 	}
 	
 	vis_new_song();
-	if (dispOpts->detectCP && scanRes.charset != NULL && ! screenRecordMode)
-		vis_printf("Detected Codepage: %s\n", scanRes.charset);
+	if (dispOpts->detectCP && ! scanRes.charset.empty() && ! screenRecordMode)
+		vis_printf("Detected Codepage: %s\n", scanRes.charset.c_str());
 	
 	UINT32 curFrame = 0;
 	midPlay.Start();
@@ -1704,7 +1606,7 @@ void PlayMidi(void)
 		syxType = 0;
 	if ((plrOpts.flags & PLROPTS_RESET) && MMASK_TYPE(mMod->modType) != MODULE_TYPE_LA)	// for the MT-32, we only do a soft reset
 		didSendSyx = 0;
-	if (screenRecordMode || syxType == 2)
+	if (screenRecordMode || ! renderPath.empty() || captureSongTime || syxType == 2)
 		didSendSyx = 0;
 	if (syxType != 0 && didSendSyx != syxType)
 	{
@@ -1738,12 +1640,32 @@ void PlayMidi(void)
 	}
 #endif
 	
-	if (! screenRecordMode)
+	if (! renderPath.empty() || captureSongTime)
+	{
+		// run the player as fast as possible, advancing the time in steps of 1 ms
+		UINT64 time = 0;
+		while(midPlay.GetState() & 0x01)
+		{
+			time += 1000000;
+			midPlay.AdvanceManualTiming(time, 0);
+			if (captureSongTime)
+				MidiOutCapture_SetTime(time);
+			midPlay.DoPlaybackStep();
+		}
+	}
+	else if (! screenRecordMode)
 	{
 #ifdef _WIN32
-		SetThreadPriority(GetCurrentThread(), pbThreadPriority);
-		controlVal = vis_main();
-		SetThreadPriority(GetCurrentThread(), THREAD_PRIORITY_NORMAL);
+		if (pbThreadEnable)
+		{
+			controlVal = vis_main();	// sets the priority of its playback thread
+		}
+		else
+		{
+			SetThreadPriority(GetCurrentThread(), pbThreadPriority);
+			controlVal = vis_main();
+			SetThreadPriority(GetCurrentThread(), THREAD_PRIORITY_NORMAL);
+		}
 #else
 		controlVal = vis_main();
 #endif
@@ -1822,6 +1744,42 @@ void PlayMidi(void)
 	}
 	midPlay.Stop();
 	
+	{
+		const std::vector<MidiPlayer::WireStats>& wireStats = midPlay.GetWireStats();
+		for (size_t curPort = 0; curPort < wireStats.size(); curPort ++)
+		{
+			const MidiPlayer::WireStats& ws = wireStats[curPort];
+			vis_printf("Port %u: %llu bytes sent, %u/%u transfers saturated (max. delay %.1f ms), %u reordered, %u messages dropped\n",
+				(unsigned)curPort, (unsigned long long)ws.bytes, ws.satBatches, ws.batches, ws.maxDelayUS / 1000.0,
+				ws.reordered, ws.dropped);
+		}
+	}
+	if (printTimingStats)
+	{
+		const MidiPlayer::TimingStats& ts = midPlay.GetTimingStats();
+		vis_printf("Timing: %llu events, send delay p50 %u us / p99 %u us / max %u us, %llu steps, %llu ticks, %u lag resets, max. queue depth %u\n",
+			(unsigned long long)ts.events, MidiPlayer::GetTimingPercentile(ts, 0.50), MidiPlayer::GetTimingPercentile(ts, 0.99),
+			ts.maxLateUS, (unsigned long long)ts.steps, (unsigned long long)ts.ticks, ts.lagResets, ts.maxQueueDepth);
+	}
+	
+	if (! renderPath.empty())
+	{
+		const char* fTitle = GetFileTitle(midFileName.c_str());
+		const char* fExt = GetFileExtension(fTitle);
+		if (fExt != NULL)
+			fExt --;	// move pinter to '.'
+		else
+			fExt = fTitle + strlen(fTitle);
+		std::string outFName = CombinePaths(renderPath, std::string(fTitle, fExt) + ".mid");
+		
+		midPlay.SetRenderOutput(NULL);
+		retVal = renderMidi.SaveFile(outFName.c_str());
+		if (retVal)
+			vis_printf("Error writing %s!\n", outFName.c_str());
+		else
+			vis_printf("Rendered to %s.\n", outFName.c_str());
+		renderMidi.ClearAll();
+	}
 	vis_addstr("Finished.");
 	vis_update();
 #if ENABLE_SCREEN_REC
@@ -1855,7 +1813,7 @@ static void SendSyxDataToPorts(const std::vector<MIDIOUT_PORT*>& outPorts, size_
 	std::vector<MIDIOUT_PORT*>::const_iterator portIt;
 	bool needDelay = true;
 	
-	if (midPlay.GetPortOptions().instantSyx)
+	if (midPlay.GetPortOptions().instantSyx || ! renderPath.empty() || captureSongTime)
 		needDelay = false;
 	midPlay.HandleRawEvent(dataLen, data);
 	portIt = outPorts.begin();
@@ -1877,6 +1835,15 @@ static void SendSyxDataToPorts(const std::vector<MIDIOUT_PORT*>& outPorts, size_
 	}
 	
 	if (needDelay)
+	{
+		// Drivers that know the state of the MIDI wire (raw MIDI) wait exactly until the data was transferred.
+		for (portIt = outPorts.begin(); portIt != outPorts.end(); ++portIt)
+		{
+			if (MidiOutPort_WaitForOutput(*portIt))
+				break;
+		}
+	}
+	if (needDelay && (outPorts.empty() || portIt != outPorts.end()))
 	{
 		// wait for data to be transferred (3125 bytes per second)
 		// (31250 bits per second transfer rate, 1 byte of payload = 10 bits: 1 start bit, 8 data bits, 1 stop bit)
@@ -1940,7 +1907,7 @@ static std::string GetMidiSongTitle(MidiFile* cMidi)
 		
 		if (evtIt->evtType == 0xFF && evtIt->evtValA == 0x03)	// FF 03 - Sequence Name
 		{
-			std::string evtText = Vector2String(evtIt->evtData);
+			std::string evtText = Vector2String(evtIt->evtData.data(), 0, evtIt->evtData.size());
 			std::string convText;
 			char retVal;
 			size_t curCP;
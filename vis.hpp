@@ -12,6 +12,12 @@ class MidiPlayer;
 #define BVMODE_OFF		0x00
 #define BVMODE_NOTES	0x01
 #define BVMODE_VOL		0x02
+
+// player commands for vis_player_command()
+#define PLRCMD_PAUSE	0x01
+#define PLRCMD_RESUME	0x02
+#define PLRCMD_RESTART	0x03
+#define PLRCMD_FADE		0x04
 struct DisplayOptions
 {
 	bool showFilePath;
@@ -45,6 +51,7 @@ void vis_do_syx_text(UINT16 chn, UINT8 mode, size_t textLen, const char* text);
 void vis_do_syx_bitmap(UINT16 chn, UINT8 mode, UINT32 dataLen, const UINT8* data);
 void vis_print_meta(UINT16 trk, UINT8 metaType, size_t dataLen, const char* data);
 void vis_update(void);
+void vis_player_command(UINT8 cmd);	// executed by the thread that runs the player
 int vis_main(void);
 
 #endif	// __VIS_HPP__
@@ -18,6 +18,10 @@
 #include <Windows.h>
 #else
 #include <unistd.h>
+#include <poll.h>
+#include <time.h>
+#include <pthread.h>
+#include <sched.h>
 #define Sleep(x)	usleep(x * 1000)
 #endif
 
@@ -30,6 +34,9 @@
 #include "utils.hpp"
 #include "MidiInsReader.h"	// for MIDI module type
 #include "vis_sc-lcd.hpp"
+#include "OSThread.h"
+#include "OSMutex.h"
+#include "OSTimer.h"
 
 #if defined(_MSC_VER) && _MSC_VER < 1900
 #define snprintf	_snprintf
@@ -48,6 +55,7 @@ UINT8* main_GetForcedInsMap(void);
 UINT8* main_GetForcedModule(void);
 UINT8 main_CanQuitAfterSong(void);
 int main_CheckRemoteCommand(void);
+int main_GetRemoteCtrlFD(void);
 
 
 static const char* notes[12] =
@@ -122,6 +130,60 @@ public:
 	void RedrawAll(void);
 };
 
+// visualization call from the playback thread, executed later by the UI thread
+// Values that depend on the player state are evaluated before deferring the call.
+struct VisDeferredCall
+{
+	UINT8 type;		// VDC_* constant
+	UINT16 chn;		// channel/track
+	UINT8 val1;
+	UINT8 val2;
+	std::string data;	// text/SysEx/Meta data
+};
+#define VDC_ADDSTR		0x00
+#define VDC_CHN_EVT		0x01
+#define VDC_INS_NAME	0x02	// data: instrument name, val1: is default map
+#define VDC_PAN			0x03	// val1: pan position, val2: grey
+#define VDC_SYX_TEXT	0x04
+#define VDC_SYX_BMP		0x05
+#define VDC_META		0x06
+#define VDC_TEMPO		0x07	// data: tempo (double)
+#define VDC_TIMESIG		0x08	// data: time signature (UINT32)
+#define VDC_INS_MAP		0x09	// val1: instrument map type
+#define VDC_DEVICE		0x0A	// data: device name
+
+// state of the player for drawing the screen, taken by the thread that runs the player
+struct VisPlayerSnapshot
+{
+	UINT8 state;		// MidiPlayer::GetState()
+	UINT8 srcType;		// current instrument map
+	size_t devID;		// ID of the opened MIDI module
+	double pbPos;
+	double pbPosTrue;	// playback position including pauses/loops (for note aging)
+	UINT32 posBar;
+	UINT32 posBeat;
+	UINT32 posTick;
+	NoteVisualization noteVis;
+	std::vector<MidiPlayer::ChannelState> chnStates;	// Note: instrument name pointers and note lists are not copied
+	MidiPlayer::TimingStats timingStats;
+	UINT32 cmdDone;		// number of player commands executed before taking the snapshot
+};
+
+// command from the UI thread, executed by the thread that runs the player
+struct VisPlayerCmd
+{
+	UINT8 type;		// PLRCMD_* constant
+	INT32 param;
+	bool restart;	// PLRCMD_SET_*: restart the song
+};
+// PLRCMD_PAUSE .. PLRCMD_FADE are defined in vis.hpp
+#define PLRCMD_TOGGLE_PAUSE	0x10
+#define PLRCMD_SEEK			0x11	// param: relative time in seconds
+#define PLRCMD_SEEK_BAR		0x12	// param: +1 = next bar, -1 = previous bar
+#define PLRCMD_STOP_NOTES	0x13
+#define PLRCMD_SET_INSMAP	0x14	// param: instrument map type
+#define PLRCMD_SET_DEVICE	0x15	// param: module ID
+
 
 typedef int (*KEYHANDLER)(void);
 
@@ -158,16 +220,36 @@ static void str_locale_conv(std::string& text);
 static void str_prepare_print(std::string& text);
 static bool string_is_empty(const std::string& str);
 //void vis_print_meta(UINT16 trk, UINT8 metaType, size_t dataLen, const char* data);
+static void vis_show_tempo(double tempo);
+static void vis_show_timesig(UINT32 timeSig);
+static void vis_show_ins_map(UINT8 mapType);
+static void vis_show_device(const char* devName);
 static void refresh_cursor_y(void);
 static void vis_printms(double time);
 static void vis_mvprintms(int row, int col, double time);
 //void vis_update(void);
 static int vis_keyhandler_normal(void);
+static void vis_wait_event(UINT64 waitTime);
+static void vis_update_draw(void);
+static void vis_make_snapshot(VisPlayerSnapshot* snap);
+static void vis_fetch_snapshot(void);
+static void vis_publish_snapshot(void);
+//void vis_player_command(UINT8 cmd);
+static void vis_player_cmd(UINT8 type, INT32 param, bool restart = false);
+static void vis_exec_player_cmd(const VisPlayerCmd& cmd);
+static void vis_defer_call(UINT8 type, UINT16 chn, UINT8 val1, UINT8 val2, size_t dataLen, const void* data);
+static bool vis_run_deferred_calls(void);
+static void vis_set_thread_priority(void);
+static void vis_playback_thread(void* args);
+static UINT8 vis_start_playback_thread(void);
+static void vis_stop_playback_thread(void);
 //int vis_main(void);
 static int vis_keyhandler_mapsel(void);
 static int vis_keyhandler_devsel(void);
 static void vis_show_map_selection(void);
 static void vis_show_device_selection(void);
+static void vis_toggle_timing_stats(void);
+static void vis_draw_timing_stats(void);
 
 
 #define POS_PB_TIME_X	0
@@ -212,6 +294,7 @@ static std::vector<ChannelData> dispChns;
 static UINT64 lastUpdateTime = 0;
 static bool stopAfterSong = false;
 static bool pauseAfterSong = false;
+static bool keyWasRead = false;	// vis_getch returned a key -> more input may be buffered
 static bool restartSong = false;
 static UINT8 secondDigits = 2;
 static bool showMeasureTicks = true;
@@ -257,6 +340,36 @@ static WINDOW* rcWin = NULL;
 static PANEL* rcPan = NULL;
 static bool rcEnable = false;
 
+// Timing Statistics (debug panel)
+#define TSTAT_SIZE_X	26
+#define TSTAT_SIZE_Y	10
+static WINDOW* tsWin = NULL;
+static PANEL* tsPan = NULL;
+
+// Playback Thread
+// While pbThread is running, only that thread accesses midPlay. The UI thread draws from a snapshot
+// of the player state and sends commands, so that it never holds the lock for more than a swap/push.
+#define PBTHREAD_MAX_WAIT	10000000	// maximum sleep time (ns), so that commands from the UI take effect quickly
+#define PBTHREAD_SNAP_INTERVAL	10000000	// time between two snapshots for the UI (ns)
+static UINT8 pbThreadMode = 0;	// 0 - play in UI thread, 1 - separate playback thread, 2 - thread with realtime priority
+static OS_THREAD* pbThread = NULL;
+static OS_MUTEX* pbMutex = NULL;	// guards pbCmdQueue, pbSnapMid/pbSnapNew and visDefCalls while pbThread is running
+static bool pbThreadStop = false;
+static OS_TIMER* pbTimer = NULL;	// shares its time base with the player's timer
+static std::vector<VisPlayerCmd> pbCmdQueue;
+static UINT32 pbCmdSent = 0;	// number of commands sent by the UI thread
+static UINT32 pbCmdDone = 0;	// number of commands executed by the thread that runs the player
+// The snapshot is triple-buffered: The playback thread fills pbSnapBack and swaps it with pbSnapMid,
+// the UI thread swaps pbSnapMid with visSnap when there is a new one.
+static VisPlayerSnapshot visSnapBuf[3];
+static VisPlayerSnapshot* visSnap = &visSnapBuf[0];	// used for drawing
+static VisPlayerSnapshot* pbSnapMid = &visSnapBuf[1];
+static VisPlayerSnapshot* pbSnapBack = &visSnapBuf[2];
+static bool pbSnapNew = false;
+static UINT64 pbSnapAgeTime = 0;	// playback time of the last note aging (ms)
+static bool visDeferCalls = false;	// true = queue calls to vis_do_* etc. for the UI thread
+static std::vector<VisDeferredCall> visDefCalls;
+
 static UINT8 count_digits(UINT32 value)
 {
 	UINT8 digits = 0;
@@ -368,6 +481,8 @@ void vis_init(void)
 	mmsWin = NULL;
 	mdsPan = NULL;
 	mdsWin = NULL;
+	tsPan = NULL;
+	tsWin = NULL;
 	
 	curYline = 0;
 	
@@ -413,6 +528,10 @@ void vis_deinit(void)
 	{
 		del_panel(rcPan);	delwin(rcWin);
 	}
+	if (tsPan != NULL)
+	{
+		del_panel(tsPan);	delwin(tsWin);
+	}
 	del_panel(nvPan);	delwin(nvWin);
 	del_panel(logPan);	delwin(logWin);
 	del_panel(lcdPan);	lcdDisp.Deinit();
@@ -443,6 +562,7 @@ int vis_getch(void)
 	//if (! _kbhit())
 	//	return 0;
 	key = getch();
+	keyWasRead = (key != ERR);
 	return vis_keyhandler_global(key);
 }
 
@@ -458,6 +578,12 @@ int vis_getch_wait(void)
 
 void vis_addstr(const char* text)
 {
+	if (visDeferCalls)
+	{
+		vis_defer_call(VDC_ADDSTR, 0, 0, 0, strlen(text), text);
+		return;
+	}
+	
 	wmove(logWin, curYline, 0);	wclrtoeol(logWin);
 	waddstr(logWin, text);
 	curYline ++;
@@ -471,6 +597,31 @@ void vis_printf(const char* format, ...)
 {
 	va_list args;
 	
+	if (visDeferCalls)
+	{
+		char buffer[0x100];
+		int textLen;
+		
+		va_start(args, format);
+		textLen = vsnprintf(buffer, sizeof(buffer), format, args);
+		va_end(args);
+		if (textLen < 0)
+			return;
+		if ((size_t)textLen < sizeof(buffer))
+		{
+			vis_defer_call(VDC_ADDSTR, 0, 0, 0, textLen, buffer);
+		}
+		else
+		{
+			std::vector<char> bigBuf(textLen + 1);
+			va_start(args, format);
+			vsnprintf(&bigBuf[0], bigBuf.size(), format, args);
+			va_end(args);
+			vis_defer_call(VDC_ADDSTR, 0, 0, 0, textLen, &bigBuf[0]);
+		}
+		return;
+	}
+	
 	wmove(logWin, curYline, 0);	wclrtoeol(logWin);
 	
 	va_start(args, format);
@@ -504,6 +655,9 @@ void vis_set_opts(UINT32 option, int value)
 	case 0x5243544C:	// 'RCTL' - Remote Control Log
 		rcEnable = !!value;
 		break;
+	case 0x50425448:	// 'PBTH' - Playback Thread
+		pbThreadMode = (UINT8)value;
+		break;
 	}
 	return;
 }
@@ -575,7 +729,7 @@ static void vis_resize(void)
 	move_panel(lcdPan, posY, posX);
 	
 	// redraw the main layout
-	noteVis = midPlay->GetNoteVis();
+	noteVis = (midPlay != NULL) ? &visSnap->noteVis : NULL;
 	for (curChn = 0; curChn < dispChns.size(); curChn ++)
 	{
 		ChannelData& dispCh = dispChns[curChn];
@@ -611,6 +765,8 @@ static void vis_resize(void)
 		wresize(rcWin, LINES - posY, COLS - posX);
 		move_panel(rcPan, posY, posX);
 	}
+	if (tsPan != NULL)
+		move_panel(tsPan, CHN_BASE_LINE, COLS - TSTAT_SIZE_X);
 	
 	// finally, redraw the screen
 	update_panels();
@@ -637,8 +793,16 @@ void vis_new_song(void)
 	chnCnt = (midPlay != NULL) ? midPlay->GetChannelStates().size() : 0x10;
 	dispChns.clear();
 	dispChns.resize(chnCnt);
-	lcdDisp.SetMidiPlayer(midPlay);
-	lcdDisp.SetNoteVis((midPlay != NULL) ? midPlay->GetNoteVis() : NULL);
+	pbSnapAgeTime = 0;
+	if (midPlay != NULL)
+	{
+		vis_fetch_snapshot();	// sets the data source of the LCD as well
+	}
+	else
+	{
+		lcdDisp.SetChannelStates(NULL);
+		lcdDisp.SetNoteVis(NULL);
+	}
 	
 	posY = CHN_BASE_LINE;
 	sizeY = chnCnt + 1;
@@ -832,6 +996,12 @@ void vis_new_song(void)
 
 void vis_do_channel_event(UINT16 chn, UINT8 action, UINT8 data)
 {
+	if (visDeferCalls)
+	{
+		vis_defer_call(VDC_CHN_EVT, chn, action, data, 0, NULL);
+		return;
+	}
+	
 	if (chn >= dispChns.size())
 		return;
 	ChannelData& dispCh = dispChns[chn];
@@ -1013,6 +1183,11 @@ void vis_do_ins_change(UINT16 chn)
 				insName[0] = '+';	// tone media: card
 		}
 	}
+	if (visDeferCalls)
+	{
+		vis_defer_call(VDC_INS_NAME, chn, isDefMap ? 1 : 0, 0, insName.length(), insName.data());
+		return;
+	}
 	dispChns[chn].SetInsName(insName.c_str(), false, isDefMap);
 	
 	return;
@@ -1022,7 +1197,7 @@ void vis_do_ctrl_change(UINT16 chn, UINT8 ctrl)
 {
 	const MidiPlayer::ChannelState* chnSt = &midPlay->GetChannelStates()[chn];
 	const NoteVisualization::ChnInfo* nvChn = midPlay->GetNoteVis()->GetChannel(chn);
-	ChannelData& dispCh = dispChns[chn];
+	INT8 pan;
 	bool flag;
 	
 	switch(ctrl)
@@ -1030,13 +1205,17 @@ void vis_do_ctrl_change(UINT16 chn, UINT8 ctrl)
 	case 0x0A:	// Pan
 		flag = !!(chnSt->ctrls[0x0A] & 0x80);
 		if (nvChn->_attr.pan == -0x40)
-			dispCh.SetPan(9, flag);	// random
+			pan = 9;	// random
 		else if (nvChn->_attr.pan < -0x15)
-			dispCh.SetPan(-1, flag);
+			pan = -1;
 		else if (nvChn->_attr.pan > 0x15)
-			dispCh.SetPan(+1, flag);
+			pan = +1;
+		else
+			pan = 0;
+		if (visDeferCalls)
+			vis_defer_call(VDC_PAN, chn, (UINT8)pan, flag ? 1 : 0, 0, NULL);
 		else
-			dispCh.SetPan(0, flag);
+			dispChns[chn].SetPan(pan, flag);
 		break;
 	}
 	
@@ -1045,6 +1224,12 @@ void vis_do_ctrl_change(UINT16 chn, UINT8 ctrl)
 
 void vis_do_syx_text(UINT16 chn, UINT8 mode, size_t textLen, const char* text)
 {
+	if (visDeferCalls)
+	{
+		vis_defer_call(VDC_SYX_TEXT, chn, mode, 0, textLen, text);
+		return;
+	}
+	
 	if (! lcdEnable)
 		return;
 	
@@ -1070,6 +1255,12 @@ void vis_do_syx_text(UINT16 chn, UINT8 mode, size_t textLen, const char* text)
 
 void vis_do_syx_bitmap(UINT16 chn, UINT8 mode, UINT32 dataLen, const UINT8* data)
 {
+	if (visDeferCalls)
+	{
+		vis_defer_call(VDC_SYX_BMP, chn, mode, 0, (data != NULL) ? dataLen : 0, data);
+		return;
+	}
+	
 	if (! lcdEnable)
 		return;
 	
@@ -1184,6 +1375,23 @@ static bool string_is_empty(const std::string& str)
 
 void vis_print_meta(UINT16 trk, UINT8 metaType, size_t dataLen, const char* data)
 {
+	// The tempo/time signature display shows the player's current values instead of the event data.
+	if (metaType == 0x51)
+	{
+		vis_show_tempo(midPlay->GetCurTempo());
+		return;
+	}
+	else if (metaType == 0x58)
+	{
+		vis_show_timesig(midPlay->GetCurTimeSig());
+		return;
+	}
+	if (visDeferCalls)
+	{
+		vis_defer_call(VDC_META, trk, metaType, 0, dataLen, data);
+		return;
+	}
+	
 	std::string text(data, &data[dataLen]);
 	
 	if (metaType < 0x10)
@@ -1267,20 +1475,6 @@ void vis_print_meta(UINT16 trk, UINT8 metaType, size_t dataLen, const char* data
 			wprintw(logWin, "Track %u Marker: %s", trk, text.c_str());
 		curYline ++;
 		break;
-	case 0x51:	// Tempo
-		mvhline(POS_TEMPO_Y, POS_TEMPO_X, ' ', 12);
-		mvprintw(POS_TEMPO_Y, POS_TEMPO_X, "%6.2f BPM", midPlay->GetCurTempo());
-		break;
-	case 0x58:	// Time Signature
-		{
-			UINT32 timeSig = midPlay->GetCurTimeSig();
-			UINT16 tsNum = (timeSig >>  0) & 0xFFFF;
-			UINT16 tsDen = (timeSig >> 16) & 0xFFFF;
-			UINT16 tsDigits = count_digits(tsNum) + count_digits(tsDen);
-			mvhline(POS_TIMESIG_Y, POS_TIMESIG_X - 1, ' ', 12);	// clear [-1..maxLen] for safety
-			mvprintw(POS_TIMESIG_Y, POS_TIMESIG_X + 2 - (tsDigits / 2), "Beat %u/%u", tsNum, tsDen);
-		}
-		break;
 	case 0x59:	// Key Signature
 		break;
 	}
@@ -1291,6 +1485,67 @@ void vis_print_meta(UINT16 trk, UINT8 metaType, size_t dataLen, const char* data
 	return;
 }
 
+static void vis_show_tempo(double tempo)
+{
+	if (visDeferCalls)
+	{
+		vis_defer_call(VDC_TEMPO, 0, 0, 0, sizeof(double), &tempo);
+		return;
+	}
+	
+	mvhline(POS_TEMPO_Y, POS_TEMPO_X, ' ', 12);
+	mvprintw(POS_TEMPO_Y, POS_TEMPO_X, "%6.2f BPM", tempo);
+	
+	return;
+}
+
+static void vis_show_timesig(UINT32 timeSig)
+{
+	if (visDeferCalls)
+	{
+		vis_defer_call(VDC_TIMESIG, 0, 0, 0, sizeof(UINT32), &timeSig);
+		return;
+	}
+	
+	UINT16 tsNum = (timeSig >>  0) & 0xFFFF;
+	UINT16 tsDen = (timeSig >> 16) & 0xFFFF;
+	UINT16 tsDigits = count_digits(tsNum) + count_digits(tsDen);
+	mvhline(POS_TIMESIG_Y, POS_TIMESIG_X - 1, ' ', 12);	// clear [-1..maxLen] for safety
+	mvprintw(POS_TIMESIG_Y, POS_TIMESIG_X + 2 - (tsDigits / 2), "Beat %u/%u", tsNum, tsDen);
+	
+	return;
+}
+
+static void vis_show_ins_map(UINT8 mapType)
+{
+	if (visDeferCalls)
+	{
+		vis_defer_call(VDC_INS_MAP, 0, mapType, 0, 0, NULL);
+		return;
+	}
+	
+	const std::string& mapStr = midiModColl->GetShortModName(mapType);
+	const char* mapStr2 = (! mapStr.empty()) ? mapStr.c_str() : "unknown";
+	mvhline(POS_INSMAP_Y, POS_INSMAP_X + 6, ' ', 12);
+	mvprintw(POS_INSMAP_Y, POS_INSMAP_X + 6, "%.12s", mapStr2);
+	
+	return;
+}
+
+static void vis_show_device(const char* devName)
+{
+	if (visDeferCalls)
+	{
+		vis_defer_call(VDC_DEVICE, 0, 0, 0, strlen(devName), devName);
+		return;
+	}
+	
+	mvhline(POS_DEVICE_Y, POS_DEVICE_X + 5, ' ', 13);
+	mvprintw(POS_DEVICE_Y, POS_DEVICE_X + 5, "%.13s", devName);
+	
+	return;
+}
+
 static void refresh_cursor_y(void)
 {
 	int curY;
@@ -1342,45 +1597,49 @@ static void vis_mvprintms(int row, int col, double time)
 
 void vis_update(void)
 {
+	if (midPlay != NULL)
+		vis_fetch_snapshot();
+	vis_update_draw();
+	update_panels();
+	refresh();
+	
+	return;
+}
+
+static void vis_update_draw(void)
+{
+	// update the screen contents without sending them to the terminal
+	// Note: draws the player state from the last snapshot (see vis_fetch_snapshot)
 	UINT64 newUpdateTime;
 	int updateTicks;
 	size_t curChn;
-	NoteVisualization* noteVis;
+	const NoteVisualization* noteVis;
 	
 	if (midPlay == NULL)
-	{
-		update_panels();
-		refresh();
 		return;
-	}
 	
-	newUpdateTime = (UINT64)(midPlay->GetPlaybackPos(true) * 1000.0);
+	newUpdateTime = (UINT64)(visSnap->pbPosTrue * 1000.0);
 	if (newUpdateTime < lastUpdateTime)
 		lastUpdateTime = 0;	// fix looping
 	updateTicks = (int)(newUpdateTime - lastUpdateTime);
 	lastUpdateTime = newUpdateTime;
 	
-	noteVis = midPlay->GetNoteVis();
-	noteVis->AdvanceAge(updateTicks);
+	noteVis = &visSnap->noteVis;	// notes were aged when taking the snapshot
 	lcdDisp.AdvanceTime(updateTicks);
 	for (curChn = 0; curChn < dispChns.size(); curChn ++)
 		dispChns[curChn].RefreshNotes(noteVis, noteVis->GetChannel(curChn));
 	if (lcdEnable)
 		lcdDisp.RefreshDisplay();
 	
-	vis_mvprintms(POS_PB_TIME_Y, POS_PB_TIME_X + 5, midPlay->GetPlaybackPos());
-	{
-		UINT32 posBar, posBeat, posTick;
-		midPlay->GetPlaybackPosM(&posBar, &posBeat, &posTick);
-		move(POS_PB_MEAS_Y, POS_PB_MEAS_X + 4);
-		if (! showMeasureTicks)
-			printw(" %0*u:%0*u", trkTickDigs[0], 1 + posBar, trkTickDigs[1], 1 + posBeat);
-		else
-			printw("%0*u:%0*u.%0*u", trkTickDigs[0], 1 + posBar, trkTickDigs[1], 1 + posBeat, trkTickDigs[2], posTick);
-	}
-	
-	update_panels();
-	refresh();
+	vis_mvprintms(POS_PB_TIME_Y, POS_PB_TIME_X + 5, visSnap->pbPos);
+	move(POS_PB_MEAS_Y, POS_PB_MEAS_X + 4);
+	if (! showMeasureTicks)
+		printw(" %0*u:%0*u", trkTickDigs[0], 1 + visSnap->posBar, trkTickDigs[1], 1 + visSnap->posBeat);
+	else
+		printw("%0*u:%0*u.%0*u", trkTickDigs[0], 1 + visSnap->posBar, trkTickDigs[1], 1 + visSnap->posBeat,
+			trkTickDigs[2], visSnap->posTick);
+	if (tsWin != NULL)
+		vis_draw_timing_stats();
 	
 	return;
 }
@@ -1415,10 +1674,7 @@ static int vis_keyhandler_normal(void)
 	case 'Q':
 		return 9;	// quit
 	case ' ':
-		if (midPlay->GetState() & 0x02)
-			midPlay->Resume();
-		else
-			midPlay->Pause();
+		vis_player_cmd(PLRCMD_TOGGLE_PAUSE, 0);
 		break;
 	case 'B':
 		if (trackNo > 1)
@@ -1429,11 +1685,18 @@ static int vis_keyhandler_normal(void)
 			return +1;	// next song
 		break;
 	case 'R':
-		midPlay->Stop();
-		midPlay->Start();
+		vis_player_cmd(PLRCMD_RESTART, 0);
+		break;
+	case KEY_LEFT:
+	case KEY_RIGHT:
+		vis_player_cmd(PLRCMD_SEEK, (inkey == KEY_LEFT) ? -5 : +5);
+		break;
+	case KEY_PPAGE:
+	case KEY_NPAGE:
+		vis_player_cmd(PLRCMD_SEEK_BAR, (inkey == KEY_NPAGE) ? +1 : -1);
 		break;
 	case KEY_CTRL('R'):
-		midPlay->StopAllNotes();
+		vis_player_cmd(PLRCMD_STOP_NOTES, 0);
 		vis_addstr("Stopping all notes ...");
 		update_panels();
 		refresh();
@@ -1447,7 +1710,10 @@ static int vis_keyhandler_normal(void)
 		vis_show_device_selection();
 		break;
 	case 'F':
-		midPlay->FadeOutT(midPlay->GetOptions().fadeTime);
+		vis_player_cmd(PLRCMD_FADE, 0);
+		break;
+	case 'T':
+		vis_toggle_timing_stats();
 		break;
 	case KEY_CTRL('P'):
 		pauseAfterSong = ! pauseAfterSong;
@@ -1472,6 +1738,446 @@ static int vis_keyhandler_normal(void)
 	return 0;
 }
 
+static void vis_make_snapshot(VisPlayerSnapshot* snap)
+{
+	// Note: must be called by the thread that runs the player
+	NoteVisualization* noteVis = midPlay->GetNoteVis();
+	UINT64 ageTime;
+	size_t curChn;
+	
+	snap->state = midPlay->GetState();
+	snap->srcType = midPlay->GetOptions().srcType;
+	snap->devID = main_GetOpenedModule();
+	snap->pbPos = midPlay->GetPlaybackPos();
+	snap->pbPosTrue = midPlay->GetPlaybackPos(true);
+	midPlay->GetPlaybackPosM(&snap->posBar, &snap->posBeat, &snap->posTick);
+	
+	ageTime = (UINT64)(snap->pbPosTrue * 1000.0);
+	if (ageTime < pbSnapAgeTime)
+		pbSnapAgeTime = 0;	// fix looping
+	noteVis->AdvanceAge((UINT32)(ageTime - pbSnapAgeTime));
+	pbSnapAgeTime = ageTime;
+	snap->noteVis = *noteVis;
+	
+	snap->chnStates = midPlay->GetChannelStates();
+	for (curChn = 0; curChn < snap->chnStates.size(); curChn ++)
+	{
+		MidiPlayer::ChannelState& chnSt = snap->chnStates[curChn];
+		// these point to data that may change while the UI is drawing
+		chnSt.userInsName = NULL;
+		chnSt.userInsRef = NULL;
+		chnSt.notes.clear();
+	}
+	snap->timingStats = midPlay->GetTimingStats();
+	snap->cmdDone = pbCmdDone;
+	
+	return;
+}
+
+static void vis_fetch_snapshot(void)
+{
+	// get the most recent player state for drawing
+	if (pbThread == NULL)
+	{
+		vis_make_snapshot(visSnap);
+	}
+	else
+	{
+		OSMutex_Lock(pbMutex);
+		if (pbSnapNew)
+		{
+			std::swap(visSnap, pbSnapMid);
+			pbSnapNew = false;
+		}
+		OSMutex_Unlock(pbMutex);
+	}
+	lcdDisp.SetChannelStates(&visSnap->chnStates);
+	lcdDisp.SetNoteVis(&visSnap->noteVis);
+	
+	return;
+}
+
+static void vis_publish_snapshot(void)
+{
+	// Note: called by the playback thread, the snapshot is taken without holding the lock
+	vis_make_snapshot(pbSnapBack);
+	OSMutex_Lock(pbMutex);
+	std::swap(pbSnapBack, pbSnapMid);
+	pbSnapNew = true;
+	OSMutex_Unlock(pbMutex);
+	
+	return;
+}
+
+void vis_player_command(UINT8 cmd)
+{
+	vis_player_cmd(cmd, 0);
+	return;
+}
+
+static void vis_player_cmd(UINT8 type, INT32 param, bool restart)
+{
+	VisPlayerCmd cmd;
+	
+	cmd.type = type;
+	cmd.param = param;
+	cmd.restart = restart;
+	pbCmdSent ++;
+	if (pbThread == NULL)
+	{
+		vis_exec_player_cmd(cmd);
+		pbCmdDone ++;
+		vis_make_snapshot(visSnap);	// let the song end check see the new state
+		return;
+	}
+	
+	OSMutex_Lock(pbMutex);
+	pbCmdQueue.push_back(cmd);
+	OSMutex_Unlock(pbMutex);
+	
+	return;
+}
+
+static void vis_exec_player_cmd(const VisPlayerCmd& cmd)
+{
+	// Note: must be called by the thread that runs the player
+	switch(cmd.type)
+	{
+	case PLRCMD_PAUSE:
+		midPlay->Pause();
+		break;
+	case PLRCMD_RESUME:
+		midPlay->Resume();
+		break;
+	case PLRCMD_TOGGLE_PAUSE:
+		if (midPlay->GetState() & 0x02)
+			midPlay->Resume();
+		else
+			midPlay->Pause();
+		break;
+	case PLRCMD_RESTART:
+		midPlay->Stop();
+		midPlay->Start();
+		break;
+	case PLRCMD_FADE:
+		midPlay->FadeOutT(midPlay->GetOptions().fadeTime);
+		break;
+	case PLRCMD_SEEK:
+		midPlay->Seek(midPlay->GetPlaybackPos() + cmd.param);
+		break;
+	case PLRCMD_SEEK_BAR:
+		{
+			UINT32 bar;
+			
+			midPlay->GetPlaybackPosM(&bar, NULL, NULL);
+			if (bar == (UINT32)-1)
+				bar = 0;	// song hasn't started yet
+			if (cmd.param > 0)
+				bar ++;
+			else if (bar > 0)
+				bar --;
+			midPlay->SeekM(bar, 0, 0);
+		}
+		break;
+	case PLRCMD_STOP_NOTES:
+		midPlay->StopAllNotes();
+		break;
+	case PLRCMD_SET_INSMAP:
+		if (cmd.restart)
+			midPlay->Stop();
+		midPlay->SetSrcModuleType((UINT8)cmd.param, true);
+		if (cmd.restart)
+			midPlay->Start();
+		vis_show_ins_map(midPlay->GetOptions().srcType);
+		break;
+	case PLRCMD_SET_DEVICE:
+		{
+			MidiModule* mMod;
+			UINT8 state;
+			
+			state = midPlay->GetState();
+			if (! cmd.restart)
+				midPlay->Pause();
+			else
+				midPlay->Stop();
+			midPlay->FlushEvents();
+			main_CloseModule();
+			main_OpenModule((size_t)cmd.param);
+			mMod = midiModColl->GetModule(main_GetOpenedModule());
+			midPlay->SetDstModuleType(mMod->modType, true);
+			if (! cmd.restart)
+			{
+				if (! (state & 0x02))
+					midPlay->Resume();
+			}
+			else
+			{
+				midPlay->Start();
+			}
+			vis_show_device((mMod != NULL) ? mMod->name.c_str() : "");
+		}
+		break;
+	}
+	
+	return;
+}
+
+static void vis_defer_call(UINT8 type, UINT16 chn, UINT8 val1, UINT8 val2, size_t dataLen, const void* data)
+{
+	VisDeferredCall vdc;
+	
+	vdc.type = type;
+	vdc.chn = chn;
+	vdc.val1 = val1;
+	vdc.val2 = val2;
+	if (dataLen > 0)
+		vdc.data.assign((const char*)data, dataLen);
+	OSMutex_Lock(pbMutex);
+	visDefCalls.push_back(vdc);
+	OSMutex_Unlock(pbMutex);
+	
+	return;
+}
+
+static bool vis_run_deferred_calls(void)
+{
+	// returns true when calls were executed
+	std::vector<VisDeferredCall> calls;
+	bool oldDefer;
+	size_t curCall;
+	
+	OSMutex_Lock(pbMutex);
+	calls.swap(visDefCalls);
+	OSMutex_Unlock(pbMutex);
+	if (calls.empty())
+		return false;
+	oldDefer = visDeferCalls;
+	visDeferCalls = false;
+	for (curCall = 0; curCall < calls.size(); curCall ++)
+	{
+		const VisDeferredCall& vdc = calls[curCall];
+		switch(vdc.type)
+		{
+		case VDC_ADDSTR:
+			vis_addstr(vdc.data.c_str());
+			break;
+		case VDC_CHN_EVT:
+			vis_do_channel_event(vdc.chn, vdc.val1, vdc.val2);
+			break;
+		case VDC_INS_NAME:
+			dispChns[vdc.chn].SetInsName(vdc.data.c_str(), false, vdc.val1 != 0);
+			break;
+		case VDC_PAN:
+			dispChns[vdc.chn].SetPan((INT8)vdc.val1, vdc.val2 != 0);
+			break;
+		case VDC_SYX_TEXT:
+			vis_do_syx_text(vdc.chn, vdc.val1, vdc.data.size(), vdc.data.data());
+			break;
+		case VDC_SYX_BMP:
+			vis_do_syx_bitmap(vdc.chn, vdc.val1, (UINT32)vdc.data.size(),
+				vdc.data.empty() ? NULL : (const UINT8*)vdc.data.data());
+			break;
+		case VDC_META:
+			vis_print_meta(vdc.chn, vdc.val1, vdc.data.size(), vdc.data.data());
+			break;
+		case VDC_TEMPO:
+			{
+				double tempo;
+				memcpy(&tempo, vdc.data.data(), sizeof(double));
+				vis_show_tempo(tempo);
+			}
+			break;
+		case VDC_TIMESIG:
+			{
+				UINT32 timeSig;
+				memcpy(&timeSig, vdc.data.data(), sizeof(UINT32));
+				vis_show_timesig(timeSig);
+			}
+			break;
+		case VDC_INS_MAP:
+			vis_show_ins_map(vdc.val1);
+			break;
+		case VDC_DEVICE:
+			vis_show_device(vdc.data.c_str());
+			break;
+		}
+	}
+	visDeferCalls = oldDefer;
+	
+	return true;
+}
+
+static void vis_set_thread_priority(void)
+{
+#ifdef _WIN32
+	SetThreadPriority(GetCurrentThread(), THREAD_PRIORITY_TIME_CRITICAL);
+#else
+	struct sched_param schedPrm;
+	int retVal;
+	
+	memset(&schedPrm, 0x00, sizeof(struct sched_param));
+	schedPrm.sched_priority = (sched_get_priority_min(SCHED_FIFO) + sched_get_priority_max(SCHED_FIFO)) / 2;
+	retVal = pthread_setschedparam(pthread_self(), SCHED_FIFO, &schedPrm);
+	if (retVal)
+		vis_printf("Unable to set realtime priority for playback thread! (error %d)\n", retVal);
+#endif
+	
+	return;
+}
+
+static void vis_playback_thread(void* args)
+{
+	std::vector<VisPlayerCmd> cmds;
+	UINT64 maxWait;
+	UINT64 snapInterval;
+	UINT64 nextSnapTime;
+	
+	(void)args;
+	if (pbThreadMode >= 2)
+		vis_set_thread_priority();
+	
+	maxWait = PBTHREAD_MAX_WAIT * OSTimer_GetFrequency(pbTimer) / 1000000000;
+	snapInterval = PBTHREAD_SNAP_INTERVAL * OSTimer_GetFrequency(pbTimer) / 1000000000;
+	nextSnapTime = 0;
+	while(true)
+	{
+		UINT64 curTime;
+		UINT64 wakeTime;
+		UINT64 maxTime;
+		size_t curCmd;
+		
+		OSMutex_Lock(pbMutex);
+		if (pbThreadStop)
+		{
+			OSMutex_Unlock(pbMutex);
+			break;
+		}
+		cmds.swap(pbCmdQueue);
+		OSMutex_Unlock(pbMutex);
+		if (! cmds.empty())
+		{
+			for (curCmd = 0; curCmd < cmds.size(); curCmd ++)
+				vis_exec_player_cmd(cmds[curCmd]);
+			pbCmdDone += (UINT32)cmds.size();
+			cmds.clear();
+			nextSnapTime = 0;	// show the result immediately
+		}
+		
+		midPlay->DoPlaybackStep();
+		curTime = OSTimer_GetTime(pbTimer);
+		if (curTime >= nextSnapTime)
+		{
+			vis_publish_snapshot();
+			nextSnapTime = curTime + snapInterval;
+		}
+		
+		// sleep until the exact time of the next event instead of a relative delay,
+		// so that the time spent in DoPlaybackStep doesn't add up
+		wakeTime = midPlay->GetNextEventTime();
+		maxTime = curTime + maxWait;
+		if (wakeTime > maxTime)
+			wakeTime = maxTime;
+		if (wakeTime > nextSnapTime)
+			wakeTime = nextSnapTime;
+		OSTimer_SleepUntil(pbTimer, wakeTime);
+	}
+	
+	return;
+}
+
+static UINT8 vis_start_playback_thread(void)
+{
+	UINT8 retVal;
+	
+	pbTimer = OSTimer_Init();
+	if (pbTimer == NULL)
+		return 0xFF;
+	retVal = OSMutex_Init(&pbMutex, 0);
+	if (retVal)
+	{
+		OSTimer_Deinit(pbTimer);	pbTimer = NULL;
+		return retVal;
+	}
+	
+	// From now on, the curses screen is only modified by the UI thread
+	// and the player is only accessed by the playback thread.
+	vis_make_snapshot(visSnap);
+	pbSnapNew = false;
+	visDeferCalls = true;
+	pbThreadStop = false;
+	retVal = OSThread_Init(&pbThread, &vis_playback_thread, NULL);
+	if (retVal)
+	{
+		pbThread = NULL;
+		visDeferCalls = false;
+		OSMutex_Deinit(pbMutex);	pbMutex = NULL;
+		OSTimer_Deinit(pbTimer);	pbTimer = NULL;
+		return retVal;
+	}
+	
+	return 0x00;
+}
+
+static void vis_stop_playback_thread(void)
+{
+	OSMutex_Lock(pbMutex);
+	pbThreadStop = true;
+	OSMutex_Unlock(pbMutex);
+	OSThread_Join(pbThread);
+	OSThread_Deinit(pbThread);	pbThread = NULL;
+	
+	pbCmdQueue.clear();	// the song ends, so remaining commands don't matter anymore
+	visDeferCalls = false;
+	vis_run_deferred_calls();
+	OSMutex_Deinit(pbMutex);	pbMutex = NULL;
+	OSTimer_Deinit(pbTimer);	pbTimer = NULL;
+	vis_fetch_snapshot();
+	
+	return;
+}
+
+static void vis_wait_event(UINT64 waitTime)
+{
+	// waitTime: maximum time to wait in ns, returns early on keyboard or remote control input
+#ifdef _WIN32
+	Sleep(1);
+#else
+	struct pollfd pfds[2];
+	nfds_t pfdCnt;
+	struct timespec tsEnd;
+	int rmCtrlFD;
+	int timeoutMS;
+	
+	if (! waitTime)
+		return;
+	clock_gettime(CLOCK_MONOTONIC, &tsEnd);
+	tsEnd.tv_sec += (time_t)(waitTime / 1000000000);
+	tsEnd.tv_nsec += (long)(waitTime % 1000000000);
+	if (tsEnd.tv_nsec >= 1000000000)
+	{
+		tsEnd.tv_sec ++;
+		tsEnd.tv_nsec -= 1000000000;
+	}
+	
+	pfdCnt = 0;
+	pfds[pfdCnt].fd = STDIN_FILENO;	pfds[pfdCnt].events = POLLIN;	pfdCnt ++;
+	rmCtrlFD = main_GetRemoteCtrlFD();
+	if (rmCtrlFD >= 0)
+	{
+		pfds[pfdCnt].fd = rmCtrlFD;	pfds[pfdCnt].events = POLLIN;	pfdCnt ++;
+	}
+	
+	// poll() has only millisecond resolution, so it is used for the coarse part of the wait
+	// and clock_nanosleep() does the precise wakeup.
+	timeoutMS = (int)(waitTime / 1000000) - 1;
+	if (poll(pfds, pfdCnt, (timeoutMS > 0) ? timeoutMS : 0) != 0)
+		return;	// input available or interrupted by a signal (e.g. terminal resize)
+	clock_nanosleep(CLOCK_MONOTONIC, TIMER_ABSTIME, &tsEnd, NULL);
+#endif
+	
+	return;
+}
+
 int vis_main(void)
 {
 	// Note: returns playback command
@@ -1481,22 +2187,47 @@ int vis_main(void)
 	UINT64 newUpdateTime;
 	int result;
 	UINT64 songEndTime = 0;
+	UINT64 endPauseTime;
 	UINT8 lastPbState = 0xFF;
 	
 	lastUpdateTime = 0;
 	result = 0;
+	endPauseTime = (UINT64)(midPlay->GetOptions().endPauseTime * 1000.0);
+	pbCmdQueue.clear();
+	pbCmdSent = pbCmdDone = 0;
+	if (pbThreadMode)
+	{
+		if (vis_start_playback_thread())
+			vis_addstr("Unable to start playback thread!");
+	}
 	while(true)
 	{
 		int retval = 0;
 		UINT8 pbState;
+		bool doRefresh = false;
+		bool endSong = false;
 		
-		midPlay->DoPlaybackStep();
-		pbState = midPlay->GetState();
+		// When using the playback thread, the UI only works with snapshots of the player state
+		// and sends commands to the thread, so that neither drawing nor a slow terminal can delay MIDI events.
+		if (pbThread != NULL)
+		{
+			if (vis_run_deferred_calls())
+				doRefresh = true;
+		}
+		else
+		{
+			midPlay->DoPlaybackStep();
+		}
+		vis_fetch_snapshot();
+		pbState = visSnap->state;
 		
-		newUpdateTime = (UINT64)(midPlay->GetPlaybackPos() * 1000.0);
+		newUpdateTime = (UINT64)(visSnap->pbPos * 1000.0);
 		// update after reset OR when 20+ ms have passed
 		if (newUpdateTime < lastUpdateTime || newUpdateTime >= lastUpdateTime + 20 || pbState != lastPbState)
-			vis_update();
+		{
+			vis_update_draw();
+			doRefresh = true;
+		}
 		lastPbState = pbState;
 		
 		retval = currentKeyHandler.back()();
@@ -1505,10 +2236,11 @@ int vis_main(void)
 			retval = main_CheckRemoteCommand();
 			if (retval != 0)
 			{
-				vis_update();
+				vis_update_draw();
+				doRefresh = true;
 				// A new song was added and we're in "paused after end" state?
-				if (retval == -8 && ((midPlay->GetState() & 0x03) == 0x02))
-					midPlay->Resume();	// yes - continue with next song
+				if (retval == -8 && ((visSnap->state & 0x03) == 0x02))
+					vis_player_cmd(PLRCMD_RESUME, 0);	// yes - continue with next song
 				if (retval < -1)
 					retval = 0;
 			}
@@ -1516,34 +2248,64 @@ int vis_main(void)
 		if (retval != 0)
 		{
 			result = retval;
-			break;
+			endSong = true;
 		}
 		
-		pbState = midPlay->GetState();
-		if ((pbState & 0x03) == 0x00)	// song ended?
+		pbState = visSnap->state;
+		// The snapshot doesn't show the effect of commands that are still queued.
+		if (! endSong && visSnap->cmdDone == pbCmdSent && (pbState & 0x03) == 0x00)	// song ended?
 		{
 			if (pauseAfterSong)
 			{
-				midPlay->Pause();
+				vis_player_cmd(PLRCMD_PAUSE, 0);
 				pauseAfterSong = false;
-				vis_update();
+				vis_update_draw();
+				doRefresh = true;
 			}
 			else if (! main_CanQuitAfterSong())
 			{
-				midPlay->Pause();
-				midPlay->StopAllNotes();
-				vis_update();
+				vis_player_cmd(PLRCMD_PAUSE, 0);
+				vis_player_cmd(PLRCMD_STOP_NOTES, 0);
+				vis_update_draw();
+				doRefresh = true;
 			}
 			else if (! (pbState & 0x03))	// NOT (playing OR paused)
 			{
-				UINT64 songTime = (UINT64)(midPlay->GetPlaybackPos(true) * 1000.0);
+				UINT64 songTime = (UINT64)(visSnap->pbPosTrue * 1000.0);
 				if (! songEndTime)
-					songEndTime = songTime + (UINT64)(midPlay->GetOptions().endPauseTime * 1000.0);
+					songEndTime = songTime + endPauseTime;
 				if (songTime >= songEndTime)
-					break;
+					endSong = true;
 			}
 		}
-		Sleep(1);
+		if (endSong)
+		{
+			if (pbThread != NULL)
+				vis_stop_playback_thread();
+			update_panels();
+			refresh();
+			break;
+		}
+		
+		if (doRefresh)
+		{
+			update_panels();
+			refresh();
+		}
+		
+		if (! keyWasRead)
+		{
+			UINT64 waitTime;
+			UINT64 maxWait;
+			
+			// sleep until the next event is due, the screen needs an update or there is new input
+			maxWait = (pbState & 0x02) ? 100000000 : 20000000;	// paused: 100 ms, else 20 ms (display update)
+			if (pbThread != NULL)
+				waitTime = maxWait;	// events are handled by the playback thread
+			else
+				waitTime = midPlay->GetNextEventDelay();
+			vis_wait_event((waitTime < maxWait) ? waitTime : maxWait);
+		}
 	}
 	if (! result)
 	{
@@ -1583,22 +2345,9 @@ static int vis_keyhandler_mapsel(void)
 		
 		if (inkey == '\n')
 		{
-			// confirm selection
-			UINT8 mapType = mapSelTypes[mmsSelection];
-			if (restartSong)
-				midPlay->Stop();
-			midPlay->SetSrcModuleType(mapType, true);
-			if (restartSong)
-			{
-				midPlay->Start();
-				restartSong = false;
-			}
-			
-			const PlayerOpts& midOpts = midPlay->GetOptions();
-			const std::string& mapStr = midiModColl->GetShortModName(midOpts.srcType);
-			const char* mapStr2 = (! mapStr.empty()) ? mapStr.c_str() : "unknown";
-			mvhline(POS_INSMAP_Y, POS_INSMAP_X + 6, ' ', 12);
-			mvprintw(POS_INSMAP_Y, POS_INSMAP_X + 6, "%.12s", mapStr2);
+			// confirm selection (the display is updated when the command was executed)
+			vis_player_cmd(PLRCMD_SET_INSMAP, mapSelTypes[mmsSelection], restartSong);
+			restartSong = false;
 		}
 		
 		update_panels();
@@ -1730,34 +2479,9 @@ static int vis_keyhandler_devsel(void)
 		
 		if (inkey == '\n')
 		{
-			// confirm selection
-			MidiModule* mMod;
-			UINT8 state;
-			
-			state = midPlay->GetState();
-			if (! restartSong)
-				midPlay->Pause();
-			else
-				midPlay->Stop();
-			midPlay->FlushEvents();
-			main_CloseModule();
-			main_OpenModule(cursorPos);
-			mMod = midiModColl->GetModule(main_GetOpenedModule());
-			midPlay->SetDstModuleType(mMod->modType, true);
-			if (! restartSong)
-			{
-				if (! (state & 0x02))
-					midPlay->Resume();
-			}
-			else
-			{
-				midPlay->Start();
-				restartSong = false;
-			}
-			
-			mvhline(POS_DEVICE_Y, POS_DEVICE_X + 5, ' ', 13);
-			if (mMod != NULL)
-				mvprintw(POS_DEVICE_Y, POS_DEVICE_X + 5, "%.13s", mMod->name.c_str());
+			// confirm selection (the display is updated when the command was executed)
+			vis_player_cmd(PLRCMD_SET_DEVICE, cursorPos, restartSong);
+			restartSong = false;
 		}
 		
 		update_panels();
@@ -1843,7 +2567,7 @@ static void vis_show_map_selection(void)
 	
 	songMapType = main_GetSongInsMap();
 	forceSrcType = *main_GetForcedInsMap();
-	midMapType = (midPlay != NULL) ? midPlay->GetOptions().srcType : 0x00;
+	midMapType = (midPlay != NULL) ? visSnap->srcType : 0x00;
 	mmsSelection = 0;
 	mmsDefaultSel = -1;
 	mmsForcedType = -1;
@@ -1912,7 +2636,7 @@ static void vis_show_device_selection(void)
 	if (midiModColl == NULL)
 		return;
 	
-	mdsSelection = (int)main_GetOpenedModule();
+	mdsSelection = (midPlay != NULL) ? (int)visSnap->devID : (int)main_GetOpenedModule();
 	mdsDefaultSel = (int)main_GetSongOptDevice();
 	if (mdsDefaultSel < 0 || mdsDefaultSel >= (int)midiModColl->GetModuleCount())
 		mdsDefaultSel = -1;
@@ -1962,6 +2686,51 @@ static void vis_show_device_selection(void)
 	return;
 }
 
+static void vis_toggle_timing_stats(void)
+{
+	static const char* panelTitle = "Timing";
+	
+	if (tsPan != NULL)
+	{
+		del_panel(tsPan);	tsPan = NULL;
+		delwin(tsWin);	tsWin = NULL;
+		update_panels();
+		refresh();
+		return;
+	}
+	
+	// The panel covers the right end of the note display, it is meant for debugging only.
+	tsWin = newwin(TSTAT_SIZE_Y, TSTAT_SIZE_X, CHN_BASE_LINE, COLS - TSTAT_SIZE_X);
+	tsPan = new_panel(tsWin);
+	box(tsWin, 0, 0);
+	wattron(tsWin, A_BOLD | COLOR_PAIR(0));
+	mvwaddstr(tsWin, 0, (TSTAT_SIZE_X - strlen(panelTitle)) / 2, panelTitle);
+	wattroff(tsWin, A_BOLD | COLOR_PAIR(0));
+	
+	vis_draw_timing_stats();
+	update_panels();
+	refresh();
+	
+	return;
+}
+
+static void vis_draw_timing_stats(void)
+{
+	const MidiPlayer::TimingStats& ts = visSnap->timingStats;
+	
+	// send delay: time between the scheduled and the actual output of a message
+	mvwprintw(tsWin, 1, 2, "Events     %10llu", (unsigned long long)ts.events);
+	mvwprintw(tsWin, 2, 2, "Delay p50  %7u us", MidiPlayer::GetTimingPercentile(ts, 0.50));
+	mvwprintw(tsWin, 3, 2, "Delay p99  %7u us", MidiPlayer::GetTimingPercentile(ts, 0.99));
+	mvwprintw(tsWin, 4, 2, "Delay max  %7u us", ts.maxLateUS);
+	mvwprintw(tsWin, 5, 2, "Steps      %10llu", (unsigned long long)ts.steps);
+	mvwprintw(tsWin, 6, 2, "Ticks      %10llu", (unsigned long long)ts.ticks);
+	mvwprintw(tsWin, 7, 2, "Lag resets %10u", ts.lagResets);
+	mvwprintw(tsWin, 8, 2, "Queue max  %10u", ts.maxQueueDepth);
+	
+	return;
+}
+
 
 void ChannelData::Initialize(UINT16 chnID, size_t screenWidth)
 {
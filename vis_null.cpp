@@ -0,0 +1,168 @@
+// Dummy visualization for tools that run the MIDI player without a user interface.
+// All functions do nothing, so they can be called safely from multiple threads.
+#include <stddef.h>
+#include <stdtype.h>
+#include "vis.hpp"
+
+static DisplayOptions dispOpts;
+
+DisplayOptions* vis_get_options(void)
+{
+	return &dispOpts;
+}
+
+void vis_init(void)
+{
+	dispOpts.showFilePath = false;
+	dispOpts.showInsChange = false;
+	dispOpts.barVisMode = BVMODE_OFF;
+	dispOpts.detectCP = false;
+	return;
+}
+
+void vis_deinit(void)
+{
+	return;
+}
+
+int vis_getch(void)
+{
+	return 0;
+}
+
+int vis_getch_wait(void)
+{
+	return 0;
+}
+
+void vis_addstr(const char* text)
+{
+	(void)text;
+	return;
+}
+
+void vis_printf(const char* format, ...)
+{
+	(void)format;
+	return;
+}
+
+void vis_rcl_printf(const char* format, ...)
+{
+	(void)format;
+	return;
+}
+
+void vis_set_opts(UINT32 option, int value)
+{
+	(void)option;
+	(void)value;
+	return;
+}
+
+void vis_set_locales(size_t numLocales, void* localeArrPtr)
+{
+	(void)numLocales;
+	(void)localeArrPtr;
+	return;
+}
+
+void vis_set_track_number(UINT32 trkNo)
+{
+	(void)trkNo;
+	return;
+}
+
+void vis_set_track_count(UINT32 trkCnt)
+{
+	(void)trkCnt;
+	return;
+}
+
+void vis_set_midi_modules(MidiModuleCollection* mmc)
+{
+	(void)mmc;
+	return;
+}
+
+void vis_set_midi_file(const char* fileName, MidiFile* mFile)
+{
+	(void)fileName;
+	(void)mFile;
+	return;
+}
+
+void vis_set_midi_player(MidiPlayer* mPlay)
+{
+	(void)mPlay;
+	return;
+}
+
+void vis_new_song(void)
+{
+	return;
+}
+
+void vis_do_channel_event(UINT16 chn, UINT8 action, UINT8 data)
+{
+	(void)chn;
+	(void)action;
+	(void)data;
+	return;
+}
+
+void vis_do_ins_change(UINT16 chn)
+{
+	(void)chn;
+	return;
+}
+
+void vis_do_ctrl_change(UINT16 chn, UINT8 ctrl)
+{
+	(void)chn;
+	(void)ctrl;
+	return;
+}
+
+void vis_do_syx_text(UINT16 chn, UINT8 mode, size_t textLen, const char* text)
+{
+	(void)chn;
+	(void)mode;
+	(void)textLen;
+	(void)text;
+	return;
+}
+
+void vis_do_syx_bitmap(UINT16 chn, UINT8 mode, UINT32 dataLen, const UINT8* data)
+{
+	(void)chn;
+	(void)mode;
+	(void)dataLen;
+	(void)data;
+	return;
+}
+
+void vis_print_meta(UINT16 trk, UINT8 metaType, size_t dataLen, const char* data)
+{
+	(void)trk;
+	(void)metaType;
+	(void)dataLen;
+	(void)data;
+	return;
+}
+
+void vis_update(void)
+{
+	return;
+}
+
+void vis_player_command(UINT8 cmd)
+{
+	(void)cmd;
+	return;
+}
+
+int vis_main(void)
+{
+	return 0;
+}
@@ -45,7 +45,7 @@ static const char* BLOCK1x2_CHRS[0x04] = {" ", "\xE2\x96\x80", "\xE2\x96\x84", "
 
 LCDDisplay::LCDDisplay() :
 	_hWin(NULL),
-	_mPlr(NULL),
+	_chnStates(NULL),
 	_nVis(NULL)
 {
 	dispOpts = vis_get_options();
@@ -83,9 +83,9 @@ void LCDDisplay::Deinit(void)
 	return;
 }
 
-void LCDDisplay::SetMidiPlayer(MidiPlayer* mPlr)
+void LCDDisplay::SetChannelStates(const std::vector<MidiPlayer::ChannelState>* chnStates)
 {
-	_mPlr = mPlr;
+	_chnStates = chnStates;
 	return;
 }
 
@@ -230,7 +230,7 @@ void LCDDisplay::RefreshDisplay(void)
 	const NoteVisualization::MidiModifiers& modAttr = _nVis->GetAttributes();
 	const NoteVisualization::ChnInfo* chnInfo;
 	const NoteVisualization::MidiModifiers* chnAttr;
-	const std::vector<MidiPlayer::ChannelState>& chnStates = _mPlr->GetChannelStates();
+	const std::vector<MidiPlayer::ChannelState>& chnStates = *_chnStates;
 	
 	_allPage.vol = modAttr.volume;
 	_allPage.pan = modAttr.pan;
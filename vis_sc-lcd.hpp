@@ -3,9 +3,10 @@
 
 #include <stdtype.h>
 #include <bitset>
+#include <vector>
 #include <curses.h>	// for WINDOW
+#include "MidiPlay.hpp"	// for MidiPlayer::ChannelState
 
-class MidiPlayer;
 class NoteVisualization;
 
 class LCDDisplay
@@ -50,7 +51,7 @@ public:
 		INT8 transp;
 	};
 	WINDOW* _hWin;
-	MidiPlayer* _mPlr;
+	const std::vector<MidiPlayer::ChannelState>* _chnStates;
 	NoteVisualization* _nVis;
 	LCDPage _allPage;
 	LCDPage _chnPage;
@@ -77,7 +78,7 @@ public:
 	~LCDDisplay();
 	void Init(int winPosX, int winPosY);
 	void Deinit(void);
-	void SetMidiPlayer(MidiPlayer* mPlr);
+	void SetChannelStates(const std::vector<MidiPlayer::ChannelState>* chnStates);
 	void SetNoteVis(NoteVisualization* nVis);
 	void GetSize(int* sizeX, int* sizeY) const;
 	WINDOW* GetWindow(void);